@@ -0,0 +1,173 @@
+/******************************************************************************
+
+    Host replacement for LPC8xx.h
+
+    The firmware sources include <LPC8xx.h>. When building the host target
+    this directory is searched first, so the firmware compiles unchanged on a
+    normal Linux machine.
+
+    The peripheral register layouts are taken from the original LPC8xx.h.
+    The Cortex-M0+ core header is skipped as it contains ARM inline assembly;
+    the few core functions the firmware uses are provided by hal.c.
+
+    Every LPC_xxx peripheral pointer expands to a call of host_access(),
+    which returns a pointer to plain memory holding the register contents.
+    host_access() gives the peripheral models in hal.c the chance to process
+    the previous register write, advance the virtual clock and dispatch
+    interrupts before the firmware touches a register.
+
+******************************************************************************/
+#ifndef __HOST_LPC8xx_H__
+#define __HOST_LPC8xx_H__
+
+#pragma GCC system_header
+
+#include <stdint.h>
+
+#define __I     volatile const
+#define __O     volatile
+#define __IO    volatile
+
+// Skip the CMSIS core header, see above
+#define __CORE_CM0PLUS_H_GENERIC
+#define __CORE_CM0PLUS_H_DEPENDANT
+
+// We provide our own SPI type below so that reading RXDAT can be observed
+#define LPC_SPI_TypeDef LPC_SPI_TypeDef_original
+
+#include "../LPC8xx/LPC8xx.h"
+
+#undef LPC_SPI_TypeDef
+
+
+// ****************************************************************************
+// Core peripherals normally provided by core_cm0plus.h
+// ****************************************************************************
+typedef struct
+{
+  __IO uint32_t CTRL;
+  __IO uint32_t LOAD;
+  __IO uint32_t VAL;
+  __I  uint32_t CALIB;
+} SysTick_Type;
+
+
+// ****************************************************************************
+// Same members as the original SPI structure, except that RXDAT is a double
+// buffer. The RXDAT macro at the end of this file turns every read of
+// LPC_SPIx->RXDAT into RXDAT[host_spi_rxdat_read()], which tells the SPI
+// model that the receive data has been consumed (clearing RXRDY), exactly
+// like the hardware does. The SPI model writes each received byte into the
+// other half of the buffer, so the byte selected by host_spi_rxdat_read()
+// stays intact even if the compiler evaluates host_access() afterwards and
+// another byte completes in between.
+// ****************************************************************************
+typedef struct
+{
+  __IO uint32_t  CFG;
+  __IO uint32_t  DLY;
+  __IO uint32_t  STAT;
+  __IO uint32_t  INTENSET;
+  __O  uint32_t  INTENCLR;
+  __I  uint32_t  RXDAT[2];
+  __IO uint32_t  TXDATCTL;
+  __IO uint32_t  TXDAT;
+  __IO uint32_t  TXCTRL;
+  __IO uint32_t  DIV;
+  __I  uint32_t  INTSTAT;
+} LPC_SPI_TypeDef;
+
+
+// ****************************************************************************
+// Register memory, defined in hal.c
+// ****************************************************************************
+extern LPC_WWDT_TypeDef host_wwdt;
+extern LPC_MRT_TypeDef host_mrt;
+extern LPC_WKT_TypeDef host_wkt;
+extern LPC_SWM_TypeDef host_swm;
+extern LPC_PMU_TypeDef host_pmu;
+extern LPC_CMP_TypeDef host_cmp;
+extern LPC_FLASHCTRL_TypeDef host_flashctrl;
+extern LPC_IOCON_TypeDef host_iocon;
+extern LPC_SYSCON_TypeDef host_syscon;
+extern LPC_I2C_TypeDef host_i2c;
+extern LPC_SPI_TypeDef host_spi0;
+extern LPC_SPI_TypeDef host_spi1;
+extern LPC_USART_TypeDef host_usart0;
+extern LPC_USART_TypeDef host_usart1;
+extern LPC_USART_TypeDef host_usart2;
+extern LPC_CRC_TypeDef host_crc;
+extern LPC_SCT_TypeDef host_sct;
+extern LPC_GPIO_PORT_TypeDef host_gpio_port;
+extern LPC_PIN_INT_TypeDef host_pin_int;
+extern SysTick_Type host_systick;
+
+void *host_access(void *peripheral);
+unsigned int host_spi_rxdat_read(void);
+
+void host_enable_irq(void);
+void host_disable_irq(void);
+uint32_t host_get_primask(void);
+void host_set_primask(uint32_t value);
+void host_nvic_enable_irq(IRQn_Type irq);
+void host_nvic_disable_irq(IRQn_Type irq);
+void host_nvic_set_priority(IRQn_Type irq, uint32_t priority);
+
+// main() of the firmware is renamed when building for the host
+int firmware_main(void);
+
+
+#undef LPC_WWDT
+#undef LPC_MRT
+#undef LPC_WKT
+#undef LPC_SWM
+#undef LPC_PMU
+#undef LPC_CMP
+#undef LPC_FLASHCTRL
+#undef LPC_IOCON
+#undef LPC_SYSCON
+#undef LPC_I2C
+#undef LPC_SPI0
+#undef LPC_SPI1
+#undef LPC_USART0
+#undef LPC_USART1
+#undef LPC_USART2
+#undef LPC_CRC
+#undef LPC_SCT
+#undef LPC_GPIO_PORT
+#undef LPC_PIN_INT
+
+#define LPC_WWDT              ((LPC_WWDT_TypeDef *) host_access(&host_wwdt))
+#define LPC_MRT               ((LPC_MRT_TypeDef *) host_access(&host_mrt))
+#define LPC_WKT               ((LPC_WKT_TypeDef *) host_access(&host_wkt))
+#define LPC_SWM               ((LPC_SWM_TypeDef *) host_access(&host_swm))
+#define LPC_PMU               ((LPC_PMU_TypeDef *) host_access(&host_pmu))
+#define LPC_CMP               ((LPC_CMP_TypeDef *) host_access(&host_cmp))
+#define LPC_FLASHCTRL         ((LPC_FLASHCTRL_TypeDef *) host_access(&host_flashctrl))
+#define LPC_IOCON             ((LPC_IOCON_TypeDef *) host_access(&host_iocon))
+#define LPC_SYSCON            ((LPC_SYSCON_TypeDef *) host_access(&host_syscon))
+#define LPC_I2C               ((LPC_I2C_TypeDef *) host_access(&host_i2c))
+#define LPC_SPI0              ((LPC_SPI_TypeDef *) host_access(&host_spi0))
+#define LPC_SPI1              ((LPC_SPI_TypeDef *) host_access(&host_spi1))
+#define LPC_USART0            ((LPC_USART_TypeDef *) host_access(&host_usart0))
+#define LPC_USART1            ((LPC_USART_TypeDef *) host_access(&host_usart1))
+#define LPC_USART2            ((LPC_USART_TypeDef *) host_access(&host_usart2))
+#define LPC_CRC               ((LPC_CRC_TypeDef *) host_access(&host_crc))
+#define LPC_SCT               ((LPC_SCT_TypeDef *) host_access(&host_sct))
+#define LPC_GPIO_PORT         ((LPC_GPIO_PORT_TypeDef *) host_access(&host_gpio_port))
+#define LPC_PIN_INT           ((LPC_PIN_INT_TypeDef *) host_access(&host_pin_int))
+#define SysTick               ((SysTick_Type *) host_access(&host_systick))
+
+#define RXDAT                 RXDAT[host_spi_rxdat_read()]
+
+#define __DSB()               do { } while (0)
+#define __ISB()               do { } while (0)
+#define __enable_irq()        host_enable_irq()
+#define __disable_irq()       host_disable_irq()
+#define __get_PRIMASK()       host_get_primask()
+#define __set_PRIMASK(m)      host_set_primask(m)
+#define NVIC_EnableIRQ(irq)   host_nvic_enable_irq(irq)
+#define NVIC_DisableIRQ(irq)  host_nvic_disable_irq(irq)
+#define NVIC_SetPriority(irq, priority) host_nvic_set_priority(irq, priority)
+
+#endif  /* __HOST_LPC8xx_H__ */
@@ -0,0 +1,15 @@
+/******************************************************************************
+
+    Host replacement for LPC8xx_ROM_API.h
+
+    Only the IAP entry point is used by the firmware. On the host it points
+    to a model of the flash programming functions in hal.c.
+
+******************************************************************************/
+#ifndef __HOST_LPC8xx_ROM_API_H__
+#define __HOST_LPC8xx_ROM_API_H__
+
+typedef void (* IAP)(unsigned int [], unsigned int[]);
+extern IAP iap_entry;
+
+#endif  /* __HOST_LPC8xx_ROM_API_H__ */
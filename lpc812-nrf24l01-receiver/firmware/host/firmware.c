@@ -0,0 +1,142 @@
+/******************************************************************************
+
+    The processor of receiver-host: the firmware compiled for the host runs
+    directly on the PC. Interrupt handlers are plain function calls, and
+    target addresses are host addresses (we link without PIE).
+
+******************************************************************************/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <LPC8xx.h>
+#include <LPC8xx_ROM_API.h>
+#include <persistent_storage.h>
+
+#include "hal.h"
+
+
+extern const volatile uint8_t persistent_data[PERSISTENT_DATA_SIZE];
+
+// Firmware interrupt handlers (main.c, uart0.c)
+void SysTick_handler(void);
+void SPI0_irq_handler(void);
+void UART0_irq_handler(void);
+void SCT_irq_handler(void);
+void MRT_irq_handler(void);
+void PININT0_irq_handler(void);
+
+IAP iap_entry = host_iap;
+
+const char *host_cpu_name = "firmware compiled for the host";
+
+
+// ****************************************************************************
+// Interrupt handlers the firmware does not implement. Weak so that the
+// firmware can provide them when it starts using the peripheral interrupt.
+// ****************************************************************************
+__attribute__ ((weak)) void SPI0_irq_handler(void)
+{
+}
+
+
+// ****************************************************************************
+__attribute__ ((weak)) void MRT_irq_handler(void)
+{
+}
+
+
+// ****************************************************************************
+void host_cpu_init(void)
+{
+    long page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)persistent_data & ~(uintptr_t)(page_size - 1);
+    uintptr_t end = (uintptr_t)persistent_data + PERSISTENT_DATA_SIZE;
+
+    // The persistent data is const in the firmware; make it writable for
+    // the IAP model.
+    if (mprotect((void *)start, end - start, PROT_READ | PROT_WRITE) != 0) {
+        perror("mprotect");
+        exit(1);
+    }
+}
+
+
+// ****************************************************************************
+bool host_cpu_load(const char *image)
+{
+    if (image) {
+        fprintf(stderr, "receiver-host runs the firmware it was built from; "
+            "use receiver-iss to run %s\n", image);
+        return false;
+    }
+    return true;
+}
+
+
+// ****************************************************************************
+void host_cpu_run(void)
+{
+    firmware_main();
+}
+
+
+// ****************************************************************************
+void host_cpu_irq(host_irq_t irq)
+{
+    switch (irq) {
+        case HOST_IRQ_SYSTICK:
+            SysTick_handler();
+            break;
+
+        case HOST_IRQ_SPI0:
+            SPI0_irq_handler();
+            break;
+
+        case HOST_IRQ_UART0:
+            UART0_irq_handler();
+            break;
+
+        case HOST_IRQ_SCT:
+            SCT_irq_handler();
+            break;
+
+        case HOST_IRQ_MRT:
+            MRT_irq_handler();
+            break;
+
+        case HOST_IRQ_PININT0:
+            PININT0_irq_handler();
+            break;
+
+        case HOST_NUMBER_OF_IRQS:
+        default:
+            break;
+    }
+}
+
+
+// ****************************************************************************
+uint8_t *host_cpu_memory(uint32_t address, uint32_t size)
+{
+    (void)size;
+
+    return (uint8_t *)(uintptr_t)address;
+}
+
+
+// ****************************************************************************
+uint32_t host_cpu_persistent_data(void)
+{
+    return (uint32_t)(uintptr_t)persistent_data;
+}
+
+
+// ****************************************************************************
+void host_cpu_report(FILE *f)
+{
+    (void)f;
+}
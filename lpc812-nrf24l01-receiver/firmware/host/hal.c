@@ -0,0 +1,2036 @@
+/******************************************************************************
+
+    Register-backed hardware abstraction for running the LPC812 receiver
+    firmware as a normal Linux executable.
+
+    All peripheral registers live in plain memory (see LPC8xx.h in this
+    directory). Every time the firmware dereferences one of the LPC_xxx
+    pointers host_access() is called, which
+
+      1. processes the write the firmware may have done with its previous
+         register access,
+      2. advances the virtual clock by the cost of one register access,
+         running the peripheral models (SCT, SysTick, MRT, SPI0, USART0,
+         GPIO, PININT, WWDT) and dispatching their interrupts on the way,
+      3. refreshes registers the firmware may read (counters, pin levels).
+
+    Write detection
+    ---------------
+    Registers where a write has side effects (write-one-to-clear flags,
+    transmit data, feed sequences, ...) are kept with bit 31 (MARKER) set by
+    the model. The firmware never writes this bit, so when it is missing the
+    register has been written since the model last looked at it. The flags
+    themselves are kept in static variables of this file, as the write
+    overwrites the memory.
+
+    GPIO SET0, CLR0 and NOT0 are simply kept at 0 by the model.
+
+    Processor
+    ---------
+    The code that accesses the registers is either the firmware compiled
+    for the host (firmware.c), or an instruction set simulator running the
+    firmware image (iss.c). Interrupt handlers, main() and the memory holding
+    the persistent data are reached through the host_cpu_xxx() functions
+    they provide.
+
+    Time
+    ----
+    host_cycles counts system clock cycles. Code that does not touch
+    peripherals takes no time; each register access costs
+    host_cycles_per_access cycles. Busy-wait loops on peripheral status
+    therefore take realistic time, and SPI or UART transfers take exactly as
+    long as the configured clock dividers dictate.
+
+******************************************************************************/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+
+#include <LPC8xx.h>
+#include <LPC8xx_ROM_API.h>
+#include <persistent_storage.h>
+
+#include "hal.h"
+#include "trace.h"
+
+// The models access RXDAT directly
+#undef RXDAT
+
+
+#define MARKER (1u << 31)
+#define WRITTEN(reg) (!((reg) & MARKER))
+
+// Registers that are read-only for the firmware are written by the models
+#define SET_RO(reg, value) (*(volatile uint32_t *)&(reg) = (value))
+
+#define NEVER UINT64_MAX
+#define THREAD_PRIORITY 4
+
+#define NUMBER_OF_PIN_HOOKS 8
+
+#define DEVICE_ID_TSSOP16 0x00008121
+#define DEVICE_ID_TSSOP20 0x00008122
+
+// Cortex-M0+ exception entry and exit
+#define IRQ_ENTRY_CYCLES 15
+#define IRQ_EXIT_CYCLES 10
+
+// LPC81x data sheet, flash characteristics
+#define FLASH_ERASE_CYCLES HOST_MS(100)
+#define FLASH_PROGRAM_CYCLES HOST_MS(1)
+#define FLASH_ERASED_VALUE 0xff
+
+#define IAP_PREPARE 50
+#define IAP_COPY_RAM_TO_FLASH 51
+#define IAP_ERASE_PAGE 59
+#define IAP_REINVOKE_ISP 57
+#define IAP_CMD_SUCCESS 0
+#define IAP_INVALID_COMMAND 1
+#define IAP_DST_ADDR_ERROR 3
+
+#define SCT_CONFIG_AUTOLIMIT_L (1 << 17)
+#define SCT_CONFIG_AUTOLIMIT_H (1 << 18)
+#define SCT_CTRL_STOP (1 << 1)
+#define SCT_CTRL_HALT (1 << 2)
+#define SCT_CTRL_CLRCTR (1 << 3)
+#define SCT_EV_HEVENT (1 << 4)
+#define SCT_EV_STATELD (1 << 14)
+#define SCT_COUNTER_L 0
+#define SCT_COUNTER_H 1
+
+#define SYSTICK_ENABLE (1 << 0)
+#define SYSTICK_TICKINT (1 << 1)
+#define SYSTICK_COUNTFLAG (1 << 16)
+
+#define MRT_INTFLAG (1 << 0)
+#define MRT_RUN (1 << 1)
+#define MRT_INTEN (1 << 0)
+#define MRT_MODE_MASK (3 << 1)
+#define MRT_MODE_ONE_SHOT (1 << 1)
+
+#define SPI_STAT_RXRDY (1 << 0)
+#define SPI_STAT_TXRDY (1 << 1)
+#define SPI_STAT_RXOV (1 << 2)
+#define SPI_STAT_TXUR (1 << 3)
+#define SPI_STAT_SSA (1 << 4)
+#define SPI_STAT_SSD (1 << 5)
+#define SPI_STAT_ENDTRANSFER (1 << 7)
+#define SPI_STAT_MSTIDLE (1 << 8)
+#define SPI_STAT_W1C (SPI_STAT_RXOV | SPI_STAT_TXUR | SPI_STAT_SSA | SPI_STAT_SSD)
+#define SPI_TXCTL_EOT (1 << 20)
+#define SPI_TXCTL_RXIGNORE (1 << 22)
+
+#define UART_STAT_TXRDY (1 << 2)
+#define UART_STAT_TXIDLE (1 << 3)
+
+#define WWDT_MOD_WDEN (1 << 0)
+
+
+typedef struct {
+    uint64_t next_tick;
+    bool running;
+    bool limit_pending;
+    uint32_t count;             // Counter value as last written by the model
+    bool next_event_known;      // next_event is valid until the SCT changes
+    uint64_t next_event;
+} sct_counter_t;
+
+typedef struct {
+    bool busy;
+    uint64_t done_at;
+    uint16_t data;
+    uint32_t ctl;
+    bool holding;
+    uint16_t holding_data;
+    uint32_t holding_ctl;
+} shifter_t;
+
+
+LPC_WWDT_TypeDef host_wwdt;
+LPC_MRT_TypeDef host_mrt;
+LPC_WKT_TypeDef host_wkt;
+LPC_SWM_TypeDef host_swm;
+LPC_PMU_TypeDef host_pmu;
+LPC_CMP_TypeDef host_cmp;
+LPC_FLASHCTRL_TypeDef host_flashctrl;
+LPC_IOCON_TypeDef host_iocon;
+LPC_SYSCON_TypeDef host_syscon;
+LPC_I2C_TypeDef host_i2c;
+LPC_SPI_TypeDef host_spi0;
+LPC_SPI_TypeDef host_spi1;
+LPC_USART_TypeDef host_usart0;
+LPC_USART_TypeDef host_usart1;
+LPC_USART_TypeDef host_usart2;
+LPC_CRC_TypeDef host_crc;
+LPC_SCT_TypeDef host_sct;
+LPC_GPIO_PORT_TypeDef host_gpio_port;
+LPC_PIN_INT_TypeDef host_pin_int;
+SysTick_Type host_systick;
+
+uint64_t host_cycles;
+unsigned int host_cycles_per_access = 4;
+bool host_idle_skipping = true;
+host_stats_t host_stats;
+FILE *host_uart_output;
+
+static void *last_access;
+static jmp_buf run_exit;
+static const char *stop_reason;
+
+static host_timer_t *timers;
+
+static bool primask;
+static bool interrupts_held;
+static unsigned int active_priority = THREAD_PRIORITY;
+static bool irq_enabled[HOST_NUMBER_OF_IRQS];
+static unsigned int irq_priority[HOST_NUMBER_OF_IRQS];
+
+static uint32_t gpio_latch;
+static uint32_t gpio_prepared_levels;
+static uint32_t input_levels = 0xffffffff;
+static uint32_t pin_levels;
+static host_pin_hook_t pin_hooks[NUMBER_OF_PIN_HOOKS];
+static unsigned int number_of_pin_hooks;
+
+static uint32_t pin_int_ist;
+
+static sct_counter_t sct_counter[2];
+static uint32_t sct_evflag;
+static uint32_t sct_matchrel[CONFIG_SCT_nRG];
+
+static uint64_t systick_next = NEVER;
+static bool systick_enabled;
+static bool systick_pending;
+
+static uint64_t mrt_expiry[4] = {NEVER, NEVER, NEVER, NEVER};
+static uint32_t mrt_interval[4];
+static uint32_t mrt_stat[4];
+
+static const host_spi_device_t *spi_device;
+static shifter_t spi;
+static uint32_t spi_stat;
+static uint32_t spi_intenset;
+static bool spi_selected;
+static uint64_t spi_selected_at;
+static bool spi_end_transfer;
+static unsigned int spi_rx_index;
+
+static shifter_t uart;
+static uint32_t uart_intenset;
+
+static uint64_t wwdt_last_feed;
+static bool wwdt_feed_armed;
+static bool busy_since_feed;
+static unsigned int idle_iterations;
+
+static const char *irq_names[HOST_NUMBER_OF_IRQS] = {
+    "SysTick",
+    "SPI0",
+    "UART0",
+    "SCT",
+    "MRT",
+    "PININT0",
+};
+
+
+// ****************************************************************************
+static uint64_t min64(uint64_t a, uint64_t b)
+{
+    return a < b ? a : b;
+}
+
+
+// ****************************************************************************
+// GPIO, switch matrix and pin interrupts
+// ****************************************************************************
+static unsigned int ctout_pin(unsigned int n)
+{
+    switch (n) {
+        case 0: return (host_swm.PINASSIGN6 >> 24) & 0xff;
+        case 1: return (host_swm.PINASSIGN7 >> 0) & 0xff;
+        case 2: return (host_swm.PINASSIGN7 >> 8) & 0xff;
+        case 3: return (host_swm.PINASSIGN7 >> 16) & 0xff;
+        default: return 0xff;
+    }
+}
+
+
+// ****************************************************************************
+static void pin_interrupt_edge(unsigned int pin, bool level)
+{
+    int n;
+
+    for (n = 0; n < 8; n++) {
+        if (host_syscon.PINTSEL[n] != pin) {
+            continue;
+        }
+
+        // Only edge sensitive mode is modelled
+        if (host_pin_int.ISEL & (1 << n)) {
+            continue;
+        }
+
+        if (level && (host_pin_int.IENR & (1 << n))) {
+            host_pin_int.RISE |= (1 << n);
+            pin_int_ist |= (1 << n);
+        }
+
+        if (!level && (host_pin_int.IENF & (1 << n))) {
+            host_pin_int.FALL |= (1 << n);
+            pin_int_ist |= (1 << n);
+        }
+    }
+
+    host_pin_int.IST = pin_int_ist | MARKER;
+}
+
+
+// ****************************************************************************
+static void update_pins(void)
+{
+    uint32_t dir = host_gpio_port.DIR0;
+    uint32_t levels;
+    uint32_t changed;
+    unsigned int n;
+    unsigned int pin;
+
+    levels = (gpio_latch & dir) | (input_levels & ~dir);
+
+    // Movable functions assigned through the switch matrix take precedence
+    // over GPIO.
+    for (n = 0; n < CONFIG_SCT_nOU; n++) {
+        pin = ctout_pin(n);
+        if (pin < HOST_NUMBER_OF_PINS) {
+            if (host_sct.OUTPUT & (1 << n)) {
+                levels |= (1 << pin);
+            }
+            else {
+                levels &= ~(1 << pin);
+            }
+        }
+    }
+
+    // UART TX idles high; we do not model the individual bits
+    pin = host_swm.PINASSIGN0 & 0xff;
+    if (pin < HOST_NUMBER_OF_PINS) {
+        levels |= (1 << pin);
+    }
+
+    // SPI0_SSEL is active low. SCK and MOSI are not modelled on bit level.
+    pin = (host_swm.PINASSIGN4 >> 16) & 0xff;
+    if (pin < HOST_NUMBER_OF_PINS) {
+        if (spi_selected) {
+            levels &= ~(1 << pin);
+        }
+        else {
+            levels |= (1 << pin);
+        }
+    }
+
+    levels &= (1 << HOST_NUMBER_OF_PINS) - 1;
+    changed = levels ^ pin_levels;
+    pin_levels = levels;
+
+    for (pin = 0; changed; pin++, changed >>= 1) {
+        if (changed & 1) {
+            bool level = (levels >> pin) & 1;
+
+            pin_interrupt_edge(pin, level);
+            for (n = 0; n < number_of_pin_hooks; n++) {
+                pin_hooks[n](pin, level);
+            }
+        }
+    }
+}
+
+
+// ****************************************************************************
+static void prepare_gpio(void);
+
+static void sync_gpio(void)
+{
+    unsigned int pin;
+
+    // The byte and word pin registers hold the levels of the last
+    // prepare_gpio(); a different value has been written. Any non-zero
+    // value sets the output.
+    for (pin = 0; pin < HOST_NUMBER_OF_PINS; pin++) {
+        bool level = (gpio_prepared_levels >> pin) & 1;
+        bool written = false;
+        bool value = false;
+
+        if (host_gpio_port.B0[pin] != level) {
+            written = true;
+            value = host_gpio_port.B0[pin] & 1;
+        }
+        else if (host_gpio_port.W0[pin] != (level ? 0xffffffff : 0)) {
+            written = true;
+            value = host_gpio_port.W0[pin] != 0;
+        }
+
+        if (written) {
+            if (value) {
+                gpio_latch |= (1 << pin);
+            }
+            else {
+                gpio_latch &= ~(1 << pin);
+            }
+        }
+    }
+
+    if (host_gpio_port.SET0) {
+        gpio_latch |= host_gpio_port.SET0;
+        host_gpio_port.SET0 = 0;
+    }
+
+    if (host_gpio_port.CLR0) {
+        gpio_latch &= ~host_gpio_port.CLR0;
+        host_gpio_port.CLR0 = 0;
+    }
+
+    if (host_gpio_port.NOT0) {
+        gpio_latch ^= host_gpio_port.NOT0;
+        host_gpio_port.NOT0 = 0;
+    }
+
+    update_pins();
+    prepare_gpio();
+}
+
+
+// ****************************************************************************
+static void prepare_gpio(void)
+{
+    unsigned int pin;
+
+    host_gpio_port.PIN0 = pin_levels;
+    gpio_prepared_levels = pin_levels;
+    for (pin = 0; pin < HOST_NUMBER_OF_PINS; pin++) {
+        bool level = (pin_levels >> pin) & 1;
+
+        host_gpio_port.B0[pin] = level;
+        host_gpio_port.W0[pin] = level ? 0xffffffff : 0;
+    }
+}
+
+
+// ****************************************************************************
+static void sync_pin_int(void)
+{
+    if (WRITTEN(host_pin_int.IST)) {
+        pin_int_ist &= ~host_pin_int.IST;
+        host_pin_int.IST = pin_int_ist | MARKER;
+    }
+}
+
+
+// ****************************************************************************
+// SCTimer
+//
+// Models the two 16-bit counters (or the unified 32-bit counter) counting
+// up, prescaler, auto limit on match 0, match events restricted by the state mask, limit, halt and
+// stop events, state changes, output set/clear with conflict resolution,
+// match reload and the event interrupt.
+// ****************************************************************************
+static bool sct_unified(void)
+{
+    return host_sct.CONFIG & (1 << 0);
+}
+
+
+// ****************************************************************************
+static uint16_t sct_ctrl(int h)
+{
+    return h ? host_sct.CTRL_H : host_sct.CTRL_L;
+}
+
+
+// ****************************************************************************
+static void sct_set_ctrl_bits(int h, uint16_t bits)
+{
+    if (h) {
+        host_sct.CTRL_H |= bits;
+    }
+    else {
+        host_sct.CTRL_L |= bits;
+    }
+}
+
+
+// ****************************************************************************
+static uint32_t sct_count(int h)
+{
+    if (sct_unified()) {
+        return host_sct.COUNT_U;
+    }
+    return h ? host_sct.COUNT_H : host_sct.COUNT_L;
+}
+
+
+// ****************************************************************************
+static void sct_set_count(int h, uint32_t count)
+{
+    if (sct_unified()) {
+        host_sct.COUNT_U = count;
+    }
+    else if (h) {
+        host_sct.COUNT_H = count;
+    }
+    else {
+        host_sct.COUNT_L = count;
+    }
+    sct_counter[h].count = count;
+}
+
+
+// ****************************************************************************
+static uint32_t sct_max(void)
+{
+    return sct_unified() ? 0xffffffff : 0xffff;
+}
+
+
+// ****************************************************************************
+static uint32_t sct_match(int h, unsigned int m)
+{
+    if (sct_unified()) {
+        return host_sct.MATCH[m].U;
+    }
+    return h ? host_sct.MATCH[m].H : host_sct.MATCH[m].L;
+}
+
+
+// ****************************************************************************
+static void sct_reload(int h)
+{
+    int m;
+
+    for (m = 0; m < CONFIG_SCT_nRG; m++) {
+        if (sct_unified()) {
+            host_sct.MATCH[m].U = host_sct.MATCHREL[m].U;
+        }
+        else if (h) {
+            host_sct.MATCH[m].H = host_sct.MATCHREL[m].H;
+        }
+        else {
+            host_sct.MATCH[m].L = host_sct.MATCHREL[m].L;
+        }
+    }
+}
+
+
+// ****************************************************************************
+static bool sct_autolimit(int h)
+{
+    return host_sct.CONFIG & (h ? SCT_CONFIG_AUTOLIMIT_H : SCT_CONFIG_AUTOLIMIT_L);
+}
+
+
+// ****************************************************************************
+static unsigned int sct_state(int h)
+{
+    return h ? host_sct.STATE_H : host_sct.STATE_L;
+}
+
+
+// ****************************************************************************
+static unsigned int sct_prescale(int h)
+{
+    return ((sct_ctrl(h) >> 5) & 0xff) + 1;
+}
+
+
+// ****************************************************************************
+static bool sct_running(int h)
+{
+    if (h && sct_unified()) {
+        return false;
+    }
+    return !(sct_ctrl(h) & (SCT_CTRL_HALT | SCT_CTRL_STOP));
+}
+
+
+// ****************************************************************************
+// Returns true if the event is a match event on counter h that is enabled in
+// the current state of that counter.
+// ****************************************************************************
+static bool sct_event_active(int h, unsigned int e)
+{
+    uint32_t ctrl = host_sct.EVENT[e].CTRL;
+    unsigned int combmode = (ctrl >> 12) & 0x3;
+
+    if (!sct_unified() && ((ctrl & SCT_EV_HEVENT) ? 1 : 0) != h) {
+        return false;
+    }
+
+    // Only match conditions are modelled (COMBMODE OR and MATCH)
+    if (combmode > 1) {
+        return false;
+    }
+
+    if ((ctrl & 0xf) >= CONFIG_SCT_nRG) {
+        return false;
+    }
+
+    return (host_sct.EVENT[e].STATE >> sct_state(h)) & 1;
+}
+
+
+// ****************************************************************************
+// Number of prescaled ticks until the counter reaches a value where
+// something happens
+// ****************************************************************************
+static uint64_t sct_ticks_to_next(int h)
+{
+    uint32_t count = sct_count(h);
+    uint64_t ticks;
+    unsigned int e;
+
+    if (sct_counter[h].limit_pending) {
+        return 1;
+    }
+
+    ticks = (uint64_t)sct_max() - count + 1;
+
+    if (sct_autolimit(h) && sct_match(h, 0) > count) {
+        ticks = min64(ticks, sct_match(h, 0) - count);
+    }
+
+    for (e = 0; e < CONFIG_SCT_nEV; e++) {
+        if (sct_event_active(h, e)) {
+            uint32_t match = sct_match(h, host_sct.EVENT[e].CTRL & 0xf);
+
+            if (match > count) {
+                ticks = min64(ticks, match - count);
+            }
+        }
+    }
+
+    return ticks;
+}
+
+
+// ****************************************************************************
+static void sct_fire(int h, uint32_t events)
+{
+    uint32_t limit = h ? host_sct.LIMIT_H : host_sct.LIMIT_L;
+    uint32_t halt = h ? host_sct.HALT_H : host_sct.HALT_L;
+    uint32_t stop = h ? host_sct.STOP_H : host_sct.STOP_L;
+    uint32_t output = host_sct.OUTPUT;
+    unsigned int e;
+    unsigned int n;
+
+    sct_evflag |= events;
+    host_sct.EVFLAG = sct_evflag | MARKER;
+
+    for (e = 0; e < CONFIG_SCT_nEV; e++) {
+        uint32_t ctrl = host_sct.EVENT[e].CTRL;
+        unsigned int statev = (ctrl >> 15) & 0x1f;
+
+        if (!(events & (1 << e))) {
+            continue;
+        }
+
+        ++host_stats.sct_events[e];
+
+        if (ctrl & SCT_EV_STATELD) {
+            if (h) { host_sct.STATE_H = statev; } else { host_sct.STATE_L = statev; }
+        }
+        else if (statev) {
+            if (h) { host_sct.STATE_H += statev; } else { host_sct.STATE_L += statev; }
+        }
+    }
+
+    for (n = 0; n < CONFIG_SCT_nOU; n++) {
+        bool set = host_sct.OUT[n].SET & events;
+        bool clr = host_sct.OUT[n].CLR & events;
+
+        if (set && clr) {
+            switch ((host_sct.RES >> (2 * n)) & 0x3) {
+                case 1: output |= (1 << n); break;
+                case 2: output &= ~(1 << n); break;
+                case 3: output ^= (1 << n); break;
+                default: break;
+            }
+        }
+        else if (set) {
+            output |= (1 << n);
+        }
+        else if (clr) {
+            output &= ~(1 << n);
+        }
+    }
+
+    if (events & limit) {
+        sct_counter[h].limit_pending = true;
+    }
+
+    if (events & halt) {
+        sct_set_ctrl_bits(h, SCT_CTRL_HALT);
+    }
+
+    if (events & stop) {
+        sct_set_ctrl_bits(h, SCT_CTRL_STOP);
+    }
+
+    if (output != host_sct.OUTPUT) {
+        host_sct.OUTPUT = output;
+        update_pins();
+    }
+}
+
+
+// ****************************************************************************
+// The time of the next event only changes when the SCT configuration or
+// state does, so it is cached: the firmware polls the other peripherals
+// far more often than the SCT does anything.
+// ****************************************************************************
+static void sct_forget_next_event(void)
+{
+    sct_counter[SCT_COUNTER_L].next_event_known = false;
+    sct_counter[SCT_COUNTER_H].next_event_known = false;
+}
+
+
+// ****************************************************************************
+static void sct_arrive(int h, uint32_t count)
+{
+    uint32_t events = 0;
+    unsigned int e;
+
+    sct_forget_next_event();
+    sct_set_count(h, count);
+
+    if (count == 0) {
+        sct_counter[h].limit_pending = false;
+        sct_reload(h);
+    }
+
+    for (e = 0; e < CONFIG_SCT_nEV; e++) {
+        if (sct_event_active(h, e)) {
+            if (sct_match(h, host_sct.EVENT[e].CTRL & 0xf) == count) {
+                events |= (1 << e);
+            }
+        }
+    }
+
+    if (events) {
+        sct_fire(h, events);
+    }
+
+    if (count && sct_autolimit(h) && sct_match(h, 0) == count) {
+        sct_counter[h].limit_pending = true;
+    }
+}
+
+
+// ****************************************************************************
+static uint64_t sct_next_event(int h)
+{
+    sct_counter_t *c = &sct_counter[h];
+
+    if (!c->running) {
+        return NEVER;
+    }
+    if (!c->next_event_known) {
+        c->next_event = c->next_tick + (sct_ticks_to_next(h) - 1) * sct_prescale(h);
+        c->next_event_known = true;
+    }
+    return c->next_event;
+}
+
+
+// ****************************************************************************
+static void sct_update(uint64_t until)
+{
+    int h;
+
+    for (h = SCT_COUNTER_L; h <= SCT_COUNTER_H; h++) {
+        sct_counter_t *c = &sct_counter[h];
+
+        while (c->running && c->next_tick <= until) {
+            unsigned int prescale = sct_prescale(h);
+            uint64_t at = sct_next_event(h);
+            uint64_t ticks = (at - c->next_tick) / prescale + 1;
+
+            if (at > until) {
+                ticks = (until - c->next_tick) / prescale + 1;
+                sct_set_count(h, sct_count(h) + ticks);
+                c->next_tick += ticks * prescale;
+                break;
+            }
+
+            c->next_tick = at + prescale;
+            if (c->limit_pending || sct_count(h) + ticks > sct_max()) {
+                sct_arrive(h, 0);
+            }
+            else {
+                sct_arrive(h, sct_count(h) + ticks);
+            }
+        }
+    }
+}
+
+
+// ****************************************************************************
+static void sync_sct(void)
+{
+    int h;
+
+    sct_forget_next_event();
+
+    if (WRITTEN(host_sct.EVFLAG)) {
+        sct_evflag &= ~host_sct.EVFLAG;
+        host_sct.EVFLAG = sct_evflag | MARKER;
+    }
+
+    for (h = 0; h < CONFIG_SCT_nRG; h++) {
+        uint32_t value = host_sct.MATCHREL[h].U;
+
+        if ((value ^ sct_matchrel[h]) & 0xffff) {
+            trace_record(TRACE_MATCHREL_L, h, value & 0xffff);
+        }
+        if ((value ^ sct_matchrel[h]) & 0xffff0000) {
+            trace_record(TRACE_MATCHREL_H, h, value >> 16);
+        }
+        sct_matchrel[h] = value;
+    }
+
+    for (h = SCT_COUNTER_L; h <= SCT_COUNTER_H; h++) {
+        sct_counter_t *c = &sct_counter[h];
+        bool running;
+
+        if (sct_ctrl(h) & SCT_CTRL_CLRCTR) {
+            if (h) {
+                host_sct.CTRL_H &= ~SCT_CTRL_CLRCTR;
+            }
+            else {
+                host_sct.CTRL_L &= ~SCT_CTRL_CLRCTR;
+            }
+            sct_set_count(h, 0);
+        }
+
+        // The firmware wrote the counter: forget a pending limit
+        if (sct_count(h) != c->count) {
+            c->count = sct_count(h);
+            c->limit_pending = false;
+        }
+
+        running = sct_running(h);
+        if (running && !c->running) {
+            c->next_tick = host_cycles + sct_prescale(h);
+        }
+        c->running = running;
+    }
+
+    // Outputs may have been written directly, or CTOUT moved
+    update_pins();
+}
+
+
+// ****************************************************************************
+// SysTick
+// ****************************************************************************
+static void sync_systick(void)
+{
+    bool enabled = host_systick.CTRL & SYSTICK_ENABLE;
+
+    if (enabled && !systick_enabled) {
+        systick_next = host_cycles + host_systick.LOAD + 1;
+    }
+    if (!enabled) {
+        systick_next = NEVER;
+    }
+    systick_enabled = enabled;
+}
+
+
+// ****************************************************************************
+static void systick_update(uint64_t until)
+{
+    while (systick_next <= until) {
+        host_systick.CTRL |= SYSTICK_COUNTFLAG;
+        if (host_systick.CTRL & SYSTICK_TICKINT) {
+            systick_pending = true;
+        }
+        systick_next += host_systick.LOAD + 1;
+    }
+}
+
+
+// ****************************************************************************
+static void prepare_systick(void)
+{
+    if (systick_next != NEVER) {
+        host_systick.VAL = (uint32_t)(systick_next - host_cycles - 1);
+    }
+}
+
+
+// ****************************************************************************
+// Multi-Rate Timer
+//
+// Writing INTVAL (re)starts the channel and clears its interrupt flag.
+// The LOAD bit (bit 31) is used as write marker and therefore not supported.
+// STAT carries the marker as well, so that writing 1 to the set INTFLAG
+// (write-one-to-clear) is noticed.
+// ****************************************************************************
+static void sync_mrt(void)
+{
+    int ch;
+
+    for (ch = 0; ch < 4; ch++) {
+        MRT_Channel_cfg_Type *c = &host_mrt.Channel[ch];
+
+        if (WRITTEN(c->INTVAL)) {
+            mrt_interval[ch] = c->INTVAL & 0x7fffffff;
+            c->INTVAL = mrt_interval[ch] | MARKER;
+            mrt_stat[ch] &= ~MRT_INTFLAG;
+
+            if (mrt_interval[ch]) {
+                mrt_expiry[ch] = host_cycles + mrt_interval[ch];
+                mrt_stat[ch] |= MRT_RUN;
+            }
+            else {
+                mrt_expiry[ch] = NEVER;
+                mrt_stat[ch] &= ~MRT_RUN;
+            }
+        }
+
+        if (WRITTEN(c->STAT)) {
+            mrt_stat[ch] &= ~(c->STAT & MRT_INTFLAG);
+        }
+        c->STAT = mrt_stat[ch] | MARKER;
+    }
+}
+
+
+// ****************************************************************************
+static void mrt_update(uint64_t until)
+{
+    int ch;
+
+    for (ch = 0; ch < 4; ch++) {
+        MRT_Channel_cfg_Type *c = &host_mrt.Channel[ch];
+
+        while (mrt_expiry[ch] <= until) {
+            mrt_stat[ch] |= MRT_INTFLAG;
+
+            if ((c->CTRL & MRT_MODE_MASK) == MRT_MODE_ONE_SHOT) {
+                mrt_expiry[ch] = NEVER;
+                mrt_stat[ch] &= ~MRT_RUN;
+            }
+            else {
+                mrt_expiry[ch] += mrt_interval[ch];
+            }
+            c->STAT = mrt_stat[ch] | MARKER;
+        }
+    }
+}
+
+
+// ****************************************************************************
+static void prepare_mrt(void)
+{
+    int ch;
+
+    for (ch = 0; ch < 4; ch++) {
+        if (mrt_expiry[ch] != NEVER) {
+            host_mrt.Channel[ch].TIMER = (uint32_t)(mrt_expiry[ch] - host_cycles);
+        }
+        else {
+            host_mrt.Channel[ch].TIMER = 0;
+        }
+    }
+}
+
+
+// ****************************************************************************
+static bool mrt_irq_pending(void)
+{
+    int ch;
+
+    for (ch = 0; ch < 4; ch++) {
+        if ((mrt_stat[ch] & MRT_INTFLAG) && (host_mrt.Channel[ch].CTRL & MRT_INTEN)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+// ****************************************************************************
+// SPI0
+//
+// One byte TX holding register in front of the shift register, one byte
+// RX data register. SSEL is asserted when a transfer starts and released
+// after a byte with EOT, or after ENDTRANSFER was written to STAT.
+//
+// As a master the SPI does not overrun: the byte in the holding register
+// is not started while RXDAT still holds unread data (unless it is sent
+// with RXIGNORE). The transfer stalls until the firmware reads RXDAT.
+// ****************************************************************************
+static void spi_set_stat(void)
+{
+    spi_stat &= ~(SPI_STAT_TXRDY | SPI_STAT_MSTIDLE);
+
+    if (!spi.holding) {
+        spi_stat |= SPI_STAT_TXRDY;
+    }
+
+    if (!spi.busy && !spi.holding) {
+        spi_stat |= SPI_STAT_MSTIDLE;
+    }
+
+    host_spi0.STAT = spi_stat | MARKER;
+    SET_RO(host_spi0.INTSTAT, spi_stat & spi_intenset);
+}
+
+
+// ****************************************************************************
+static void spi_select(bool selected)
+{
+    if (selected == spi_selected) {
+        return;
+    }
+
+    spi_selected = selected;
+    spi_stat |= selected ? SPI_STAT_SSA : SPI_STAT_SSD;
+
+    if (selected) {
+        ++host_stats.spi_transactions;
+        spi_selected_at = host_cycles;
+    }
+    else {
+        host_stats.spi_selected_cycles += host_cycles - spi_selected_at;
+    }
+
+    if (spi_device && spi_device->select) {
+        spi_device->select(selected);
+    }
+
+    update_pins();
+}
+
+
+// ****************************************************************************
+static void spi_start(uint16_t data, uint32_t ctl)
+{
+    spi_select(true);
+
+    spi.busy = true;
+    spi.data = data;
+    spi.ctl = ctl;
+    spi.done_at = host_cycles + 8 * (uint64_t)((host_spi0.DIV & 0xffff) + 1);
+}
+
+
+// ****************************************************************************
+static bool spi_stalled(void)
+{
+    return (spi_stat & SPI_STAT_RXRDY) && !(spi.holding_ctl & SPI_TXCTL_RXIGNORE);
+}
+
+
+// ****************************************************************************
+static void spi_start_holding(void)
+{
+    spi.holding = false;
+    spi_start(spi.holding_data, spi.holding_ctl);
+}
+
+
+// ****************************************************************************
+static void spi_queue(uint16_t data, uint32_t ctl)
+{
+    if (!spi.busy) {
+        spi_start(data, ctl);
+    }
+    else {
+        // Overwrites a byte that is still waiting, just like the hardware
+        spi.holding = true;
+        spi.holding_data = data;
+        spi.holding_ctl = ctl;
+    }
+}
+
+
+// ****************************************************************************
+static void spi_update(uint64_t until)
+{
+    while (spi.busy && spi.done_at <= until) {
+        uint8_t miso = 0xff;
+
+        if (spi_device && spi_device->exchange) {
+            miso = spi_device->exchange(spi.data & 0xff);
+        }
+        ++host_stats.spi_bytes;
+
+        if (!(spi.ctl & SPI_TXCTL_RXIGNORE)) {
+            if (spi_stat & SPI_STAT_RXRDY) {
+                spi_stat |= SPI_STAT_RXOV;
+            }
+            spi_rx_index ^= 1;
+            SET_RO(host_spi0.RXDAT[spi_rx_index], miso);
+            spi_stat |= SPI_STAT_RXRDY;
+        }
+
+        spi.busy = false;
+
+        if ((spi.ctl & SPI_TXCTL_EOT) || (spi_end_transfer && !spi.holding)) {
+            spi_end_transfer = false;
+            spi_select(false);
+        }
+
+        if (spi.holding && !spi_stalled()) {
+            spi_start_holding();
+        }
+    }
+
+    spi_set_stat();
+}
+
+
+// ****************************************************************************
+static void sync_spi(void)
+{
+    if (WRITTEN(host_spi0.STAT)) {
+        uint32_t written = host_spi0.STAT;
+
+        spi_stat &= ~(written & SPI_STAT_W1C);
+
+        if (written & SPI_STAT_ENDTRANSFER) {
+            if (spi.busy || spi.holding) {
+                spi_end_transfer = true;
+            }
+            else {
+                spi_select(false);
+            }
+        }
+    }
+
+    if (WRITTEN(host_spi0.INTENSET)) {
+        spi_intenset |= host_spi0.INTENSET;
+        host_spi0.INTENSET = spi_intenset | MARKER;
+    }
+
+    if (WRITTEN(host_spi0.INTENCLR)) {
+        spi_intenset &= ~host_spi0.INTENCLR;
+        host_spi0.INTENSET = spi_intenset | MARKER;
+        host_spi0.INTENCLR = MARKER;
+    }
+
+    if (WRITTEN(host_spi0.TXDATCTL)) {
+        uint32_t value = host_spi0.TXDATCTL;
+
+        host_spi0.TXCTRL = value & 0xffff0000;
+        host_spi0.TXDATCTL = MARKER;
+        spi_queue(value & 0xffff, value & 0xffff0000);
+    }
+
+    if (WRITTEN(host_spi0.TXDAT)) {
+        uint32_t value = host_spi0.TXDAT;
+
+        host_spi0.TXDAT = MARKER;
+        spi_queue(value & 0xffff, host_spi0.TXCTRL);
+    }
+
+    spi_set_stat();
+}
+
+
+// ****************************************************************************
+// Called while the firmware reads LPC_SPI0->RXDAT. Returns the index of the
+// RXDAT buffer that holds the byte received last.
+// ****************************************************************************
+unsigned int host_spi_rxdat_read(void)
+{
+    spi_stat &= ~SPI_STAT_RXRDY;
+
+    // Resume a stalled transfer
+    if (!spi.busy && spi.holding) {
+        spi_start_holding();
+    }
+
+    spi_set_stat();
+    return spi_rx_index;
+}
+
+
+// ****************************************************************************
+// USART0 (transmit only)
+// ****************************************************************************
+static uint64_t uart_byte_cycles(void)
+{
+    // 1 start bit, 8 data bits, 1 stop bit; 16x oversampling
+    uint64_t cycles;
+
+    cycles = 10 * 16 * (uint64_t)((host_usart0.BRG & 0xffff) + 1);
+    cycles *= host_syscon.UARTCLKDIV ? host_syscon.UARTCLKDIV : 1;
+    cycles = cycles * (256 + (host_syscon.UARTFRGMULT & 0xff)) / 256;
+    return cycles;
+}
+
+
+// ****************************************************************************
+static void uart_set_stat(void)
+{
+    uint32_t stat = host_usart0.STAT & ~(UART_STAT_TXRDY | UART_STAT_TXIDLE);
+
+    if (!uart.holding) {
+        stat |= UART_STAT_TXRDY;
+    }
+
+    if (!uart.busy && !uart.holding) {
+        stat |= UART_STAT_TXIDLE;
+    }
+
+    host_usart0.STAT = stat;
+    host_usart0.INTSTAT = stat & uart_intenset;
+}
+
+
+// ****************************************************************************
+static void uart_start(uint16_t data)
+{
+    uart.busy = true;
+    uart.data = data;
+    uart.done_at = host_cycles + uart_byte_cycles();
+}
+
+
+// ****************************************************************************
+static void uart_update(uint64_t until)
+{
+    while (uart.busy && uart.done_at <= until) {
+        ++host_stats.uart_bytes;
+        if (host_uart_output) {
+            fputc(uart.data & 0xff, host_uart_output);
+        }
+
+        uart.busy = false;
+        if (uart.holding) {
+            uart.holding = false;
+            uart_start(uart.holding_data);
+        }
+    }
+
+    uart_set_stat();
+}
+
+
+// ****************************************************************************
+static void sync_uart(void)
+{
+    if (WRITTEN(host_usart0.TXDATA)) {
+        uint16_t data = host_usart0.TXDATA & 0x1ff;
+
+        host_usart0.TXDATA = MARKER;
+        if (!uart.busy) {
+            uart_start(data);
+        }
+        else {
+            uart.holding = true;
+            uart.holding_data = data;
+        }
+    }
+
+    if (WRITTEN(host_usart0.INTENSET)) {
+        uart_intenset |= host_usart0.INTENSET;
+        host_usart0.INTENSET = uart_intenset | MARKER;
+    }
+
+    if (WRITTEN(host_usart0.INTENCLR)) {
+        uart_intenset &= ~host_usart0.INTENCLR;
+        host_usart0.INTENSET = uart_intenset | MARKER;
+        host_usart0.INTENCLR = MARKER;
+    }
+
+    uart_set_stat();
+}
+
+
+// ****************************************************************************
+// Windowed watchdog. We do not reset the firmware, but count timeouts and
+// keep track of the longest time between two feeds.
+// ****************************************************************************
+static uint64_t wwdt_timeout_cycles(void)
+{
+    static const uint32_t freqsel_khz[16] = {
+        0, 600, 1050, 1400, 1750, 2100, 2400, 2700,
+        3000, 3250, 3500, 3750, 4000, 4200, 4400, 4600
+    };
+    uint32_t khz = freqsel_khz[(host_syscon.WDTOSCCTRL >> 5) & 0xf];
+    uint32_t divider = 2 * (1 + (host_syscon.WDTOSCCTRL & 0x1f));
+
+    if (khz == 0) {
+        return NEVER;
+    }
+
+    // The watchdog counter is clocked with the watchdog oscillator / 4
+    return (uint64_t)host_wwdt.TC * 4 * divider * (__SYSTEM_CLOCK / 1000) / khz;
+}
+
+
+// ****************************************************************************
+// Idle skipping
+//
+// A main loop iteration that did not access any peripheral other than the
+// watchdog, and during which no interrupt was served, only polled flags in
+// RAM that are set by interrupt handlers. When two of those iterations
+// happened in a row, the firmware will keep looping like that until the
+// next peripheral event, so we jump there directly. This makes long soak
+// runs fast without changing what the firmware observes.
+// ****************************************************************************
+static uint64_t next_event(uint64_t limit);
+
+static void skip_idle_time(void)
+{
+    uint64_t next;
+
+    if (busy_since_feed) {
+        busy_since_feed = false;
+        idle_iterations = 0;
+        return;
+    }
+
+    if (!host_idle_skipping || ++idle_iterations < 2) {
+        return;
+    }
+
+    next = next_event(NEVER);
+    if (next == NEVER || next <= host_cycles) {
+        return;
+    }
+
+    ++host_stats.idle_skips;
+    host_stats.idle_cycles_skipped += next - host_cycles;
+    host_advance(next - host_cycles);
+
+    // The skipped time is not a watchdog gap; the firmware would have fed
+    // the watchdog all the time.
+    wwdt_last_feed = host_cycles;
+}
+
+
+// ****************************************************************************
+static void sync_wwdt(void)
+{
+    if (WRITTEN(host_wwdt.FEED)) {
+        uint32_t value = host_wwdt.FEED & 0xff;
+
+        host_wwdt.FEED = MARKER;
+
+        if (value == 0xaa) {
+            wwdt_feed_armed = true;
+        }
+        else if (value == 0x55 && wwdt_feed_armed) {
+            uint64_t gap = host_cycles - wwdt_last_feed;
+
+            if (gap > host_stats.longest_watchdog_gap && wwdt_last_feed) {
+                host_stats.longest_watchdog_gap = gap;
+            }
+            wwdt_last_feed = host_cycles;
+            wwdt_feed_armed = false;
+            ++host_stats.main_loop_iterations;
+
+            skip_idle_time();
+        }
+        else {
+            wwdt_feed_armed = false;
+        }
+    }
+}
+
+
+// ****************************************************************************
+static void wwdt_update(uint64_t until)
+{
+    if (!(host_wwdt.MOD & WWDT_MOD_WDEN) || !wwdt_last_feed) {
+        return;
+    }
+
+    if (until - wwdt_last_feed > wwdt_timeout_cycles()) {
+        ++host_stats.watchdog_timeouts;
+        wwdt_last_feed = until;
+    }
+}
+
+
+// ****************************************************************************
+// Flash programming (IAP). Only the persistent data pages are writable.
+// Returns the offset of *address* in the persistent data, or
+// PERSISTENT_DATA_SIZE when it is outside.
+// ****************************************************************************
+static unsigned int persistent_data_offset(unsigned int address)
+{
+    unsigned int offset = address - host_cpu_persistent_data();
+
+    return offset < PERSISTENT_DATA_SIZE ? offset : PERSISTENT_DATA_SIZE;
+}
+
+
+// ****************************************************************************
+void host_iap(unsigned int param[], unsigned int result[])
+{
+    uint8_t *flash = host_cpu_memory(host_cpu_persistent_data(), PERSISTENT_DATA_SIZE);
+    const uint8_t *source;
+    unsigned int command = param[0];
+    unsigned int offset;
+    unsigned int count;
+
+    switch (command) {
+        case IAP_PREPARE:
+            result[0] = IAP_CMD_SUCCESS;
+            break;
+
+        case IAP_ERASE_PAGE:
+            offset = persistent_data_offset(param[1] << 6);
+            if (offset >= PERSISTENT_DATA_SIZE) {
+                result[0] = IAP_DST_ADDR_ERROR;
+                break;
+            }
+            memset(&flash[offset], FLASH_ERASED_VALUE, PERSISTENT_PAGE_SIZE);
+            ++host_stats.flash_erases;
+            host_advance(FLASH_ERASE_CYCLES);
+            result[0] = IAP_CMD_SUCCESS;
+            break;
+
+        case IAP_COPY_RAM_TO_FLASH:
+            offset = persistent_data_offset(param[1]);
+            if (offset >= PERSISTENT_DATA_SIZE  ||  (offset % PERSISTENT_PAGE_SIZE)) {
+                result[0] = IAP_DST_ADDR_ERROR;
+                break;
+            }
+
+            count = param[3];
+            if (count > PERSISTENT_PAGE_SIZE) {
+                count = PERSISTENT_PAGE_SIZE;
+            }
+            source = host_cpu_memory(param[2], count);
+            if (!source) {
+                result[0] = IAP_DST_ADDR_ERROR;
+                break;
+            }
+            memcpy(&flash[offset], source, count);
+            ++host_stats.flash_writes;
+            host_advance(FLASH_PROGRAM_CYCLES);
+            result[0] = IAP_CMD_SUCCESS;
+            break;
+
+        case IAP_REINVOKE_ISP:
+            host_stop("ISP invoked");
+            break;
+
+        default:
+            result[0] = IAP_INVALID_COMMAND;
+            break;
+    }
+}
+
+
+// ****************************************************************************
+// Interrupts
+// ****************************************************************************
+static bool irq_pending(host_irq_t irq)
+{
+    switch (irq) {
+        case HOST_IRQ_SYSTICK:
+            return systick_pending;
+
+        case HOST_IRQ_SPI0:
+            return spi_stat & spi_intenset & 0x3f;
+
+        case HOST_IRQ_UART0:
+            return host_usart0.STAT & uart_intenset;
+
+        case HOST_IRQ_SCT:
+            return sct_evflag & host_sct.EVEN;
+
+        case HOST_IRQ_MRT:
+            return mrt_irq_pending();
+
+        case HOST_IRQ_PININT0:
+            return pin_int_ist & (1 << 0);
+
+        case HOST_NUMBER_OF_IRQS:
+        default:
+            return false;
+    }
+}
+
+
+// ****************************************************************************
+static void call_handler(host_irq_t irq)
+{
+    if (irq == HOST_IRQ_SYSTICK) {
+        systick_pending = false;
+    }
+
+    host_cpu_irq(irq);
+
+    // COUNTFLAG is cleared by reading SysTick->CTRL
+    if (irq == HOST_IRQ_SYSTICK) {
+        host_systick.CTRL &= ~SYSTICK_COUNTFLAG;
+    }
+}
+
+
+// ****************************************************************************
+static void sync_last_access(void);
+
+static void dispatch_interrupts(void)
+{
+    while (!primask && !interrupts_held) {
+        host_irq_t best = HOST_NUMBER_OF_IRQS;
+        unsigned int saved_priority;
+        uint64_t start;
+        int irq;
+
+        // Lower exception numbers win when priorities are equal. The
+        // host_irq_t enumeration is ordered by exception number.
+        for (irq = 0; irq < HOST_NUMBER_OF_IRQS; irq++) {
+            if (!irq_enabled[irq] || irq_priority[irq] >= active_priority) {
+                continue;
+            }
+            if (!irq_pending(irq)) {
+                continue;
+            }
+            if (best == HOST_NUMBER_OF_IRQS || irq_priority[irq] < irq_priority[best]) {
+                best = irq;
+            }
+        }
+
+        if (best == HOST_NUMBER_OF_IRQS) {
+            return;
+        }
+
+        saved_priority = active_priority;
+        active_priority = irq_priority[best];
+        start = host_cycles;
+        ++host_stats.irq_count[best];
+
+        busy_since_feed = true;
+        host_advance(IRQ_ENTRY_CYCLES);
+        call_handler(best);
+        sync_last_access();
+        host_advance(IRQ_EXIT_CYCLES);
+
+        host_stats.irq_cycles[best] += host_cycles - start;
+        active_priority = saved_priority;
+    }
+}
+
+
+// ****************************************************************************
+void host_enable_irq(void)
+{
+    primask = false;
+    dispatch_interrupts();
+}
+
+
+// ****************************************************************************
+void host_disable_irq(void)
+{
+    primask = true;
+}
+
+
+// ****************************************************************************
+uint32_t host_get_primask(void)
+{
+    return primask;
+}
+
+
+// ****************************************************************************
+void host_set_primask(uint32_t value)
+{
+    primask = value & 1;
+    if (!primask) {
+        dispatch_interrupts();
+    }
+}
+
+
+// ****************************************************************************
+void host_hold_interrupts(bool hold)
+{
+    interrupts_held = hold;
+}
+
+
+// ****************************************************************************
+static int irq_from_irqn(IRQn_Type irqn)
+{
+    if (irqn == SysTick_IRQn) {
+        return HOST_IRQ_SYSTICK;
+    }
+    if (irqn == SPI0_IRQn) {
+        return HOST_IRQ_SPI0;
+    }
+    if (irqn == UART0_IRQn) {
+        return HOST_IRQ_UART0;
+    }
+    if (irqn == SCT_IRQn) {
+        return HOST_IRQ_SCT;
+    }
+    if (irqn == MRT_IRQn) {
+        return HOST_IRQ_MRT;
+    }
+    if (irqn == PININT0_IRQn) {
+        return HOST_IRQ_PININT0;
+    }
+    return HOST_NUMBER_OF_IRQS;
+}
+
+
+// ****************************************************************************
+void host_nvic_enable_irq(IRQn_Type irqn)
+{
+    int irq = irq_from_irqn(irqn);
+
+    if (irq < HOST_NUMBER_OF_IRQS) {
+        irq_enabled[irq] = true;
+    }
+}
+
+
+// ****************************************************************************
+void host_nvic_disable_irq(IRQn_Type irqn)
+{
+    int irq = irq_from_irqn(irqn);
+
+    if (irq < HOST_NUMBER_OF_IRQS && irq != HOST_IRQ_SYSTICK) {
+        irq_enabled[irq] = false;
+    }
+}
+
+
+// ****************************************************************************
+void host_nvic_set_priority(IRQn_Type irqn, uint32_t priority)
+{
+    int irq = irq_from_irqn(irqn);
+
+    // The LPC81x implements 2 priority bits
+    if (irq < HOST_NUMBER_OF_IRQS) {
+        irq_priority[irq] = priority & 0x3;
+    }
+}
+
+
+// ****************************************************************************
+// Virtual clock
+// ****************************************************************************
+static uint64_t next_event(uint64_t limit)
+{
+    uint64_t next = limit;
+    int ch;
+
+    next = min64(next, systick_next);
+    next = min64(next, sct_next_event(SCT_COUNTER_L));
+    next = min64(next, sct_next_event(SCT_COUNTER_H));
+    for (ch = 0; ch < 4; ch++) {
+        next = min64(next, mrt_expiry[ch]);
+    }
+    if (spi.busy) {
+        next = min64(next, spi.done_at);
+    }
+    if (uart.busy) {
+        next = min64(next, uart.done_at);
+    }
+    if (timers) {
+        next = min64(next, timers->at);
+    }
+
+    return next;
+}
+
+
+// ****************************************************************************
+static void run_timers(void)
+{
+    while (timers && timers->at <= host_cycles) {
+        host_timer_t *timer = timers;
+
+        timers = timer->next;
+        timer->armed = false;
+        timer->callback(timer->context);
+    }
+}
+
+
+// ****************************************************************************
+void host_advance(uint64_t cycles)
+{
+    uint64_t target = host_cycles + cycles;
+
+    dispatch_interrupts();
+
+    while (host_cycles < target) {
+        uint64_t next = next_event(target);
+
+        if (next < host_cycles) {
+            next = host_cycles;
+        }
+        host_cycles = next;
+
+        systick_update(next);
+        sct_update(next);
+        mrt_update(next);
+        spi_update(next);
+        uart_update(next);
+        wwdt_update(next);
+        run_timers();
+
+        dispatch_interrupts();
+    }
+}
+
+
+// ****************************************************************************
+void host_timer_start(host_timer_t *timer, uint64_t at)
+{
+    host_timer_t **p;
+
+    host_timer_stop(timer);
+
+    timer->at = at;
+    timer->armed = true;
+
+    for (p = &timers; *p && (*p)->at <= at; p = &(*p)->next) {
+        ;
+    }
+    timer->next = *p;
+    *p = timer;
+}
+
+
+// ****************************************************************************
+void host_timer_stop(host_timer_t *timer)
+{
+    host_timer_t **p;
+
+    if (!timer->armed) {
+        return;
+    }
+
+    for (p = &timers; *p; p = &(*p)->next) {
+        if (*p == timer) {
+            *p = timer->next;
+            break;
+        }
+    }
+    timer->armed = false;
+}
+
+
+// ****************************************************************************
+// Register access
+// ****************************************************************************
+static void sync_peripheral(void *peripheral)
+{
+    if (peripheral == &host_gpio_port) {
+        sync_gpio();
+    }
+    else if (peripheral == &host_sct) {
+        sync_sct();
+    }
+    else if (peripheral == &host_spi0) {
+        sync_spi();
+    }
+    else if (peripheral == &host_usart0) {
+        sync_uart();
+    }
+    else if (peripheral == &host_mrt) {
+        sync_mrt();
+    }
+    else if (peripheral == &host_systick) {
+        sync_systick();
+    }
+    else if (peripheral == &host_pin_int) {
+        sync_pin_int();
+    }
+    else if (peripheral == &host_wwdt) {
+        sync_wwdt();
+    }
+    else if (peripheral == &host_swm) {
+        update_pins();
+    }
+}
+
+
+// ****************************************************************************
+static void sync_last_access(void)
+{
+    void *peripheral = last_access;
+
+    last_access = NULL;
+    sync_peripheral(peripheral);
+}
+
+
+// ****************************************************************************
+static void prepare_peripheral(void *peripheral)
+{
+    if (peripheral == &host_gpio_port) {
+        prepare_gpio();
+    }
+    else if (peripheral == &host_sct) {
+        sct_update(host_cycles);
+    }
+    else if (peripheral == &host_mrt) {
+        prepare_mrt();
+    }
+    else if (peripheral == &host_systick) {
+        prepare_systick();
+    }
+    else if (peripheral == &host_syscon) {
+        host_syscon.SYSPLLSTAT = 1;
+    }
+}
+
+
+// ****************************************************************************
+void *host_access(void *peripheral)
+{
+    sync_last_access();
+    host_advance(host_cycles_per_access);
+    prepare_peripheral(peripheral);
+
+    ++host_stats.accesses;
+    if (peripheral != &host_wwdt) {
+        busy_since_feed = true;
+    }
+    last_access = peripheral;
+    return peripheral;
+}
+
+
+// ****************************************************************************
+// Register access by the instruction set simulator. Unlike host_access()
+// it takes no time, as the simulator accounts for the instruction cycles,
+// and interrupts are only taken between instructions.
+// ****************************************************************************
+void *host_bus_access(void *peripheral)
+{
+    sync_last_access();
+    prepare_peripheral(peripheral);
+
+    ++host_stats.accesses;
+    if (peripheral != &host_wwdt) {
+        busy_since_feed = true;
+    }
+    last_access = peripheral;
+    return peripheral;
+}
+
+
+// ****************************************************************************
+// Processes a register write of the instruction set simulator right away
+// ****************************************************************************
+void host_bus_sync(void)
+{
+    sync_last_access();
+}
+
+
+// ****************************************************************************
+// Simulation control
+// ****************************************************************************
+void host_set_spi_device(const host_spi_device_t *device)
+{
+    spi_device = device;
+}
+
+
+// ****************************************************************************
+void host_add_pin_hook(host_pin_hook_t hook)
+{
+    if (number_of_pin_hooks < NUMBER_OF_PIN_HOOKS) {
+        pin_hooks[number_of_pin_hooks++] = hook;
+    }
+}
+
+
+// ****************************************************************************
+void host_set_input(unsigned int pin, bool level)
+{
+    if (level) {
+        input_levels |= (1 << pin);
+    }
+    else {
+        input_levels &= ~(1 << pin);
+    }
+    update_pins();
+}
+
+
+// ****************************************************************************
+bool host_get_pin(unsigned int pin)
+{
+    return (pin_levels >> pin) & 1;
+}
+
+
+// ****************************************************************************
+void host_write_persistent_data(unsigned int slot, const uint8_t *data, unsigned int count)
+{
+    uint8_t *flash = host_cpu_memory(host_cpu_persistent_data(), PERSISTENT_DATA_SIZE);
+    unsigned int offset = PERSISTENT_DATA_SIZE - PERSISTENT_PAGE_SIZE * (slot / 2 + 1) +
+        PERSISTENT_SLOT_SIZE * (slot % 2);
+    unsigned int i;
+
+    if (slot >= NUMBER_OF_BIND_SLOTS) {
+        return;
+    }
+    if (count > NUMBER_OF_PERSISTENT_ELEMENTS) {
+        count = NUMBER_OF_PERSISTENT_ELEMENTS;
+    }
+    memcpy(&flash[offset], data, count);
+
+    for (i = 0; i < 4; i++) {
+        flash[offset + PERSISTENT_SLOT_MAGIC_OFFSET + i] = (uint8_t)(PERSISTENT_SLOT_MAGIC >> (8 * i));
+    }
+}
+
+
+// ****************************************************************************
+void host_init(bool is8channel)
+{
+    int i;
+
+    host_cpu_init();
+
+    SET_RO(host_syscon.DEVICE_ID, is8channel ? DEVICE_ID_TSSOP20 : DEVICE_ID_TSSOP16);
+    host_syscon.SYSPLLSTAT = 1;
+
+    for (i = 0; i < 9; i++) {
+        host_swm.PINASSIGN[i] = 0xffffffff;
+    }
+    for (i = 0; i < 8; i++) {
+        host_syscon.PINTSEL[i] = 0xff;
+    }
+
+    host_sct.CTRL_L = SCT_CTRL_HALT;
+    host_sct.CTRL_H = SCT_CTRL_HALT;
+    host_sct.EVFLAG = MARKER;
+
+    host_pin_int.IST = MARKER;
+
+    for (i = 0; i < 4; i++) {
+        host_mrt.Channel[i].INTVAL = MARKER;
+        host_mrt.Channel[i].STAT = MARKER;
+    }
+
+    host_spi0.TXDAT = MARKER;
+    host_spi0.TXDATCTL = MARKER;
+    host_spi0.INTENSET = MARKER;
+    host_spi0.INTENCLR = MARKER;
+    spi_set_stat();
+
+    host_usart0.TXDATA = MARKER;
+    host_usart0.INTENSET = MARKER;
+    host_usart0.INTENCLR = MARKER;
+    uart_set_stat();
+
+    host_wwdt.FEED = MARKER;
+
+    // SysTick is an exception, it can not be disabled in the NVIC
+    irq_enabled[HOST_IRQ_SYSTICK] = true;
+
+    update_pins();
+}
+
+
+// ****************************************************************************
+static void stop_timer_callback(void *context)
+{
+    (void)context;
+    host_stop("time limit reached");
+}
+
+
+// ****************************************************************************
+const char *host_run(uint64_t duration)
+{
+    static host_timer_t stop_timer = {.callback = stop_timer_callback};
+
+    host_timer_start(&stop_timer, host_cycles + duration);
+
+    if (setjmp(run_exit) == 0) {
+        host_cpu_run();
+        stop_reason = "firmware returned from main()";
+    }
+
+    host_timer_stop(&stop_timer);
+    return stop_reason;
+}
+
+
+// ****************************************************************************
+void host_stop(const char *reason)
+{
+    stop_reason = reason;
+    longjmp(run_exit, 1);
+}
+
+
+// ****************************************************************************
+const char *host_irq_name(host_irq_t irq)
+{
+    return irq < HOST_NUMBER_OF_IRQS ? irq_names[irq] : "?";
+}
+
+
+// ****************************************************************************
+void host_report(FILE *f)
+{
+    double seconds = (double)host_cycles / __SYSTEM_CLOCK;
+    int i;
+
+    fprintf(f, "Virtual time:           %.3f s (%llu cycles)\n",
+        seconds, (unsigned long long)host_cycles);
+    fprintf(f, "Register accesses:      %llu\n",
+        (unsigned long long)host_stats.accesses);
+    fprintf(f, "Main loop iterations:   %llu\n",
+        (unsigned long long)host_stats.main_loop_iterations);
+    fprintf(f, "Idle skips:             %llu (%.3f s skipped)\n",
+        (unsigned long long)host_stats.idle_skips,
+        (double)host_stats.idle_cycles_skipped / __SYSTEM_CLOCK);
+    fprintf(f, "Longest watchdog gap:   %.3f ms\n",
+        (double)host_stats.longest_watchdog_gap * 1000 / __SYSTEM_CLOCK);
+    fprintf(f, "Watchdog timeouts:      %llu\n",
+        (unsigned long long)host_stats.watchdog_timeouts);
+    fprintf(f, "SPI transactions:       %llu\n",
+        (unsigned long long)host_stats.spi_transactions);
+    fprintf(f, "SPI bytes:              %llu\n",
+        (unsigned long long)host_stats.spi_bytes);
+    if (host_stats.spi_selected_cycles) {
+        fprintf(f, "SPI throughput:         %.2f bytes/us while selected (%.1f us per transaction)\n",
+            (double)host_stats.spi_bytes * HOST_CYCLES_PER_US / host_stats.spi_selected_cycles,
+            (double)host_stats.spi_selected_cycles / HOST_CYCLES_PER_US / host_stats.spi_transactions);
+    }
+    fprintf(f, "UART bytes:             %llu\n",
+        (unsigned long long)host_stats.uart_bytes);
+    fprintf(f, "Flash erases / writes:  %llu / %llu\n",
+        (unsigned long long)host_stats.flash_erases,
+        (unsigned long long)host_stats.flash_writes);
+
+    for (i = 0; i < CONFIG_SCT_nEV; i++) {
+        fprintf(f, "SCT EVENT[%d]:           %llu\n", i,
+            (unsigned long long)host_stats.sct_events[i]);
+    }
+
+    for (i = 0; i < HOST_NUMBER_OF_IRQS; i++) {
+        uint64_t count = host_stats.irq_count[i];
+
+        fprintf(f, "IRQ %-8s            %llu (%.1f cycles average)\n",
+            host_irq_name(i), (unsigned long long)count,
+            count ? (double)host_stats.irq_cycles[i] / count : 0.0);
+    }
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#define HOST_CYCLES_PER_US (__SYSTEM_CLOCK / 1000000)
+#define HOST_US(us) ((uint64_t)(us) * HOST_CYCLES_PER_US)
+#define HOST_MS(ms) ((uint64_t)(ms) * HOST_CYCLES_PER_US * 1000)
+
+#define HOST_NUMBER_OF_PINS 18
+
+
+typedef struct host_timer {
+    uint64_t at;
+    void (* callback)(void *context);
+    void *context;
+    bool armed;
+    struct host_timer *next;
+} host_timer_t;
+
+typedef struct {
+    // Called when SSEL (the nRF24 CSN) changes. selected is true when the
+    // chip select is asserted (low).
+    void (* select)(bool selected);
+
+    // Called when a byte has been shifted out. Returns the byte that was
+    // shifted in at the same time.
+    uint8_t (* exchange)(uint8_t mosi);
+} host_spi_device_t;
+
+typedef void (* host_pin_hook_t)(unsigned int pin, bool level);
+
+typedef enum {
+    HOST_IRQ_SYSTICK,
+    HOST_IRQ_SPI0,
+    HOST_IRQ_UART0,
+    HOST_IRQ_SCT,
+    HOST_IRQ_MRT,
+    HOST_IRQ_PININT0,
+    HOST_NUMBER_OF_IRQS
+} host_irq_t;
+
+typedef struct {
+    uint64_t accesses;
+    uint64_t main_loop_iterations;
+    uint64_t idle_skips;
+    uint64_t idle_cycles_skipped;
+    uint64_t spi_transactions;
+    uint64_t spi_bytes;
+    uint64_t spi_selected_cycles;
+    uint64_t uart_bytes;
+    uint64_t sct_events[8];
+    uint64_t irq_count[HOST_NUMBER_OF_IRQS];
+    uint64_t irq_cycles[HOST_NUMBER_OF_IRQS];
+    uint64_t longest_watchdog_gap;
+    uint64_t watchdog_timeouts;
+    uint64_t flash_erases;
+    uint64_t flash_writes;
+} host_stats_t;
+
+
+extern uint64_t host_cycles;
+extern unsigned int host_cycles_per_access;
+extern bool host_idle_skipping;
+extern host_stats_t host_stats;
+extern FILE *host_uart_output;
+
+
+void host_init(bool is8channel);
+void host_advance(uint64_t cycles);
+
+// Runs the firmware for the given number of cycles, or until host_stop() is
+// called. Returns the reason why the run ended.
+const char *host_run(uint64_t duration);
+void host_stop(const char *reason);
+
+void host_timer_start(host_timer_t *timer, uint64_t at);
+void host_timer_stop(host_timer_t *timer);
+
+void host_set_spi_device(const host_spi_device_t *device);
+void host_add_pin_hook(host_pin_hook_t hook);
+void host_set_input(unsigned int pin, bool level);
+bool host_get_pin(unsigned int pin);
+
+// Holds back all interrupts while *hold* is true, as a long critical
+// section of the firmware would
+void host_hold_interrupts(bool hold);
+
+// Writes the bind data of one model into bind slot *slot*
+void host_write_persistent_data(unsigned int slot, const uint8_t *data, unsigned int count);
+
+const char *host_irq_name(host_irq_t irq);
+void host_report(FILE *f);
+
+
+// Flash programming model, called through the IAP entry point
+void host_iap(unsigned int param[], unsigned int result[]);
+
+// Register access of the instruction set simulator, see hal.c
+void *host_bus_access(void *peripheral);
+void host_bus_sync(void);
+
+
+// ****************************************************************************
+// The processor running the firmware: firmware.c (the firmware compiled for
+// the host) or iss.c (instruction set simulator running the firmware image).
+// Each program links one of them.
+// ****************************************************************************
+extern const char *host_cpu_name;
+
+// Called by host_init()
+void host_cpu_init(void);
+
+// Loads the firmware image; NULL selects the default
+bool host_cpu_load(const char *image);
+
+// Runs the firmware from reset. Returns if main() returns.
+void host_cpu_run(void);
+
+// Runs the interrupt handler to completion
+void host_cpu_irq(host_irq_t irq);
+
+// Host memory backing the given target address range, NULL if none
+uint8_t *host_cpu_memory(uint32_t address, uint32_t size);
+
+// Target address of the persistent data (bind data) in flash
+uint32_t host_cpu_persistent_data(void);
+
+void host_cpu_report(FILE *f);
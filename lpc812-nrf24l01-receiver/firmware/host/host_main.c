@@ -0,0 +1,1100 @@
+/******************************************************************************
+
+    Runs the receiver firmware on the host, using the register models in
+    hal.c, and prints statistics about what the firmware did.
+
+    Usage: receiver-host [options]
+
+        -8          Simulate the 8-channel hardware (DEVICE_ID 0x8122)
+        -t ms       Virtual run time in milliseconds (default 10000)
+        -b hex      Preload the bind data in flash (26 bytes as hex string)
+        -u file     Write the UART output of the firmware to file ('-': stdout)
+        -c cycles   Cost of a register access in CPU cycles (default 4)
+        -v          Print LED and servo output changes as they happen
+        -T file     Write a binary event trace (see trace.h)
+        -M mask     Record types to write into the trace (default: all)
+        -I          Do not skip idle main loop iterations
+        -x image    Firmware image (Intel HEX) for receiver-iss (default:
+                    receiver.hex)
+        -E file     Write the servo output edges to file: time in cycles,
+                    pin and level, one edge per line
+
+    Transmitter options:
+
+        -P protocol Transmitter protocol: 3, 4, 8 or 'none' (default: 4, or
+                    8 with -8)
+        -s seed     Seed for the bind data and the loss model (default 1)
+        -a ms       Switch the transmitter on after the given time
+        -d ppm      Crystal error of the transmitter
+        -g p,r,good,bad
+                    Gilbert-Elliott burst loss: probabilities to enter and
+                    leave the bad state, and to lose a packet in each state
+        -w ch=shape[:center[:amplitude[:period]]]
+                    Stick trajectory of channel 1..8, shape is const, sine,
+                    square or ramp; values in +/-10000, period in ms
+        -o start:length[:period]
+                    Switch the transmitter off for length ms at start ms,
+                    optionally repeated every period ms
+        -B ms       Press the bind button at the given time for 200 ms
+        -R ms[:period]
+                    Brown-out of the nRF24 at the given time, optionally
+                    repeated every period ms: it loses its configuration
+                    while the LPC812 keeps running
+        -L start:length[:period]
+                    Hold back all interrupts of the firmware for length ms
+                    at start ms, optionally repeated every period ms, like
+                    a long critical section
+        -n          Do not preload the bind data of the transmitter (the
+                    receiver has to be bound with -B)
+        -S slot     Preload the bind data of the transmitter into the given
+                    bind slot (default 0) and fill the slots below it with
+                    other models, so that the receiver has to find the
+                    transmitter at power-up
+
+    Many cars on one track (see medium.c):
+
+        -N cars     Simulate the given number of transmitter/receiver pairs
+                    and print packet loss and failsafe statistics per car.
+                    Every car has its own bind data derived from the seed.
+                    UART output, -v and the trace only cover car 1.
+        -j jobs     Number of worker processes (default: number of CPUs)
+
+    Failsafe is detected like a human would: the LED, which is on steadily
+    while packets are received, starts blinking. Resync time is the time
+    from the end of a transmitter outage to the first received packet,
+    brown-out recovery the time from a brown-out of the nRF24 to the first
+    received packet.
+
+******************************************************************************/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <platform.h>
+#include <persistent_storage.h>
+
+#include "hal.h"
+#include "medium.h"
+#include "nrf24.h"
+#include "trace.h"
+#include "transmitter.h"
+
+
+#define DEFAULT_RUN_TIME_MS 10000
+
+// The LED blinks with 320 ms in failsafe, and is on steadily while receiving
+#define LED_STEADY_TIME HOST_MS(400)
+
+#define BIND_BUTTON_PRESS_TIME HOST_MS(200)
+
+// Received packets further apart than this belong to different trains
+#define PACKET_TRAIN_GAP HOST_MS(2)
+
+// Packet to pulse latencies are counted in 1 ms bins, longer ones than
+// LATENCY_BINS - 1 ms in the last bin
+#define LATENCY_BINS 16
+
+// Servo supply model for the rail sag report: every servo draws
+// SERVO_DRIVE_CURRENT_MA for SERVO_DRIVE_TIME from the rising edge of its
+// pulse, from a BEC with an output resistance of SERVO_SUPPLY_MOHM
+#define SERVO_DRIVE_TIME HOST_MS(2)
+#define SERVO_DRIVE_CURRENT_MA 1000
+#define SERVO_SUPPLY_MOHM 200
+
+
+typedef struct {
+    unsigned int pin;
+    uint64_t rising;
+    uint64_t pulses;
+    uint64_t width_min;
+    uint64_t width_max;
+    uint64_t width_sum;
+    uint64_t width_last;
+    uint64_t step_max;
+    uint64_t period_min;
+    uint64_t period_max;
+    uint64_t drive_until;
+} servo_output_t;
+
+
+static bool simulate_8channel;
+static bool verbose;
+static unsigned int led_pin;
+static uint64_t led_changes;
+static uint64_t last_led_change;
+
+static host_timer_t led_timer;
+static bool led_steady;
+static bool in_failsafe;
+static uint64_t failsafe_since;
+static uint64_t failsafe_cycles;
+static uint64_t first_lock;
+static uint64_t last_packet_received;
+static uint64_t failsafe_entries;
+static uint64_t time_to_failsafe_min = UINT64_MAX;
+static uint64_t time_to_failsafe_max;
+static uint64_t time_to_failsafe_sum;
+
+static transmitter_t transmitter;
+static transmitter_t *own_transmitter = &transmitter;
+static bool transmitter_enabled = true;
+static transmitter_config_t tx_config;
+static bool preload_tx_bind_data = true;
+static unsigned int preload_slot;
+static uint64_t own_outcomes[NRF24_NUMBER_OF_OUTCOMES];
+static bool own_received;
+static uint64_t longest_gap;
+static uint64_t resyncs;
+static uint64_t resync_time_min = UINT64_MAX;
+static uint64_t resync_time_max;
+static uint64_t resync_time_sum;
+
+static host_timer_t bind_button_timer;
+static int64_t bind_button_ms = -1;
+
+static host_timer_t brown_out_timer;
+static const char *brown_out;
+static uint64_t brown_out_period;
+static uint64_t last_brown_out;
+static uint64_t recoveries;
+static uint64_t recovery_time_min = UINT64_MAX;
+static uint64_t recovery_time_max;
+static uint64_t recovery_time_sum;
+
+static uint64_t fresh_packet;
+static uint64_t latencies;
+static uint64_t latency_min = UINT64_MAX;
+static uint64_t latency_max;
+static uint64_t latency_sum;
+static uint64_t latency_histogram[LATENCY_BINS];
+
+static host_timer_t lockout_timer;
+static const char *lockout;
+static uint64_t lockout_length;
+static uint64_t lockout_period;
+static bool locked_out;
+
+static unsigned int number_of_cars = 1;
+static bool check_medium;
+static uint64_t run_time_ms = DEFAULT_RUN_TIME_MS;
+static const char *bind_data;
+static const char *trace_filename;
+static const char *image;
+static const char *edge_filename;
+static FILE *edge_file;
+
+static servo_output_t servo_outputs[NUMBER_OF_CHANNELS];
+static unsigned int number_of_servo_outputs;
+static uint64_t drive_cycles[NUMBER_OF_CHANNELS + 1];
+static uint64_t drive_accounted;
+static unsigned int drive_peak;
+static uint32_t trace_mask = 0xffffffff;
+
+
+// ****************************************************************************
+static void usage(const char *name)
+{
+    fprintf(stderr,
+        "Usage: %s [-8] [-t ms] [-b hex] [-u file] [-c cycles] [-v] "
+        "[-T file] [-M mask] [-I] [-x image] [-E file]\n"
+        "       [-P protocol] [-s seed] [-a ms] [-d ppm] [-g p,r,good,bad] "
+        "[-w ch=shape[:center[:amplitude[:period]]]] [-o start:length[:period]] "
+        "[-B ms] [-R ms[:period]] [-L start:length[:period]] [-n] [-S slot] [-N cars] [-j jobs] [-C]\n", name);
+    exit(1);
+}
+
+
+// ****************************************************************************
+static void led_steady_timeout(void *context)
+{
+    (void)context;
+
+    led_steady = true;
+
+    // The servos are not driven until the receiver locks on for the first
+    // time, so that counts as failsafe time too
+    if (!first_lock) {
+        first_lock = host_cycles - LED_STEADY_TIME;
+        failsafe_cycles += first_lock;
+    }
+
+    if (in_failsafe) {
+        in_failsafe = false;
+        // The LED came on LED_STEADY_TIME ago
+        failsafe_cycles += host_cycles - LED_STEADY_TIME - failsafe_since;
+        trace_record(TRACE_FAILSAFE_END, 0, 0);
+    }
+}
+
+
+// ****************************************************************************
+static void led_changed(bool on)
+{
+    ++led_changes;
+    last_led_change = host_cycles;
+
+    if (on) {
+        host_timer_start(&led_timer, host_cycles + LED_STEADY_TIME);
+        return;
+    }
+
+    host_timer_stop(&led_timer);
+
+    // The LED was on steadily and starts blinking: failsafe
+    if (led_steady && !in_failsafe) {
+        uint64_t delay = host_cycles - last_packet_received;
+        uint64_t delay_ms = delay / HOST_MS(1);
+
+        in_failsafe = true;
+        failsafe_since = host_cycles;
+        ++failsafe_entries;
+        time_to_failsafe_sum += delay;
+        if (delay < time_to_failsafe_min) {
+            time_to_failsafe_min = delay;
+        }
+        if (delay > time_to_failsafe_max) {
+            time_to_failsafe_max = delay;
+        }
+        trace_record(TRACE_FAILSAFE, 0, delay_ms > 0xffff ? 0xffff : delay_ms);
+    }
+    led_steady = false;
+}
+
+
+// ****************************************************************************
+static void packet_ended(const nrf24_packet_t *packet, nrf24_outcome_t outcome)
+{
+    uint64_t outage_end;
+
+    // Other cars put their packets on air as well. The packets before the
+    // receiver first picks up its transmitter are lost while it searches;
+    // that time is accounted as failsafe time, so they are not counted.
+    if (transmitter_enabled &&
+            memcmp(packet->address, own_transmitter->config.address, TRANSMITTER_ADDRESS_WIDTH) == 0) {
+        if (outcome == NRF24_RECEIVED && !own_received) {
+            own_received = true;
+            memset(own_outcomes, 0, sizeof(own_outcomes));
+        }
+        ++own_outcomes[outcome];
+    }
+
+    if (outcome != NRF24_RECEIVED) {
+        return;
+    }
+
+    if (last_packet_received && host_cycles - last_packet_received > longest_gap) {
+        longest_gap = host_cycles - last_packet_received;
+    }
+
+    // First packet after the transmitter came back on
+    outage_end = transmitter_last_outage_end(own_transmitter);
+    if (transmitter_enabled && outage_end && last_packet_received < outage_end) {
+        uint64_t delay = host_cycles - outage_end;
+
+        ++resyncs;
+        resync_time_sum += delay;
+        if (delay < resync_time_min) {
+            resync_time_min = delay;
+        }
+        if (delay > resync_time_max) {
+            resync_time_max = delay;
+        }
+    }
+
+    // First packet after the nRF24 lost its configuration
+    if (last_brown_out && last_packet_received < last_brown_out) {
+        uint64_t delay = host_cycles - last_brown_out;
+
+        ++recoveries;
+        recovery_time_sum += delay;
+        if (delay < recovery_time_min) {
+            recovery_time_min = delay;
+        }
+        if (delay > recovery_time_max) {
+            recovery_time_max = delay;
+        }
+    }
+
+    // First packet of a train: new stick data that waits for the next pulse
+    if (!last_packet_received || host_cycles - last_packet_received > PACKET_TRAIN_GAP) {
+        fresh_packet = host_cycles;
+    }
+
+    last_packet_received = host_cycles;
+}
+
+
+// ****************************************************************************
+static void brown_out_expired(void *context)
+{
+    (void)context;
+
+    nrf24_brown_out();
+    last_brown_out = host_cycles;
+    if (brown_out_period) {
+        host_timer_start(&brown_out_timer, host_cycles + brown_out_period);
+    }
+}
+
+
+// ****************************************************************************
+static void lockout_changed(void *context)
+{
+    (void)context;
+
+    locked_out = !locked_out;
+    host_hold_interrupts(locked_out);
+    if (locked_out) {
+        host_timer_start(&lockout_timer, host_cycles + lockout_length);
+    }
+    else if (lockout_period > lockout_length) {
+        host_timer_start(&lockout_timer, host_cycles + lockout_period - lockout_length);
+    }
+}
+
+
+// ****************************************************************************
+static void bind_button_changed(void *context)
+{
+    (void)context;
+
+    // The button is active low: press it, and release it again later
+    if (host_get_pin(GPIO_BIT_BIND)) {
+        host_set_input(GPIO_BIT_BIND, false);
+        host_timer_start(&bind_button_timer, host_cycles + BIND_BUTTON_PRESS_TIME);
+    }
+    else {
+        host_set_input(GPIO_BIT_BIND, true);
+    }
+}
+
+
+// ****************************************************************************
+// Packet to pulse latency: from the end of the first packet of a train to
+// the next rising edge of CH1. A train that is followed by the next one
+// before a pulse starts is not counted, as its data never goes out. A pulse
+// that starts while the firmware still decodes the packet is counted,
+// although it carries the previous data.
+// ****************************************************************************
+static void record_latency(uint64_t latency)
+{
+    uint64_t bin = latency / HOST_MS(1);
+
+    ++latencies;
+    latency_sum += latency;
+    if (latency < latency_min) {
+        latency_min = latency;
+    }
+    if (latency > latency_max) {
+        latency_max = latency;
+    }
+    ++latency_histogram[bin < LATENCY_BINS ? bin : LATENCY_BINS - 1];
+}
+
+
+// ****************************************************************************
+static void report_latency(FILE *f)
+{
+    unsigned int i;
+
+    if (!latencies) {
+        return;
+    }
+
+    fprintf(f, "Packet to pulse:        %.2f / %.2f / %.2f ms (min / avg / max, %llu)\n",
+        (double)latency_min / HOST_MS(1),
+        (double)latency_sum / latencies / HOST_MS(1),
+        (double)latency_max / HOST_MS(1),
+        (unsigned long long)latencies);
+    for (i = 0; i < LATENCY_BINS; i++) {
+        char label[32];
+
+        if (!latency_histogram[i]) {
+            continue;
+        }
+        if (i < LATENCY_BINS - 1) {
+            snprintf(label, sizeof(label), "%u-%u ms:", i, i + 1);
+        }
+        else {
+            snprintf(label, sizeof(label), "%u ms or more:", i);
+        }
+        fprintf(f, "  %-21s %5.1f %%\n", label,
+            100.0 * latency_histogram[i] / latencies);
+    }
+}
+
+
+// ****************************************************************************
+// Accounts the time up to now to the number of drive strokes of the supply
+// model that were running, stroke end by stroke end
+// ****************************************************************************
+static void account_drive_strokes(void)
+{
+    while (drive_accounted < host_cycles) {
+        uint64_t next = host_cycles;
+        unsigned int running = 0;
+        unsigned int i;
+
+        for (i = 0; i < number_of_servo_outputs; i++) {
+            uint64_t end = servo_outputs[i].drive_until;
+
+            if (end > drive_accounted) {
+                ++running;
+                if (end < next) {
+                    next = end;
+                }
+            }
+        }
+        drive_cycles[running] += next - drive_accounted;
+        drive_accounted = next;
+    }
+}
+
+
+// ****************************************************************************
+static void start_drive_stroke(servo_output_t *output)
+{
+    unsigned int running = 0;
+    unsigned int i;
+
+    account_drive_strokes();
+    output->drive_until = host_cycles + SERVO_DRIVE_TIME;
+    for (i = 0; i < number_of_servo_outputs; i++) {
+        if (servo_outputs[i].drive_until > host_cycles) {
+            ++running;
+        }
+    }
+    if (running > drive_peak) {
+        drive_peak = running;
+    }
+}
+
+
+// ****************************************************************************
+static void report_servo_supply(FILE *f)
+{
+    unsigned int i;
+
+    if (!drive_peak) {
+        return;
+    }
+    account_drive_strokes();
+
+    fprintf(f, "Servo supply:           peak %u servo%s driving at once: %.1f A, %u mV sag\n",
+        drive_peak, drive_peak > 1 ? "s" : "",
+        drive_peak * SERVO_DRIVE_CURRENT_MA / 1000.0,
+        drive_peak * SERVO_DRIVE_CURRENT_MA * SERVO_SUPPLY_MOHM / 1000);
+    fprintf(f, "                        (%u mA for %.1f ms per pulse, %u mOhm)\n",
+        SERVO_DRIVE_CURRENT_MA, (double)SERVO_DRIVE_TIME / HOST_MS(1),
+        SERVO_SUPPLY_MOHM);
+    for (i = 0; i <= drive_peak; i++) {
+        fprintf(f, "  %u servo%s driving:      %5.1f %% of the time\n",
+            i, i != 1 ? "s" : " ", 100.0 * drive_cycles[i] / host_cycles);
+    }
+}
+
+
+// ****************************************************************************
+// Pulse width and period of the servo outputs, measured from rising edge
+// to falling edge and from rising edge to rising edge
+// ****************************************************************************
+static void servo_edge(servo_output_t *output, bool level)
+{
+    uint64_t width;
+    uint64_t period;
+
+    if (edge_file) {
+        fprintf(edge_file, "%llu %u %u\n", (unsigned long long)host_cycles,
+            output->pin, level);
+    }
+
+    if (level) {
+        if (output == &servo_outputs[0] && fresh_packet) {
+            record_latency(host_cycles - fresh_packet);
+            fresh_packet = 0;
+        }
+        start_drive_stroke(output);
+        if (output->rising) {
+            period = host_cycles - output->rising;
+            if (!output->period_min || period < output->period_min) {
+                output->period_min = period;
+            }
+            if (period > output->period_max) {
+                output->period_max = period;
+            }
+        }
+        output->rising = host_cycles;
+        return;
+    }
+
+    if (!output->rising) {
+        return;
+    }
+
+    width = host_cycles - output->rising;
+    if (!output->pulses || width < output->width_min) {
+        output->width_min = width;
+    }
+    if (width > output->width_max) {
+        output->width_max = width;
+    }
+    output->width_sum += width;
+    if (output->pulses) {
+        uint64_t step = width > output->width_last ?
+            width - output->width_last : output->width_last - width;
+
+        if (step > output->step_max) {
+            output->step_max = step;
+        }
+    }
+    output->width_last = width;
+    ++output->pulses;
+}
+
+
+// ****************************************************************************
+static void init_servo_outputs(void)
+{
+    static const unsigned int pins_4ch[] = {
+        GPIO_4CH_BIT_CH1, GPIO_4CH_BIT_CH2, GPIO_4CH_BIT_CH3, GPIO_4CH_BIT_CH4
+    };
+    static const unsigned int pins_8ch[] = {
+        GPIO_8CH_BIT_CH1, GPIO_8CH_BIT_CH2, GPIO_8CH_BIT_CH3, GPIO_8CH_BIT_CH4,
+        GPIO_8CH_BIT_CH5, GPIO_8CH_BIT_CH6, GPIO_8CH_BIT_CH7, GPIO_8CH_BIT_CH8
+    };
+    const unsigned int *pins = simulate_8channel ? pins_8ch : pins_4ch;
+    unsigned int i;
+
+    number_of_servo_outputs = simulate_8channel ? 8 : 4;
+    for (i = 0; i < number_of_servo_outputs; i++) {
+        servo_outputs[i].pin = pins[i];
+    }
+}
+
+
+// ****************************************************************************
+static void report_servo_outputs(FILE *f)
+{
+    unsigned int i;
+
+    fprintf(f, "Servo pulses (us):     pulses     min   average       max  jitter    step  period min / max\n");
+
+    for (i = 0; i < number_of_servo_outputs; i++) {
+        const servo_output_t *output = &servo_outputs[i];
+
+        if (!output->pulses) {
+            fprintf(f, "  CH%u (pin %2u)          none\n", i + 1, output->pin);
+            continue;
+        }
+        fprintf(f, "  CH%u (pin %2u)    %10llu  %6.2f  %8.3f  %8.2f  %6.2f  %6.2f  %.2f / %.2f ms\n",
+            i + 1, output->pin, (unsigned long long)output->pulses,
+            (double)output->width_min / HOST_CYCLES_PER_US,
+            (double)output->width_sum / output->pulses / HOST_CYCLES_PER_US,
+            (double)output->width_max / HOST_CYCLES_PER_US,
+            (double)(output->width_max - output->width_min) / HOST_CYCLES_PER_US,
+            (double)output->step_max / HOST_CYCLES_PER_US,
+            (double)output->period_min / HOST_MS(1),
+            (double)output->period_max / HOST_MS(1));
+    }
+}
+
+
+// ****************************************************************************
+static void pin_changed(unsigned int pin, bool level)
+{
+    unsigned int i;
+
+    if (pin == led_pin) {
+        // The LED is active low
+        led_changed(!level);
+    }
+
+    for (i = 0; i < number_of_servo_outputs; i++) {
+        if (servo_outputs[i].pin == pin) {
+            servo_edge(&servo_outputs[i], level);
+        }
+    }
+
+    if (verbose) {
+        printf("%12.6f pin %2u %s%s\n", (double)host_cycles / __SYSTEM_CLOCK,
+            pin, level ? "high" : "low", pin == led_pin ? " (LED)" : "");
+    }
+}
+
+
+// ****************************************************************************
+static void parse_bind_data(const char *hex)
+{
+    uint8_t data[NUMBER_OF_PERSISTENT_ELEMENTS];
+    unsigned int count = 0;
+
+    memset(data, 0xff, sizeof(data));
+
+    while (hex[0] && hex[1] && count < NUMBER_OF_PERSISTENT_ELEMENTS) {
+        char byte[3] = {hex[0], hex[1], '\0'};
+
+        data[count++] = (uint8_t)strtoul(byte, NULL, 16);
+        hex += 2;
+    }
+
+    host_write_persistent_data(0, data, sizeof(data));
+}
+
+
+// ****************************************************************************
+static void parse_loss_model(gilbert_elliott_t *loss, const char *text)
+{
+    char *end;
+
+    loss->p = strtod(text, &end);
+    if (*end == ',') {
+        loss->r = strtod(end + 1, &end);
+    }
+    if (*end == ',') {
+        loss->loss_good = strtod(end + 1, &end);
+    }
+    if (*end == ',') {
+        loss->loss_bad = strtod(end + 1, &end);
+    }
+}
+
+
+// ****************************************************************************
+static void parse_outage(transmitter_config_t *config, const char *text)
+{
+    char *end;
+
+    config->outage_start = HOST_MS(strtoull(text, &end, 0));
+    if (*end == ':') {
+        config->outage_length = HOST_MS(strtoull(end + 1, &end, 0));
+    }
+    if (*end == ':') {
+        config->outage_period = HOST_MS(strtoull(end + 1, &end, 0));
+    }
+}
+
+
+// ****************************************************************************
+static bool open_edge_file(void)
+{
+    edge_file = fopen(edge_filename, "w");
+    if (!edge_file) {
+        perror(edge_filename);
+        return false;
+    }
+    return true;
+}
+
+
+// ****************************************************************************
+static void start_simulation(unsigned int car)
+{
+    uint8_t data[NUMBER_OF_PERSISTENT_ELEMENTS];
+
+    led_pin = simulate_8channel ? GPIO_8CH_BIT_LED : GPIO_4CH_BIT_LED;
+    led_timer.callback = led_steady_timeout;
+    init_servo_outputs();
+
+    host_init(simulate_8channel);
+    if (!host_cpu_load(image)) {
+        exit(1);
+    }
+    if (bind_data) {
+        parse_bind_data(bind_data);
+    }
+
+    if (transmitter_enabled) {
+        if (number_of_cars > 1) {
+            own_transmitter = medium_create_transmitters(&tx_config, number_of_cars, car,
+                bind_button_ms >= 0 || !preload_tx_bind_data);
+        }
+        else {
+            transmitter_init(&transmitter, &tx_config);
+        }
+
+        if (!bind_data && preload_tx_bind_data) {
+            unsigned int slot;
+
+            // Models bound to the receiver but switched off
+            for (slot = 0; slot < preload_slot; slot++) {
+                transmitter_config_t other;
+
+                transmitter_default_config(&other, tx_config.protocol, tx_config.seed + 100 + slot);
+                memset(data, 0xff, sizeof(data));
+                memcpy(data, other.address, TRANSMITTER_ADDRESS_WIDTH);
+                memcpy(data + TRANSMITTER_ADDRESS_WIDTH, other.hop, TRANSMITTER_NUMBER_OF_HOP_CHANNELS);
+                data[TRANSMITTER_BIND_DATA_SIZE - 1] = (uint8_t)other.protocol;
+                host_write_persistent_data(slot, data, sizeof(data));
+            }
+
+            memset(data, 0xff, sizeof(data));
+            transmitter_get_bind_data(own_transmitter, data);
+            host_write_persistent_data(preload_slot, data, sizeof(data));
+        }
+    }
+
+    if (bind_button_ms >= 0) {
+        bind_button_timer.callback = bind_button_changed;
+        host_timer_start(&bind_button_timer, HOST_MS(bind_button_ms));
+    }
+    host_add_pin_hook(pin_changed);
+
+    if (simulate_8channel) {
+        nrf24_init(GPIO_8CH_BIT_NRF_CE, GPIO_8CH_BIT_NRF_IRQ);
+    }
+    else {
+        nrf24_init(GPIO_4CH_BIT_NRF_CE, GPIO_4CH_BIT_NRF_IRQ);
+    }
+    nrf24_set_rx_hook(packet_ended);
+
+    if (brown_out) {
+        char *end;
+        uint64_t at = HOST_MS(strtoull(brown_out, &end, 0));
+
+        if (*end == ':') {
+            brown_out_period = HOST_MS(strtoull(end + 1, NULL, 0));
+        }
+        brown_out_timer.callback = brown_out_expired;
+        host_timer_start(&brown_out_timer, at);
+    }
+
+    if (lockout) {
+        char *end;
+        uint64_t at = HOST_MS(strtoull(lockout, &end, 0));
+
+        if (*end == ':') {
+            lockout_length = HOST_MS(strtoull(end + 1, &end, 0));
+        }
+        if (*end == ':') {
+            lockout_period = HOST_MS(strtoull(end + 1, &end, 0));
+        }
+        lockout_timer.callback = lockout_changed;
+        host_timer_start(&lockout_timer, at);
+    }
+}
+
+
+// ****************************************************************************
+// Runs in a worker process when simulating many cars
+// ****************************************************************************
+static void run_car(unsigned int car, medium_car_result_t *result)
+{
+    if (car != 0) {
+        host_uart_output = NULL;
+        verbose = false;
+    }
+    else {
+        if (trace_filename && !trace_open(trace_filename, trace_mask)) {
+            exit(1);
+        }
+        if (edge_filename && !open_edge_file()) {
+            exit(1);
+        }
+    }
+
+    start_simulation(car);
+    host_run(HOST_MS(run_time_ms));
+
+    if (in_failsafe) {
+        failsafe_cycles += host_cycles - failsafe_since;
+    }
+    else if (!first_lock) {
+        failsafe_cycles = host_cycles;
+    }
+
+    result->first_hop = own_transmitter->config.hop[0];
+    result->drift_ppm = own_transmitter->config.drift_ppm;
+    memcpy(result->outcomes, own_outcomes, sizeof(result->outcomes));
+    result->failsafe_entries = failsafe_entries;
+    result->failsafe_cycles = failsafe_cycles;
+    result->locked = first_lock != 0;
+    result->longest_gap = longest_gap;
+
+    trace_close();
+    if (edge_file) {
+        fclose(edge_file);
+    }
+}
+
+
+// ****************************************************************************
+int main(int argc, char *argv[])
+{
+    const char *reason;
+    uint64_t hops;
+    const char *protocol = NULL;
+    const char *loss_model = NULL;
+    const char *outage = NULL;
+    const char *trajectories[TRANSMITTER_NUMBER_OF_CHANNELS] = {NULL};
+    uint64_t seed = 1;
+    uint64_t tx_start_ms = 0;
+    int32_t drift_ppm = 0;
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned int channel;
+    int i;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "8t:b:u:c:vT:M:Ix:E:P:s:a:d:g:w:o:B:R:L:nS:N:j:C")) != -1) {
+        switch (opt) {
+            case '8':
+                simulate_8channel = true;
+                break;
+
+            case 't':
+                run_time_ms = strtoull(optarg, NULL, 0);
+                break;
+
+            case 'b':
+                bind_data = optarg;
+                break;
+
+            case 'u':
+                if (strcmp(optarg, "-") == 0) {
+                    host_uart_output = stdout;
+                }
+                else {
+                    host_uart_output = fopen(optarg, "wb");
+                    if (!host_uart_output) {
+                        perror(optarg);
+                        return 1;
+                    }
+                }
+                break;
+
+            case 'c':
+                host_cycles_per_access = strtoul(optarg, NULL, 0);
+                break;
+
+            case 'v':
+                verbose = true;
+                break;
+
+            case 'T':
+                trace_filename = optarg;
+                break;
+
+            case 'M':
+                trace_mask = strtoul(optarg, NULL, 16);
+                break;
+
+            case 'I':
+                host_idle_skipping = false;
+                break;
+
+            case 'x':
+                image = optarg;
+                break;
+
+            case 'E':
+                edge_filename = optarg;
+                break;
+
+            case 'P':
+                protocol = optarg;
+                break;
+
+            case 's':
+                seed = strtoull(optarg, NULL, 0);
+                break;
+
+            case 'a':
+                tx_start_ms = strtoull(optarg, NULL, 0);
+                break;
+
+            case 'd':
+                drift_ppm = strtol(optarg, NULL, 0);
+                break;
+
+            case 'g':
+                loss_model = optarg;
+                break;
+
+            case 'w':
+                channel = strtoul(optarg, NULL, 0);
+                if (channel < 1 || channel > TRANSMITTER_NUMBER_OF_CHANNELS ||
+                        !strchr(optarg, '=')) {
+                    usage(argv[0]);
+                }
+                trajectories[channel - 1] = strchr(optarg, '=') + 1;
+                break;
+
+            case 'o':
+                outage = optarg;
+                break;
+
+            case 'B':
+                bind_button_ms = strtoll(optarg, NULL, 0);
+                break;
+
+            case 'R':
+                brown_out = optarg;
+                break;
+
+            case 'L':
+                lockout = optarg;
+                break;
+
+            case 'n':
+                preload_tx_bind_data = false;
+                break;
+
+            case 'S':
+                preload_slot = strtoul(optarg, NULL, 0);
+                if (preload_slot >= NUMBER_OF_BIND_SLOTS) {
+                    fprintf(stderr, "Bind slot must be below %u\n", NUMBER_OF_BIND_SLOTS);
+                    return 1;
+                }
+                break;
+
+            case 'N':
+                number_of_cars = strtoul(optarg, NULL, 0);
+                if (number_of_cars < 1 || number_of_cars > MEDIUM_MAX_CARS) {
+                    fprintf(stderr, "Between 1 and %u cars\n", MEDIUM_MAX_CARS);
+                    return 1;
+                }
+                break;
+
+            case 'j':
+                jobs = strtol(optarg, NULL, 0);
+                break;
+
+            case 'C':
+                check_medium = true;
+                break;
+
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if (!protocol) {
+        protocol = simulate_8channel ? "8" : "4";
+    }
+    if (strcmp(protocol, "none") == 0) {
+        transmitter_enabled = false;
+    }
+    else {
+        unsigned int number_of_channels = strtoul(protocol, NULL, 0);
+
+        if (number_of_channels == 3) {
+            transmitter_default_config(&tx_config, PROTOCOL_3CH, seed);
+        }
+        else if (number_of_channels == 4) {
+            transmitter_default_config(&tx_config, PROTOCOL_4CH, seed);
+        }
+        else if (number_of_channels == 8) {
+            transmitter_default_config(&tx_config, PROTOCOL_8CH, seed);
+        }
+        else {
+            usage(argv[0]);
+        }
+
+        tx_config.start = HOST_MS(tx_start_ms);
+        tx_config.drift_ppm = drift_ppm;
+        if (loss_model) {
+            parse_loss_model(&tx_config.loss, loss_model);
+        }
+        if (outage) {
+            parse_outage(&tx_config, outage);
+        }
+        for (i = 0; i < TRANSMITTER_NUMBER_OF_CHANNELS; i++) {
+            if (trajectories[i] &&
+                    !transmitter_parse_trajectory(&tx_config.sticks[i], trajectories[i])) {
+                fprintf(stderr, "Invalid trajectory '%s'\n", trajectories[i]);
+                return 1;
+            }
+        }
+    }
+
+    if (check_medium) {
+        return medium_check(stdout) ? 0 : 1;
+    }
+
+    if (number_of_cars > 1) {
+        static medium_car_result_t results[MEDIUM_MAX_CARS];
+        bool success;
+
+        success = medium_run(number_of_cars, jobs > 0 ? jobs : 1, run_car, results);
+        medium_report(stdout, results, number_of_cars, HOST_MS(run_time_ms));
+        return success ? 0 : 1;
+    }
+
+    if (trace_filename && !trace_open(trace_filename, trace_mask)) {
+        return 1;
+    }
+    if (edge_filename && !open_edge_file()) {
+        return 1;
+    }
+
+    start_simulation(0);
+
+    reason = host_run(HOST_MS(run_time_ms));
+
+    printf("Run ended: %s\n", reason);
+    printf("Processor:              %s\n", host_cpu_name);
+    host_report(stdout);
+    host_cpu_report(stdout);
+    nrf24_report(stdout);
+    if (transmitter_enabled) {
+        transmitter_report(own_transmitter, stdout);
+    }
+
+    // Counted in the nRF24 model, so that it works for any firmware image
+    hops = nrf24_stats.channel_writes;
+    printf("Hops:                   %llu\n", (unsigned long long)hops);
+    if (hops) {
+        printf("SPI bytes per hop:      %.1f\n",
+            (double)host_stats.spi_bytes / hops);
+        printf("SPI transactions / hop: %.1f\n",
+            (double)host_stats.spi_transactions / hops);
+    }
+    printf("LED changes:            %llu (last at %.3f s)\n",
+        (unsigned long long)led_changes,
+        (double)last_led_change / __SYSTEM_CLOCK);
+    if (first_lock) {
+        printf("First lock:             %.3f s\n", (double)first_lock / __SYSTEM_CLOCK);
+    }
+    else {
+        printf("First lock:             never\n");
+    }
+    printf("Failsafe entries:       %llu\n", (unsigned long long)failsafe_entries);
+    if (failsafe_entries) {
+        printf("Time to failsafe:       %.1f / %.1f / %.1f ms (min / avg / max)\n",
+            (double)time_to_failsafe_min / HOST_MS(1),
+            (double)time_to_failsafe_sum / failsafe_entries / HOST_MS(1),
+            (double)time_to_failsafe_max / HOST_MS(1));
+    }
+    if (resyncs) {
+        printf("Resync time:            %.1f / %.1f / %.1f ms (min / avg / max, %llu)\n",
+            (double)resync_time_min / HOST_MS(1),
+            (double)resync_time_sum / resyncs / HOST_MS(1),
+            (double)resync_time_max / HOST_MS(1),
+            (unsigned long long)resyncs);
+    }
+
+    if (recoveries) {
+        printf("Brown-out recovery:     %.1f / %.1f / %.1f ms (min / avg / max, %llu)\n",
+            (double)recovery_time_min / HOST_MS(1),
+            (double)recovery_time_sum / recoveries / HOST_MS(1),
+            (double)recovery_time_max / HOST_MS(1),
+            (unsigned long long)recoveries);
+    }
+
+    report_latency(stdout);
+    report_servo_outputs(stdout);
+    report_servo_supply(stdout);
+
+    trace_close();
+    if (edge_file) {
+        fclose(edge_file);
+    }
+
+    if (host_uart_output && host_uart_output != stdout) {
+        fclose(host_uart_output);
+    }
+
+    return 0;
+}
@@ -0,0 +1,1564 @@
+/******************************************************************************
+
+    The processor of receiver-iss: an instruction set simulator for the
+    Cortex-M0+ (ARMv6-M, Thumb) that runs the firmware image built for the
+    LPC812, e.g. receiver.hex, on the register models in hal.c.
+
+    Unlike receiver-host this runs exactly the code the compiler generated
+    for the target, and every instruction takes the number of cycles the
+    Cortex-M0+ needs for it. This gives cycle-exact execution times of the
+    interrupt handlers and the main loop, and servo pulse timing that
+    includes the latencies of the firmware.
+
+    Memory map
+    ----------
+    0x00000000  16 KB flash (the image; the persistent data page is written
+                through the IAP model in hal.c)
+    0x10000000  4 KB RAM
+    0x1fff1ff1  IAP entry point in the boot ROM, trapped
+    0x40000000  APB peripherals, 0x50000000 CRC and SCT, 0xa0000000 GPIO
+                and pin interrupts: the host_xxx registers of hal.c
+    0xe000e000  SysTick, NVIC and SCB registers the firmware uses
+
+    Accesses to other addresses, unaligned accesses and undefined
+    instructions stop the simulation with a HardFault message.
+
+    Timing
+    ------
+    Instruction cycles as documented for the Cortex-M0+ with zero wait state
+    flash (main.c sets FLASHCFG to 0): 1 for most instructions, 2 for loads,
+    stores and taken branches, 1 + N for LDM/STM/PUSH/POP, 3 for BL, MSR,
+    MRS and barriers. GPIO is on the single cycle I/O port. Exception entry
+    and exit are accounted for by hal.c.
+
+    The virtual clock advances after every instruction, so interrupts are
+    taken between instructions like on the real processor.
+
+******************************************************************************/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <LPC8xx.h>
+#include <persistent_storage.h>
+
+#include "hal.h"
+
+// The simulator accesses RXDAT directly
+#undef RXDAT
+
+
+#define DEFAULT_IMAGE "receiver.hex"
+
+#define FLASH_BASE 0x00000000
+#define FLASH_SIZE 0x4000
+#define RAM_BASE 0x10000000
+#define RAM_SIZE 0x1000
+#define IAP_ENTRY_ADDRESS 0x1fff1ff0
+#define IOPORT_BASE 0xa0000000
+#define IOPORT_SIZE 0x4000
+#define PERSISTENT_DATA_ADDRESS (FLASH_BASE + FLASH_SIZE - PERSISTENT_DATA_SIZE)
+
+#define PERIPHERAL_WINDOW 0x4000
+#define SYSTICK_BASE 0xe000e010
+#define NVIC_ISER 0xe000e100
+#define NVIC_ICER 0xe000e180
+#define NVIC_ISPR 0xe000e200
+#define NVIC_ICPR 0xe000e280
+#define NVIC_IPR 0xe000e400
+#define NVIC_NUMBER_OF_IRQS 32
+#define SCB_CPUID 0xe000ed00
+#define SCB_ICSR 0xe000ed04
+#define SCB_VTOR 0xe000ed08
+#define SCB_AIRCR 0xe000ed0c
+#define SCB_CCR 0xe000ed14
+#define SCB_SHPR2 0xe000ed1c
+#define SCB_SHPR3 0xe000ed20
+#define SCS_BASE 0xe000e000
+#define SCS_SIZE 0x1000
+
+#define CPUID_CORTEX_M0PLUS 0x410cc601
+#define CCR_STKALIGN (1 << 9)
+#define AIRCR_VECTKEY 0x05fa0000
+#define AIRCR_SYSRESETREQ (1 << 2)
+
+#define SP 13
+#define LR 14
+#define PC 15
+
+#define XPSR_N (1u << 31)
+#define XPSR_Z (1 << 30)
+#define XPSR_C (1 << 29)
+#define XPSR_V (1 << 28)
+#define XPSR_FRAME_ALIGNED (1 << 9)
+#define XPSR_T (1 << 24)
+
+#define EXC_RETURN_HANDLER 0xfffffff1
+#define EXC_RETURN_THREAD 0xfffffff9
+
+#define SYSTICK_EXCEPTION 15
+#define IRQ_EXCEPTION(irqn) (16 + (irqn))
+
+#define NUMBER_OF_IAP_PARAMS 5
+#define NUMBER_OF_IAP_RESULTS 4
+
+
+typedef struct {
+    uint32_t base;
+    uint32_t window;
+    void *registers;
+    uint32_t size;
+} peripheral_t;
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+} cycle_stats_t;
+
+
+const char *host_cpu_name = "instruction set simulator";
+
+static const peripheral_t peripherals[] = {
+    {0x40000000, PERIPHERAL_WINDOW, &host_wwdt, sizeof(host_wwdt)},
+    {0x40004000, PERIPHERAL_WINDOW, &host_mrt, sizeof(host_mrt)},
+    {0x40008000, PERIPHERAL_WINDOW, &host_wkt, sizeof(host_wkt)},
+    {0x4000c000, PERIPHERAL_WINDOW, &host_swm, sizeof(host_swm)},
+    {0x40020000, PERIPHERAL_WINDOW, &host_pmu, sizeof(host_pmu)},
+    {0x40024000, PERIPHERAL_WINDOW, &host_cmp, sizeof(host_cmp)},
+    {0x40040000, PERIPHERAL_WINDOW, &host_flashctrl, sizeof(host_flashctrl)},
+    {0x40044000, PERIPHERAL_WINDOW, &host_iocon, sizeof(host_iocon)},
+    {0x40048000, PERIPHERAL_WINDOW, &host_syscon, sizeof(host_syscon)},
+    {0x40050000, PERIPHERAL_WINDOW, &host_i2c, sizeof(host_i2c)},
+    {0x40058000, PERIPHERAL_WINDOW, &host_spi0, sizeof(host_spi0)},
+    {0x4005c000, PERIPHERAL_WINDOW, &host_spi1, sizeof(host_spi1)},
+    {0x40064000, PERIPHERAL_WINDOW, &host_usart0, sizeof(host_usart0)},
+    {0x40068000, PERIPHERAL_WINDOW, &host_usart1, sizeof(host_usart1)},
+    {0x4006c000, PERIPHERAL_WINDOW, &host_usart2, sizeof(host_usart2)},
+    {0x50000000, PERIPHERAL_WINDOW, &host_crc, sizeof(host_crc)},
+    {0x50004000, PERIPHERAL_WINDOW, &host_sct, sizeof(host_sct)},
+    {0xa0000000, PERIPHERAL_WINDOW, &host_gpio_port, sizeof(host_gpio_port)},
+    {0xa0004000, PERIPHERAL_WINDOW, &host_pin_int, sizeof(host_pin_int)},
+    {SYSTICK_BASE, sizeof(host_systick), &host_systick, sizeof(host_systick)},
+};
+
+// Exception numbers of the host_irq_t interrupts
+static const unsigned int exception_numbers[HOST_NUMBER_OF_IRQS] = {
+    SYSTICK_EXCEPTION,
+    IRQ_EXCEPTION(SPI0_IRQn),
+    IRQ_EXCEPTION(UART0_IRQn),
+    IRQ_EXCEPTION(SCT_IRQn),
+    IRQ_EXCEPTION(MRT_IRQn),
+    IRQ_EXCEPTION(PININT0_IRQn),
+};
+
+static uint8_t flash[FLASH_SIZE];
+static uint8_t ram[RAM_SIZE];
+static bool image_loaded;
+
+static uint32_t r[16];
+static bool flag_n;
+static bool flag_z;
+static bool flag_c;
+static bool flag_v;
+static bool primask;
+static unsigned int ipsr;
+
+// Set while executing an instruction
+static uint32_t next_pc;
+static bool exception_return;
+static bool peripheral_written;
+static bool enable_irq_pending;
+
+static uint32_t nvic_enabled;
+static uint8_t nvic_priority[NVIC_NUMBER_OF_IRQS];
+static uint32_t shpr2;
+static uint32_t shpr3;
+static uint32_t vtor;
+
+static char fault_message[160];
+
+static uint64_t instructions;
+static uint64_t thread_cycles;
+static uint64_t *cycle_counter = &thread_cycles;
+static uint64_t iteration_start;
+static uint64_t last_main_loop_iterations;
+static cycle_stats_t main_loop_stats;
+static cycle_stats_t handler_stats[HOST_NUMBER_OF_IRQS];
+
+
+// ****************************************************************************
+static void fault(const char *what, uint32_t address)
+{
+    snprintf(fault_message, sizeof(fault_message),
+        "HardFault: %s 0x%08x (pc 0x%08x)", what, address, r[PC] - 4);
+    host_stop(fault_message);
+}
+
+
+// ****************************************************************************
+static void add_cycle_sample(cycle_stats_t *stats, uint64_t cycles)
+{
+    if (stats->count == 0 || cycles < stats->min) {
+        stats->min = cycles;
+    }
+    if (cycles > stats->max) {
+        stats->max = cycles;
+    }
+    stats->sum += cycles;
+    ++stats->count;
+}
+
+
+// ****************************************************************************
+// Intel HEX image
+// ****************************************************************************
+static int hex_byte(const char *text)
+{
+    char byte[3] = {text[0], text[1], '\0'};
+
+    if (!isxdigit((unsigned char)text[0]) || !isxdigit((unsigned char)text[1])) {
+        return -1;
+    }
+    return (int)strtoul(byte, NULL, 16);
+}
+
+
+// ****************************************************************************
+static bool load_hex(const char *filename)
+{
+    char line[600];
+    uint32_t base = 0;
+    unsigned int line_number = 0;
+    FILE *f;
+
+    f = fopen(filename, "r");
+    if (!f) {
+        perror(filename);
+        return false;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        uint8_t record[260];
+        unsigned int length;
+        unsigned int i;
+        uint8_t checksum = 0;
+        uint32_t address;
+
+        ++line_number;
+        if (line[0] != ':') {
+            continue;
+        }
+
+        for (i = 0; i < sizeof(record); i++) {
+            int byte = hex_byte(&line[1 + 2 * i]);
+
+            if (byte < 0) {
+                break;
+            }
+            record[i] = (uint8_t)byte;
+            checksum += record[i];
+        }
+        length = i;
+
+        if (length < 5 || length != record[0] + 5u || checksum != 0) {
+            fprintf(stderr, "%s:%u: invalid record\n", filename, line_number);
+            fclose(f);
+            return false;
+        }
+
+        address = base + ((uint32_t)record[1] << 8) + record[2];
+
+        switch (record[3]) {
+            case 0x00:
+                if (address - FLASH_BASE > FLASH_SIZE - (uint32_t)record[0]) {
+                    fprintf(stderr, "%s:%u: data outside of the flash\n", filename, line_number);
+                    fclose(f);
+                    return false;
+                }
+                memcpy(&flash[address - FLASH_BASE], &record[4], record[0]);
+                break;
+
+            case 0x01:
+                fclose(f);
+                return true;
+
+            case 0x02:
+                base = (((uint32_t)record[4] << 8) + record[5]) << 4;
+                break;
+
+            case 0x04:
+                base = (((uint32_t)record[4] << 8) + record[5]) << 16;
+                break;
+
+            default:
+                // Start addresses: we start from the reset vector
+                break;
+        }
+    }
+
+    fclose(f);
+    return true;
+}
+
+
+// ****************************************************************************
+// Bus
+// ****************************************************************************
+static const peripheral_t *find_peripheral(uint32_t address)
+{
+    unsigned int i;
+
+    for (i = 0; i < sizeof(peripherals) / sizeof(peripherals[0]); i++) {
+        if (address - peripherals[i].base < peripherals[i].window) {
+            return &peripherals[i];
+        }
+    }
+    return NULL;
+}
+
+
+// ****************************************************************************
+// Offset into the host register structure. The host SPI structure has a
+// double buffered RXDAT (see LPC8xx.h), which moves the registers after it.
+// Returns false for registers without backing memory.
+// ****************************************************************************
+static bool register_offset(const peripheral_t *p, uint32_t address, bool read, uint32_t *offset)
+{
+    *offset = address - p->base;
+
+    if (p->registers == &host_spi0 || p->registers == &host_spi1) {
+        if (*offset >= 0x14 && *offset < 0x18) {
+            if (!read || p->registers != &host_spi0) {
+                return false;
+            }
+            *offset += 4 * host_spi_rxdat_read();
+        }
+        else if (*offset >= 0x18) {
+            *offset += 4;
+        }
+    }
+
+    return *offset < p->size;
+}
+
+
+// ****************************************************************************
+static uint32_t scs_read(uint32_t address)
+{
+    if (address >= NVIC_IPR && address < NVIC_IPR + NVIC_NUMBER_OF_IRQS) {
+        uint32_t value;
+
+        memcpy(&value, &nvic_priority[address - NVIC_IPR], sizeof(value));
+        return value;
+    }
+
+    switch (address) {
+        case NVIC_ISER:
+        case NVIC_ICER:
+            return nvic_enabled;
+
+        case SCB_CPUID:
+            return CPUID_CORTEX_M0PLUS;
+
+        case SCB_ICSR:
+            return ipsr;
+
+        case SCB_VTOR:
+            return vtor;
+
+        case SCB_AIRCR:
+            return 0xfa050000;
+
+        case SCB_CCR:
+            return CCR_STKALIGN;
+
+        case SCB_SHPR2:
+            return shpr2;
+
+        case SCB_SHPR3:
+            return shpr3;
+
+        default:
+            return 0;
+    }
+}
+
+
+// ****************************************************************************
+static void scs_write(uint32_t address, uint32_t value, unsigned int size)
+{
+    unsigned int i;
+
+    // The priority registers are byte accessible
+    if (address >= NVIC_IPR && address < NVIC_IPR + NVIC_NUMBER_OF_IRQS) {
+        for (i = 0; i < size; i++) {
+            unsigned int irqn = address - NVIC_IPR + i;
+
+            nvic_priority[irqn] = (uint8_t)(value >> (8 * i)) & 0xc0;
+            host_nvic_set_priority((IRQn_Type)irqn, nvic_priority[irqn] >> 6);
+        }
+        return;
+    }
+
+    if (size != 4) {
+        fault("sub-word access to system control space", address);
+    }
+
+    switch (address) {
+        case NVIC_ISER:
+            for (i = 0; i < NVIC_NUMBER_OF_IRQS; i++) {
+                if (value & (1u << i)) {
+                    host_nvic_enable_irq((IRQn_Type)i);
+                }
+            }
+            nvic_enabled |= value;
+            break;
+
+        case NVIC_ICER:
+            for (i = 0; i < NVIC_NUMBER_OF_IRQS; i++) {
+                if (value & (1u << i)) {
+                    host_nvic_disable_irq((IRQn_Type)i);
+                }
+            }
+            nvic_enabled &= ~value;
+            break;
+
+        case SCB_VTOR:
+            vtor = value & 0xffffff80;
+            break;
+
+        case SCB_AIRCR:
+            if ((value & 0xffff0000) == AIRCR_VECTKEY && (value & AIRCR_SYSRESETREQ)) {
+                host_stop("system reset requested");
+            }
+            break;
+
+        case SCB_SHPR2:
+            shpr2 = value & 0xc0000000;
+            break;
+
+        case SCB_SHPR3:
+            shpr3 = value & 0xc0c00000;
+            host_nvic_set_priority(SysTick_IRQn, shpr3 >> 30);
+            break;
+
+        default:
+            // NVIC pending registers, SCR, ...: no effect on the models
+            break;
+    }
+}
+
+
+// ****************************************************************************
+static uint8_t *memory(uint32_t address, uint32_t size)
+{
+    if (address - FLASH_BASE < FLASH_SIZE && size <= FLASH_BASE + FLASH_SIZE - address) {
+        return &flash[address - FLASH_BASE];
+    }
+    if (address - RAM_BASE < RAM_SIZE && size <= RAM_BASE + RAM_SIZE - address) {
+        return &ram[address - RAM_BASE];
+    }
+    return NULL;
+}
+
+
+// ****************************************************************************
+static uint32_t read_memory(uint32_t address, unsigned int size)
+{
+    const peripheral_t *p;
+    uint32_t value = 0;
+    uint32_t offset;
+    uint8_t *m;
+
+    if (address & (size - 1)) {
+        fault("unaligned read at", address);
+    }
+
+    m = memory(address, size);
+    if (m) {
+        memcpy(&value, m, size);
+        return value;
+    }
+
+    p = find_peripheral(address);
+    if (p) {
+        host_bus_access(p->registers);
+        if (register_offset(p, address, true, &offset)) {
+            memcpy(&value, (uint8_t *)p->registers + offset, size);
+        }
+        return value;
+    }
+
+    if (address - SCS_BASE < SCS_SIZE) {
+        return scs_read(address & ~3u) >> (8 * (address & 3));
+    }
+
+    fault("read from unmapped address", address);
+    return 0;
+}
+
+
+// ****************************************************************************
+static void write_memory(uint32_t address, uint32_t value, unsigned int size)
+{
+    const peripheral_t *p;
+    uint32_t offset;
+
+    if (address & (size - 1)) {
+        fault("unaligned write at", address);
+    }
+
+    if (address - RAM_BASE < RAM_SIZE) {
+        memcpy(&ram[address - RAM_BASE], &value, size);
+        return;
+    }
+
+    p = find_peripheral(address);
+    if (p) {
+        host_bus_access(p->registers);
+        if (getenv("ISSDBG")) fprintf(stderr, "%llu W %08x %08x pc %08x\n", (unsigned long long)host_cycles, address, value, r[PC]-4);
+        if (register_offset(p, address, false, &offset)) {
+            memcpy((uint8_t *)p->registers + offset, &value, size);
+        }
+        peripheral_written = true;
+        return;
+    }
+
+    if (address - SCS_BASE < SCS_SIZE) {
+        scs_write(address, value, size);
+        return;
+    }
+
+    fault("write to read-only or unmapped address", address);
+}
+
+
+// ****************************************************************************
+// Load and store cycles: 2, or 1 on the single cycle I/O port
+// ****************************************************************************
+static unsigned int access_cycles(uint32_t address)
+{
+    return address - IOPORT_BASE < IOPORT_SIZE ? 1 : 2;
+}
+
+
+// ****************************************************************************
+// Registers and flags
+// ****************************************************************************
+static uint32_t get_xpsr(void)
+{
+    return (flag_n ? XPSR_N : 0) | (flag_z ? XPSR_Z : 0) |
+        (flag_c ? XPSR_C : 0) | (flag_v ? XPSR_V : 0) | XPSR_T | ipsr;
+}
+
+
+// ****************************************************************************
+static void set_xpsr(uint32_t xpsr)
+{
+    flag_n = xpsr & XPSR_N;
+    flag_z = xpsr & XPSR_Z;
+    flag_c = xpsr & XPSR_C;
+    flag_v = xpsr & XPSR_V;
+    ipsr = xpsr & 0x3f;
+}
+
+
+// ****************************************************************************
+static void set_nz(uint32_t result)
+{
+    flag_n = result >> 31;
+    flag_z = result == 0;
+}
+
+
+// ****************************************************************************
+static uint32_t add_with_carry(uint32_t a, uint32_t b, bool carry)
+{
+    uint64_t unsigned_sum = (uint64_t)a + b + carry;
+    int64_t signed_sum = (int64_t)(int32_t)a + (int32_t)b + carry;
+    uint32_t result = (uint32_t)unsigned_sum;
+
+    set_nz(result);
+    flag_c = unsigned_sum >> 32;
+    flag_v = (int64_t)(int32_t)result != signed_sum;
+    return result;
+}
+
+
+// ****************************************************************************
+// Shifts by a register (amount 0..255) as done by the data processing
+// instructions; immediate shifts are converted to the same semantics.
+// ****************************************************************************
+static uint32_t shift_left(uint32_t value, unsigned int amount)
+{
+    if (amount == 0) {
+        return value;
+    }
+    flag_c = amount <= 32 ? (value >> (32 - amount)) & 1 : 0;
+    return amount < 32 ? value << amount : 0;
+}
+
+
+// ****************************************************************************
+static uint32_t shift_right(uint32_t value, unsigned int amount)
+{
+    if (amount == 0) {
+        return value;
+    }
+    flag_c = amount <= 32 ? (value >> (amount - 1)) & 1 : 0;
+    return amount < 32 ? value >> amount : 0;
+}
+
+
+// ****************************************************************************
+static uint32_t arithmetic_shift_right(uint32_t value, unsigned int amount)
+{
+    if (amount == 0) {
+        return value;
+    }
+    if (amount >= 32) {
+        flag_c = value >> 31;
+        return (value >> 31) ? 0xffffffff : 0;
+    }
+    flag_c = (value >> (amount - 1)) & 1;
+    return (uint32_t)((int32_t)value >> amount);
+}
+
+
+// ****************************************************************************
+static uint32_t rotate_right(uint32_t value, unsigned int amount)
+{
+    if (amount == 0) {
+        return value;
+    }
+    amount &= 31;
+    if (amount) {
+        value = (value >> amount) | (value << (32 - amount));
+    }
+    flag_c = value >> 31;
+    return value;
+}
+
+
+// ****************************************************************************
+// CPSID and MSR PRIMASK take effect right away; after CPSIE pending
+// interrupts are taken once the instruction completed.
+// ****************************************************************************
+static void set_primask(bool disabled)
+{
+    primask = disabled;
+    if (primask) {
+        host_disable_irq();
+    }
+    else {
+        enable_irq_pending = true;
+    }
+}
+
+
+// ****************************************************************************
+// BX, BLX and POP: bit 0 selects Thumb state, EXC_RETURN ends the handler
+// ****************************************************************************
+static void bx_write_pc(uint32_t address)
+{
+    if (ipsr && (address & 0xf0000000) == 0xf0000000) {
+        if (address != EXC_RETURN_HANDLER && address != EXC_RETURN_THREAD) {
+            fault("unsupported EXC_RETURN", address);
+        }
+        exception_return = true;
+        next_pc = address;
+        return;
+    }
+
+    if (!(address & 1)) {
+        fault("branch to ARM state at", address);
+    }
+    next_pc = address & ~1u;
+}
+
+
+// ****************************************************************************
+// Instruction execution. Each function returns the number of cycles.
+// ****************************************************************************
+static unsigned int shift_add_subtract_move_compare(uint16_t op)
+{
+    unsigned int rd = op & 7;
+    unsigned int rn = (op >> 3) & 7;
+    unsigned int imm5 = (op >> 6) & 0x1f;
+    unsigned int rd8 = (op >> 8) & 7;
+    uint32_t imm8 = op & 0xff;
+
+    switch (op >> 11) {
+        case 0x00:      // LSLS Rd, Rm, #imm5
+            r[rd] = shift_left(r[rn], imm5);
+            set_nz(r[rd]);
+            break;
+
+        case 0x01:      // LSRS Rd, Rm, #imm5
+            r[rd] = shift_right(r[rn], imm5 ? imm5 : 32);
+            set_nz(r[rd]);
+            break;
+
+        case 0x02:      // ASRS Rd, Rm, #imm5
+            r[rd] = arithmetic_shift_right(r[rn], imm5 ? imm5 : 32);
+            set_nz(r[rd]);
+            break;
+
+        case 0x03: {
+            uint32_t operand = (op & (1 << 10)) ? (op >> 6) & 7 : r[(op >> 6) & 7];
+
+            if (op & (1 << 9)) {    // SUBS Rd, Rn, Rm / #imm3
+                r[rd] = add_with_carry(r[rn], ~operand, true);
+            }
+            else {                  // ADDS Rd, Rn, Rm / #imm3
+                r[rd] = add_with_carry(r[rn], operand, false);
+            }
+            break;
+        }
+
+        case 0x04:      // MOVS Rd, #imm8
+            r[rd8] = imm8;
+            set_nz(imm8);
+            break;
+
+        case 0x05:      // CMP Rn, #imm8
+            add_with_carry(r[rd8], ~imm8, true);
+            break;
+
+        case 0x06:      // ADDS Rdn, #imm8
+            r[rd8] = add_with_carry(r[rd8], imm8, false);
+            break;
+
+        case 0x07:      // SUBS Rdn, #imm8
+        default:
+            r[rd8] = add_with_carry(r[rd8], ~imm8, true);
+            break;
+    }
+
+    return 1;
+}
+
+
+// ****************************************************************************
+static unsigned int data_processing(uint16_t op)
+{
+    unsigned int rdn = op & 7;
+    uint32_t a = r[rdn];
+    uint32_t b = r[(op >> 3) & 7];
+    uint32_t result;
+
+    switch ((op >> 6) & 0xf) {
+        case 0x0:   // ANDS
+            r[rdn] = result = a & b;
+            set_nz(result);
+            break;
+
+        case 0x1:   // EORS
+            r[rdn] = result = a ^ b;
+            set_nz(result);
+            break;
+
+        case 0x2:   // LSLS
+            r[rdn] = result = shift_left(a, b & 0xff);
+            set_nz(result);
+            break;
+
+        case 0x3:   // LSRS
+            r[rdn] = result = shift_right(a, b & 0xff);
+            set_nz(result);
+            break;
+
+        case 0x4:   // ASRS
+            r[rdn] = result = arithmetic_shift_right(a, b & 0xff);
+            set_nz(result);
+            break;
+
+        case 0x5:   // ADCS
+            r[rdn] = add_with_carry(a, b, flag_c);
+            break;
+
+        case 0x6:   // SBCS
+            r[rdn] = add_with_carry(a, ~b, flag_c);
+            break;
+
+        case 0x7:   // RORS
+            r[rdn] = result = rotate_right(a, b & 0xff);
+            set_nz(result);
+            break;
+
+        case 0x8:   // TST
+            set_nz(a & b);
+            break;
+
+        case 0x9:   // RSBS Rd, Rn, #0
+            r[rdn] = add_with_carry(~b, 0, true);
+            break;
+
+        case 0xa:   // CMP
+            add_with_carry(a, ~b, true);
+            break;
+
+        case 0xb:   // CMN
+            add_with_carry(a, b, false);
+            break;
+
+        case 0xc:   // ORRS
+            r[rdn] = result = a | b;
+            set_nz(result);
+            break;
+
+        case 0xd:   // MULS
+            r[rdn] = result = a * b;
+            set_nz(result);
+            break;
+
+        case 0xe:   // BICS
+            r[rdn] = result = a & ~b;
+            set_nz(result);
+            break;
+
+        case 0xf:   // MVNS
+        default:
+            r[rdn] = result = ~b;
+            set_nz(result);
+            break;
+    }
+
+    return 1;
+}
+
+
+// ****************************************************************************
+// ADD, CMP and MOV with high registers, BX and BLX
+// ****************************************************************************
+static unsigned int special_data_branch(uint16_t op)
+{
+    unsigned int rdn = (op & 7) | ((op >> 4) & 8);
+    unsigned int rm = (op >> 3) & 0xf;
+    uint32_t target;
+
+    switch ((op >> 8) & 3) {
+        case 0:     // ADD Rdn, Rm
+            if (rdn == PC) {
+                next_pc = (r[PC] + r[rm]) & ~1u;
+                return 2;
+            }
+            r[rdn] = r[rdn] + r[rm];
+            if (rdn == SP) {
+                r[SP] &= ~3u;
+            }
+            return 1;
+
+        case 1:     // CMP Rn, Rm
+            add_with_carry(r[rdn], ~r[rm], true);
+            return 1;
+
+        case 2:     // MOV Rd, Rm
+            if (rdn == PC) {
+                next_pc = r[rm] & ~1u;
+                return 2;
+            }
+            r[rdn] = r[rm];
+            if (rdn == SP) {
+                r[SP] &= ~3u;
+            }
+            return 1;
+
+        case 3:     // BX Rm, BLX Rm
+        default:
+            target = r[rm];
+            if (op & (1 << 7)) {
+                r[LR] = (r[PC] - 2) | 1;
+            }
+            bx_write_pc(target);
+            return 2;
+    }
+}
+
+
+// ****************************************************************************
+static unsigned int load_store_register(uint16_t op)
+{
+    unsigned int rt = op & 7;
+    uint32_t address = r[(op >> 3) & 7] + r[(op >> 6) & 7];
+
+    switch ((op >> 9) & 7) {
+        case 0:     // STR
+            write_memory(address, r[rt], 4);
+            break;
+
+        case 1:     // STRH
+            write_memory(address, r[rt] & 0xffff, 2);
+            break;
+
+        case 2:     // STRB
+            write_memory(address, r[rt] & 0xff, 1);
+            break;
+
+        case 3:     // LDRSB
+            r[rt] = (uint32_t)(int8_t)read_memory(address, 1);
+            break;
+
+        case 4:     // LDR
+            r[rt] = read_memory(address, 4);
+            break;
+
+        case 5:     // LDRH
+            r[rt] = read_memory(address, 2);
+            break;
+
+        case 6:     // LDRB
+            r[rt] = read_memory(address, 1);
+            break;
+
+        case 7:     // LDRSH
+        default:
+            r[rt] = (uint32_t)(int16_t)read_memory(address, 2);
+            break;
+    }
+
+    return access_cycles(address);
+}
+
+
+// ****************************************************************************
+static unsigned int load_store_immediate(uint16_t op)
+{
+    unsigned int rt = op & 7;
+    uint32_t base = r[(op >> 3) & 7];
+    uint32_t imm5 = (op >> 6) & 0x1f;
+    bool load = op & (1 << 11);
+    unsigned int size;
+    uint32_t address;
+
+    switch (op >> 12) {
+        case 0x6:   // STR, LDR
+            size = 4;
+            break;
+
+        case 0x7:   // STRB, LDRB
+            size = 1;
+            break;
+
+        case 0x8:   // STRH, LDRH
+        default:
+            size = 2;
+            break;
+    }
+
+    address = base + imm5 * size;
+    if (load) {
+        r[rt] = read_memory(address, size);
+    }
+    else {
+        write_memory(address, r[rt] & (0xffffffff >> (32 - 8 * size)), size);
+    }
+
+    return access_cycles(address);
+}
+
+
+// ****************************************************************************
+static unsigned int push_pop(uint16_t op)
+{
+    unsigned int count = 0;
+    uint32_t address;
+    int i;
+
+    if (op & (1 << 11)) {   // POP
+        address = r[SP];
+        for (i = 0; i < 8; i++) {
+            if (op & (1 << i)) {
+                r[i] = read_memory(address, 4);
+                address += 4;
+                ++count;
+            }
+        }
+        if (op & (1 << 8)) {
+            uint32_t target = read_memory(address, 4);
+
+            r[SP] = address + 4;
+            bx_write_pc(target);
+            return 3 + count + 1;
+        }
+        r[SP] = address;
+        return 1 + count;
+    }
+
+    // PUSH: the lowest register goes to the lowest address
+    for (i = 0; i < 8; i++) {
+        count += (op >> i) & 1;
+    }
+    count += (op >> 8) & 1;
+    address = r[SP] - 4 * count;
+    r[SP] = address;
+    for (i = 0; i < 8; i++) {
+        if (op & (1 << i)) {
+            write_memory(address, r[i], 4);
+            address += 4;
+        }
+    }
+    if (op & (1 << 8)) {
+        write_memory(address, r[LR], 4);
+    }
+
+    return 1 + count;
+}
+
+
+// ****************************************************************************
+static unsigned int miscellaneous(uint16_t op)
+{
+    unsigned int rd = op & 7;
+    uint32_t rm = r[(op >> 3) & 7];
+
+    switch ((op >> 8) & 0xf) {
+        case 0x0:
+            if (op & (1 << 7)) {    // SUB SP, SP, #imm7
+                r[SP] -= (op & 0x7f) * 4;
+            }
+            else {                  // ADD SP, SP, #imm7
+                r[SP] += (op & 0x7f) * 4;
+            }
+            return 1;
+
+        case 0x2:
+            switch ((op >> 6) & 3) {
+                case 0:     // SXTH
+                    r[rd] = (uint32_t)(int16_t)rm;
+                    break;
+
+                case 1:     // SXTB
+                    r[rd] = (uint32_t)(int8_t)rm;
+                    break;
+
+                case 2:     // UXTH
+                    r[rd] = rm & 0xffff;
+                    break;
+
+                case 3:     // UXTB
+                default:
+                    r[rd] = rm & 0xff;
+                    break;
+            }
+            return 1;
+
+        case 0x4:
+        case 0x5:
+        case 0xc:
+        case 0xd:
+            return push_pop(op);
+
+        case 0x6:
+            if ((op & 0xffef) == 0xb662) {  // CPSIE i, CPSID i
+                set_primask(op & (1 << 4));
+                return 1;
+            }
+            break;
+
+        case 0xa:
+            switch ((op >> 6) & 3) {
+                case 0:     // REV
+                    r[rd] = __builtin_bswap32(rm);
+                    return 1;
+
+                case 1:     // REV16
+                    r[rd] = ((rm & 0x00ff00ff) << 8) | ((rm >> 8) & 0x00ff00ff);
+                    return 1;
+
+                case 3:     // REVSH
+                    r[rd] = (uint32_t)(int16_t)(((rm & 0xff) << 8) | ((rm >> 8) & 0xff));
+                    return 1;
+
+                default:
+                    break;
+            }
+            break;
+
+        case 0xe:           // BKPT
+            snprintf(fault_message, sizeof(fault_message),
+                "breakpoint %u at pc 0x%08x", op & 0xff, r[PC] - 4);
+            host_stop(fault_message);
+            break;
+
+        case 0xf:           // NOP, YIELD, WFE, WFI, SEV
+            if ((op & 0xff) == 0) {
+                return 1;
+            }
+            return 2;
+
+        default:
+            break;
+    }
+
+    fault("undefined instruction", op);
+    return 1;
+}
+
+
+// ****************************************************************************
+static unsigned int load_store_multiple(uint16_t op)
+{
+    unsigned int rn = (op >> 8) & 7;
+    uint32_t address = r[rn];
+    unsigned int count = 0;
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        if (!(op & (1 << i))) {
+            continue;
+        }
+        if (op & (1 << 11)) {
+            r[i] = read_memory(address, 4);
+        }
+        else {
+            write_memory(address, r[i], 4);
+        }
+        address += 4;
+        ++count;
+    }
+
+    // LDM does not write back when the base register is in the list
+    if (!(op & (1 << 11)) || !(op & (1 << rn))) {
+        r[rn] = address;
+    }
+
+    return 1 + count;
+}
+
+
+// ****************************************************************************
+static bool condition_passed(unsigned int condition)
+{
+    bool result;
+
+    switch (condition >> 1) {
+        case 0: result = flag_z; break;                         // EQ, NE
+        case 1: result = flag_c; break;                         // CS, CC
+        case 2: result = flag_n; break;                         // MI, PL
+        case 3: result = flag_v; break;                         // VS, VC
+        case 4: result = flag_c && !flag_z; break;              // HI, LS
+        case 5: result = flag_n == flag_v; break;               // GE, LT
+        case 6: result = flag_n == flag_v && !flag_z; break;    // GT, LE
+        default: result = true; break;
+    }
+
+    return (condition & 1) ? !result : result;
+}
+
+
+// ****************************************************************************
+// BL, MSR, MRS, DMB, DSB, ISB
+// ****************************************************************************
+static unsigned int execute32(uint16_t op1, uint16_t op2)
+{
+    next_pc = r[PC];
+
+    if ((op2 & 0xd000) == 0xd000) {     // BL
+        uint32_t s = (op1 >> 10) & 1;
+        uint32_t i1 = !(((op2 >> 13) & 1) ^ s);
+        uint32_t i2 = !(((op2 >> 11) & 1) ^ s);
+        uint32_t offset = (i1 << 23) | (i2 << 22) | ((op1 & 0x3ffu) << 12) | ((op2 & 0x7ffu) << 1);
+
+        if (s) {
+            offset |= 0xff000000;
+        }
+        r[LR] = r[PC] | 1;
+        next_pc = r[PC] + offset;
+        return 3;
+    }
+
+    if ((op1 & 0xfff0) == 0xf380 && (op2 & 0xff00) == 0x8800) {    // MSR
+        uint32_t value = r[op1 & 0xf];
+
+        switch (op2 & 0xff) {
+            case 0x00:  // APSR
+            case 0x01:  // IAPSR
+            case 0x02:  // EAPSR
+            case 0x03:  // xPSR
+                set_xpsr((value & 0xf0000000) | ipsr);
+                return 3;
+
+            case 0x08:  // MSP
+                r[SP] = value & ~3u;
+                return 3;
+
+            case 0x10:  // PRIMASK
+                set_primask(value & 1);
+                return 3;
+
+            default:
+                break;
+        }
+    }
+
+    if (op1 == 0xf3ef && (op2 & 0xf000) == 0x8000) {       // MRS
+        unsigned int rd = (op2 >> 8) & 0xf;
+        unsigned int sysm = op2 & 0xff;
+
+        switch (sysm) {
+            case 0x00:  // APSR
+            case 0x01:  // IAPSR
+            case 0x02:  // EAPSR
+            case 0x03:  // xPSR
+            case 0x05:  // IPSR
+            case 0x06:  // EPSR
+            case 0x07:  // IEPSR
+                // The EPSR reads as zero
+                r[rd] = (sysm & 1) ? ipsr : 0;
+                if (!(sysm & 4)) {
+                    r[rd] |= get_xpsr() & 0xf0000000;
+                }
+                return 3;
+
+            case 0x08:
+            case 0x09:
+                r[rd] = r[SP];
+                return 3;
+
+            case 0x10:
+                r[rd] = primask;
+                return 3;
+
+            case 0x14:
+                r[rd] = 0;
+                return 3;
+
+            default:
+                break;
+        }
+    }
+
+    if (op1 == 0xf3bf && (op2 & 0xff00) == 0x8f00) {        // DSB, DMB, ISB
+        return 3;
+    }
+
+    fault("undefined instruction", ((uint32_t)op1 << 16) | op2);
+    return 1;
+}
+
+
+// ****************************************************************************
+static unsigned int execute(uint16_t op)
+{
+    uint32_t imm8 = op & 0xff;
+    unsigned int rd8 = (op >> 8) & 7;
+    uint32_t address;
+    int32_t offset;
+
+    switch (op >> 12) {
+        case 0x0:
+        case 0x1:
+        case 0x2:
+        case 0x3:
+            return shift_add_subtract_move_compare(op);
+
+        case 0x4:
+            if ((op & 0xfc00) == 0x4000) {
+                return data_processing(op);
+            }
+            if ((op & 0xfc00) == 0x4400) {
+                return special_data_branch(op);
+            }
+            // LDR Rt, [PC, #imm8]
+            address = (r[PC] & ~3u) + imm8 * 4;
+            r[rd8] = read_memory(address, 4);
+            return 2;
+
+        case 0x5:
+            return load_store_register(op);
+
+        case 0x6:
+        case 0x7:
+        case 0x8:
+            return load_store_immediate(op);
+
+        case 0x9:
+            address = r[SP] + imm8 * 4;
+            if (op & (1 << 11)) {   // LDR Rt, [SP, #imm8]
+                r[rd8] = read_memory(address, 4);
+            }
+            else {                  // STR Rt, [SP, #imm8]
+                write_memory(address, r[rd8], 4);
+            }
+            return 2;
+
+        case 0xa:
+            if (op & (1 << 11)) {   // ADD Rd, SP, #imm8
+                r[rd8] = r[SP] + imm8 * 4;
+            }
+            else {                  // ADR Rd, label
+                r[rd8] = (r[PC] & ~3u) + imm8 * 4;
+            }
+            return 1;
+
+        case 0xb:
+            return miscellaneous(op);
+
+        case 0xc:
+            return load_store_multiple(op);
+
+        case 0xd:
+            if (rd8 == 7 && (op & (1 << 11))) {     // SVC
+                fault("SVC not supported", imm8);
+            }
+            if ((op & 0x0f00) == 0x0e00) {          // UDF
+                fault("undefined instruction", op);
+            }
+            if (!condition_passed((op >> 8) & 0xf)) {
+                return 1;
+            }
+            next_pc = r[PC] + (int32_t)(int8_t)imm8 * 2;
+            return 2;
+
+        case 0xe:
+            if (op & (1 << 11)) {
+                fault("undefined instruction", op);
+            }
+            offset = (int32_t)((uint32_t)(op & 0x7ff) << 21) >> 20;
+            next_pc = r[PC] + offset;
+            return 2;
+
+        case 0xf:
+        default:
+            if ((op & 0xf800) == 0xe800) {
+                fault("undefined instruction", op);
+            }
+            return execute32(op, (uint16_t)read_memory(r[PC] - 2, 2));
+    }
+}
+
+
+// ****************************************************************************
+// The IAP functions in the boot ROM, called with the parameter table in R0
+// and the result table in R1
+// ****************************************************************************
+static void call_iap(void)
+{
+    unsigned int param[NUMBER_OF_IAP_PARAMS];
+    unsigned int result[NUMBER_OF_IAP_RESULTS];
+    uint32_t param_address = r[0];
+    uint32_t result_address = r[1];
+    int i;
+
+    for (i = 0; i < NUMBER_OF_IAP_PARAMS; i++) {
+        param[i] = read_memory(param_address + 4 * i, 4);
+    }
+    memset(result, 0, sizeof(result));
+
+    // Return to the caller before the IAP model advances the clock
+    r[PC] = r[LR] & ~1u;
+    host_iap(param, result);
+
+    for (i = 0; i < NUMBER_OF_IAP_RESULTS; i++) {
+        write_memory(result_address + 4 * i, result[i], 4);
+    }
+}
+
+
+// ****************************************************************************
+// Executes one instruction and advances the virtual clock by its cycles
+// ****************************************************************************
+static void step(void)
+{
+    uint32_t pc = r[PC];
+    unsigned int cycles;
+    uint8_t *m;
+    uint16_t op;
+
+    if (pc == IAP_ENTRY_ADDRESS) {
+        call_iap();
+        return;
+    }
+
+    m = memory(pc, 2);
+    if (!m) {
+        r[PC] = pc + 4;
+        fault("instruction fetch from", pc);
+    }
+    op = (uint16_t)(m[0] | (m[1] << 8));
+
+    // Instructions read the PC as their address + 4
+    r[PC] = pc + 4;
+    next_pc = pc + 2;
+    peripheral_written = false;
+
+    cycles = execute(op);
+    r[PC] = next_pc;
+
+    ++instructions;
+    *cycle_counter += cycles;
+
+    if (peripheral_written) {
+        host_bus_sync();
+    }
+    if (enable_irq_pending) {
+        enable_irq_pending = false;
+        host_enable_irq();
+    }
+    host_advance(cycles);
+
+    // The main loop fed the watchdog
+    if (host_stats.main_loop_iterations != last_main_loop_iterations) {
+        last_main_loop_iterations = host_stats.main_loop_iterations;
+        if (iteration_start) {
+            add_cycle_sample(&main_loop_stats, thread_cycles - iteration_start);
+        }
+        iteration_start = thread_cycles;
+    }
+}
+
+
+// ****************************************************************************
+// Processor interface, see hal.h
+// ****************************************************************************
+void host_cpu_init(void)
+{
+    memset(flash, 0xff, sizeof(flash));
+}
+
+
+// ****************************************************************************
+bool host_cpu_load(const char *image)
+{
+    if (!image) {
+        image = DEFAULT_IMAGE;
+    }
+    image_loaded = load_hex(image);
+    return image_loaded;
+}
+
+
+// ****************************************************************************
+void host_cpu_run(void)
+{
+    if (!image_loaded) {
+        host_stop("no firmware image loaded");
+    }
+
+    r[SP] = read_memory(FLASH_BASE, 4) & ~3u;
+    r[PC] = read_memory(FLASH_BASE + 4, 4);
+    r[LR] = 0xffffffff;
+    if (!(r[PC] & 1)) {
+        fault("reset vector without Thumb bit", r[PC]);
+    }
+    r[PC] &= ~1u;
+
+    for (;;) {
+        step();
+    }
+}
+
+
+// ****************************************************************************
+// Exception entry pushes R0-R3, R12, LR, the return address and xPSR onto
+// the stack (8-byte aligned), then runs the handler until it returns with
+// EXC_RETURN. Higher priority interrupts nest through host_advance().
+// ****************************************************************************
+void host_cpu_irq(host_irq_t irq)
+{
+    unsigned int exception = exception_numbers[irq];
+    uint64_t *saved_cycle_counter = cycle_counter;
+    uint64_t handler_cycles = 0;
+    uint32_t frame;
+    uint32_t xpsr = get_xpsr();
+    uint32_t vector;
+
+    frame = r[SP] - 32;
+    if (frame & 4) {
+        frame &= ~4u;
+        xpsr |= XPSR_FRAME_ALIGNED;
+    }
+
+    write_memory(frame + 0, r[0], 4);
+    write_memory(frame + 4, r[1], 4);
+    write_memory(frame + 8, r[2], 4);
+    write_memory(frame + 12, r[3], 4);
+    write_memory(frame + 16, r[12], 4);
+    write_memory(frame + 20, r[LR], 4);
+    write_memory(frame + 24, r[PC], 4);
+    write_memory(frame + 28, xpsr, 4);
+
+    r[SP] = frame;
+    r[LR] = ipsr ? EXC_RETURN_HANDLER : EXC_RETURN_THREAD;
+    ipsr = exception;
+
+    vector = read_memory(vtor + 4 * exception, 4);
+    if (!(vector & 1)) {
+        fault("vector without Thumb bit", vector);
+    }
+    r[PC] = vector & ~1u;
+
+    cycle_counter = &handler_cycles;
+    while (!exception_return) {
+        step();
+    }
+    exception_return = false;
+    cycle_counter = saved_cycle_counter;
+
+    add_cycle_sample(&handler_stats[irq], handler_cycles);
+
+    // Exception return
+    frame = r[SP];
+    r[0] = read_memory(frame + 0, 4);
+    r[1] = read_memory(frame + 4, 4);
+    r[2] = read_memory(frame + 8, 4);
+    r[3] = read_memory(frame + 12, 4);
+    r[12] = read_memory(frame + 16, 4);
+    r[LR] = read_memory(frame + 20, 4);
+    r[PC] = read_memory(frame + 24, 4);
+    xpsr = read_memory(frame + 28, 4);
+
+    set_xpsr(xpsr);
+    r[SP] = frame + 32 + ((xpsr & XPSR_FRAME_ALIGNED) ? 4 : 0);
+}
+
+
+// ****************************************************************************
+uint8_t *host_cpu_memory(uint32_t address, uint32_t size)
+{
+    return memory(address, size);
+}
+
+
+// ****************************************************************************
+uint32_t host_cpu_persistent_data(void)
+{
+    return PERSISTENT_DATA_ADDRESS;
+}
+
+
+// ****************************************************************************
+static void print_cycle_stats(FILE *f, const char *name, const cycle_stats_t *stats)
+{
+    if (!stats->count) {
+        return;
+    }
+    fprintf(f, "  %-20s %10llu  %6llu  %8.1f  %6llu\n", name,
+        (unsigned long long)stats->count, (unsigned long long)stats->min,
+        (double)stats->sum / stats->count, (unsigned long long)stats->max);
+}
+
+
+// ****************************************************************************
+void host_cpu_report(FILE *f)
+{
+    int i;
+
+    fprintf(f, "Instructions executed:  %llu\n", (unsigned long long)instructions);
+    fprintf(f, "Thread mode cycles:     %llu\n", (unsigned long long)thread_cycles);
+    fprintf(f, "Execution cycles (without exception entry and exit):\n");
+    fprintf(f, "                            count     min   average     max\n");
+    print_cycle_stats(f, "Main loop iteration", &main_loop_stats);
+    for (i = 0; i < HOST_NUMBER_OF_IRQS; i++) {
+        char name[32];
+
+        snprintf(name, sizeof(name), "%s handler", host_irq_name(i));
+        print_cycle_stats(f, name, &handler_stats[i]);
+    }
+}
@@ -0,0 +1,292 @@
+/******************************************************************************
+
+    Many cars on one track: N transmitter/receiver pairs sharing the
+    2.4 GHz band.
+
+    Transmitters never listen, so the packets on air do not depend on what
+    the receivers do. Every receiver can therefore be simulated on its own,
+    with all N transmitters feeding its nRF24 model: packets of other cars
+    on the receiver's channel collide with its own packets there.
+
+    The firmware and the register models keep their state in static
+    variables, like on the microcontroller, so each receiver runs in its
+    own worker process. The workers start from a fork of the freshly
+    initialized simulator and return their results through shared memory.
+
+    A packet of another car only makes a difference where it can destroy a
+    packet of the simulated car: on its hop channels, and on the bind
+    channel while the receiver may be binding. The other transmitters skip
+    their packets on all other channels without simulation events, which
+    keeps the cost per car close to that of a single car.
+
+******************************************************************************/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "medium.h"
+
+
+// Typical crystal tolerance; each transmitter runs off by a random amount
+// within that range
+#define CRYSTAL_TOLERANCE_PPM 30
+
+#define TRAIN_TIME_US 5000
+
+// Trains of the second car in medium_check()
+#define CHECK_TRAINS 200
+
+
+static transmitter_t transmitters[MEDIUM_MAX_CARS];
+static uint64_t check_collisions[3];     // Stick packets of car 1, 2; bind packets
+
+
+// ****************************************************************************
+transmitter_t *medium_create_transmitters(const transmitter_config_t *base,
+    unsigned int number_of_cars, unsigned int car, bool binding)
+{
+    uint8_t audible[TRANSMITTER_NUMBER_OF_HOP_CHANNELS + 1];
+    unsigned int i;
+
+    for (i = 0; i < number_of_cars && i < MEDIUM_MAX_CARS; i++) {
+        transmitter_config_t config = *base;
+        transmitter_config_t bound;
+        uint64_t seed = base->seed + i;
+
+        // Bind data from the per-car seed, everything else as configured
+        transmitter_default_config(&bound, base->protocol, seed);
+        memcpy(config.address, bound.address, sizeof(config.address));
+        memcpy(config.hop, bound.hop, sizeof(config.hop));
+        config.seed = seed;
+
+        // Cars are switched on at random times, so they are anywhere in
+        // their hop sequence relative to each other, and their crystals
+        // differ
+        config.start += (seed * 7919 * HOST_CYCLES_PER_US) %
+            HOST_US(TRAIN_TIME_US * TRANSMITTER_NUMBER_OF_HOP_CHANNELS);
+        config.drift_ppm += (int32_t)((seed * 104729) % (2 * CRYSTAL_TOLERANCE_PPM + 1)) -
+            CRYSTAL_TOLERANCE_PPM;
+
+        transmitter_init(&transmitters[i], &config);
+    }
+
+    memcpy(audible, transmitters[car].config.hop, TRANSMITTER_NUMBER_OF_HOP_CHANNELS);
+    audible[TRANSMITTER_NUMBER_OF_HOP_CHANNELS] = TRANSMITTER_BIND_CHANNEL;
+
+    for (i = 0; i < number_of_cars && i < MEDIUM_MAX_CARS; i++) {
+        if (i != car) {
+            transmitter_set_audible_channels(&transmitters[i], audible,
+                binding ? sizeof(audible) : TRANSMITTER_NUMBER_OF_HOP_CHANNELS);
+        }
+    }
+
+    return &transmitters[car];
+}
+
+
+// ****************************************************************************
+bool medium_run(unsigned int number_of_cars, unsigned int jobs,
+    medium_car_function_t run_car, medium_car_result_t *results)
+{
+    medium_car_result_t *shared;
+    size_t size = number_of_cars * sizeof(medium_car_result_t);
+    unsigned int next = 0;
+    unsigned int running = 0;
+    bool success = true;
+    int status;
+
+    shared = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        perror("mmap");
+        return false;
+    }
+    memset(shared, 0, size);
+
+    // Buffered output would otherwise be printed by every worker
+    fflush(stdout);
+    fflush(stderr);
+
+    while (next < number_of_cars || running) {
+        if (next < number_of_cars && running < jobs) {
+            pid_t pid = fork();
+
+            if (pid == 0) {
+                run_car(next, &shared[next]);
+                shared[next].valid = true;
+                fflush(stdout);
+                _exit(0);
+            }
+            if (pid < 0) {
+                perror("fork");
+                success = false;
+                break;
+            }
+
+            ++next;
+            ++running;
+            continue;
+        }
+
+        if (wait(&status) < 0) {
+            perror("wait");
+            success = false;
+            break;
+        }
+        --running;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            success = false;
+        }
+    }
+
+    while (running && wait(&status) >= 0) {
+        --running;
+    }
+
+    memcpy(results, shared, size);
+    munmap(shared, size);
+    return success;
+}
+
+
+// ****************************************************************************
+static void check_packet_ended(const nrf24_packet_t *packet, nrf24_outcome_t outcome)
+{
+    unsigned int i;
+
+    if (outcome != NRF24_MISSED_COLLISION) {
+        return;
+    }
+
+    // Attributed by address like the per-car statistics; the bind packets
+    // of all cars share the bind address
+    for (i = 0; i < 2; i++) {
+        if (memcmp(packet->address, transmitters[i].config.address, TRANSMITTER_ADDRESS_WIDTH) == 0) {
+            break;
+        }
+    }
+    ++check_collisions[i];
+}
+
+
+// ****************************************************************************
+// Car 2 hops 10 channels above car 1 and is switched on 10 trains and
+// 100 us after it. In every other pass through 10 hop channels the two
+// are on the same channel at the same time, and each stick packet of one
+// car overlaps the same stick packet of the other. The bind packets, all
+// on the bind channel, collide in every train.
+// ****************************************************************************
+bool medium_check(FILE *f)
+{
+    static const char *names[3] = {
+        "Stick packets of car 1", "Stick packets of car 2", "Bind packets"
+    };
+    transmitter_config_t config;
+    uint64_t expected[3];
+    bool ok = true;
+    int i;
+
+    transmitter_default_config(&config, PROTOCOL_4CH, 1);
+    for (i = 0; i < TRANSMITTER_NUMBER_OF_HOP_CHANNELS; i++) {
+        config.hop[i] = (uint8_t)(10 + i);
+    }
+    config.start = host_cycles;
+    transmitter_init(&transmitters[0], &config);
+
+    transmitter_default_config(&config, PROTOCOL_4CH, 2);
+    for (i = 0; i < TRANSMITTER_NUMBER_OF_HOP_CHANNELS; i++) {
+        config.hop[i] = (uint8_t)(20 + i);
+    }
+    config.start = host_cycles + HOST_US(10 * TRAIN_TIME_US + 100);
+    transmitter_init(&transmitters[1], &config);
+
+    memset(check_collisions, 0, sizeof(check_collisions));
+    nrf24_set_rx_hook(check_packet_ended);
+    host_advance(config.start + HOST_US(CHECK_TRAINS * TRAIN_TIME_US) - host_cycles);
+    nrf24_set_rx_hook(NULL);
+
+    // Two stick packets of each car in every other train, and the bind
+    // packets of both cars in every train
+    expected[0] = CHECK_TRAINS;
+    expected[1] = CHECK_TRAINS;
+    expected[2] = 2 * CHECK_TRAINS;
+
+    for (i = 0; i < 3; i++) {
+        fprintf(f, "%-22s %5llu collided, expected %llu\n", names[i],
+            (unsigned long long)check_collisions[i], (unsigned long long)expected[i]);
+        if (check_collisions[i] != expected[i]) {
+            ok = false;
+        }
+    }
+
+    fprintf(f, "Medium check %s\n", ok ? "passed" : "FAILED");
+    return ok;
+}
+
+
+// ****************************************************************************
+void medium_report(FILE *f, const medium_car_result_t *results,
+    unsigned int number_of_cars, uint64_t run_time)
+{
+    uint64_t total_sent = 0;
+    uint64_t total_received = 0;
+    uint64_t total_collisions = 0;
+    uint64_t total_failsafe_entries = 0;
+    unsigned int never_locked = 0;
+    unsigned int i;
+    int j;
+
+    fprintf(f, "Car  Hops    ppm   Packets   Loss %%  Collided %%  Failsafes  In failsafe  Longest gap\n");
+
+    for (i = 0; i < number_of_cars; i++) {
+        const medium_car_result_t *r = &results[i];
+        uint64_t sent = 0;
+        uint64_t received = r->outcomes[NRF24_RECEIVED];
+        uint64_t collisions = r->outcomes[NRF24_MISSED_COLLISION];
+        char failsafes[16];
+
+        if (!r->valid) {
+            fprintf(f, "%3u  simulation failed\n", i + 1);
+            continue;
+        }
+
+        for (j = 0; j < NRF24_NUMBER_OF_OUTCOMES; j++) {
+            sent += r->outcomes[j];
+        }
+
+        if (r->locked) {
+            snprintf(failsafes, sizeof(failsafes), "%llu",
+                (unsigned long long)r->failsafe_entries);
+        }
+        else {
+            snprintf(failsafes, sizeof(failsafes), "never");
+            ++never_locked;
+        }
+
+        fprintf(f, "%3u  %2u-%-2u  %+4d  %8llu  %7.2f  %10.2f  %9s  %9.1f s  %8.1f ms\n",
+            i + 1, r->first_hop, r->first_hop + TRANSMITTER_NUMBER_OF_HOP_CHANNELS - 1,
+            r->drift_ppm, (unsigned long long)sent,
+            sent ? 100.0 * (double)(sent - received) / (double)sent : 0.0,
+            sent ? 100.0 * (double)collisions / (double)sent : 0.0,
+            failsafes,
+            (double)r->failsafe_cycles / __SYSTEM_CLOCK,
+            (double)r->longest_gap / HOST_MS(1));
+
+        total_sent += sent;
+        total_received += received;
+        total_collisions += collisions;
+        total_failsafe_entries += r->failsafe_entries;
+    }
+
+    if (total_sent) {
+        fprintf(f, "All cars: %.2f %% lost, %.2f %% collided, %llu failsafes in %.0f s, %u never locked\n",
+            100.0 * (double)(total_sent - total_received) / (double)total_sent,
+            100.0 * (double)total_collisions / (double)total_sent,
+            (unsigned long long)total_failsafe_entries,
+            (double)run_time / __SYSTEM_CLOCK, never_locked);
+    }
+}
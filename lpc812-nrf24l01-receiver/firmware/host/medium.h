@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "nrf24.h"
+#include "transmitter.h"
+
+#define MEDIUM_MAX_CARS 200
+
+
+typedef struct {
+    bool valid;                     // The simulation of the car completed
+    uint8_t first_hop;
+    int32_t drift_ppm;
+    // Of its own packets, from the first one the receiver got on; all of
+    // them if it never got one
+    uint64_t outcomes[NRF24_NUMBER_OF_OUTCOMES];
+    uint64_t failsafe_entries;
+    uint64_t failsafe_cycles;       // Including the time until the first lock
+    bool locked;                    // The receiver locked on at least once
+    uint64_t longest_gap;           // Longest time without a received packet
+} medium_car_result_t;
+
+typedef void (* medium_car_function_t)(unsigned int car, medium_car_result_t *result);
+
+
+// Creates the transmitters of all cars on the track. Every car gets its own
+// bind data, crystal error and phase, derived from the seed in base and
+// the car number. Returns the transmitter of the given car. The bind
+// packets of the other cars only go on air if the receiver may be binding.
+transmitter_t *medium_create_transmitters(const transmitter_config_t *base,
+    unsigned int number_of_cars, unsigned int car, bool binding);
+
+// Calls run_car for every car in its own worker process, with at most jobs
+// workers at a time. Returns false if a worker failed.
+bool medium_run(unsigned int number_of_cars, unsigned int jobs,
+    medium_car_function_t run_car, medium_car_result_t *results);
+
+// Runs two transmitters whose hop sequences meet in every other train and
+// checks that the collisions of each car's packets are counted for it.
+// Returns false if the counts are off.
+bool medium_check(FILE *f);
+
+void medium_report(FILE *f, const medium_car_result_t *results,
+    unsigned int number_of_cars, uint64_t run_time);
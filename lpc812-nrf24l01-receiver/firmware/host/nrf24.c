@@ -0,0 +1,701 @@
+/******************************************************************************
+
+    Behavioral model of the nRF24L01+ for the host build.
+
+    The model is connected to the SPI0 model (CSN = SSEL), the CE output and
+    the IRQ input of the LPC812 model in hal.c. It implements the register
+    file and commands used by rf.c, a 3 level RX FIFO and the datasheet
+    timings that matter for frequency hopping:
+
+      - Tpd2stby: power down to standby (4.5 ms worst case)
+      - Tstby2a: standby to RX mode after CE rising, and after re-tuning the
+        synthesizer by writing RF_CH or RF_SETUP (130 us)
+      - On-air time of a packet: preamble, address, packet control field,
+        payload and CRC at 250 kbps, 1 Mbps or 2 Mbps
+
+    A packet is received when the receiver was in RX mode on the right
+    channel for the whole duration of the packet, the address, data rate,
+    CRC and payload length match, and the RX FIFO is not full.
+
+******************************************************************************/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <rf.h>
+
+#include "hal.h"
+#include "nrf24.h"
+#include "trace.h"
+
+
+#define NUMBER_OF_REGISTERS 0x20
+#define MAX_PACKETS_ON_AIR 64
+
+#define IRQ_FLAGS (RX_RD | TX_DS | MAX_RT)
+#define RX_P_NO_EMPTY (7 << 1)
+#define FIFO_STATUS_RX_EMPTY (1 << 0)
+#define FIFO_STATUS_RX_FULL (1 << 1)
+#define FIFO_STATUS_TX_EMPTY (1 << 4)
+
+// Datasheet table 13: delay from CE positive edge to CSN low
+#define TPECE2CSN_US 4
+
+#define PREAMBLE_BITS 8
+#define PCF_BITS 9
+
+
+typedef struct {
+    uint8_t length;
+    uint8_t payload[NRF24_MAX_PAYLOAD];
+} fifo_entry_t;
+
+typedef struct {
+    bool in_use;
+    nrf24_packet_t packet;
+    uint64_t end;
+    bool listening;                 // Receiver was listening when it started
+    bool on_channel;
+    unsigned int epoch;
+    bool collided;
+    host_timer_t timer;
+} air_packet_t;
+
+
+nrf24_stats_t nrf24_stats;
+
+static unsigned int ce_pin;
+static unsigned int irq_pin;
+static bool ce;
+static uint64_t ce_rising_at;
+
+static uint8_t registers[NUMBER_OF_REGISTERS];
+static uint8_t rx_addr_p0[NRF24_MAX_ADDRESS_WIDTH];
+static uint8_t rx_addr_p1[NRF24_MAX_ADDRESS_WIDTH];
+static uint8_t tx_addr[NRF24_MAX_ADDRESS_WIDTH];
+
+static fifo_entry_t rx_fifo[NRF24_RX_FIFO_DEPTH];
+static unsigned int rx_fifo_count;
+
+static nrf24_state_t state;
+static uint64_t state_since;
+static host_timer_t state_timer;
+
+// Incremented whenever the receiver stops listening or re-tunes, so that a
+// packet that was being received can be discarded.
+static unsigned int listen_epoch;
+
+static air_packet_t on_air[MAX_PACKETS_ON_AIR];
+static nrf24_rx_hook_t rx_hook;
+
+static uint8_t command;
+static unsigned int byte_index;
+
+static const char *state_names[NRF24_NUMBER_OF_STATES] = {
+    "power down",
+    "start-up",
+    "standby",
+    "RX settling",
+    "RX",
+};
+
+
+// ****************************************************************************
+static uint8_t *address_register(uint8_t reg)
+{
+    switch (reg) {
+        case RX_ADDR_P0: return rx_addr_p0;
+        case RX_ADDR_P1: return rx_addr_p1;
+        case TX_ADDR: return tx_addr;
+        default: return NULL;
+    }
+}
+
+
+// ****************************************************************************
+static uint8_t get_status(void)
+{
+    uint8_t status = registers[STATUS] & IRQ_FLAGS;
+
+    status |= rx_fifo_count ? 0 : RX_P_NO_EMPTY;
+    return status;
+}
+
+
+// ****************************************************************************
+static uint8_t get_data_rate(void)
+{
+    if (registers[RF_SETUP] & RF_DR_LOW) {
+        return DATA_RATE_250K;
+    }
+    if (registers[RF_SETUP] & RF_DR_HIGH) {
+        return DATA_RATE_2M;
+    }
+    return DATA_RATE_1M;
+}
+
+
+// ****************************************************************************
+static uint8_t get_crc_length(void)
+{
+    if (!(registers[CONFIG] & EN_CRC)) {
+        return 0;
+    }
+    return (registers[CONFIG] & CRC0) ? 2 : 1;
+}
+
+
+// ****************************************************************************
+static bool dynamic_payload_length(void)
+{
+    return (registers[FEATURE] & EN_DPL) && (registers[DYNPD] & DATA_PIPE_0);
+}
+
+
+// ****************************************************************************
+static void update_irq(void)
+{
+    uint8_t active = registers[STATUS] & IRQ_FLAGS & ~registers[CONFIG];
+
+    // The IRQ pin is active low
+    host_set_input(irq_pin, !active);
+}
+
+
+// ****************************************************************************
+// State machine
+// ****************************************************************************
+static void enter_state(nrf24_state_t new_state)
+{
+    if (new_state == state) {
+        return;
+    }
+
+    nrf24_stats.state_cycles[state] += host_cycles - state_since;
+    state_since = host_cycles;
+
+    if (state == NRF24_RX) {
+        ++listen_epoch;
+    }
+    state = new_state;
+}
+
+
+// ****************************************************************************
+static void start_settling(void)
+{
+    ++listen_epoch;
+    ++nrf24_stats.settles;
+    enter_state(NRF24_RX_SETTLING);
+    host_timer_start(&state_timer, host_cycles + HOST_US(NRF24_TSTBY2A_US));
+}
+
+
+// ****************************************************************************
+static void evaluate_state(void)
+{
+    bool rx = ce && (registers[CONFIG] & PRIM_RX);
+
+    if (!(registers[CONFIG] & PWR_UP)) {
+        host_timer_stop(&state_timer);
+        enter_state(NRF24_POWER_DOWN);
+        return;
+    }
+
+    switch (state) {
+        case NRF24_POWER_DOWN:
+            enter_state(NRF24_START_UP);
+            host_timer_start(&state_timer, host_cycles + HOST_US(NRF24_TPD2STBY_US));
+            break;
+
+        case NRF24_START_UP:
+            break;
+
+        case NRF24_STANDBY:
+            if (rx) {
+                start_settling();
+            }
+            break;
+
+        case NRF24_RX_SETTLING:
+        case NRF24_RX:
+            if (!rx) {
+                host_timer_stop(&state_timer);
+                enter_state(NRF24_STANDBY);
+            }
+            break;
+
+        case NRF24_NUMBER_OF_STATES:
+        default:
+            break;
+    }
+}
+
+
+// ****************************************************************************
+static void state_timer_expired(void *context)
+{
+    (void)context;
+
+    if (state == NRF24_START_UP) {
+        enter_state(NRF24_STANDBY);
+        evaluate_state();
+    }
+    else if (state == NRF24_RX_SETTLING) {
+        enter_state(NRF24_RX);
+    }
+}
+
+
+// ****************************************************************************
+// The synthesizer has to settle again when the channel or data rate changes
+// ****************************************************************************
+static void retune(void)
+{
+    if (state == NRF24_RX || state == NRF24_RX_SETTLING) {
+        start_settling();
+    }
+}
+
+
+// ****************************************************************************
+static void ce_changed(unsigned int pin, bool level)
+{
+    if (pin != ce_pin || level == ce) {
+        return;
+    }
+
+    ce = level;
+    if (ce) {
+        ce_rising_at = host_cycles;
+    }
+    evaluate_state();
+}
+
+
+// ****************************************************************************
+// Registers and FIFO
+// ****************************************************************************
+static void flush_rx_fifo(void)
+{
+    rx_fifo_count = 0;
+    ++nrf24_stats.fifo_flushes;
+}
+
+
+// ****************************************************************************
+static void pop_rx_fifo(void)
+{
+    if (rx_fifo_count) {
+        --rx_fifo_count;
+        memmove(&rx_fifo[0], &rx_fifo[1], rx_fifo_count * sizeof(rx_fifo[0]));
+        ++nrf24_stats.payloads_read;
+    }
+}
+
+
+// ****************************************************************************
+static uint8_t read_register(uint8_t reg, unsigned int index)
+{
+    uint8_t *address = address_register(reg);
+    uint8_t value;
+
+    if (address) {
+        return index < NRF24_MAX_ADDRESS_WIDTH ? address[index] : 0;
+    }
+
+    if (index) {
+        return 0;
+    }
+
+    switch (reg) {
+        case STATUS:
+            return get_status();
+
+        case FIFO_STATUS:
+            value = FIFO_STATUS_TX_EMPTY;
+            value |= rx_fifo_count ? 0 : FIFO_STATUS_RX_EMPTY;
+            value |= rx_fifo_count == NRF24_RX_FIFO_DEPTH ? FIFO_STATUS_RX_FULL : 0;
+            return value;
+
+        default:
+            return reg < NUMBER_OF_REGISTERS ? registers[reg] : 0;
+    }
+}
+
+
+// ****************************************************************************
+static void write_register(uint8_t reg, unsigned int index, uint8_t value)
+{
+    uint8_t *address = address_register(reg);
+
+    if (reg != STATUS && ce && (registers[CONFIG] & PRIM_RX) && index == 0) {
+        ++nrf24_stats.writes_in_rx;
+    }
+
+    if (address) {
+        if (index < NRF24_MAX_ADDRESS_WIDTH) {
+            address[index] = value;
+        }
+        return;
+    }
+
+    if (index || reg >= NUMBER_OF_REGISTERS) {
+        return;
+    }
+
+    switch (reg) {
+        case STATUS:
+            registers[STATUS] &= ~(value & IRQ_FLAGS);
+            update_irq();
+            break;
+
+        case CONFIG:
+            registers[CONFIG] = value & 0x7f;
+            evaluate_state();
+            update_irq();
+            break;
+
+        case RF_CH:
+            registers[RF_CH] = value & 0x7f;
+            ++nrf24_stats.channel_writes;
+            trace_record(TRACE_HOP, 0, registers[RF_CH]);
+            retune();
+            break;
+
+        case RF_SETUP:
+            registers[RF_SETUP] = value;
+            retune();
+            break;
+
+        case OBSERVE_TX:
+        case RPD:
+        case FIFO_STATUS:
+            break;
+
+        default:
+            registers[reg] = value;
+            break;
+    }
+}
+
+
+// ****************************************************************************
+// SPI slave
+// ****************************************************************************
+static void spi_select(bool selected)
+{
+    if (selected) {
+        if (ce && host_cycles - ce_rising_at < HOST_US(TPECE2CSN_US)) {
+            ++nrf24_stats.ce_to_csn_violations;
+        }
+        byte_index = 0;
+        return;
+    }
+
+    // Commands are executed on the rising edge of CSN
+    if (command == R_RX_PAYLOAD && byte_index > 1) {
+        pop_rx_fifo();
+    }
+    else if (command == FLUSH_RX && byte_index > 0) {
+        flush_rx_fifo();
+    }
+    command = NOP;
+}
+
+
+// ****************************************************************************
+static uint8_t spi_exchange(uint8_t mosi)
+{
+    unsigned int index = byte_index - 1;
+    uint8_t miso = 0;
+
+    if (byte_index == 0) {
+        command = mosi;
+        ++byte_index;
+        return get_status();
+    }
+    ++byte_index;
+
+    if ((command & 0xe0) == R_REGISTER) {
+        miso = read_register(command & 0x1f, index);
+    }
+    else if ((command & 0xe0) == W_REGISTER) {
+        write_register(command & 0x1f, index, mosi);
+    }
+    else if (command == R_RX_PAYLOAD) {
+        if (rx_fifo_count && index < rx_fifo[0].length) {
+            miso = rx_fifo[0].payload[index];
+        }
+    }
+    else if (command == R_RX_PL_WID) {
+        miso = rx_fifo_count ? rx_fifo[0].length : 0;
+    }
+
+    return miso;
+}
+
+
+// ****************************************************************************
+// Air interface
+// ****************************************************************************
+uint64_t nrf24_air_time(const nrf24_packet_t *packet)
+{
+    static const uint32_t bit_rate[] = {
+        [DATA_RATE_250K] = 250000,
+        [DATA_RATE_1M] = 1000000,
+        [DATA_RATE_2M] = 2000000,
+    };
+    uint64_t bits;
+
+    bits = PREAMBLE_BITS + PCF_BITS;
+    bits += 8 * (packet->address_width + packet->length + packet->crc_length);
+
+    return bits * __SYSTEM_CLOCK / bit_rate[packet->data_rate];
+}
+
+
+// ****************************************************************************
+static bool packet_matches(const nrf24_packet_t *packet)
+{
+    unsigned int aw = (registers[SETUP_AW] & 0x3) + 2;
+
+    if (!(registers[EN_RXADDR] & DATA_PIPE_0)) {
+        return false;
+    }
+
+    if (packet->address_width != aw) {
+        return false;
+    }
+
+    if (memcmp(packet->address, rx_addr_p0, aw) != 0) {
+        return false;
+    }
+
+    if (packet->data_rate != get_data_rate()) {
+        return false;
+    }
+
+    if (packet->crc_length != get_crc_length()) {
+        return false;
+    }
+
+    if (dynamic_payload_length()) {
+        return packet->length >= 1 && packet->length <= NRF24_MAX_PAYLOAD;
+    }
+
+    return packet->length == registers[RX_PW_P0];
+}
+
+
+// ****************************************************************************
+static void packet_ended(void *context)
+{
+    air_packet_t *p = (air_packet_t *)context;
+    nrf24_outcome_t outcome;
+
+    p->in_use = false;
+
+    if (p->collided) {
+        outcome = NRF24_MISSED_COLLISION;
+    }
+    else if (!p->listening) {
+        outcome = NRF24_MISSED_NOT_LISTENING;
+    }
+    else if (!p->on_channel) {
+        outcome = NRF24_MISSED_WRONG_CHANNEL;
+    }
+    else if (p->epoch != listen_epoch || state != NRF24_RX) {
+        outcome = NRF24_MISSED_INTERRUPTED;
+    }
+    else if (!packet_matches(&p->packet)) {
+        outcome = NRF24_MISSED_MISMATCH;
+    }
+    else if (rx_fifo_count >= NRF24_RX_FIFO_DEPTH) {
+        outcome = NRF24_MISSED_FIFO_FULL;
+    }
+    else {
+        fifo_entry_t *entry = &rx_fifo[rx_fifo_count++];
+
+        entry->length = p->packet.length;
+        memcpy(entry->payload, p->packet.payload, p->packet.length);
+        registers[STATUS] |= RX_RD;
+        update_irq();
+
+        outcome = NRF24_RECEIVED;
+    }
+
+    ++nrf24_stats.outcomes[outcome];
+    trace_record(TRACE_PACKET, outcome, p->packet.channel | (p->packet.length << 8));
+
+    if (rx_hook) {
+        rx_hook(&p->packet, outcome);
+    }
+}
+
+
+// ****************************************************************************
+void nrf24_transmit(const nrf24_packet_t *packet)
+{
+    air_packet_t *p = NULL;
+    uint64_t end = host_cycles + nrf24_air_time(packet);
+    int i;
+
+    for (i = 0; i < MAX_PACKETS_ON_AIR; i++) {
+        if (!on_air[i].in_use) {
+            p = &on_air[i];
+            break;
+        }
+    }
+
+    ++nrf24_stats.packets_on_air;
+
+    if (!p) {
+        ++nrf24_stats.outcomes[NRF24_MISSED_COLLISION];
+        return;
+    }
+
+    p->in_use = true;
+    p->packet = *packet;
+    p->end = end;
+    p->listening = (state == NRF24_RX);
+    p->on_channel = (registers[RF_CH] == packet->channel);
+    p->epoch = listen_epoch;
+    p->collided = false;
+
+    // Any other packet on the same channel that is still on air destroys
+    // this one and vice versa.
+    for (i = 0; i < MAX_PACKETS_ON_AIR; i++) {
+        air_packet_t *other = &on_air[i];
+
+        if (other != p && other->in_use && other->packet.channel == packet->channel) {
+            other->collided = true;
+            p->collided = true;
+        }
+    }
+
+    p->timer.callback = packet_ended;
+    p->timer.context = p;
+    host_timer_start(&p->timer, end);
+}
+
+
+// ****************************************************************************
+void nrf24_set_rx_hook(nrf24_rx_hook_t hook)
+{
+    rx_hook = hook;
+}
+
+
+// ****************************************************************************
+nrf24_state_t nrf24_get_state(void)
+{
+    return state;
+}
+
+
+// ****************************************************************************
+uint8_t nrf24_get_channel(void)
+{
+    return registers[RF_CH];
+}
+
+
+// ****************************************************************************
+static void reset_registers(void)
+{
+    static const uint8_t reset_values[NUMBER_OF_REGISTERS] = {
+        [CONFIG] = 0x08,
+        [EN_AA] = 0x3f,
+        [EN_RXADDR] = 0x03,
+        [SETUP_AW] = 0x03,
+        [SETUP_RETR] = 0x03,
+        [RF_CH] = 0x02,
+        [RF_SETUP] = 0x0e,
+        [STATUS] = 0x0e,
+        [RX_ADDR_P2] = 0xc3,
+        [RX_ADDR_P3] = 0xc4,
+        [RX_ADDR_P4] = 0xc5,
+        [RX_ADDR_P5] = 0xc6,
+    };
+
+    memcpy(registers, reset_values, sizeof(registers));
+    memset(rx_addr_p0, 0xe7, sizeof(rx_addr_p0));
+    memset(rx_addr_p1, 0xc2, sizeof(rx_addr_p1));
+    memset(tx_addr, 0xe7, sizeof(tx_addr));
+    rx_fifo_count = 0;
+}
+
+
+// ****************************************************************************
+void nrf24_brown_out(void)
+{
+    ++nrf24_stats.brown_outs;
+    reset_registers();
+    evaluate_state();
+    update_irq();
+}
+
+
+// ****************************************************************************
+void nrf24_init(unsigned int ce_pin_number, unsigned int irq_pin_number)
+{
+    static const host_spi_device_t device = {
+        .select = spi_select,
+        .exchange = spi_exchange,
+    };
+
+    ce_pin = ce_pin_number;
+    irq_pin = irq_pin_number;
+
+    reset_registers();
+
+    state = NRF24_POWER_DOWN;
+    state_since = host_cycles;
+    state_timer.callback = state_timer_expired;
+    command = NOP;
+
+    host_set_spi_device(&device);
+    host_add_pin_hook(ce_changed);
+    update_irq();
+}
+
+
+// ****************************************************************************
+void nrf24_report(FILE *f)
+{
+    uint64_t total = host_cycles ? host_cycles : 1;
+    int i;
+
+    // Account for the time spent in the current state
+    nrf24_stats.state_cycles[state] += host_cycles - state_since;
+    state_since = host_cycles;
+
+    fprintf(f, "nRF24 packets on air:   %llu\n",
+        (unsigned long long)nrf24_stats.packets_on_air);
+    for (i = 0; i < NRF24_NUMBER_OF_OUTCOMES; i++) {
+        fprintf(f, "  %-22s%llu\n", nrf24_outcome_name(i),
+            (unsigned long long)nrf24_stats.outcomes[i]);
+    }
+    fprintf(f, "nRF24 payloads read:    %llu\n",
+        (unsigned long long)nrf24_stats.payloads_read);
+    fprintf(f, "nRF24 FIFO flushes:     %llu\n",
+        (unsigned long long)nrf24_stats.fifo_flushes);
+    fprintf(f, "nRF24 RX settles:       %llu\n",
+        (unsigned long long)nrf24_stats.settles);
+    fprintf(f, "nRF24 CE->CSN < 4 us:   %llu\n",
+        (unsigned long long)nrf24_stats.ce_to_csn_violations);
+    fprintf(f, "nRF24 writes in RX:     %llu\n",
+        (unsigned long long)nrf24_stats.writes_in_rx);
+    if (nrf24_stats.brown_outs) {
+        fprintf(f, "nRF24 brown-outs:       %llu\n",
+            (unsigned long long)nrf24_stats.brown_outs);
+    }
+
+    for (i = 0; i < NRF24_NUMBER_OF_STATES; i++) {
+        fprintf(f, "nRF24 %-12s      %.3f s (%.2f %%)\n", state_names[i],
+            (double)nrf24_stats.state_cycles[i] / __SYSTEM_CLOCK,
+            100.0 * nrf24_stats.state_cycles[i] / total);
+    }
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#define NRF24_MAX_PAYLOAD 32
+#define NRF24_MAX_ADDRESS_WIDTH 5
+#define NRF24_RX_FIFO_DEPTH 3
+
+// Datasheet table 16 (worst case with a 90 mH crystal) and section 6.1.7
+#define NRF24_TPD2STBY_US 4500
+#define NRF24_TSTBY2A_US 130
+
+
+typedef struct {
+    uint8_t channel;
+    uint8_t data_rate;              // DATA_RATE_250K, DATA_RATE_1M, DATA_RATE_2M
+    uint8_t crc_length;             // 0, 1 or 2 bytes
+    uint8_t address_width;
+    uint8_t address[NRF24_MAX_ADDRESS_WIDTH];   // LSB first, like RX_ADDR_P0
+    uint8_t length;
+    uint8_t payload[NRF24_MAX_PAYLOAD];
+} nrf24_packet_t;
+
+typedef enum {
+    NRF24_POWER_DOWN,
+    NRF24_START_UP,                 // PWR_UP set, waiting Tpd2stby
+    NRF24_STANDBY,
+    NRF24_RX_SETTLING,              // CE high or channel changed, waiting Tstby2a
+    NRF24_RX,
+    NRF24_NUMBER_OF_STATES
+} nrf24_state_t;
+
+typedef enum {
+    NRF24_RECEIVED,
+    NRF24_MISSED_NOT_LISTENING,     // Not in RX mode, or still settling
+    NRF24_MISSED_WRONG_CHANNEL,
+    NRF24_MISSED_INTERRUPTED,       // Receiver re-tuned during the packet
+    NRF24_MISSED_MISMATCH,          // Address, data rate, CRC or length
+    NRF24_MISSED_FIFO_FULL,
+    NRF24_MISSED_COLLISION,
+    NRF24_NUMBER_OF_OUTCOMES
+} nrf24_outcome_t;
+
+typedef struct {
+    uint64_t packets_on_air;
+    uint64_t outcomes[NRF24_NUMBER_OF_OUTCOMES];
+    uint64_t fifo_flushes;
+    uint64_t payloads_read;
+    uint64_t settles;
+    uint64_t ce_to_csn_violations;  // CSN low less than 4 us after CE rising
+    uint64_t writes_in_rx;          // Config register writes while CE is high
+    uint64_t channel_writes;        // RF_CH writes: hops, whatever the firmware
+    uint64_t brown_outs;
+    uint64_t state_cycles[NRF24_NUMBER_OF_STATES];
+} nrf24_stats_t;
+
+typedef void (* nrf24_rx_hook_t)(const nrf24_packet_t *packet, nrf24_outcome_t outcome);
+
+
+extern nrf24_stats_t nrf24_stats;
+
+
+void nrf24_init(unsigned int ce_pin, unsigned int irq_pin);
+
+// Puts a packet on air, starting now
+void nrf24_transmit(const nrf24_packet_t *packet);
+
+// On-air time of a packet in CPU cycles
+uint64_t nrf24_air_time(const nrf24_packet_t *packet);
+
+// Called at the end of every packet, whether it was received or not
+void nrf24_set_rx_hook(nrf24_rx_hook_t hook);
+
+// Resets the registers and the FIFOs, like a supply dip does that the MCU
+// survives
+void nrf24_brown_out(void);
+
+nrf24_state_t nrf24_get_state(void);
+uint8_t nrf24_get_channel(void);
+
+void nrf24_report(FILE *f);
+
+
+// ****************************************************************************
+// Inline so that tools reading traces can use it without the model
+// ****************************************************************************
+static inline const char *nrf24_outcome_name(nrf24_outcome_t outcome)
+{
+    static const char *names[NRF24_NUMBER_OF_OUTCOMES] = {
+        "received",
+        "missed, not in RX",
+        "missed, wrong channel",
+        "missed, interrupted",
+        "missed, mismatch",
+        "missed, FIFO full",
+        "missed, collision",
+    };
+
+    return outcome < NRF24_NUMBER_OF_OUTCOMES ? names[outcome] : "?";
+}
@@ -0,0 +1,80 @@
+/******************************************************************************
+
+    Binary event trace of a host simulation run. See trace.h for the format.
+
+******************************************************************************/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+
+#define TRACE_BUFFER_SIZE (1024 * 1024)
+
+
+static FILE *trace_file;
+static uint32_t trace_mask;
+static uint64_t records_written;
+
+// ****************************************************************************
+static void write_le64(uint64_t value)
+{
+    uint8_t bytes[8];
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        bytes[i] = (uint8_t)(value >> (8 * i));
+    }
+    fwrite(bytes, sizeof(bytes), 1, trace_file);
+}
+
+
+// ****************************************************************************
+bool trace_open(const char *filename, uint32_t type_mask)
+{
+    uint8_t header[TRACE_HEADER_SIZE];
+
+    trace_file = fopen(filename, "wb");
+    if (!trace_file) {
+        perror(filename);
+        return false;
+    }
+    setvbuf(trace_file, NULL, _IOFBF, TRACE_BUFFER_SIZE);
+
+    // Magic, followed by the record size and reserved bytes
+    memset(header, 0, sizeof(header));
+    memcpy(header, TRACE_MAGIC, strlen(TRACE_MAGIC));
+    header[8] = sizeof(trace_record_t);
+    fwrite(header, sizeof(header), 1, trace_file);
+
+    trace_mask = type_mask;
+    records_written = 0;
+    return true;
+}
+
+
+// ****************************************************************************
+void trace_write(uint64_t time_us, trace_type_t type, unsigned int index, unsigned int value)
+{
+    if (!trace_file || !(trace_mask & (1u << type))) {
+        return;
+    }
+
+    write_le64(TRACE_RECORD(time_us, type, index, value));
+    ++records_written;
+}
+
+
+// ****************************************************************************
+void trace_close(void)
+{
+    if (trace_file) {
+        fclose(trace_file);
+        trace_file = NULL;
+        fprintf(stderr, "Trace: %llu records\n", (unsigned long long)records_written);
+    }
+}
+
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "hal.h"
+
+// ****************************************************************************
+// Binary event trace of a simulation run
+//
+// The file consists of a 16 byte header followed by 8 byte records in
+// little endian byte order, so it can be memory-mapped and indexed directly.
+// Records are in chronological order.
+//
+//      bits 63..24     Time in microseconds (enough for 12 days)
+//      bits 23..20     Record type (trace_type_t)
+//      bits 19..16     Type specific index
+//      bits 15..0      Type specific value
+// ****************************************************************************
+
+#define TRACE_MAGIC "RXTRACE1"
+#define TRACE_HEADER_SIZE 16
+
+#define TRACE_RECORD(us, type, index, value) \
+    (((uint64_t)(us) << 24) | (((uint64_t)(type) & 0xf) << 20) | \
+     (((uint64_t)(index) & 0xf) << 16) | ((uint64_t)(value) & 0xffff))
+
+#define TRACE_TIME_US(record) ((record) >> 24)
+#define TRACE_TYPE(record) ((trace_type_t)(((record) >> 20) & 0xf))
+#define TRACE_INDEX(record) ((unsigned int)(((record) >> 16) & 0xf))
+#define TRACE_VALUE(record) ((unsigned int)((record) & 0xffff))
+
+
+typedef enum {
+    // End of a packet on air. Index: nrf24_outcome_t,
+    // value: channel | (payload length << 8)
+    TRACE_PACKET,
+
+    // RF_CH written. Value: channel
+    TRACE_HOP,
+
+    // MATCHREL[index].L / MATCHREL[index].H changed. Value: new value
+    TRACE_MATCHREL_L,
+    TRACE_MATCHREL_H,
+
+    // The receiver entered failsafe. Value: milliseconds since the last
+    // received packet (saturated)
+    TRACE_FAILSAFE,
+
+    // The receiver left failsafe (LED steady on again)
+    TRACE_FAILSAFE_END,
+
+    TRACE_NUMBER_OF_TYPES
+} trace_type_t;
+
+typedef uint64_t trace_record_t;
+
+
+// Records of types whose bit is cleared in the mask are not written
+bool trace_open(const char *filename, uint32_t type_mask);
+void trace_write(uint64_t time_us, trace_type_t type, unsigned int index, unsigned int value);
+void trace_close(void);
+
+
+// ****************************************************************************
+static inline const char *trace_type_name(trace_type_t type)
+{
+    static const char *names[TRACE_NUMBER_OF_TYPES] = {
+        "packet",
+        "hop",
+        "matchrel-l",
+        "matchrel-h",
+        "failsafe",
+        "failsafe-end",
+    };
+
+    return type < TRACE_NUMBER_OF_TYPES ? names[type] : "?";
+}
+
+
+// ****************************************************************************
+// Writes a record with the current virtual time
+// ****************************************************************************
+static inline void trace_record(trace_type_t type, unsigned int index, unsigned int value)
+{
+    trace_write(host_cycles / HOST_CYCLES_PER_US, type, index, value);
+}
@@ -0,0 +1,257 @@
+/******************************************************************************
+
+    Queries a binary event trace written by receiver-host -T.
+
+    Usage: trace-query [options] trace-file
+
+        -p          Print the records (default: summary only)
+        -t type     Only consider records of the given type (see -l)
+        -f seconds  Start at the given virtual time
+        -u seconds  Stop at the given virtual time
+        -l          List the record types
+
+    The trace is memory-mapped, and the start time is found by binary
+    search, so querying a small window of a 24 hour trace is instant.
+
+******************************************************************************/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "nrf24.h"
+#include "trace.h"
+
+
+static const trace_record_t *records;
+static size_t number_of_records;
+
+
+// ****************************************************************************
+static void usage(const char *name)
+{
+    fprintf(stderr,
+        "Usage: %s [-p] [-t type] [-f seconds] [-u seconds] [-l] trace-file\n",
+        name);
+    exit(1);
+}
+
+
+// ****************************************************************************
+static int type_from_name(const char *name)
+{
+    int i;
+
+    for (i = 0; i < TRACE_NUMBER_OF_TYPES; i++) {
+        if (strcmp(name, trace_type_name(i)) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+// ****************************************************************************
+static bool map_trace(const char *filename)
+{
+    struct stat st;
+    const uint8_t *data;
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror(filename);
+        return false;
+    }
+
+    if (fstat(fd, &st) != 0 || st.st_size < TRACE_HEADER_SIZE) {
+        fprintf(stderr, "%s: not a trace file\n", filename);
+        close(fd);
+        return false;
+    }
+
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror("mmap");
+        return false;
+    }
+
+    if (memcmp(data, TRACE_MAGIC, strlen(TRACE_MAGIC)) != 0 ||
+            data[8] != sizeof(trace_record_t)) {
+        fprintf(stderr, "%s: not a trace file\n", filename);
+        return false;
+    }
+
+    // The records are little endian, like the host we run on
+    records = (const trace_record_t *)(data + TRACE_HEADER_SIZE);
+    number_of_records = (st.st_size - TRACE_HEADER_SIZE) / sizeof(trace_record_t);
+    return true;
+}
+
+
+// ****************************************************************************
+// Index of the first record at or after the given time
+// ****************************************************************************
+static size_t find_time(uint64_t us)
+{
+    size_t low = 0;
+    size_t high = number_of_records;
+
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+
+        if (TRACE_TIME_US(records[mid]) < us) {
+            low = mid + 1;
+        }
+        else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+
+// ****************************************************************************
+static void print_record(trace_record_t r)
+{
+    unsigned int index = TRACE_INDEX(r);
+    unsigned int value = TRACE_VALUE(r);
+
+    printf("%14.6f %-12s ", TRACE_TIME_US(r) / 1e6, trace_type_name(TRACE_TYPE(r)));
+
+    switch (TRACE_TYPE(r)) {
+        case TRACE_PACKET:
+            printf("ch %3u len %2u %s\n", value & 0xff, value >> 8,
+                nrf24_outcome_name(index));
+            break;
+
+        case TRACE_HOP:
+            printf("ch %3u\n", value);
+            break;
+
+        case TRACE_MATCHREL_L:
+        case TRACE_MATCHREL_H:
+            printf("[%u] %u\n", index, value);
+            break;
+
+        case TRACE_FAILSAFE:
+            printf("%u ms after the last packet\n", value);
+            break;
+
+        case TRACE_FAILSAFE_END:
+        case TRACE_NUMBER_OF_TYPES:
+        default:
+            printf("\n");
+            break;
+    }
+}
+
+
+// ****************************************************************************
+int main(int argc, char *argv[])
+{
+    uint64_t type_counts[TRACE_NUMBER_OF_TYPES];
+    uint64_t outcomes[NRF24_NUMBER_OF_OUTCOMES];
+    uint64_t from_us = 0;
+    uint64_t until_us = UINT64_MAX;
+    uint64_t last_received = UINT64_MAX;
+    uint64_t longest_gap = 0;
+    uint64_t longest_gap_at = 0;
+    bool print = false;
+    int type = -1;
+    size_t i;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "pt:f:u:l")) != -1) {
+        switch (opt) {
+            case 'p':
+                print = true;
+                break;
+
+            case 't':
+                type = type_from_name(optarg);
+                if (type < 0) {
+                    fprintf(stderr, "Unknown record type '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+
+            case 'f':
+                from_us = (uint64_t)(strtod(optarg, NULL) * 1e6);
+                break;
+
+            case 'u':
+                until_us = (uint64_t)(strtod(optarg, NULL) * 1e6);
+                break;
+
+            case 'l':
+                for (i = 0; i < TRACE_NUMBER_OF_TYPES; i++) {
+                    printf("%s\n", trace_type_name(i));
+                }
+                return 0;
+
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if (optind != argc - 1 || !map_trace(argv[optind])) {
+        usage(argv[0]);
+    }
+
+    memset(type_counts, 0, sizeof(type_counts));
+    memset(outcomes, 0, sizeof(outcomes));
+
+    for (i = find_time(from_us); i < number_of_records; i++) {
+        trace_record_t r = records[i];
+        uint64_t us = TRACE_TIME_US(r);
+
+        if (us >= until_us) {
+            break;
+        }
+
+        if (type >= 0 && TRACE_TYPE(r) != (trace_type_t)type) {
+            continue;
+        }
+
+        if (TRACE_TYPE(r) < TRACE_NUMBER_OF_TYPES) {
+            ++type_counts[TRACE_TYPE(r)];
+        }
+
+        if (TRACE_TYPE(r) == TRACE_PACKET && TRACE_INDEX(r) < NRF24_NUMBER_OF_OUTCOMES) {
+            ++outcomes[TRACE_INDEX(r)];
+
+            if (TRACE_INDEX(r) == NRF24_RECEIVED) {
+                if (last_received != UINT64_MAX && us - last_received > longest_gap) {
+                    longest_gap = us - last_received;
+                    longest_gap_at = last_received;
+                }
+                last_received = us;
+            }
+        }
+
+        if (print) {
+            print_record(r);
+        }
+    }
+
+    printf("Records in file:        %zu\n", number_of_records);
+    for (i = 0; i < TRACE_NUMBER_OF_TYPES; i++) {
+        printf("%-24s%llu\n", trace_type_name(i), (unsigned long long)type_counts[i]);
+    }
+    for (i = 0; i < NRF24_NUMBER_OF_OUTCOMES; i++) {
+        printf("  %-22s%llu\n", nrf24_outcome_name(i), (unsigned long long)outcomes[i]);
+    }
+    if (longest_gap) {
+        printf("Longest packet gap:     %.3f ms, starting at %.6f s\n",
+            longest_gap / 1e3, longest_gap_at / 1e6);
+    }
+
+    return 0;
+}
@@ -0,0 +1,576 @@
+/******************************************************************************
+
+    Model of the transmitters the receiver works with: the HK310 and 3XS
+    (3 channels), modified HK310 nRF modules (4 channels) and the LANE Boys RC
+    headless transmitter (8 channels).
+
+    Every 5 ms the transmitter sends a packet train of two stick packets,
+    which are failsafe packets in every 17th train, on the current hop
+    channel, followed by one bind packet on channel 81 at low power.
+    See doc/hkr3000-info.md, doc/4-channel-info.md and doc/8-channel-info.md.
+
+    Each packet is loaded into the nRF24 and started when the previous one
+    has left the air; the nRF24 needs Tstby2a to ramp up the PLL before the
+    next packet goes out.
+
+    On top of the protocol the model adds the crystal error of the
+    transmitter, outages (transmitter switched off) and burst losses using
+    a Gilbert-Elliott channel. Losses are random but repeatable: they only
+    depend on the seed.
+
+******************************************************************************/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <rf.h>
+#include <stickdata.h>
+
+#include "transmitter.h"
+
+
+#define TRAIN_TIME_US 5000
+#define FAILSAFE_TRAIN_INTERVAL 17
+#define NUMBER_OF_SLOTS 3
+
+// Time for the transmitter MCU to load the next payload over SPI
+#define LOAD_TIME_US 40
+
+#define PAYLOAD_SIZE_4CH 10
+#define PAYLOAD_SIZE_8CH 13
+#define BIND_PAYLOAD_SIZE_8CH 27
+
+#define STICKDATA_PACKETID_3CH 0x55
+#define FAILSAFE_PACKETID_3CH 0xaa
+#define STICKDATA_PACKETID_4CH 0x56
+#define FAILSAFE_PACKETID_4CH 0xab
+#define STICKDATA_PACKETID_8CH 0x57
+#define FAILSAFE_PACKETID_8CH 0xac
+
+static const uint8_t BIND_ADDRESS[TRANSMITTER_ADDRESS_WIDTH] = {0x12, 0x23, 0x23, 0x45, 0x78};
+
+
+// ****************************************************************************
+// xorshift64*, so that runs are repeatable independent of the C library
+// ****************************************************************************
+static uint64_t next_random(uint64_t *state)
+{
+    uint64_t x = *state;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545f4914f6cdd1dull;
+}
+
+
+// ****************************************************************************
+static double random_probability(uint64_t *state)
+{
+    return (double)(next_random(state) >> 11) / (double)(1ull << 53);
+}
+
+
+// ****************************************************************************
+void transmitter_default_config(transmitter_config_t *config, rx_protocol_t protocol, uint64_t seed)
+{
+    uint64_t state = seed ? seed : 1;
+    unsigned int first_hop;
+    int i;
+
+    memset(config, 0, sizeof(*config));
+
+    config->protocol = protocol;
+    config->seed = seed;
+    config->failsafe_enabled = true;
+
+    for (i = 0; i < TRANSMITTER_ADDRESS_WIDTH; i++) {
+        config->address[i] = (uint8_t)next_random(&state);
+    }
+
+    // Like the transmitters do: a random start channel, then consecutive
+    // channels
+    first_hop = next_random(&state) % 50;
+    for (i = 0; i < TRANSMITTER_NUMBER_OF_HOP_CHANNELS; i++) {
+        config->hop[i] = (uint8_t)(first_hop + i);
+    }
+
+    for (i = 0; i < TRANSMITTER_NUMBER_OF_CHANNELS; i++) {
+        config->sticks[i].shape = TRAJECTORY_CONSTANT;
+        config->sticks[i].center = CHANNEL_CENTER;
+        config->sticks[i].period_ms = 1000;
+        config->failsafe[i] = CHANNEL_CENTER;
+    }
+}
+
+
+// ****************************************************************************
+void transmitter_get_bind_data(const transmitter_t *tx, uint8_t *data)
+{
+    memcpy(data, tx->config.address, TRANSMITTER_ADDRESS_WIDTH);
+    memcpy(data + TRANSMITTER_ADDRESS_WIDTH, tx->config.hop, TRANSMITTER_NUMBER_OF_HOP_CHANNELS);
+    data[TRANSMITTER_BIND_DATA_SIZE - 1] = (uint8_t)tx->config.protocol;
+}
+
+
+// ****************************************************************************
+int32_t transmitter_get_channel(const transmitter_t *tx, unsigned int channel, uint64_t at)
+{
+    const trajectory_t *t = &tx->config.sticks[channel];
+    uint64_t period = HOST_MS(t->period_ms ? t->period_ms : 1);
+    double phase = (double)(at % period) / (double)period;
+    int32_t value;
+
+    switch (t->shape) {
+        case TRAJECTORY_SINE:
+            value = t->center + (int32_t)lround(t->amplitude * sin(2 * M_PI * phase));
+            break;
+
+        case TRAJECTORY_SQUARE:
+            value = t->center + (phase < 0.5 ? t->amplitude : -t->amplitude);
+            break;
+
+        case TRAJECTORY_RAMP:
+            value = t->center - t->amplitude + (int32_t)lround(2 * t->amplitude * phase);
+            break;
+
+        case TRAJECTORY_CONSTANT:
+        case TRAJECTORY_NUMBER_OF_SHAPES:
+        default:
+            value = t->center;
+            break;
+    }
+
+    if (value > CHANNEL_100_PERCENT) {
+        value = CHANNEL_100_PERCENT;
+    }
+    if (value < CHANNEL_N100_PERCENT) {
+        value = CHANNEL_N100_PERCENT;
+    }
+    return value;
+}
+
+
+// ****************************************************************************
+// The HK310 sends timer values for the 750 ns timer of the nRF24LE1:
+//
+//      servo_pulse_in_us = (0xffff - stickdata) * 3 / 4
+//
+// ****************************************************************************
+static uint16_t channel_to_timer(int32_t ch)
+{
+    int32_t pulse_us;
+
+    pulse_us = 1500 + ch * 500 / CHANNEL_100_PERCENT;
+    return (uint16_t)(0xffff - pulse_us * 4 / 3);
+}
+
+
+// ****************************************************************************
+uint32_t transmitter_expected_pulse_us(const transmitter_t *tx, int32_t value)
+{
+    if (tx->config.protocol == PROTOCOL_8CH) {
+        return 476 + channel_to_stickdata(value) / 2;
+    }
+    return (0xffff - channel_to_timer(value)) * 3 / 4;
+}
+
+
+// ****************************************************************************
+static void build_4ch_stick_packet(const transmitter_t *tx, nrf24_packet_t *packet,
+    const int32_t *ch, bool failsafe)
+{
+    bool is4ch = (tx->config.protocol == PROTOCOL_4CH);
+    uint16_t value;
+    int i;
+
+    packet->length = PAYLOAD_SIZE_4CH;
+
+    for (i = 0; i < 3; i++) {
+        value = channel_to_timer(ch[i]);
+        packet->payload[2 * i] = (uint8_t)value;
+        packet->payload[2 * i + 1] = (uint8_t)(value >> 8);
+    }
+
+    // Unused by the HK310; the 4ch protocol puts CH4 there. The values are
+    // what a captured HK310 packet contains.
+    if (is4ch) {
+        value = channel_to_timer(ch[3]);
+        packet->payload[6] = (uint8_t)value;
+        packet->payload[9] = (uint8_t)(value >> 8);
+    }
+    else {
+        packet->payload[6] = 0xb8;
+        packet->payload[9] = 0x0f;
+    }
+
+    if (failsafe) {
+        packet->payload[7] = is4ch ? FAILSAFE_PACKETID_4CH : FAILSAFE_PACKETID_3CH;
+        packet->payload[8] = tx->config.failsafe_enabled ? 0x5a : 0x5b;
+    }
+    else {
+        packet->payload[7] = is4ch ? STICKDATA_PACKETID_4CH : STICKDATA_PACKETID_3CH;
+        packet->payload[8] = 0x67;
+    }
+}
+
+
+// ****************************************************************************
+static void build_8ch_stick_packet(nrf24_packet_t *packet, const int32_t *ch, bool failsafe)
+{
+    int i;
+
+    packet->length = PAYLOAD_SIZE_8CH;
+    packet->payload[0] = failsafe ? FAILSAFE_PACKETID_8CH : STICKDATA_PACKETID_8CH;
+
+    for (i = 0; i < TRANSMITTER_NUMBER_OF_CHANNELS; i += 2) {
+        uint16_t a = channel_to_stickdata(ch[i]);
+        uint16_t b = channel_to_stickdata(ch[i + 1]);
+
+        packet->payload[1 + i] = (uint8_t)a;
+        packet->payload[2 + i] = (uint8_t)b;
+        packet->payload[9 + i / 2] = ((a >> 8) & 0x0f) | ((b >> 4) & 0xf0);
+    }
+}
+
+
+// ****************************************************************************
+// The 3/4ch transmitters cycle through four bind packets, the headless
+// transmitter sends all bind data in a single packet.
+// ****************************************************************************
+static void build_bind_packet(const transmitter_t *tx, nrf24_packet_t *packet)
+{
+    const transmitter_config_t *c = &tx->config;
+    uint16_t checksum = 0;
+    int i;
+
+    packet->channel = TRANSMITTER_BIND_CHANNEL;
+    memcpy(packet->address, BIND_ADDRESS, TRANSMITTER_ADDRESS_WIDTH);
+
+    if (c->protocol == PROTOCOL_8CH) {
+        packet->data_rate = DATA_RATE_2M;
+        packet->length = BIND_PAYLOAD_SIZE_8CH;
+        packet->payload[0] = 0xac;
+        packet->payload[1] = 0x57;
+        memcpy(&packet->payload[2], c->address, TRANSMITTER_ADDRESS_WIDTH);
+        memcpy(&packet->payload[7], c->hop, TRANSMITTER_NUMBER_OF_HOP_CHANNELS);
+        return;
+    }
+
+    packet->length = PAYLOAD_SIZE_4CH;
+
+    for (i = 0; i < TRANSMITTER_ADDRESS_WIDTH; i++) {
+        checksum += c->address[i];
+    }
+
+    switch (tx->train % 4) {
+        case 0:
+            packet->payload[0] = 0xff;
+            if (c->protocol == PROTOCOL_4CH) {
+                packet->payload[1] = 0xab;
+                packet->payload[2] = 0x56;
+            }
+            else {
+                packet->payload[1] = 0xaa;
+                packet->payload[2] = 0x55;
+            }
+            memcpy(&packet->payload[3], c->address, TRANSMITTER_ADDRESS_WIDTH);
+            break;
+
+        default:
+            packet->payload[0] = (uint8_t)checksum;
+            packet->payload[1] = (uint8_t)(checksum >> 8);
+            packet->payload[2] = (uint8_t)(tx->train % 4 - 1);
+            memcpy(&packet->payload[3], &c->hop[(tx->train % 4 - 1) * 7],
+                tx->train % 4 == 3 ? 6 : 7);
+            break;
+    }
+}
+
+
+// ****************************************************************************
+static void build_packet(transmitter_t *tx, nrf24_packet_t *packet)
+{
+    const transmitter_config_t *c = &tx->config;
+    int32_t ch[TRANSMITTER_NUMBER_OF_CHANNELS];
+    bool failsafe;
+    int i;
+
+    memset(packet, 0, sizeof(*packet));
+    packet->data_rate = DATA_RATE_250K;
+    packet->crc_length = CRC_2_BYTES;
+    packet->address_width = TRANSMITTER_ADDRESS_WIDTH;
+
+    if (tx->slot == NUMBER_OF_SLOTS - 1) {
+        build_bind_packet(tx, packet);
+        ++tx->stats.bind_packets;
+        return;
+    }
+
+    packet->channel = c->hop[tx->train % TRANSMITTER_NUMBER_OF_HOP_CHANNELS];
+    memcpy(packet->address, c->address, TRANSMITTER_ADDRESS_WIDTH);
+
+    // The 8ch failsafe packet has no "off" flag, so the headless transmitter
+    // sends stick data instead when failsafe is off
+    failsafe = (tx->train % FAILSAFE_TRAIN_INTERVAL) == FAILSAFE_TRAIN_INTERVAL - 1;
+    if (c->protocol == PROTOCOL_8CH && !c->failsafe_enabled) {
+        failsafe = false;
+    }
+
+    for (i = 0; i < TRANSMITTER_NUMBER_OF_CHANNELS; i++) {
+        ch[i] = failsafe ? c->failsafe[i] : transmitter_get_channel(tx, i, tx->train_start);
+    }
+
+    if (c->protocol == PROTOCOL_8CH) {
+        build_8ch_stick_packet(packet, ch, failsafe);
+    }
+    else {
+        build_4ch_stick_packet(tx, packet, ch, failsafe);
+    }
+
+    if (failsafe) {
+        ++tx->stats.failsafe_packets;
+    }
+    else {
+        ++tx->stats.stick_packets;
+    }
+}
+
+
+// ****************************************************************************
+static bool is_muted(transmitter_t *tx, uint64_t at)
+{
+    const transmitter_config_t *c = &tx->config;
+    uint64_t offset;
+
+    if (!c->outage_length || at < c->outage_start) {
+        return false;
+    }
+
+    offset = at - c->outage_start;
+    if (c->outage_period) {
+        offset %= c->outage_period;
+    }
+    else if (offset >= c->outage_length) {
+        tx->last_outage_end = c->outage_start + c->outage_length;
+        return false;
+    }
+
+    if (offset >= c->outage_length) {
+        tx->last_outage_end = at - offset + c->outage_length;
+        return false;
+    }
+    return true;
+}
+
+
+// ****************************************************************************
+// Gilbert-Elliott channel: the state changes before each packet, and the
+// loss probability depends on the state
+// ****************************************************************************
+static bool is_lost(transmitter_t *tx)
+{
+    const gilbert_elliott_t *l = &tx->config.loss;
+
+    if (tx->bad_state) {
+        if (random_probability(&tx->random_state) < l->r) {
+            tx->bad_state = false;
+        }
+    }
+    else if (random_probability(&tx->random_state) < l->p) {
+        tx->bad_state = true;
+        ++tx->stats.bursts;
+    }
+
+    return random_probability(&tx->random_state) <
+        (tx->bad_state ? l->loss_bad : l->loss_good);
+}
+
+
+// ****************************************************************************
+// Start of a packet train, with the crystal error applied. Computed from the
+// train number so that the error does not accumulate rounding errors.
+// ****************************************************************************
+static uint64_t train_start_time(const transmitter_t *tx, uint64_t train)
+{
+    int64_t nominal = (int64_t)(train * HOST_US(TRAIN_TIME_US));
+
+    return tx->config.start + nominal + nominal * tx->config.drift_ppm / 1000000;
+}
+
+
+// ****************************************************************************
+static bool is_audible(const transmitter_t *tx, uint8_t channel)
+{
+    return (tx->audible[channel / 64] >> (channel % 64)) & 1;
+}
+
+
+// ****************************************************************************
+static uint8_t slot_channel(const transmitter_t *tx)
+{
+    if (tx->slot == NUMBER_OF_SLOTS - 1) {
+        return TRANSMITTER_BIND_CHANNEL;
+    }
+    return tx->config.hop[tx->train % TRANSMITTER_NUMBER_OF_HOP_CHANNELS];
+}
+
+
+// ****************************************************************************
+// Sends the packet of the current slot at *at*, if it is audible, and moves
+// on to the next slot. Returns the start of the next slot.
+// ****************************************************************************
+static uint64_t send_packet(transmitter_t *tx, uint64_t at)
+{
+    nrf24_packet_t packet;
+    uint64_t next;
+
+    build_packet(tx, &packet);
+
+    if (is_muted(tx, at)) {
+        ++tx->stats.muted;
+    }
+    else if (is_lost(tx)) {
+        ++tx->stats.lost;
+    }
+    else if (is_audible(tx, packet.channel)) {
+        nrf24_transmit(&packet);
+    }
+
+    next = at + nrf24_air_time(&packet) + HOST_US(LOAD_TIME_US + NRF24_TSTBY2A_US);
+
+    if (++tx->slot >= NUMBER_OF_SLOTS) {
+        tx->slot = 0;
+        ++tx->train;
+        ++tx->stats.trains;
+        tx->train_start = train_start_time(tx, tx->train);
+        next = tx->train_start;
+    }
+
+    return next;
+}
+
+
+// ****************************************************************************
+// Slots on channels that are not audible are accounted for right away
+// rather than with an event each, up to one pass through the hop channels
+// ****************************************************************************
+static void send_slot(void *context)
+{
+    transmitter_t *tx = context;
+    uint64_t next = host_cycles;
+    unsigned int slots = 0;
+
+    do {
+        next = send_packet(tx, next);
+    } while (!is_audible(tx, slot_channel(tx)) &&
+        ++slots < NUMBER_OF_SLOTS * TRANSMITTER_NUMBER_OF_HOP_CHANNELS);
+
+    host_timer_start(&tx->timer, next);
+}
+
+
+// ****************************************************************************
+void transmitter_init(transmitter_t *tx, const transmitter_config_t *config)
+{
+    memset(tx, 0, sizeof(*tx));
+
+    tx->config = *config;
+    tx->random_state = config->seed ? config->seed : 1;
+    tx->audible[0] = UINT64_MAX;
+    tx->audible[1] = UINT64_MAX;
+    tx->train_start = train_start_time(tx, 0);
+
+    tx->timer.callback = send_slot;
+    tx->timer.context = tx;
+    host_timer_start(&tx->timer, tx->train_start);
+}
+
+
+// ****************************************************************************
+void transmitter_set_audible_channels(transmitter_t *tx, const uint8_t *channels,
+    unsigned int count)
+{
+    unsigned int i;
+
+    tx->audible[0] = 0;
+    tx->audible[1] = 0;
+
+    for (i = 0; i < count; i++) {
+        tx->audible[(channels[i] / 64) & 1] |= 1ull << (channels[i] % 64);
+    }
+}
+
+
+// ****************************************************************************
+uint64_t transmitter_last_outage_end(const transmitter_t *tx)
+{
+    return tx->last_outage_end;
+}
+
+
+// ****************************************************************************
+bool transmitter_parse_trajectory(trajectory_t *trajectory, const char *text)
+{
+    static const char *shapes[TRAJECTORY_NUMBER_OF_SHAPES] = {
+        "const", "sine", "square", "ramp"
+    };
+    const char *colon = strchr(text, ':');
+    size_t length = colon ? (size_t)(colon - text) : strlen(text);
+    char *end;
+    int i;
+
+    for (i = 0; i < TRAJECTORY_NUMBER_OF_SHAPES; i++) {
+        if (strlen(shapes[i]) == length && strncmp(text, shapes[i], length) == 0) {
+            break;
+        }
+    }
+    if (i >= TRAJECTORY_NUMBER_OF_SHAPES) {
+        return false;
+    }
+    trajectory->shape = (trajectory_shape_t)i;
+
+    if (!colon) {
+        return true;
+    }
+    trajectory->center = strtol(colon + 1, &end, 0);
+
+    if (*end != ':') {
+        return *end == '\0';
+    }
+    trajectory->amplitude = strtol(end + 1, &end, 0);
+
+    if (*end != ':') {
+        return *end == '\0';
+    }
+    trajectory->period_ms = strtoul(end + 1, &end, 0);
+
+    return *end == '\0';
+}
+
+
+// ****************************************************************************
+void transmitter_report(const transmitter_t *tx, FILE *f)
+{
+    const transmitter_stats_t *s = &tx->stats;
+    uint64_t sent = s->stick_packets + s->failsafe_packets + s->bind_packets;
+
+    fprintf(f, "Transmitter:            %s, %+d ppm\n",
+        tx->config.protocol == PROTOCOL_8CH ? "8ch" :
+        tx->config.protocol == PROTOCOL_4CH ? "4ch" : "3ch",
+        tx->config.drift_ppm);
+    fprintf(f, "  Packet trains:        %llu\n", (unsigned long long)s->trains);
+    fprintf(f, "  Stick packets:        %llu\n", (unsigned long long)s->stick_packets);
+    fprintf(f, "  Failsafe packets:     %llu\n", (unsigned long long)s->failsafe_packets);
+    fprintf(f, "  Bind packets:         %llu\n", (unsigned long long)s->bind_packets);
+    fprintf(f, "  Muted (outage):       %llu\n", (unsigned long long)s->muted);
+    if (sent) {
+        fprintf(f, "  Lost (channel model): %llu (%.2f %%, %llu bursts)\n",
+            (unsigned long long)s->lost, 100.0 * (double)s->lost / (double)sent,
+            (unsigned long long)s->bursts);
+    }
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include <rc_receiver.h>
+
+#include "hal.h"
+#include "nrf24.h"
+
+#define TRANSMITTER_NUMBER_OF_CHANNELS 8
+#define TRANSMITTER_ADDRESS_WIDTH 5
+#define TRANSMITTER_NUMBER_OF_HOP_CHANNELS 20
+#define TRANSMITTER_BIND_CHANNEL 0x51
+
+// address[5], hop[20], protocol; the layout of the receiver's bind storage
+#define TRANSMITTER_BIND_DATA_SIZE \
+    (TRANSMITTER_ADDRESS_WIDTH + TRANSMITTER_NUMBER_OF_HOP_CHANNELS + 1)
+
+
+typedef enum {
+    TRAJECTORY_CONSTANT,            // center
+    TRAJECTORY_SINE,                // center +/- amplitude
+    TRAJECTORY_SQUARE,              // center + amplitude, then center - amplitude
+    TRAJECTORY_RAMP,                // center - amplitude rising to center + amplitude
+    TRAJECTORY_NUMBER_OF_SHAPES
+} trajectory_shape_t;
+
+// Stick position over time, in the channel units of stickdata.h
+// (CHANNEL_N100_PERCENT .. CHANNEL_100_PERCENT)
+typedef struct {
+    trajectory_shape_t shape;
+    int32_t center;
+    int32_t amplitude;
+    uint32_t period_ms;
+} trajectory_t;
+
+// Two-state burst loss model, evaluated for every packet. p is the chance to
+// go from the good to the bad state, r the chance to go back.
+typedef struct {
+    double p;
+    double r;
+    double loss_good;
+    double loss_bad;
+} gilbert_elliott_t;
+
+typedef struct {
+    rx_protocol_t protocol;
+    uint8_t address[TRANSMITTER_ADDRESS_WIDTH];
+    uint8_t hop[TRANSMITTER_NUMBER_OF_HOP_CHANNELS];
+
+    // Crystal error of the transmitter; positive values make it slower
+    int32_t drift_ppm;
+
+    // The transmitter is silent before start and during the outages:
+    // outage_length cycles starting at outage_start, repeated every
+    // outage_period cycles (0: once)
+    uint64_t start;
+    uint64_t outage_start;
+    uint64_t outage_length;
+    uint64_t outage_period;
+
+    bool failsafe_enabled;
+    int32_t failsafe[TRANSMITTER_NUMBER_OF_CHANNELS];
+    trajectory_t sticks[TRANSMITTER_NUMBER_OF_CHANNELS];
+    gilbert_elliott_t loss;
+    uint64_t seed;
+} transmitter_config_t;
+
+typedef struct {
+    uint64_t trains;
+    uint64_t stick_packets;
+    uint64_t failsafe_packets;
+    uint64_t bind_packets;
+    uint64_t lost;                  // Dropped by the loss model
+    uint64_t muted;                 // Not sent because of an outage
+    uint64_t bursts;                // Transitions into the bad state
+} transmitter_stats_t;
+
+typedef struct {
+    transmitter_config_t config;
+    transmitter_stats_t stats;
+    host_timer_t timer;
+    uint64_t train;
+    unsigned int slot;
+    uint64_t train_start;
+    uint64_t last_outage_end;
+    bool bad_state;
+    uint64_t random_state;
+    uint64_t audible[2];            // Channels 0..127 whose packets go on air
+} transmitter_t;
+
+
+// Fills in a bound transmitter with centered sticks, failsafe on, no drift
+// and no loss. Address and hop channels are derived from the seed.
+void transmitter_default_config(transmitter_config_t *config, rx_protocol_t protocol, uint64_t seed);
+
+void transmitter_init(transmitter_t *tx, const transmitter_config_t *config);
+
+// The bind data the receiver stores after binding to this transmitter
+void transmitter_get_bind_data(const transmitter_t *tx, uint8_t *data);
+
+// Stick position of a channel at the given time, in channel units
+int32_t transmitter_get_channel(const transmitter_t *tx, unsigned int channel, uint64_t at);
+
+// Servo pulse in microseconds that the receiver should output for a channel
+// value, after the encoding of the protocol
+uint32_t transmitter_expected_pulse_us(const transmitter_t *tx, int32_t value);
+
+// Only packets on the given channels go on air; all channels do after
+// transmitter_init(). The other packets count in the statistics as sent,
+// but cost no simulation events.
+void transmitter_set_audible_channels(transmitter_t *tx, const uint8_t *channels,
+    unsigned int count);
+
+// End of the most recent outage, 0 if there was none yet
+uint64_t transmitter_last_outage_end(const transmitter_t *tx);
+
+// Parses "shape:center:amplitude:period_ms"; shape is const, sine, square
+// or ramp. Missing fields keep their value.
+bool transmitter_parse_trajectory(trajectory_t *trajectory, const char *text);
+
+void transmitter_report(const transmitter_t *tx, FILE *f);
@@ -28,6 +28,10 @@ void SCT_irq_handler(void);
 void MRT_irq_handler(void);
 void switch_gpio_according_rx_protocol(rx_protocol_t rx_protocol);
 
+// rf.c (rf.h can not be included here as its register names clash with
+// the LPC8xx.h ones)
+void rf_ce_timer_handler(void);
+
 
 
 // Global flag that is true for one mainloop every __SYSTICK_IN_MS
@@ -137,8 +141,12 @@ static void init_hardware(void)
 
     // ------------------------
     // Multi Rate Timer configuration
-    // This timer is used for the delay_us functionality
+    // Channel 0 is used for the delay_us functionality, channel 1 by the SPI
+    // driver to delay transactions after CE went high, channel 2 to defer CE
+    // until the nRF24 has started up.
     LPC_MRT->Channel[0].CTRL = (0x1 << 1); // One-shot mode
+    LPC_MRT->Channel[1].CTRL = (0x1 << 1) | (1 << 0); // One-shot, interrupt
+    LPC_MRT->Channel[2].CTRL = (0x1 << 1) | (1 << 0); // One-shot, interrupt
 
 
 #ifdef USE_IRC
@@ -320,11 +328,11 @@ static void init_hardware(void)
 
     // 8-channel multiplexing
     //
-    // All 4 channel events are triggering an interrupt. Whenever an event fires,
-    // we load the corresponding MATCHREL with the value for the other servo
-    // channel, and CTOUT with the port number of that other servo channel.
-    // The next EVENT0 reseting the timer will output the other channel and
-    // the cycle repeats.
+    // The event of the longest servo pulse triggers an interrupt. When it
+    // fires, all 4 outputs are low and we switch CTOUT over to the port
+    // numbers of the other 4 servo channels, and load the MATCHREL registers
+    // with their values. The next EVENT0 reseting the timer will output the
+    // other channels and the cycle repeats.
 
 
     // All servo outputs will be SET with timer reload event 0, and CLEARED
@@ -392,6 +400,8 @@ static void init_hardware_final(void)
 
     NVIC_EnableIRQ(PININT0_IRQn);
     NVIC_EnableIRQ(SCT_IRQn);
+    NVIC_EnableIRQ(SPI0_IRQn);
+    NVIC_EnableIRQ(MRT_IRQn);
 }
 
 
@@ -403,43 +413,40 @@ void switch_gpio_according_rx_protocol(rx_protocol_t protocol)
     LPC_SCT->CTRL_H = (1 << 2);
 
     if (is8channel && (protocol == PROTOCOL_8CH)) {
-        // The timer is running at 2 MHz clock (500ns resolution).
+        // The timer is running at 2 MHz clock (500ns resolution), or 6 MHz
+        // with SERVO_HIGH_RESOLUTION.
         LPC_SCT->CTRL_H = (1 << 3) | (1 << 2) |
-          (((__SYSTEM_CLOCK / 2000000) - 1) << 5);
+          ((SERVO_PRESCALER_8CH - 1) << 5);
 
         // The repeat frequency is 8ms, leading to a pulse repeat rate of 16ms
         // because we process 2 sets of 4 servo outputs.
         // NOTE: Hitec HS65-HB don't work well with 10ms repeat rate, but fine
         // with 16 or above
-        LPC_SCT->MATCHREL[0].H = (8000 * 2) - 1;
+        LPC_SCT->MATCHREL[0].H = SERVO_US_TO_TICKS(8000, SERVO_PRESCALER_8CH) - 1;
 
         // Servo pulse 1.5 ms intially
-        LPC_SCT->MATCHREL[1].H = SERVO_PULSE_CENTER * 2;
-        LPC_SCT->MATCHREL[2].H = SERVO_PULSE_CENTER * 2;
-        LPC_SCT->MATCHREL[3].H = SERVO_PULSE_CENTER * 2;
-        LPC_SCT->MATCHREL[4].H = SERVO_PULSE_CENTER * 2;
-
-        // EVENT[1..4] generate an interrupt
-        LPC_SCT->EVEN |= (1u << 1) |
-                         (1u << 2) |
-                         (1u << 3) |
-                         (1u << 4);
+        LPC_SCT->MATCHREL[1].H = SERVO_US_TO_TICKS(SERVO_PULSE_CENTER, SERVO_PRESCALER_8CH);
+        LPC_SCT->MATCHREL[2].H = SERVO_US_TO_TICKS(SERVO_PULSE_CENTER, SERVO_PRESCALER_8CH);
+        LPC_SCT->MATCHREL[3].H = SERVO_US_TO_TICKS(SERVO_PULSE_CENTER, SERVO_PRESCALER_8CH);
+        LPC_SCT->MATCHREL[4].H = SERVO_US_TO_TICKS(SERVO_PULSE_CENTER, SERVO_PRESCALER_8CH);
+
+        // The event of the longest pulse generates an interrupt, see
+        // configure_multiplexing() in rc_receiver.c
     }
     else {
-        // The timer is running at 1.3 MHz clock (750ns resolution).
-        // The repeat frequency is 10ms (a multiple of the on-air packet repeat
-        // rate).
+        // The timer is running at 1.3 MHz clock (750ns resolution), or at
+        // the full 12 MHz with SERVO_HIGH_RESOLUTION.
+        // The repeat frequency is set for each output by
+        // configure_servo_frames() in rc_receiver.c (10 ms by default, a
+        // multiple of the on-air packet repeat rate).
         LPC_SCT->CTRL_H = (1 << 3) | (1 << 2) |
-          (((__SYSTEM_CLOCK / 1333333) - 1) << 5);
-
-        // 10 ms servo pulse repeat time
-        LPC_SCT->MATCHREL[0].H = (10000 * 4 / 3) - 1;
+          ((SERVO_PRESCALER_4CH - 1) << 5);
 
         // Servo pulse 1.5 ms intially
-        LPC_SCT->MATCHREL[1].H = SERVO_PULSE_CENTER * 4 / 3;
-        LPC_SCT->MATCHREL[2].H = SERVO_PULSE_CENTER * 4 / 3;
-        LPC_SCT->MATCHREL[3].H = SERVO_PULSE_CENTER * 4 / 3;
-        LPC_SCT->MATCHREL[4].H = SERVO_PULSE_CENTER * 4 / 3;
+        LPC_SCT->MATCHREL[1].H = SERVO_US_TO_TICKS(SERVO_PULSE_CENTER, SERVO_PRESCALER_4CH);
+        LPC_SCT->MATCHREL[2].H = SERVO_US_TO_TICKS(SERVO_PULSE_CENTER, SERVO_PRESCALER_4CH);
+        LPC_SCT->MATCHREL[3].H = SERVO_US_TO_TICKS(SERVO_PULSE_CENTER, SERVO_PRESCALER_4CH);
+        LPC_SCT->MATCHREL[4].H = SERVO_US_TO_TICKS(SERVO_PULSE_CENTER, SERVO_PRESCALER_4CH);
 
         // EVENT[1..4] DON'T generate an interrupt
         LPC_SCT->EVEN &= ~((1u << 1) |
@@ -544,14 +551,36 @@ void SCT_irq_handler(void)
         hop_timer_handler();
     }
 
+    // Event 0 starts a servo frame; it only interrupts when outputs have
+    // different frame periods
+    if (LPC_SCT->EVEN & LPC_SCT->EVFLAG & (1u << 0)) {
+        LPC_SCT->EVFLAG = (1u << 0);
+        servo_frame_timer_handler();
+    }
+
     // Events 1..4 for 8ch multiplexing
-    if (LPC_SCT->EVFLAG & ((1u << 1) | (1u << 2) | (1u << 3) | (1u << 4))) {
+    if (LPC_SCT->EVEN & LPC_SCT->EVFLAG & ((1u << 1) | (1u << 2) | (1u << 3) | (1u << 4))) {
       // Note: flags are cleared within the function!
       servo_pulse_timer_handler();
     }
 }
 
 
+// ****************************************************************************
+void MRT_irq_handler(void)
+{
+    if (LPC_MRT->Channel[1].STAT & (1 << 0)) {
+        LPC_MRT->Channel[1].STAT = (1 << 0);
+        spi_hold_timer_handler();
+    }
+
+    if (LPC_MRT->Channel[2].STAT & (1 << 0)) {
+        LPC_MRT->Channel[2].STAT = (1 << 0);
+        rf_ce_timer_handler();
+    }
+}
+
+
 // ****************************************************************************
 void SysTick_handler(void)
 {
@@ -1,7 +1,8 @@
 /******************************************************************************
 
 	Use IAP to program the flash
-	A single page of 64 bytes should be sufficient
+	The bind data of up to NUMBER_OF_BIND_SLOTS models is kept in the
+	top-most pages, two models per page of 64 bytes
 	Top 32 bytes of RAM needed
 	RAM buffer with data needs to be on word boundary
 	Uses 148 bytes of stack space
@@ -22,17 +23,55 @@ typedef void (* IAP)(unsigned int [], unsigned int[]);
 extern IAP iap_entry;
 
 
-__attribute__ ((section(".persistent_data")))
-const volatile uint8_t persistent_data[NUMBER_OF_PERSISTENT_ELEMENTS];
+__attribute__ ((section(".persistent_data"), aligned (PERSISTENT_PAGE_SIZE)))
+const volatile uint8_t persistent_data[PERSISTENT_DATA_SIZE];
+
+// IAP copies whole pages from a word aligned RAM buffer
+static uint8_t page_buffer[PERSISTENT_PAGE_SIZE] __attribute__ ((aligned (4)));
+
+
+// ****************************************************************************
+// Slot 0 and 1 are in the top-most page, 2 and 3 in the one below, ...
+// ****************************************************************************
+static unsigned int slot_offset(uint8_t slot)
+{
+    return PERSISTENT_DATA_SIZE - PERSISTENT_PAGE_SIZE * (slot / 2 + 1) +
+        PERSISTENT_SLOT_SIZE * (slot % 2);
+}
 
 
 // ****************************************************************************
-void load_persistent_storage(uint8_t *data)
+// Slot 0 is valid without the magic, as single model firmware left it there
+// ****************************************************************************
+static bool slot_valid(uint8_t slot)
 {
+    unsigned int offset = slot_offset(slot) + PERSISTENT_SLOT_MAGIC_OFFSET;
     int i;
 
+    if (slot == 0) {
+        return true;
+    }
+
+    for (i = 0; i < 4; i++) {
+        if (persistent_data[offset + i] != (uint8_t)(PERSISTENT_SLOT_MAGIC >> (8 * i))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// ****************************************************************************
+// An empty slot reads as all 0xff, i.e. with an invalid protocol
+// ****************************************************************************
+void load_persistent_storage(uint8_t slot, uint8_t *data)
+{
+    int i;
+    unsigned int offset = slot_offset(slot);
+    bool valid = slot_valid(slot);
+
     for (i = 0; i < NUMBER_OF_PERSISTENT_ELEMENTS; i++) {
-        data[i] = persistent_data[i];
+        data[i] = valid ? persistent_data[offset + i] : 0xff;
     }
 
     // M05 test data
@@ -68,71 +107,133 @@ void load_persistent_storage(uint8_t *data)
 
 
 // ****************************************************************************
-void save_persistent_storage(uint8_t new_data[])
+// Erase the page at *offset* in the persistent data and program it with
+// page_buffer
+// ****************************************************************************
+static bool write_page(unsigned int offset)
 {
     unsigned int param[5];
-    int i;
-
-    for (i = 0; i < NUMBER_OF_PERSISTENT_ELEMENTS; i++) {
-        if (new_data[i] != persistent_data[i]) {
-
-            param[0] = 50;
-            param[1] = ((unsigned int)persistent_data) >> 10;
-            param[2] = ((unsigned int)persistent_data) >> 10;
-            __disable_irq();
-            iap_entry(param, param);
-            __enable_irq();
-            if (param[0] != 0) {
+    unsigned int address = (unsigned int)&persistent_data[offset];
+
+    param[0] = 50;
+    param[1] = address >> 10;
+    param[2] = address >> 10;
+    __disable_irq();
+    iap_entry(param, param);
+    __enable_irq();
+    if (param[0] != 0) {
 #ifndef NO_DEBUG
-                uart0_send_cstring("ERROR: prepare sector failed\n");
+        uart0_send_cstring("ERROR: prepare sector failed\n");
 #endif
-                return;
-            }
+        return false;
+    }
 
-            param[0] = 59;  // Erase page command
-            param[1] = ((unsigned int)persistent_data) >> 6;
-            param[2] = ((unsigned int)persistent_data) >> 6;
-            param[3] = __SYSTEM_CLOCK / 1000;
-            __disable_irq();
-            iap_entry(param, param);
-            __enable_irq();
-            if (param[0] != 0) {
+    param[0] = 59;  // Erase page command
+    param[1] = address >> 6;
+    param[2] = address >> 6;
+    param[3] = __SYSTEM_CLOCK / 1000;
+    __disable_irq();
+    iap_entry(param, param);
+    __enable_irq();
+    if (param[0] != 0) {
 #ifndef NO_DEBUG
-                uart0_send_cstring("ERROR: erase page failed\n");
+        uart0_send_cstring("ERROR: erase page failed\n");
 #endif
-                return;
-            }
+        return false;
+    }
 
-            param[0] = 50;
-            param[1] = ((unsigned int)persistent_data) >> 10;
-            param[2] = ((unsigned int)persistent_data) >> 10;
-            __disable_irq();
-            iap_entry(param, param);
-            __enable_irq();
-            if (param[0] != 0) {
+    param[0] = 50;
+    param[1] = address >> 10;
+    param[2] = address >> 10;
+    __disable_irq();
+    iap_entry(param, param);
+    __enable_irq();
+    if (param[0] != 0) {
 #ifndef NO_DEBUG
-                uart0_send_cstring("ERROR: prepare sector failed\n");
+        uart0_send_cstring("ERROR: prepare sector failed\n");
 #endif
-                return;
-            }
+        return false;
+    }
 
-            param[0] = 51;  // Copy RAM to Flash command
-            param[1] = (unsigned int)persistent_data;
-            param[2] = (unsigned int)new_data;
-            param[3] = 64;
-            param[4] = __SYSTEM_CLOCK / 1000;
-            __disable_irq();
-            iap_entry(param, param);
-            __enable_irq();
-            if (param[0] != 0) {
+    param[0] = 51;  // Copy RAM to Flash command
+    param[1] = address;
+    param[2] = (unsigned int)page_buffer;
+    param[3] = PERSISTENT_PAGE_SIZE;
+    param[4] = __SYSTEM_CLOCK / 1000;
+    __disable_irq();
+    iap_entry(param, param);
+    __enable_irq();
+    if (param[0] != 0) {
 #ifndef NO_DEBUG
-                uart0_send_cstring("ERROR: copy RAM to flash failed: ");
-                uart0_send_uint32_hex(param[0]);
-                uart0_send_linefeed();
+        uart0_send_cstring("ERROR: copy RAM to flash failed: ");
+        uart0_send_uint32_hex(param[0]);
+        uart0_send_linefeed();
 #endif
-                return;
+        return false;
+    }
+
+    return true;
+}
+
+
+// ****************************************************************************
+// Store *new_data* in slot 0. The models in the slots before *replaced_slot*
+// move up by one slot, the one in *replaced_slot* is dropped: pass the slot
+// that holds the same model, or the last slot to drop the oldest model.
+//
+// Only pages that change are written. The pages are written from the last
+// slot down, so each slot is copied before it is overwritten. Slots without
+// the magic are erased on the way.
+// ****************************************************************************
+void save_persistent_storage(uint8_t *new_data, uint8_t replaced_slot)
+{
+    int slot;
+    int i;
+
+    if (replaced_slot >= NUMBER_OF_BIND_SLOTS) {
+        replaced_slot = NUMBER_OF_BIND_SLOTS - 1;
+    }
+
+    for (slot = NUMBER_OF_BIND_SLOTS - 2; slot >= 0; slot -= 2) {
+        unsigned int page = slot_offset((uint8_t)slot);
+        bool changed = false;
+        int s;
+
+        for (s = slot; s < slot + 2; s++) {
+            uint8_t *dst = &page_buffer[PERSISTENT_SLOT_SIZE * (s % 2)];
+            uint8_t src = (uint8_t)(s <= replaced_slot ? s - 1 : s);
+
+            for (i = 0; i < PERSISTENT_SLOT_SIZE; i++) {
+                dst[i] = 0xff;
+            }
+
+            if (s == 0) {
+                for (i = 0; i < NUMBER_OF_PERSISTENT_ELEMENTS; i++) {
+                    dst[i] = new_data[i];
+                }
+            }
+            else if (slot_valid(src)) {
+                for (i = 0; i < NUMBER_OF_PERSISTENT_ELEMENTS; i++) {
+                    dst[i] = persistent_data[slot_offset(src) + i];
+                }
+            }
+            else {
+                continue;
             }
 
+            for (i = 0; i < 4; i++) {
+                dst[PERSISTENT_SLOT_MAGIC_OFFSET + i] =
+                    (uint8_t)(PERSISTENT_SLOT_MAGIC >> (8 * i));
+            }
+        }
+
+        for (i = 0; i < PERSISTENT_PAGE_SIZE; i++) {
+            if (page_buffer[i] != persistent_data[page + i]) {
+                changed = true;
+            }
+        }
+
+        if (changed  &&  !write_page(page)) {
             return;
         }
     }
@@ -1,6 +1,24 @@
 #pragma once
 
+// Bind data of one model: address[5], hop[20], protocol
 #define NUMBER_OF_PERSISTENT_ELEMENTS 26
 
-void load_persistent_storage(uint8_t *data);
-void save_persistent_storage(uint8_t *new_data);
+// The bind data of several models is kept in slots of half a flash page at
+// the top of the flash. Slot 0 is at the start of the top-most page, where
+// firmware with a single model stores its bind data, and holds the model
+// used last. The .persistent_data section in receiver.ld must be
+// PERSISTENT_DATA_SIZE bytes below the end of the flash.
+#define NUMBER_OF_BIND_SLOTS 4
+#define PERSISTENT_SLOT_SIZE 32
+#define PERSISTENT_PAGE_SIZE 64
+#define PERSISTENT_DATA_SIZE (NUMBER_OF_BIND_SLOTS * PERSISTENT_SLOT_SIZE)
+
+// The last 4 bytes of every slot written by this firmware hold
+// PERSISTENT_SLOT_MAGIC, least significant byte first. Firmware with a single
+// model wrote 64 bytes of RAM into the top-most page, so slot 1 may hold
+// garbage after an upgrade: a slot other than 0 without the magic is empty.
+#define PERSISTENT_SLOT_MAGIC 0x4d4f444cu
+#define PERSISTENT_SLOT_MAGIC_OFFSET (PERSISTENT_SLOT_SIZE - 4)
+
+void load_persistent_storage(uint8_t slot, uint8_t *data);
+void save_persistent_storage(uint8_t *new_data, uint8_t replaced_slot);
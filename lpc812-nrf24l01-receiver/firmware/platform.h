@@ -11,6 +11,23 @@
 #define SERVO_PULSE_CENTER 1500
 #define INITIAL_ENDPOINT_DELTA 200
 
+// Prescalers of the SCT H counter that times the servo pulses, for the 3/4ch
+// outputs and for the 8ch multiplexing; see SERVO_HIGH_RESOLUTION in the
+// makefile. At the full system clock the 16-bit counter covers 5.46 ms: the
+// 8 ms frame of the multiplexing needs a prescaler of 2, and longer 3/4ch
+// frames are split up (see configure_servo_frames() in rc_receiver.c).
+#ifndef SERVO_HIGH_RESOLUTION
+#define SERVO_HIGH_RESOLUTION 0
+#endif
+#if SERVO_HIGH_RESOLUTION
+#define SERVO_PRESCALER_4CH 1                       // 83 ns
+#define SERVO_PRESCALER_8CH 2                       // 167 ns
+#else
+#define SERVO_PRESCALER_4CH (__SYSTEM_CLOCK / 1333333)  // 750 ns
+#define SERVO_PRESCALER_8CH (__SYSTEM_CLOCK / 2000000)  // 500 ns
+#endif
+#define SERVO_US_TO_TICKS(us, prescaler) ((us) * (__SYSTEM_CLOCK / 1000000) / (prescaler))
+
 
 // ****************************************************************************
 // IO pins:
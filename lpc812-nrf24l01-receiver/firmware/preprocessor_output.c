@@ -99,10 +99,11 @@ void output_preprocessor(void)
 
     if (systick) {
         if (successful_stick_data && startup_count >= NUMBER_OF_STARTUP_PACKETS) {
-            // Multiply by 0.75 to get microseconds from 750ns based clock
-            servo[0].raw_data = channels[0] * 3 / 4;
-            servo[1].raw_data = channels[1] * 3 / 4;
-            ch3_raw = channels[2] * 3 / 4;
+            // Microseconds from the servo timer ticks (750ns, or 83ns with
+            // SERVO_HIGH_RESOLUTION)
+            servo[0].raw_data = channels[0] * SERVO_PRESCALER_4CH / (__SYSTEM_CLOCK / 1000000);
+            servo[1].raw_data = channels[1] * SERVO_PRESCALER_4CH / (__SYSTEM_CLOCK / 1000000);
+            ch3_raw = channels[2] * SERVO_PRESCALER_4CH / (__SYSTEM_CLOCK / 1000000);
 
             if (!initialized) {
                 initialized = true;
@@ -5,6 +5,7 @@
 #include <rc_receiver.h>
 #include <persistent_storage.h>
 #include <rf.h>
+#include <stickdata.h>
 #include <uart0.h>
 
 
@@ -25,9 +26,103 @@
 #define FIRST_HOP_TIME_IN_US 2500
 #define HOP_TIME_IN_US 5000
 
+// Hops without a packet before we wait for the transmitter on the first hop
+// channel; see DEAD_RECKONING_CYCLES in the makefile
+#ifndef DEAD_RECKONING_CYCLES
+#define DEAD_RECKONING_CYCLES 5
+#endif
+#define DEAD_RECKONING_HOPS (DEAD_RECKONING_CYCLES * NUMBER_OF_HOP_CHANNELS)
+
+// The nRF24 needs 130 us after CE goes high before it receives (data sheet
+// page 22: Tstby2a). The hop is moved earlier by this plus the measured time
+// from the hop timer to CE going high, but by no more than MAX_HOP_COST_IN_US.
+#define RX_SETTLING_TIME_IN_US 130
+#define MAX_HOP_COST_IN_US 1000
+
+// Hop phase tracking: the first packet of a train should arrive this long
+// after the hop. A larger error than HOP_LOCK_LIMIT_IN_US means we lost the
+// transmitter; the hop timer is restarted from the next packet then. The
+// period trim is limited to +-2.5 %, which covers the IRC of the LPC812.
+#define HOP_PHASE_IN_US (HOP_TIME_IN_US - FIRST_HOP_TIME_IN_US)
+#define HOP_LOCK_LIMIT_IN_US (HOP_TIME_IN_US / 4)
+#define MAX_HOP_TRIM_Q8 ((HOP_TIME_IN_US * 256) / 40)
+
+// Packet-synchronous servo frames: the servo frame starts this long after
+// the first stick packet of a train; see SERVO_SYNC_OFFSET_US in the makefile.
+#ifndef SERVO_SYNC_OFFSET_US
+#define SERVO_SYNC_OFFSET_US 0
+#endif
+
+// A synchronized frame ends at least this long after the longest pulse
+#define SERVO_SYNC_MARGIN_US 100
+
+// Servo frame period of each output in 3/4ch mode; see SERVO_FRAME_US in the
+// makefile
+#ifndef SERVO_FRAME_US
+#define SERVO_FRAME_US 10000, 10000, 10000, 10000
+#endif
+
+// The shortest of the 4 frame periods, and whether the others are multiples
+// of it. SERVO_FRAMES() applies them to the list in SERVO_FRAME_US.
+#define SERVO_MIN(a, b) ((a) < (b) ? (a) : (b))
+#define SERVO_FRAME_SHORTEST(a, b, c, d) SERVO_MIN(SERVO_MIN(a, b), SERVO_MIN(c, d))
+#define SERVO_FRAME_MULTIPLES(a, b, c, d) \
+    ((a) % SERVO_FRAME_SHORTEST(a, b, c, d) == 0  &&  (b) % SERVO_FRAME_SHORTEST(a, b, c, d) == 0  &&  \
+     (c) % SERVO_FRAME_SHORTEST(a, b, c, d) == 0  &&  (d) % SERVO_FRAME_SHORTEST(a, b, c, d) == 0)
+#define SERVO_FRAMES(macro, ...) macro(__VA_ARGS__)
+
+#if SERVO_FRAMES(SERVO_FRAME_SHORTEST, SERVO_FRAME_US) < 3000
+#error "The shortest SERVO_FRAME_US entry must be at least 3000"
+#endif
+#if !SERVO_FRAMES(SERVO_FRAME_MULTIPLES, SERVO_FRAME_US)
+#error "Every SERVO_FRAME_US entry must be a multiple of the shortest one"
+#endif
+
+// The frame sync moves the frame start to the same point of every packet
+// train, which only works if the frames line up with the trains
+#if SERVO_SYNC_OFFSET_US > 0  &&  SERVO_FRAMES(SERVO_FRAME_SHORTEST, SERVO_FRAME_US) % HOP_TIME_IN_US != 0
+#error "SERVO_SYNC_OFFSET_US needs the shortest SERVO_FRAME_US entry to be a multiple of 5000"
+#endif
+
+// Chained servo pulses in 3/4ch mode: each output rises when the previous one
+// falls, so the servos do not start their drive strokes together; see
+// SERVO_STAGGER in the makefile. All 4 pulses of up to SERVO_PULSE_MAX_US
+// must fit into every SCT frame.
+#ifndef SERVO_STAGGER
+#define SERVO_STAGGER 0
+#endif
+#define SERVO_PULSE_MAX_US 2500
+#if SERVO_STAGGER  &&  SERVO_FRAMES(SERVO_FRAME_SHORTEST, SERVO_FRAME_US) < 4 * SERVO_PULSE_MAX_US
+#error "SERVO_STAGGER needs every SERVO_FRAME_US entry to be at least 10000"
+#endif
+#if SERVO_STAGGER && SERVO_HIGH_RESOLUTION
+#error "SERVO_STAGGER needs unsplit frames of at least 10 ms, SERVO_HIGH_RESOLUTION splits them"
+#endif
+
+// Upsampling of the 3/4ch outputs between the packet trains; see
+// SERVO_UPSAMPLING in the makefile
+#ifndef SERVO_UPSAMPLING
+#define SERVO_UPSAMPLING 0
+#endif
+
+// Event that sets an output at the start of its pulse: the frame limit, or
+// the end of the previous output's pulse when they are chained
+#define SERVO_SET_EVENT(output) (SERVO_STAGGER ? (1u << (output)) : (1u << 0))
+
+#define CLOCK_REPORT_TIME (5000 / __SYSTICK_IN_MS)
+
+// At power-up we listen on the first hop channel of each bound model for this
+// long. The transmitter comes by there once per hop cycle of 100 ms.
+#define DETECT_TIME (110 / __SYSTICK_IN_MS)
+
 #define FAILSAFE_TIMEOUT (640 / __SYSTICK_IN_MS)
 #define BIND_TIMEOUT (5000 / __SYSTICK_IN_MS)
-#define BIND_SWAP_TIMEOUT (50 / __SYSTICK_IN_MS)
+
+// The transmitters send a bind packet every BIND_PACKET_TIME_IN_MS. We swap
+// between the 3/4ch and 8ch bind modes when two bind packets did not arrive
+// (the systick timer can expire up to one tick early).
+#define BIND_PACKET_TIME_IN_MS 5
+#define BIND_SWAP_TIMEOUT ((2 * BIND_PACKET_TIME_IN_MS + __SYSTICK_IN_MS - 1) / __SYSTICK_IN_MS + 1)
 #define ISP_TIMEOUT (3000 / __SYSTICK_IN_MS)
 #define BLINK_TIME_FAILSAFE (320 / __SYSTICK_IN_MS)
 #define BLINK_TIME_BINDING (50 / __SYSTICK_IN_MS)
@@ -54,34 +149,174 @@ uint16_t channels[NUMBER_OF_CHANNELS];
 uint16_t raw_data[2];
 bool successful_stick_data = false;
 
-static bool rf_int_fired = false;
+// The SPI interrupt reads packets straight into one of these buffers while
+// the main loop decodes the other one. Byte 0 is the nRF24 command and
+// STATUS, the payload follows.
+static uint8_t packet_buffers[2][RF_PACKET_BUFFER_SIZE];
+static uint8_t decoding_buffer;
+
+// Set by the SPI interrupt when a packet has been read into the other buffer
+static volatile bool rf_int_fired = false;
+static uint8_t received_width;
+static bool received_repeat;
 
 static led_state_t led_state;
 
 static unsigned int blink_timer;
 static unsigned int bind_button_timer;
 
-static uint8_t payload[RF_MAX_BUFFER_LENGTH];
+static uint8_t *payload = &packet_buffers[0][1];
+static uint8_t payload_width;
+
+// payload[] is the same as the packet before. The transmitter sends every
+// packet twice, so this is the case for every other packet.
+static bool payload_repeat;
+
+// The servo outputs and failsafe values reflect payload[]; cleared when the
+// outputs go to failsafe so that the next packet is decoded in any case
+static bool payload_applied;
 
 static uint8_t failsafe_enabled;
 static uint16_t failsafe[NUMBER_OF_CHANNELS];
 static unsigned int failsafe_timer;
 
+// The SCT H counter runs with the shortest frame period of the outputs.
+// Outputs with a longer period only pulse every servo_frame_divider[]-th
+// frame; servo_frame_timer_handler() enables their set event for the frames
+// in which they pulse.
+static const uint16_t servo_frame_in_us[4] = {SERVO_FRAME_US};
+static uint8_t servo_prescaler = SERVO_PRESCALER_4CH;
+static uint16_t servo_frame_ticks;
+static uint8_t servo_frame_divider[4];
+static uint8_t servo_frame_phase[4];
+
+#if SERVO_UPSAMPLING
+// The pulses of the last 3 packet trains, newest first, and the age of the
+// newest at the start of the current frame in servo timer ticks. The frame
+// interrupt extrapolates the pulses of the next frame from them.
+static uint16_t servo_samples[4][3];
+static int32_t servo_sample_age;
+static int32_t servo_train_ticks;
+static uint32_t servo_train_scale;          // (256 << 16) / servo_train_ticks
+#endif
+
+// 8ch multiplexing: the SCT outputs serve CH1..4 and CH5..8 in turn. Each
+// bank holds everything that switches the outputs over to it, so that
+// servo_pulse_timer_handler() only copies it into the registers. The
+// interrupt comes from the pulse event of the longest pulse in the bank.
+typedef struct {
+    uint32_t pinassign6;
+    uint32_t pinassign7;
+    uint32_t released_pins;         // Pins of the other bank, driven by GPIO
+    uint32_t last_event;
+    uint16_t pulses[4];
+} servo_bank_t;
+
+static servo_bank_t servo_banks[2];
+static uint8_t servo_bank;
+
 static uint8_t model_address[ADDRESS_WIDTH];
-static bool perform_hop_requested = false;
-static unsigned int hops_without_packet;
-static unsigned int hop_index;
 static uint8_t hop_data[NUMBER_OF_HOP_CHANNELS];
 
+// The hops are done by the SCT interrupt (hop_timer_handler()) with the
+// channel change commands prepared from hop_data[]. Too many hops without a
+// packet make it request a restart from the main loop.
+static uint8_t hop_commands[NUMBER_OF_HOP_CHANNELS][RF_HOP_COMMAND_SIZE];
+static volatile bool restart_requested = false;
+static volatile unsigned int hops_without_packet;
+static volatile unsigned int hop_index;
+
+// Time from the hop timer until the nRF24 listens on the new channel
+static volatile uint16_t hop_cost_in_us = RX_SETTLING_TIME_IN_US;
+
+// The hop timer follows the packet trains once it has been started from a
+// packet. rf_interrupt_handler() timestamps the first packet after each hop
+// with the hop timer counter; hop_timer_handler() compares it with where it
+// should be and trims the hop period. hop_trim_q8 is the period error of
+// the transmitter against our clock in 1/256 us; it survives restarts.
+static volatile bool hop_timer_locked;
+
+// Set while reinitialize_rf() rewrites the nRF24 configuration: the hop
+// timer keeps counting hops but does not touch the nRF24
+static volatile bool rf_reinitializing;
+static volatile uint8_t slot_packets;
+static volatile uint16_t slot_first_packet_time;
+static volatile uint8_t packet_channel;
+static int32_t hop_trim_q8;
+static int32_t hop_trim_fraction;
+static unsigned int clock_report_timer;
+
 static bool binding_requested = false;
 static bool binding = false;
 static unsigned int bind_timer;
 static unsigned int bind_swap_timer;
+static bool bind_8ch_mode;
+
+// The 3/4ch bind packets received so far: bit n is set for packet n (0 is
+// the one with the address). All of them carry the same address checksum.
+static uint8_t bind_fragments;
+static uint16_t bind_checksum;
 static const uint8_t BIND_CHANNEL = 0x51;
 static const uint8_t BIND_ADDRESS[ADDRESS_WIDTH] = {0x12, 0x23, 0x23, 0x45, 0x78};
 static uint8_t bind_storage_area[NUMBER_OF_PERSISTENT_ELEMENTS] __attribute__ ((aligned (4)));
 #define PROTOCOLID_INDEX (sizeof(bind_storage_area)-1)
 
+// The bind slot that bind_storage_area was loaded from. Until the first
+// packet after power-up, detect_slots has a bit set for each slot with a
+// bound model and we move on to the next one every DETECT_TIME.
+static uint8_t bind_slot;
+static uint8_t detect_slots;
+static unsigned int detect_timer;
+
+// Radio modes. Switching between them only writes the registers that differ.
+static const rf_profile_t PROFILE_4CH = {
+    .crc = CRC_2_BYTES,
+    .irq_source = RX_RD,
+    .address_width = ADDRESS_WIDTH,
+    .data_rate = DATA_RATE_250K,
+    .pipes = DATA_PIPE_0,
+    .auto_acknowledge_pipes = NO_AUTO_ACKNOWLEDGE,
+    .payload_size = PAYLOAD_SIZE,
+    .dynpd = 0,
+    .feature = 0
+};
+
+static const rf_profile_t PROFILE_8CH = {
+    .crc = CRC_2_BYTES,
+    .irq_source = RX_RD,
+    .address_width = ADDRESS_WIDTH,
+    .data_rate = DATA_RATE_250K,
+    .pipes = DATA_PIPE_0,
+    .auto_acknowledge_pipes = NO_AUTO_ACKNOWLEDGE,
+    .payload_size = PAYLOAD_SIZE,   // Not used, but saves a write when swapping
+    .dynpd = DATA_PIPE_0,
+    .feature = EN_DPL
+};
+
+static const rf_profile_t PROFILE_4CH_BIND = {
+    .crc = CRC_2_BYTES,
+    .irq_source = RX_RD,
+    .address_width = ADDRESS_WIDTH,
+    .data_rate = DATA_RATE_250K,
+    .pipes = DATA_PIPE_0,
+    .auto_acknowledge_pipes = NO_AUTO_ACKNOWLEDGE,
+    .payload_size = PAYLOAD_SIZE,
+    .dynpd = 0,
+    .feature = 0
+};
+
+static const rf_profile_t PROFILE_8CH_BIND = {
+    .crc = CRC_2_BYTES,
+    .irq_source = RX_RD,
+    .address_width = ADDRESS_WIDTH,
+    .data_rate = DATA_RATE_2M,
+    .pipes = DATA_PIPE_0,
+    .auto_acknowledge_pipes = NO_AUTO_ACKNOWLEDGE,
+    .payload_size = PAYLOAD_SIZE,
+    .dynpd = DATA_PIPE_0,
+    .feature = EN_DPL
+};
+
 static uint8_t stickdata_packetid;
 static uint8_t failsafe_packetid;
 
@@ -100,6 +335,57 @@ static rx_protocol_t rx_protocol;
 // }
 
 
+// ****************************************************************************
+// Called from the SPI interrupt with the newest packet read from the nRF24
+// ****************************************************************************
+static void store_received_payload(const uint8_t *data, uint8_t width)
+{
+    uint8_t i;
+
+    // Compare with the packet the main loop has; it does not change it
+    received_repeat = (width == payload_width);
+    for (i = 0; i < width  &&  received_repeat; i++) {
+        if (payload[i] != data[i]) {
+            received_repeat = false;
+        }
+    }
+    received_width = width;
+    rf_int_fired = true;
+}
+
+
+// ****************************************************************************
+// Make the last packet read in the background the one in payload[]. Returns
+// false if there is none.
+// ****************************************************************************
+static bool fetch_payload(void)
+{
+    // Test the flag with interrupts off: a packet coming in between would
+    // start draining into the buffer we are about to decode
+    __disable_irq();
+    if (!rf_int_fired) {
+        __enable_irq();
+        return false;
+    }
+
+    decoding_buffer ^= 1;
+    payload = &packet_buffers[decoding_buffer][1];
+    payload_width = received_width;
+    payload_repeat = received_repeat;
+    rf_int_fired = false;
+    __enable_irq();
+
+    return true;
+}
+
+
+// ****************************************************************************
+static int32_t us_to_servo_ticks(int32_t us)
+{
+    return SERVO_US_TO_TICKS(us, servo_prescaler);
+}
+
+
 // ****************************************************************************
 static void initialize_failsafe(void) {
     int i;
@@ -107,11 +393,146 @@ static void initialize_failsafe(void) {
     failsafe_enabled = false;
     failsafe_timer = FAILSAFE_TIMEOUT;
     for (i = 0; i < NUMBER_OF_CHANNELS; i++) {
-        failsafe[i] = SERVO_PULSE_CENTER;
+        failsafe[i] = us_to_servo_ticks(SERVO_PULSE_CENTER);
+    }
+}
+
+
+// ****************************************************************************
+// The pulse event of the longest of the 4 pulses of a bank
+// ****************************************************************************
+static uint32_t longest_pulse_event(const uint16_t *pulses)
+{
+    int longest = 0;
+    int i;
+
+    for (i = 1; i < 4; i++) {
+        if (pulses[i] > pulses[longest]) {
+            longest = i;
+        }
+    }
+    return 1u << (longest + 1);
+}
+
+
+// ****************************************************************************
+// Writes the pulses of the 3/4ch outputs for the next frame
+// ****************************************************************************
+static void write_pulses(const uint16_t *pulses)
+{
+    int i;
+
+#if SERVO_STAGGER
+    {
+        // The pulse of output i ends at the sum of the first i + 1 pulses
+        uint16_t end = 0;
+
+        for (i = 0; i < 4; i++) {
+            end += pulses[i];
+            LPC_SCT->MATCHREL[i + 1].H = end;
+        }
+    }
+#else
+    for (i = 0; i < 4; i++) {
+        LPC_SCT->MATCHREL[i + 1].H = pulses[i];
+    }
+#endif
+}
+
+
+#if SERVO_UPSAMPLING
+// ****************************************************************************
+// Adds channels[] to the upsampling history and outputs it. Called for every
+// stick data packet, repeats included; the second packet of a train only
+// replaces the sample of the first. After a gap of more than 2 trains the
+// history restarts from the new sample.
+// ****************************************************************************
+static void add_servo_sample(void)
+{
+    int32_t age;
+    int i;
+
+    __disable_irq();
+    age = servo_sample_age + LPC_SCT->COUNT_H;
+
+    for (i = 0; i < 4; i++) {
+        uint16_t *samples = servo_samples[i];
+
+        if (age >= 2 * servo_train_ticks) {
+            samples[2] = samples[1] = channels[i];
+        }
+        else if (age >= servo_train_ticks / 2) {
+            samples[2] = samples[1];
+            samples[1] = samples[0];
+        }
+        samples[0] = channels[i];
+    }
+
+    if (age >= servo_train_ticks / 2) {
+        servo_sample_age = -(int32_t)LPC_SCT->COUNT_H;
     }
+    write_pulses(channels);
+    __enable_irq();
 }
 
 
+// ****************************************************************************
+// Called from the frame interrupt: extrapolates the pulses for the next
+// frame, in Q8 fractions of a train from the newest sample. The speed is the
+// smaller of the last two steps, and zero when they differ in direction, so
+// that a stick that stops or turns around does not overshoot by more than
+// one train of steady motion, and a step does not overshoot at all. Without
+// a new sample we stop one train after the newest.
+// ****************************************************************************
+static void upsample_pulses(void)
+{
+    uint16_t pulses[4];
+    int32_t age;
+    int32_t t_q8;
+    int i;
+
+    if (servo_sample_age < 2 * servo_train_ticks) {
+        servo_sample_age += servo_frame_ticks;
+    }
+
+    // The age can be negative when the frame sync stretched the frame in
+    // which the sample came
+    age = servo_sample_age + servo_frame_ticks;
+    if (age < 0) {
+        age = 0;
+    }
+    else if (age > servo_train_ticks) {
+        age = servo_train_ticks;
+    }
+    t_q8 = (int32_t)(((uint32_t)age * servo_train_scale) >> 16);
+
+    for (i = 0; i < 4; i++) {
+        const uint16_t *samples = servo_samples[i];
+        int32_t step = (int32_t)samples[0] - samples[1];
+        int32_t previous_step = (int32_t)samples[1] - samples[2];
+
+        if (step > 0  &&  previous_step > 0) {
+            if (previous_step < step) {
+                step = previous_step;
+            }
+        }
+        else if (step < 0  &&  previous_step < 0) {
+            if (previous_step > step) {
+                step = previous_step;
+            }
+        }
+        else {
+            step = 0;
+        }
+
+        pulses[i] = samples[0] + step * t_q8 / 256;
+    }
+
+    write_pulses(pulses);
+}
+#endif
+
+
 // ****************************************************************************
 static void output_pulses(void)
 {
@@ -120,30 +541,220 @@ static void output_pulses(void)
     // For the 4ch hardware output the pulses directly (first 4 channels
     // only), for the 8ch hardware the multiplexing will write the values
     if (is8channel && rx_protocol == PROTOCOL_8CH) {
+        __disable_irq();
+        for (i = 0; i < 4; i++) {
+            servo_banks[0].pulses[i] = channels[i];
+            servo_banks[1].pulses[i] = channels[i + 4];
+        }
+        servo_banks[0].last_event = longest_pulse_event(servo_banks[0].pulses);
+        servo_banks[1].last_event = longest_pulse_event(servo_banks[1].pulses);
+        __enable_irq();
         return;
     }
 
+#if SERVO_UPSAMPLING
+    add_servo_sample();
+#else
+    write_pulses(channels);
+#endif
+}
+
+
+// ****************************************************************************
+// Prepare both banks of the 8ch multiplexing and start with CH1..4. The
+// other fields of PINASSIGN6/7 keep what switch_gpio_according_rx_protocol()
+// set up.
+// ****************************************************************************
+static void configure_multiplexing(void)
+{
+    static const uint8_t pins[2][4] = {
+        {GPIO_8CH_BIT_CH1, GPIO_8CH_BIT_CH2, GPIO_8CH_BIT_CH3, GPIO_8CH_BIT_CH4},
+        {GPIO_8CH_BIT_CH5, GPIO_8CH_BIT_CH6, GPIO_8CH_BIT_CH7, GPIO_8CH_BIT_CH8}
+    };
+    int bank;
+    int i;
+
+    for (bank = 0; bank < 2; bank++) {
+        servo_bank_t *b = &servo_banks[bank];
+        const uint8_t *p = pins[bank];
+        const uint8_t *other = pins[bank ^ 1];
+
+        b->pinassign6 = (LPC_SWM->PINASSIGN6 & 0x00ffffff) | (p[0] << 24);     // CTOUT_0
+        b->pinassign7 = (LPC_SWM->PINASSIGN7 & 0xff000000) |
+                        (p[3] << 16) |                                      // CTOUT_3
+                        (p[2] << 8) |                                       // CTOUT_2
+                        (p[1] << 0);                                        // CTOUT_1
+        b->released_pins = (1 << other[0]) | (1 << other[1]) |
+                           (1 << other[2]) | (1 << other[3]);
+        for (i = 0; i < 4; i++) {
+            b->pulses[i] = us_to_servo_ticks(SERVO_PULSE_CENTER);
+        }
+        b->last_event = longest_pulse_event(b->pulses);
+    }
+
+    servo_bank = 0;
+    LPC_SWM->PINASSIGN6 = servo_banks[0].pinassign6;
+    LPC_SWM->PINASSIGN7 = servo_banks[0].pinassign7;
+    LPC_SCT->EVFLAG = 0x1e;
+    LPC_SCT->EVEN = (LPC_SCT->EVEN & ~0x1eu) | servo_banks[0].last_event;
+}
+
+
+// ****************************************************************************
+// Set up the servo frame periods after switch_gpio_according_rx_protocol().
+// The 8ch multiplexing needs the fixed frame set up there.
+//
+// With SERVO_HIGH_RESOLUTION a frame may not fit into the 16-bit counter.
+// It is split into periods that do then, and the outputs only pulse in the
+// first of them, like outputs with a longer frame period.
+// ****************************************************************************
+static void configure_servo_frames(void)
+{
+    uint16_t frame_in_us;
+    uint32_t frame_ticks;
+    uint8_t splits;
+    bool skipping = false;
+    int i;
+
+    if (is8channel && rx_protocol == PROTOCOL_8CH) {
+        servo_prescaler = SERVO_PRESCALER_8CH;
+        for (i = 0; i < 4; i++) {
+            LPC_SCT->OUT[i].SET = (1 << 0);
+        }
+        LPC_SCT->EVEN &= ~(1u << 0);
+        configure_multiplexing();
+        return;
+    }
+
+    servo_prescaler = SERVO_PRESCALER_4CH;
+
+    frame_in_us = servo_frame_in_us[0];
+    for (i = 1; i < 4; i++) {
+        if (servo_frame_in_us[i] < frame_in_us) {
+            frame_in_us = servo_frame_in_us[i];
+        }
+    }
+
+    frame_ticks = us_to_servo_ticks(frame_in_us);
+    splits = (frame_ticks + 0xffff) / 0x10000;
+    servo_frame_ticks = frame_ticks / splits;
+    LPC_SCT->MATCHREL[0].H = servo_frame_ticks - 1;
+
+    // The first EVENT[0] after the counter starts begins frame 1 of every
+    // output's cycle, so only outputs that pulse in every frame rise on it;
+    // the others first pulse when their phase comes round to 0. From then
+    // on the frame interrupt enables the set event one frame ahead.
     for (i = 0; i < 4; i++) {
-        LPC_SCT->MATCHREL[i + 1].H = channels[i];
+        servo_frame_divider[i] = splits *
+            ((servo_frame_in_us[i] + frame_in_us / 2) / frame_in_us);
+        if (servo_frame_divider[i] > 1) {
+            skipping = true;
+        }
+        servo_frame_phase[i] = 1 % servo_frame_divider[i];
+        LPC_SCT->OUT[i].SET = servo_frame_phase[i] ? 0 : SERVO_SET_EVENT(i);
+#if SERVO_STAGGER
+        LPC_SCT->MATCHREL[i + 1].H = (i + 1) * us_to_servo_ticks(SERVO_PULSE_CENTER);
+#endif
+    }
+
+#if SERVO_UPSAMPLING
+    servo_train_ticks = us_to_servo_ticks(HOP_TIME_IN_US);
+    servo_train_scale = (256u << 16) / servo_train_ticks;
+    servo_sample_age = 2 * servo_train_ticks;
+#endif
+
+    // EVENT[0] generates an interrupt only if an output skips frames or the
+    // pulses are upsampled
+    if (skipping  ||  SERVO_UPSAMPLING) {
+        LPC_SCT->EVEN |= (1u << 0);
+    }
+    else {
+        LPC_SCT->EVEN &= ~(1u << 0);
+    }
+}
+
+
+// ****************************************************************************
+// Move the servo frame so that it starts SERVO_SYNC_OFFSET_US after the
+// first packet of a train, instead of up to a frame later. Where the first
+// packet arrives is known from the hop timer (see track_hop_phase()), so
+// this works with repeated and lost packets alike. The frame is two packet
+// trains long, so the error is taken modulo a train.
+//
+// Only the next frame can be moved (MATCHREL is loaded at the end of the
+// running one). The error is measured against the end of the running frame,
+// so all packets of the frame ask for the same correction.
+// ****************************************************************************
+static void synchronize_servo_frame(void)
+{
+#if SERVO_SYNC_OFFSET_US > 0
+    int32_t train = us_to_servo_ticks(HOP_TIME_IN_US);
+    int32_t target;
+    int32_t error;
+    int32_t reload;
+    int32_t shortest;
+    int i;
+
+    if (!hop_timer_locked  ||  (is8channel && rx_protocol == PROTOCOL_8CH)) {
+        return;
+    }
+
+    // Time until the frame should start, and until it does
+    target = HOP_PHASE_IN_US + hop_cost_in_us + SERVO_SYNC_OFFSET_US - LPC_SCT->COUNT_L;
+    error = (int32_t)LPC_SCT->MATCH[0].H - (int32_t)LPC_SCT->COUNT_H;
+
+    error = (error - us_to_servo_ticks(target)) % train;
+    if (error > train / 2) {
+        error -= train;
+    }
+    else if (error < -train / 2) {
+        error += train;
     }
+
+    // The frame must neither end before the longest pulse (the end of the
+    // chain in staggered mode) nor outgrow the 16-bit counter. With the
+    // split frames of SERVO_HIGH_RESOLUTION a train is as long as a whole
+    // frame; a larger correction then takes several frames.
+    shortest = 0;
+    for (i = 1; i <= 4; i++) {
+        if (LPC_SCT->MATCHREL[i].H > shortest) {
+            shortest = LPC_SCT->MATCHREL[i].H;
+        }
+    }
+    shortest += us_to_servo_ticks(SERVO_SYNC_MARGIN_US);
+
+    reload = (int32_t)servo_frame_ticks - 1 - error;
+    if (reload < shortest) {
+        reload = shortest;
+    }
+    else if (reload > 0xffff) {
+        reload = 0xffff;
+    }
+    LPC_SCT->MATCHREL[0].H = reload;
+#endif
 }
 
 
+// ****************************************************************************
+// The HK310 sends timer values for the 750 ns timer of the nRF24LE1. The
+// servo timer runs at a whole multiple of that (12 MHz / 9 or 12 MHz).
 // ****************************************************************************
 static uint16_t stickdata2timer(uint16_t stickdata)
 {
-    uint32_t ms;
+    uint32_t ticks;
 
-    // ms = (0xffff - stickdata) * 3 / 4;
-    ms = (0xffff - stickdata);
-    return ms & 0xffff;
+    // us = (0xffff - stickdata) * 3 / 4;
+    ticks = (uint32_t)(0xffff - stickdata) * (__SYSTEM_CLOCK * 3 / 4000000) / servo_prescaler;
+    return ticks & 0xffff;
 }
 
 
+// ****************************************************************************
+// The 8ch protocol sends 12 bits in 500 ns steps from 476 us
 // ****************************************************************************
 static uint16_t stickdata2timer8ch(uint16_t stickdata)
 {
-    return (476 * 2) + stickdata;
+    return (uint32_t)((476 * 2) + stickdata) * (__SYSTEM_CLOCK / 2000000) / servo_prescaler;
 }
 
 
@@ -170,10 +781,12 @@ static uint16_t stickdata2txdata(uint16_t stickdata)
 // ****************************************************************************
 static void stop_hop_timer(void)
 {
-    // Stop the SCTimer L
+    // Stop the SCTimer L, and drop a hop event that may just have happened
     LPC_SCT->CTRL_L |= (1 << 2);
+    LPC_SCT->EVFLAG = (1u << 5);
 
-    perform_hop_requested = false;
+    hop_timer_locked = false;
+    restart_requested = false;
 }
 
 
@@ -181,62 +794,224 @@ static void stop_hop_timer(void)
 static void restart_hop_timer(void)
 {
     LPC_SCT->CTRL_L |= (1 << 2);
-    LPC_SCT->MATCHREL[0].L = HOP_TIME_IN_US - 1;
+    LPC_SCT->EVFLAG = (1u << 5);
+    LPC_SCT->MATCHREL[0].L = HOP_TIME_IN_US + hop_trim_q8 / 256 - 1;
 
     // We need to set the MATCH register, not the MATCHREL register here as
     // only after the first match the MATCHREL gets copied in!
-    LPC_SCT->MATCH[0].L = FIRST_HOP_TIME_IN_US;
+    //
+    // All hops happen hop_cost_in_us early, so that the nRF24 is ready on
+    // the new channel when the hop is due.
+    LPC_SCT->MATCH[0].L = FIRST_HOP_TIME_IN_US - hop_cost_in_us;
 
     LPC_SCT->COUNT_L = 0;
+    hops_without_packet = 0;
+    restart_requested = false;
+    slot_packets = 0;
+    hop_trim_fraction = 0;
+    hop_timer_locked = true;
+
     LPC_SCT->CTRL_L &= ~(1 << 2);
+}
+
+
+// ****************************************************************************
+// A packet arrived. If the hop timer is not following the transmitter yet
+// it starts from this packet, and from the hop channel the packet came in
+// on.
+// ****************************************************************************
+static void synchronize_hop_timer(void)
+{
+    uint8_t i;
 
     hops_without_packet = 0;
-    perform_hop_requested = false;
+
+    if (hop_timer_locked) {
+        return;
+    }
+
+    for (i = 0; i < NUMBER_OF_HOP_CHANNELS; i++) {
+        if (hop_data[i] == packet_channel) {
+            hop_index = i;
+            break;
+        }
+    }
+    restart_hop_timer();
 }
 
 
 // ****************************************************************************
-static void restart_packet_receiving(void)
+// Called from the hop timer interrupt. Sets the length of the hop period
+// after the one that just started (MATCHREL is loaded at the end of a
+// period), using the packets received in the period that just ended.
+//
+// Only periods in which both packets of a train were received give a phase
+// sample, so that we can be sure the timestamp is the one of the first
+// packet. The phase error is corrected by a quarter each time, and slowly
+// integrated into the period trim.
+// ****************************************************************************
+static void track_hop_phase(void)
 {
-    stop_hop_timer();
+    int32_t period = HOP_TIME_IN_US;
+    int32_t trim;
 
-    rf_clear_ce();
-    hop_index = 0;
-    hops_without_packet = 0;
-    perform_hop_requested = false;
+    if (hop_timer_locked  &&  slot_packets >= 2) {
+        int32_t error = (int32_t)slot_first_packet_time - (HOP_PHASE_IN_US + hop_cost_in_us);
+
+        if (error > HOP_LOCK_LIMIT_IN_US  ||  error < -HOP_LOCK_LIMIT_IN_US) {
+            hop_timer_locked = false;
+        }
+        else {
+            hop_trim_q8 += error * 8;
+            if (hop_trim_q8 > MAX_HOP_TRIM_Q8) {
+                hop_trim_q8 = MAX_HOP_TRIM_Q8;
+            }
+            if (hop_trim_q8 < -MAX_HOP_TRIM_Q8) {
+                hop_trim_q8 = -MAX_HOP_TRIM_Q8;
+            }
+            period += error / 4;
+        }
+    }
+    slot_packets = 0;
 
-    rf_set_crc(CRC_2_BYTES);
-    rf_set_irq_source(RX_RD);
-    rf_set_address_width(ADDRESS_WIDTH);
-    rf_set_data_rate(DATA_RATE_250K);
-    rf_set_data_pipes(DATA_PIPE_0, NO_AUTO_ACKNOWLEDGE);
+    // Carry the fraction of a microsecond over to the next period
+    hop_trim_fraction += hop_trim_q8;
+    trim = hop_trim_fraction / 256;
+    hop_trim_fraction -= trim * 256;
+
+    LPC_SCT->MATCHREL[0].L = period + trim - 1;
+}
 
-    // FIXME: set timer to 500ns for 8ch, 750ns for 3/4ch protocol
 
+#ifndef NO_DEBUG
+// ****************************************************************************
+// The clock error of the transmitter against ours in ppm, as estimated by
+// the hop phase tracking
+// ****************************************************************************
+static int32_t get_clock_offset_ppm(void)
+{
+    return (hop_trim_q8 * (1000000 / HOP_TIME_IN_US)) / 256;
+}
+#endif
+
+
+// ****************************************************************************
+// Configure the nRF24 for the packets of the bound model, with CE low
+// ****************************************************************************
+static void apply_packet_profile(void)
+{
     if (rx_protocol == PROTOCOL_8CH) {
-        // Enable dynamic payload length
-        rf_set_feature(EN_DPL);
-        // Enable dynamic payload length on pipe 0
-        rf_set_dynpd(DATA_PIPE_0);
+        rf_apply_profile(&PROFILE_8CH);
     }
     else {
-        rf_set_payload_size(DATA_PIPE_0, PAYLOAD_SIZE);
-        // Disable dynamic payout size on all pipes
-        rf_set_dynpd(0);
-        // Disable all dynamic features
-        rf_set_feature(0);
+        rf_apply_profile(&PROFILE_4CH);
     }
 
     rf_set_rx_address(DATA_PIPE_0, ADDRESS_WIDTH, model_address);
-    rf_set_channel(hop_data[0]);
 
     rf_flush_rx_fifo();
     rf_clear_irq(RX_RD);
     rf_int_fired = false;
+    payload_applied = false;
+}
+
+
+// ****************************************************************************
+static void restart_packet_receiving(void)
+{
+    stop_hop_timer();
+
+    rf_clear_ce();
+    hop_index = 0;
+    hops_without_packet = 0;
+
+    // FIXME: set timer to 500ns for 8ch, 750ns for 3/4ch protocol
+
+    apply_packet_profile();
+    rf_set_channel(hop_data[0]);
     rf_set_ce();
 }
 
 
+// ****************************************************************************
+static bool load_bind_slot(uint8_t slot)
+{
+    load_persistent_storage(slot, bind_storage_area);
+    bind_slot = slot;
+
+    switch (bind_storage_area[PROTOCOLID_INDEX]) {
+        case PROTOCOL_3CH:
+        case PROTOCOL_4CH:
+        case PROTOCOL_8CH:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+
+// ****************************************************************************
+// Store the newly bound model in slot 0. A model that was bound before
+// replaces its old slot, otherwise the least recently used model is dropped.
+// ****************************************************************************
+static void save_bind_data(void)
+{
+    uint8_t stored[NUMBER_OF_PERSISTENT_ELEMENTS];
+    uint8_t slot;
+    int i;
+
+    for (slot = 0; slot < NUMBER_OF_BIND_SLOTS - 1; slot++) {
+        load_persistent_storage(slot, stored);
+        for (i = 0; i < ADDRESS_WIDTH; i++) {
+            if (stored[i] != bind_storage_area[i]) {
+                break;
+            }
+        }
+        if (i == ADDRESS_WIDTH) {
+            break;
+        }
+    }
+
+    save_persistent_storage(bind_storage_area, slot);
+    bind_slot = 0;
+}
+
+
+// ****************************************************************************
+// Write the whole configuration into the nRF24 again. A brown-out can reset
+// the nRF24 while the MCU keeps running; the shadow registers in rf.c are
+// read back first so that everything that was lost is written.
+//
+// While the hop timer is locked it keeps running, so that we are back on the
+// transmitter's channel from the next train on instead of waiting for it on
+// the first hop channel. It only counts the hops during the rewrite; at the
+// end CE goes high once, on the channel of the current hop.
+// ****************************************************************************
+static void reinitialize_rf(void)
+{
+    if (!hop_timer_locked) {
+        stop_hop_timer();
+        rf_clear_ce();
+        rf_sync_registers();
+        rf_enable_receiver();
+        restart_packet_receiving();
+        return;
+    }
+
+    rf_reinitializing = true;
+    rf_clear_ce();
+    rf_sync_registers();
+    rf_enable_receiver();
+    apply_packet_profile();
+
+    __disable_irq();
+    rf_reinitializing = false;
+    rf_hop_async(hop_commands[hop_index], NULL);
+    __enable_irq();
+}
+
+
 // ****************************************************************************
 static void parse_bind_data(void)
 {
@@ -248,6 +1023,7 @@ static void parse_bind_data(void)
 
     for (i = 0; i < NUMBER_OF_HOP_CHANNELS; i++) {
         hop_data[i] = bind_storage_area[ADDRESS_WIDTH + i];
+        rf_prepare_hop(hop_commands[i], hop_data[i]);
     }
 
     rx_protocol = bind_storage_area[PROTOCOLID_INDEX];
@@ -273,6 +1049,7 @@ static void parse_bind_data(void)
     }
 
     switch_gpio_according_rx_protocol(rx_protocol);
+    configure_servo_frames();
     successful_stick_data = false;
 }
 
@@ -289,6 +1066,21 @@ static void binding_done(void)
 }
 
 
+// ****************************************************************************
+static void start_bind_receiving(const rf_profile_t *profile)
+{
+    // The hop timer would move the nRF24 off the bind channel
+    stop_hop_timer();
+    rf_clear_ce();
+    rf_apply_profile(profile);
+    // Set special address 12h 23h 23h 45h 78h
+    rf_set_rx_address(DATA_PIPE_0, ADDRESS_WIDTH, BIND_ADDRESS);
+    // Set special channel 0x51
+    rf_set_channel(BIND_CHANNEL);
+    rf_set_ce();
+}
+
+
 // ****************************************************************************
 // The bind process works as follows:
 //
@@ -310,18 +1102,93 @@ static void binding_done(void)
 // h[a-t]       20 channels for frequency hopping
 // ..           Not used
 //
+// The packets are stored in whatever order they arrive; the checksum ties
+// them to the same address. A packet with a different checksum comes from
+// another transmitter, and we start over with it.
+//
+// The headless 8ch transmitter sends all bind data in one packet at 2 Mbps:
+// ac 57 a1 a2 a3 a4 a5 ha .. ht
+//
+// ****************************************************************************
+static void bind_done(void)
+{
+    save_bind_data();
+    parse_bind_data();
+#ifndef NO_DEBUG
+    switch (rx_protocol) {
+        case PROTOCOL_3CH:
+            uart0_send_cstring("Bind successful (3ch)\n");
+            break;
+
+        case PROTOCOL_4CH:
+            uart0_send_cstring("Bind successful (4ch)\n");
+            break;
+
+        case PROTOCOL_8CH:
+        default:
+            uart0_send_cstring("Bind successful (8ch)\n");
+            break;
+    }
+#endif
+    binding_done();
+}
+
+
+// ****************************************************************************
+static void process_4ch_bind_packet(void)
+{
+    uint16_t checksum = 0;
+    uint8_t fragment;
+    int i;
+
+    if (payload[0] == 0xff  &&
+            ((payload[1] == 0xaa  &&  payload[2] == 0x55)  ||
+             (payload[1] == 0xab  &&  payload[2] == 0x56))) {
+        for (i = 0; i < ADDRESS_WIDTH; i++) {
+            checksum += payload[3 + i];
+        }
+        fragment = 0;
+    }
+    else if (payload[2] <= 2) {
+        checksum = payload[0] + (payload[1] << 8);
+        fragment = payload[2] + 1;
+    }
+    else {
+        return;
+    }
+
+    if (bind_fragments  &&  checksum != bind_checksum) {
+        bind_fragments = 0;
+    }
+    bind_checksum = checksum;
+    bind_fragments |= 1 << fragment;
+
+    switch (fragment) {
+        case 0:
+            // Save the protocol identifier (PROTOCOL_3CH=0xaa or PROTOCOL_4CH=0xab)
+            bind_storage_area[PROTOCOLID_INDEX] = payload[1];
+            for (i = 0; i < ADDRESS_WIDTH; i++) {
+                bind_storage_area[i] = payload[3 + i];
+            }
+            break;
+
+        default:
+            // 7 hop channels each, 6 in the last packet
+            for (i = 0; i < (fragment == 3 ? 6 : 7); i++) {
+                bind_storage_area[ADDRESS_WIDTH + (fragment - 1) * 7 + i] = payload[3 + i];
+            }
+            break;
+    }
+
+    if (bind_fragments == 0x0f) {
+        bind_done();
+    }
+}
+
+
 // ****************************************************************************
 static void process_binding(void)
 {
-    static enum {
-        BIND_STATE_4CH_1,
-        BIND_STATE_4CH_2,
-        BIND_STATE_4CH_3,
-        BIND_STATE_4CH_4,
-        BIND_STATE_8CH,
-    } bind_state;
-    static uint16_t checksum;
-    uint8_t payload_width = PAYLOAD_SIZE;
     int i;
 
     // ================================
@@ -333,7 +1200,9 @@ static void process_binding(void)
         binding_requested = false;
         led_state = LED_STATE_BINDING;
         binding = true;
-        bind_state = BIND_STATE_4CH_1;
+        detect_slots = 0;
+        bind_8ch_mode = false;
+        bind_fragments = 0;
         bind_timer = BIND_TIMEOUT;
         bind_swap_timer = 0;
 
@@ -355,154 +1224,35 @@ static void process_binding(void)
 
 
     // ================================
-    // Every 50ms we toggle between the 3/4ch bind mode and 8ch bind mode.
-    // We only do that if we haven't received one of the 3/4ch bind packets
-    // yet (multiple bind packets are combined to form bind data)
+    // We toggle between the 3/4ch bind mode and 8ch bind mode unless bind
+    // packets keep coming in the current mode. Bind packets received in the
+    // 3/4ch mode are kept over a swap.
     if (bind_swap_timer == 0) {
         bind_swap_timer = BIND_SWAP_TIMEOUT;
-
-        if (bind_state == BIND_STATE_4CH_1) {
-            bind_state = BIND_STATE_8CH;
-            // Set special address 12h 23h 23h 45h 78h
-            rf_set_rx_address(0, ADDRESS_WIDTH, BIND_ADDRESS);
-            // Set special channel 0x51
-            rf_set_channel(BIND_CHANNEL);
-
-            rf_set_data_rate(DATA_RATE_2M);
-            // Enable dynamic payload length
-            rf_set_feature(EN_DPL);
-            // Enable dynamic payload length on pipe 0
-            rf_set_dynpd(DATA_PIPE_0);
-            rf_set_ce();
-        }
-        else if (bind_state == BIND_STATE_8CH) {
-            bind_state = BIND_STATE_4CH_1;
-
-            rf_clear_ce();
-            // Set special address 12h 23h 23h 45h 78h
-            rf_set_rx_address(0, ADDRESS_WIDTH, BIND_ADDRESS);
-            // Set special channel 0x51
-            rf_set_channel(BIND_CHANNEL);
-
-            rf_set_data_rate(DATA_RATE_250K);
-            rf_set_payload_size(DATA_PIPE_0, PAYLOAD_SIZE);
-            // Disable dynamic payout size on all pipes
-            rf_set_dynpd(0);
-            // Disable all dynamic features
-            rf_set_feature(0);
-            rf_set_ce();
-        }
+        bind_8ch_mode = !bind_8ch_mode;
+        start_bind_receiving(bind_8ch_mode ? &PROFILE_8CH_BIND : &PROFILE_4CH_BIND);
     }
 
 
     // ================================
-    if (!rf_int_fired) {
+    if (!fetch_payload()) {
         return;
     }
-    rf_int_fired = false;
 
-    while (!rf_is_rx_fifo_emtpy()) {
-        payload_width = rf_read_payload_width();
-        rf_read_fifo(payload, payload_width);
+    if (!bind_8ch_mode) {
+        bind_swap_timer = BIND_SWAP_TIMEOUT;
+        process_4ch_bind_packet();
+        return;
     }
-    rf_clear_irq(RX_RD);
 
-    switch (bind_state) {
-        case BIND_STATE_4CH_1:
-            if (payload[0] == 0xff) {
-                if (((payload[1] == 0xaa) && (payload[2] == 0x55)) ||
-                    ((payload[1] == 0xab) && (payload[2] == 0x56))) {
-
-                    // Save the protocol identifier (PROTOCOL_3CH=0xaa or PROTOCOL_4CH=0xab)
-                    bind_storage_area[PROTOCOLID_INDEX] = payload[1];
-
-                    checksum = 0;
-                    for (i = 0; i < 5; i++) {
-                        uint8_t payload_byte;
-
-                        payload_byte = payload[3 + i];
-                        bind_storage_area[i] = payload_byte;
-                        checksum += payload_byte;
-                    }
-                    bind_state = BIND_STATE_4CH_2;
-                }
-            }
-            break;
+    if (payload_width == 27  &&  payload[0] == 0xac  &&  payload[1] == 0x57) {
+        // Save the protocol identifier
+        bind_storage_area[PROTOCOLID_INDEX] = PROTOCOL_8CH;
 
-        case BIND_STATE_4CH_2:
-            if (payload[0] == (checksum & 0xff)) {
-                if (payload[1] == (checksum >> 8)) {
-                    if (payload[2] == 0) {
-                        for (i = 0; i < 7; i++) {
-                            bind_storage_area[5 + i] = payload[3 + i];
-                        }
-                        bind_state = BIND_STATE_4CH_3;
-                    }
-                }
-            }
-            break;
-
-        case BIND_STATE_4CH_3:
-            if (payload[0] == (checksum & 0xff)) {
-                if (payload[1] == (checksum >> 8)) {
-                    if (payload[2] == 1) {
-                        for (i = 0; i < 7; i++) {
-                            bind_storage_area[12 + i] = payload[3 + i];
-                        }
-                        bind_state = BIND_STATE_4CH_4;
-                    }
-                }
-            }
-            break;
-
-        case BIND_STATE_4CH_4:
-            if (payload[0] == (checksum & 0xff)) {
-                if (payload[1] == (checksum >> 8)) {
-                    if (payload[2] == 2) {
-                        for (i = 0; i < 6; i++) {
-                            bind_storage_area[19 + i] = payload[3 + i];
-                        }
-
-                        save_persistent_storage(bind_storage_area);
-                        parse_bind_data();
-#ifndef NO_DEBUG
-                        if (rx_protocol == PROTOCOL_3CH) {
-                            uart0_send_cstring("Bind successful (3ch)\n");
-                        }
-                        else {
-                            uart0_send_cstring("Bind successful (4ch)\n");
-                        }
-#endif
-                        binding_done();
-                        return;
-                    }
-                }
-            }
-            break;
-
-        case BIND_STATE_8CH:
-            if (payload_width == 27) {
-                if ((payload[0] == 0xac) && (payload[1] == 0x57)) {
-                    // Save the protocol identifier
-                    bind_storage_area[PROTOCOLID_INDEX] = PROTOCOL_8CH;
-
-                    for (i = 0; i < 25; i++) {
-                        bind_storage_area[i] = payload[2 + i];
-                    }
-
-                    save_persistent_storage(bind_storage_area);
-                    parse_bind_data();
-#ifndef NO_DEBUG
-                    uart0_send_cstring("Bind successful (8ch)\n");
-#endif
-                    binding_done();
-                }
-            }
-            break;
-
-        default:
-            bind_state = BIND_STATE_4CH_1;
-            break;
+        for (i = 0; i < 25; i++) {
+            bind_storage_area[i] = payload[2 + i];
+        }
+        bind_done();
     }
 }
 
@@ -510,13 +1260,6 @@ static void process_binding(void)
 // ****************************************************************************
 static void process_4ch_receiving(void)
 {
-#ifndef SIMULATE_RF_DATA
-    while (!rf_is_rx_fifo_emtpy()) {
-        rf_read_fifo(payload, PAYLOAD_SIZE);
-    }
-    rf_clear_irq(RX_RD);
-#endif
-
 #ifndef NO_DEBUG
     if (hops_without_packet > 1) {
         uart0_send_uint32(hops_without_packet);
@@ -524,7 +1267,21 @@ static void process_4ch_receiving(void)
     }
 #endif
 
-    restart_hop_timer();
+    synchronize_hop_timer();
+    synchronize_servo_frame();
+
+    // A repeat changes nothing but proves that the link is alive
+    if (payload_repeat  &&  payload_applied) {
+        if (payload[7] == stickdata_packetid) {
+            failsafe_timer = FAILSAFE_TIMEOUT;
+#if SERVO_UPSAMPLING
+            // The upsampling needs a sample of every train
+            output_pulses();
+#endif
+        }
+        return;
+    }
+    payload_applied = true;
 
 
     // ================================
@@ -578,19 +1335,9 @@ static void process_4ch_receiving(void)
 // ****************************************************************************
 static void process_8ch_receiving(void)
 {
-#ifndef SIMULATE_RF_DATA
-    uint8_t payload_width = 0;
-
-    while (!rf_is_rx_fifo_emtpy()) {
-        payload_width = rf_read_payload_width();
-        rf_read_fifo(payload, payload_width);
-    }
-    rf_clear_irq(RX_RD);
-
     if (payload_width != 13) {
         return;
     }
-#endif
 
 #ifndef NO_DEBUG
     if (hops_without_packet > 1) {
@@ -599,7 +1346,21 @@ static void process_8ch_receiving(void)
     }
 #endif
 
-    restart_hop_timer();
+    synchronize_hop_timer();
+    synchronize_servo_frame();
+
+    // A repeat changes nothing but proves that the link is alive
+    if (payload_repeat  &&  payload_applied) {
+        if (payload[0] == stickdata_packetid) {
+            failsafe_timer = FAILSAFE_TIMEOUT;
+#if SERVO_UPSAMPLING
+            // The upsampling needs a sample of every train
+            output_pulses();
+#endif
+        }
+        return;
+    }
+    payload_applied = true;
 
     // ================================
     // payload[0] is 0x57 for stick data
@@ -652,43 +1413,65 @@ static void process_receiving(void)
     // This way the servo outputs stay off until we got successful stick
     // data, so the servos do not got to the failsafe point after power up
     // in case the transmitter is not on yet.
+    //
+    // The failsafe values are applied when failsafe starts and then once per
+    // systick, which picks up new failsafe values but leaves the main loop
+    // idle in between.
     if (successful_stick_data) {
-        if (failsafe_timer == 0) {
+        if (failsafe_timer == 0  &&  (systick  ||  led_state != LED_STATE_FAILSAFE)) {
             uint8_t i;
 
             for (i = 0; i < NUMBER_OF_CHANNELS; i++) {
                 channels[i] = failsafe[i];
             }
             output_pulses();
+            payload_applied = false;
 
+            // The nRF24 may have lost its configuration
+            if (led_state != LED_STATE_FAILSAFE) {
+                reinitialize_rf();
+            }
             led_state = LED_STATE_FAILSAFE;
         }
     }
 
 
     // ================================
-    if (perform_hop_requested) {
-        perform_hop_requested = false;
-        ++hops_without_packet;
-
+    if (restart_requested) {
+        restart_packet_receiving();
+    }
 
-        if (hops_without_packet > MAX_HOP_WITHOUT_PACKET) {
-            restart_packet_receiving();
-        }
-        else {
-            rf_clear_ce();
-            hop_index = (hop_index + 1) % NUMBER_OF_HOP_CHANNELS;
-            rf_set_channel(hop_data[hop_index]);
-            rf_set_ce();
-        }
+#ifndef NO_DEBUG
+    if (clock_report_timer == 0  &&  hop_timer_locked) {
+        clock_report_timer = CLOCK_REPORT_TIME;
+        uart0_send_cstring("TX clock offset (ppm): ");
+        uart0_send_int32(get_clock_offset_ppm());
+        uart0_send_linefeed();
     }
+#endif
 
 
     // ================================
-    if (!rf_int_fired) {
+    if (!fetch_payload()) {
         return;
     }
-    rf_int_fired = false;
+
+    // The first packet after power-up tells which model is live. Move it to
+    // slot 0 so that it is tried first next time. Programming the flash
+    // stops everything for a page erase time, which loses the hop phase, so
+    // we start over on the first hop channel afterwards.
+    if (detect_slots) {
+        detect_slots = 0;
+#ifndef NO_DEBUG
+        uart0_send_cstring("Model detected\n");
+#endif
+        if (bind_slot != 0) {
+            save_persistent_storage(bind_storage_area, bind_slot);
+            bind_slot = 0;
+            restart_packet_receiving();
+            return;
+        }
+    }
 
     if (rx_protocol == PROTOCOL_8CH) {
         process_8ch_receiving();
@@ -699,6 +1482,46 @@ static void process_receiving(void)
 }
 
 
+// ****************************************************************************
+// Check one nRF24 register per systick; with CONFIG checked every other time
+// a reset of the nRF24 is found within 2 systicks.
+// ****************************************************************************
+static void process_rf_check(void)
+{
+    if (!systick  ||  binding) {
+        return;
+    }
+
+    if (!rf_check_registers()) {
+#ifndef NO_DEBUG
+        uart0_send_cstring("nRF24 configuration lost\n");
+#endif
+        reinitialize_rf();
+    }
+}
+
+
+// ****************************************************************************
+// Power-up transmitter detection: while no packet comes in, listen for the
+// next bound model every DETECT_TIME.
+// ****************************************************************************
+static void process_model_detection(void)
+{
+    if (!detect_slots  ||  binding  ||  detect_timer) {
+        return;
+    }
+
+    do {
+        bind_slot = (bind_slot + 1) % NUMBER_OF_BIND_SLOTS;
+    } while (!(detect_slots & (1 << bind_slot)));
+
+    load_bind_slot(bind_slot);
+    parse_bind_data();
+    restart_packet_receiving();
+    detect_timer = DETECT_TIME;
+}
+
+
 // ****************************************************************************
 static void process_systick(void)
 {
@@ -725,6 +1548,14 @@ static void process_systick(void)
     if (blink_timer) {
         --blink_timer;
     }
+
+    if (clock_report_timer) {
+        --clock_report_timer;
+    }
+
+    if (detect_timer) {
+        --detect_timer;
+    }
 }
 
 
@@ -811,48 +1642,17 @@ static void process_led(void)
 
 #ifdef SIMULATE_RF_DATA
 // ****************************************************************************
-#define CHANNEL_100_PERCENT 10000
-#define CHANNEL_CENTER 0
-#define CHANNEL_N100_PERCENT -10000
-
-// Exactly the same function as we use in the rc-headless-transmitter
-static uint16_t channel_to_stickdata(int32_t ch)
-{
-    int32_t pulse_ns;
-/*
-    Desired us range:
-        476         1000       1500    2000     2523
-
-    ns with reference to 476 us minimum:
-        0           524000       1024000    1524000    2048000
-
-    Translated 12 bit values:
-        0           1048       2048    2048     4095
-
-    => 12 bit value = ns / 500
-*/
-
-    pulse_ns = ch * 500 * 1000 / CHANNEL_100_PERCENT;
-    pulse_ns += 1500 * 1000;
-    pulse_ns -= 476 * 1000;
-
-    if (pulse_ns < 0) {
-        pulse_ns = 0;
-    }
-
-    pulse_ns /= 500;
-    return (uint16_t)pulse_ns;
-}
-
 static void process_rf_simulation(void)
 {
     static uint32_t next_rf_packet_time = 1000;
+    uint8_t *packet = &packet_buffers[decoding_buffer ^ 1][1];
 
     if (rx_protocol != PROTOCOL_8CH) {
         rx_protocol = PROTOCOL_8CH;
         stickdata_packetid = STICKDATA_PACKETID_8CH;
         failsafe_packetid = FAILSAFE_PACKETID_8CH;
         switch_gpio_according_rx_protocol(rx_protocol);
+        configure_servo_frames();
         successful_stick_data = false;
     }
 
@@ -862,41 +1662,41 @@ static void process_rf_simulation(void)
 
         next_rf_packet_time += 100;
 
-        payload[0] = STICKDATA_PACKETID_8CH;
+        packet[0] = STICKDATA_PACKETID_8CH;
 
         stick_data = channel_to_stickdata(ch[0]);
-        payload[1] = stick_data;
-        payload[9] = stick_data >> 8;
+        packet[1] = stick_data;
+        packet[9] = stick_data >> 8;
 
         stick_data = channel_to_stickdata(ch[1]);
-        payload[2] = stick_data;
-        payload[9] |= (stick_data >> 4) & 0xf0;
+        packet[2] = stick_data;
+        packet[9] |= (stick_data >> 4) & 0xf0;
 
         stick_data = channel_to_stickdata(ch[2]);
-        payload[3] = stick_data;
-        payload[10] = stick_data >> 8;
+        packet[3] = stick_data;
+        packet[10] = stick_data >> 8;
 
         stick_data = channel_to_stickdata(ch[3]);
-        payload[4] = stick_data;
-        payload[10] |= (stick_data >> 4) & 0xf0;
+        packet[4] = stick_data;
+        packet[10] |= (stick_data >> 4) & 0xf0;
 
         stick_data = channel_to_stickdata(ch[4]);
-        payload[5] = stick_data;
-        payload[11] = stick_data >> 8;
+        packet[5] = stick_data;
+        packet[11] = stick_data >> 8;
 
         stick_data = channel_to_stickdata(ch[5]);
-        payload[6] = stick_data;
-        payload[11] |= (stick_data >> 4) & 0xf0;
+        packet[6] = stick_data;
+        packet[11] |= (stick_data >> 4) & 0xf0;
 
         stick_data = channel_to_stickdata(ch[6]);
-        payload[7] = stick_data;
-        payload[12] = stick_data >> 8;
+        packet[7] = stick_data;
+        packet[12] = stick_data >> 8;
 
         stick_data = channel_to_stickdata(ch[7]);
-        payload[8] = stick_data;
-        payload[12] |= (stick_data >> 4) & 0xf0;
+        packet[8] = stick_data;
+        packet[12] |= (stick_data >> 4) & 0xf0;
 
-        rf_int_fired = true;
+        store_received_payload(packet, 13);
     }
 }
 #endif
@@ -905,12 +1705,30 @@ static void process_rf_simulation(void)
 // ****************************************************************************
 void init_receiver(void)
 {
-    load_persistent_storage(bind_storage_area);
+    uint8_t slot;
+    uint8_t first_slot = 0;
+
+    // Start with the model used last, which is in the first bound slot.
+    // Detection is only needed when more than one model is bound.
+    for (slot = NUMBER_OF_BIND_SLOTS; slot > 0; slot--) {
+        if (load_bind_slot(slot - 1)) {
+            detect_slots |= 1 << (slot - 1);
+            first_slot = slot - 1;
+        }
+    }
+    load_bind_slot(first_slot);
+    if (detect_slots & (detect_slots - 1)) {
+        detect_timer = DETECT_TIME;
+    }
+    else {
+        detect_slots = 0;
+    }
     parse_bind_data();
     initialize_failsafe();
 
     rf_enable_clock();
     rf_clear_ce();
+    rf_sync_registers();
     rf_enable_receiver();
 
     restart_packet_receiving();
@@ -935,6 +1753,8 @@ void process_receiver(void)
     process_systick();
     process_bind_button();
     process_binding();
+    process_model_detection();
+    process_rf_check();
     process_receiving();
     process_led();
 }
@@ -943,98 +1763,130 @@ void process_receiver(void)
 // ****************************************************************************
 void rf_interrupt_handler(void)
 {
-    rf_int_fired = true;
+    if (slot_packets == 0) {
+        slot_first_packet_time = LPC_SCT->COUNT_L;
+    }
+    packet_channel = rf_get_channel();
+    if (slot_packets < 255) {
+        ++slot_packets;
+    }
+
+    // A packet that has not been fetched yet is replaced by a newer one.
+    // All interrupts have the same priority, so the SPI interrupt can not
+    // come in between.
+    rf_int_fired = false;
+    rf_drain_rx_fifo_async(packet_buffers[decoding_buffer ^ 1], store_received_payload);
 }
 
 
 // ****************************************************************************
-void hop_timer_handler(void)
+// Called when CE is high again after a hop. The hop timer counter was reset
+// by the hop event, so it holds the time the hop took so far.
+//
+// A longer hop is taken over at once; shorter ones only bring the cost down
+// slowly, so that a single quick hop does not make the next slow one late.
+// ****************************************************************************
+static void hop_done(void)
 {
-    perform_hop_requested = true;
+    uint16_t cost = LPC_SCT->COUNT_L + RX_SETTLING_TIME_IN_US;
+
+    if (cost > MAX_HOP_COST_IN_US) {
+        cost = MAX_HOP_COST_IN_US;
+    }
+
+    if (cost >= hop_cost_in_us) {
+        hop_cost_in_us = cost;
+    }
+    else {
+        hop_cost_in_us -= (hop_cost_in_us - cost + 7) / 8;
+    }
 }
 
 
 // ****************************************************************************
-void servo_pulse_timer_handler(void)
+void hop_timer_handler(void)
 {
-    static uint8_t flipped = 0;
-    static bool ch1to4 = true;
+    track_hop_phase();
 
-    if (!is8channel || (rx_protocol != PROTOCOL_8CH)) {
+    if (restart_requested) {
         return;
     }
 
-    if (LPC_SCT->EVFLAG & (1 << 1)) {
-        LPC_SCT->EVFLAG = (1 << 1);
-        flipped |= (1 << 0);
+    // When packets stop coming we keep hopping on time for
+    // DEAD_RECKONING_CYCLES full cycles, so that we catch the transmitter
+    // again as soon as the fade is over. Only then we park on the first
+    // channel. Restarting takes many SPI transactions; leave it to the main
+    // loop.
+    ++hops_without_packet;
+    if (hops_without_packet > MAX_HOP_WITHOUT_PACKET + DEAD_RECKONING_HOPS) {
+        restart_requested = true;
+        return;
+    }
 
-        // CTOUT_0
-        if (ch1to4) {
-            LPC_GPIO_PORT->CLR0 = (1 << GPIO_8CH_BIT_CH5);
-            LPC_SWM->PINASSIGN6 = (LPC_SWM->PINASSIGN6 & 0x00ffffff) | (GPIO_8CH_BIT_CH1 << 24);
-            LPC_SCT->MATCHREL[1].H = channels[0];
-        }
-        else {
-            LPC_GPIO_PORT->CLR0 = (1 << GPIO_8CH_BIT_CH1);
-            LPC_SWM->PINASSIGN6 = (LPC_SWM->PINASSIGN6 & 0x00ffffff) | (GPIO_8CH_BIT_CH5 << 24);
-            LPC_SCT->MATCHREL[1].H = channels[4];
-        }
+    hop_index = (hop_index + 1) % NUMBER_OF_HOP_CHANNELS;
+    if (rf_reinitializing) {
+        return;
     }
+    rf_hop_async(hop_commands[hop_index], hop_done);
+}
 
-    if (LPC_SCT->EVFLAG & (1 << 2)) {
-        LPC_SCT->EVFLAG = (1 << 2);
-        flipped |= (1 << 1);
 
-        // CTOUT_1
-        if (ch1to4) {
-            LPC_GPIO_PORT->CLR0 = (1 << GPIO_8CH_BIT_CH6);
-            LPC_SWM->PINASSIGN7 = (LPC_SWM->PINASSIGN7 & 0xffffff00) | (GPIO_8CH_BIT_CH2 << 0);
-            LPC_SCT->MATCHREL[2].H = channels[1];
-        }
-        else {
-            LPC_GPIO_PORT->CLR0 = (1 << GPIO_8CH_BIT_CH2);
-            LPC_SWM->PINASSIGN7 = (LPC_SWM->PINASSIGN7 & 0xffffff00) | (GPIO_8CH_BIT_CH6 << 0);
-            LPC_SCT->MATCHREL[2].H = channels[5];
-        }
-    }
+// ****************************************************************************
+// A servo frame has started. The outputs are set at the end of it, so
+// decide now which of them pulse in the frame after.
+// ****************************************************************************
+void servo_frame_timer_handler(void)
+{
+    int i;
 
-    if (LPC_SCT->EVFLAG & (1 << 3)) {
-        LPC_SCT->EVFLAG = (1 << 3);
-        flipped |= (1 << 2);
+#if SERVO_UPSAMPLING
+    upsample_pulses();
+#endif
 
-        // CTOUT_2
-        if (ch1to4) {
-            LPC_GPIO_PORT->CLR0 = (1 << GPIO_8CH_BIT_CH7);
-            LPC_SWM->PINASSIGN7 = (LPC_SWM->PINASSIGN7 & 0xffff00ff) | (GPIO_8CH_BIT_CH3 << 8);
-            LPC_SCT->MATCHREL[3].H = channels[2];
-        }
-        else {
-            LPC_GPIO_PORT->CLR0 = (1 << GPIO_8CH_BIT_CH3);
-            LPC_SWM->PINASSIGN7 = (LPC_SWM->PINASSIGN7 & 0xffff00ff) | (GPIO_8CH_BIT_CH7 << 8);
-            LPC_SCT->MATCHREL[3].H = channels[6];
+    for (i = 0; i < 4; i++) {
+        if (++servo_frame_phase[i] >= servo_frame_divider[i]) {
+            servo_frame_phase[i] = 0;
         }
+        LPC_SCT->OUT[i].SET = servo_frame_phase[i] ? 0 : SERVO_SET_EVENT(i);
     }
+}
 
-    if (LPC_SCT->EVFLAG & (1 << 4)) {
-        LPC_SCT->EVFLAG = (1 << 4);
-        flipped |= (1 << 3);
 
-        //  CTOUT_3
-        if (ch1to4) {
-            LPC_GPIO_PORT->CLR0 = (1 << GPIO_8CH_BIT_CH8);
-            LPC_SWM->PINASSIGN7 = (LPC_SWM->PINASSIGN7 & 0xff00ffff) | (GPIO_8CH_BIT_CH4 << 16);
-            LPC_SCT->MATCHREL[4].H = channels[3];
-        }
-        else {
-            LPC_GPIO_PORT->CLR0 = (1 << GPIO_8CH_BIT_CH4);
-            LPC_SWM->PINASSIGN7 = (LPC_SWM->PINASSIGN7 & 0xff00ffff) | (GPIO_8CH_BIT_CH8 << 16);
-            LPC_SCT->MATCHREL[4].H = channels[7];
-        }
+// ****************************************************************************
+// 8ch multiplexing: the longest pulse of the frame has ended, so all SCT
+// outputs are low. Switch them over to the other bank, which the SCT outputs
+// from the next frame on.
+//
+// When we come in late, after the next frame has started, its pulses may be
+// high. The switch waits for the end of the longest pulse again then; until
+// it happens the SCT repeats the bank, with its own pulse widths.
+// ****************************************************************************
+void servo_pulse_timer_handler(void)
+{
+    const servo_bank_t *next;
+
+    LPC_SCT->EVFLAG = 0x1e;
+
+    if (!is8channel || (rx_protocol != PROTOCOL_8CH)) {
+        return;
     }
 
-    // If all 4 channels have been processed, progress to the next 8
-    if (flipped == 0x0f) {
-        flipped = 0;
-        ch1to4 = !ch1to4;
+    if (LPC_SCT->COUNT_H < LPC_SCT->MATCH[1].H  ||
+            LPC_SCT->COUNT_H < LPC_SCT->MATCH[2].H  ||
+            LPC_SCT->COUNT_H < LPC_SCT->MATCH[3].H  ||
+            LPC_SCT->COUNT_H < LPC_SCT->MATCH[4].H) {
+        return;
     }
+
+    servo_bank ^= 1;
+    next = &servo_banks[servo_bank];
+
+    LPC_GPIO_PORT->CLR0 = next->released_pins;
+    LPC_SWM->PINASSIGN6 = next->pinassign6;
+    LPC_SWM->PINASSIGN7 = next->pinassign7;
+    LPC_SCT->MATCHREL[1].H = next->pulses[0];
+    LPC_SCT->MATCHREL[2].H = next->pulses[1];
+    LPC_SCT->MATCHREL[3].H = next->pulses[2];
+    LPC_SCT->MATCHREL[4].H = next->pulses[3];
+    LPC_SCT->EVEN = (LPC_SCT->EVEN & ~0x1eu) | next->last_event;
 }
\ No newline at end of file
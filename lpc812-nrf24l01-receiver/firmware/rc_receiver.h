@@ -10,4 +10,5 @@ void process_receiver(void);
 void init_receiver(void);
 void rf_interrupt_handler(void);
 void hop_timer_handler(void);
+void servo_frame_timer_handler(void);
 void servo_pulse_timer_handler(void);
\ No newline at end of file
@@ -6,7 +6,141 @@
 #include <spi.h>
 #include <rf.h>
 
-static uint8_t spi_buffer[RF_MAX_BUFFER_LENGTH + 1];
+// MRT channel that times the nRF24 start-up before CE may go high
+#define CE_TIMER 2
+#define MRT_STAT_RUN (1 << 1)
+
+// Tpd2stby, worst case (data sheet page 24)
+#define POWER_UP_DELAY_IN_US 4500
+
+// Delay from CE positive edge to CSN low (data sheet page 24)
+#define CE_TO_CSN_DELAY_IN_US 4
+
+// RX_P_NO in STATUS when the receive FIFO is empty
+#define STATUS_RX_P_NO_MASK 0x0e
+#define STATUS_RX_FIFO_EMPTY 0x0e
+
+// Longest register: a 5 byte address. Payloads are transferred in the
+// caller's buffer (rf_transfer()).
+#define RF_MAX_REGISTER_LENGTH 5
+
+static uint8_t spi_buffer[RF_MAX_REGISTER_LENGTH + 1];
+
+// CE goes high as soon as the start-up timer expires
+static volatile bool ce_pending;
+
+// CE goes high when the channel write of rf_hop_async() is done
+static volatile bool ce_after_hop;
+
+// Draining the receive FIFO in the background (rf_drain_rx_fifo_async())
+typedef enum {
+    RX_IDLE,
+    RX_WIDTH,
+    RX_PAYLOAD,
+    RX_CLEAR
+} rx_step_t;
+
+static spi_request_t rx_request;
+static uint8_t *rx_buffer;
+static uint8_t rx_command[2];
+static volatile rx_step_t rx_step = RX_IDLE;
+static volatile bool rx_again;
+static bool rx_valid;
+static uint8_t rx_width;
+static rf_payload_callback_t rx_callback;
+
+// Changing the channel in the background (rf_hop_async()). hop_next is a
+// hop that came while the previous one was still queued.
+static spi_request_t hop_request;
+static uint8_t * volatile hop_next;
+static rf_hop_callback_t hop_callback;
+
+// RAM copy of the configuration registers, indexed by register address.
+// Only the registers for which is_shadowed() is true are valid; STATUS and
+// the other status registers change on their own and are always read from
+// the nRF24.
+static uint8_t shadow[FEATURE + 1];
+
+// The receive address of pipe 0; shadow_rx_address_width is 0 while it is
+// unknown.
+static uint8_t shadow_rx_address[5];
+static uint8_t shadow_rx_address_width;
+
+// The registers that rf_check_registers() compares with the shadow in turn.
+// CONFIG is checked every other time: it loses PWR_UP when the nRF24 resets.
+static const uint8_t checked_registers[] = {
+    RF_SETUP, SETUP_AW, EN_RXADDR, RX_PW_P0, DYNPD, FEATURE, RX_ADDR_P0
+};
+static uint8_t check_index;
+
+
+// ****************************************************************************
+static bool is_shadowed(uint8_t reg)
+{
+    if (reg <= RF_SETUP) {
+        return true;
+    }
+
+    if (reg >= RX_PW_P0  &&  reg <= RX_PW_P5) {
+        return true;
+    }
+
+    return (reg == DYNPD  ||  reg == FEATURE);
+}
+
+
+// ****************************************************************************
+// Returns the CONFIG value *config* with the IRQ mask bits set so that only
+// *irq_source* asserts the IRQ pin
+// ****************************************************************************
+static uint8_t config_irq_source(uint8_t config, uint8_t irq_source)
+{
+    // Datasheet page 56: The IRQ mask in the CONFIG register is used to select
+    // the IRQ sources that are allowed to assert the IRQ pin. By setting one of
+    // the MASK bits high, the corresponding IRQ source is disabled. By default
+    // all IRQ sources are enabled.
+
+    config |= 0x70;
+    config &= ~irq_source;      // Toggle bits as 1 = irq source disabled
+    return config;
+}
+
+
+// ****************************************************************************
+// Returns the CONFIG value *config* with the CRC bits set for *crc_size*
+// ****************************************************************************
+static uint8_t config_crc(uint8_t config, uint8_t crc_size)
+{
+    config &= ~(EN_CRC | CRC0);
+    if (crc_size == 1) {
+        config |= EN_CRC;
+    }
+    else if (crc_size == 2) {
+        config |= EN_CRC | CRC0;
+    }
+    return config;
+}
+
+
+// ****************************************************************************
+// Returns the RF_SETUP value *rf_setup* with the data rate bits set for
+// *data_rate*
+// ****************************************************************************
+static uint8_t rf_setup_data_rate(uint8_t rf_setup, uint8_t data_rate)
+{
+    // Clear everything except transmit power
+    rf_setup &= 0x06;
+    if (data_rate == DATA_RATE_250K) {
+        rf_setup |= RF_DR_LOW;
+    }
+    else if (data_rate == DATA_RATE_1M) {
+        // Nothing to do, both bits are already cleared
+    }
+    else { // 2Mbps (default)
+        rf_setup |= RF_DR_HIGH;
+    }
+    return rf_setup;
+}
 
 
 // ****************************************************************************
@@ -44,8 +178,8 @@ static uint8_t rf_write_command_buffer(uint8_t cmd, uint8_t count, const uint8_t
 {
     int i;
 
-    if (count > RF_MAX_BUFFER_LENGTH) {
-        count = RF_MAX_BUFFER_LENGTH;
+    if (count > RF_MAX_REGISTER_LENGTH) {
+        count = RF_MAX_REGISTER_LENGTH;
     }
 
     spi_buffer[0] = cmd;
@@ -65,8 +199,8 @@ static uint8_t rf_read_command_buffer(uint8_t cmd, uint8_t count, uint8_t *buffe
 {
     int i;
 
-    if (count > RF_MAX_BUFFER_LENGTH) {
-        count = RF_MAX_BUFFER_LENGTH;
+    if (count > RF_MAX_REGISTER_LENGTH) {
+        count = RF_MAX_REGISTER_LENGTH;
     }
 
     spi_buffer[0] = cmd;
@@ -107,6 +241,15 @@ static void rf_write_register(uint8_t reg, uint8_t value)
     //
     // It is left to the user of this library to set/clear CE properly.
 
+    // Writing the value the register already holds changes nothing, so we
+    // save the SPI transaction.
+    if (is_shadowed(reg)) {
+        if (shadow[reg] == value) {
+            return;
+        }
+        shadow[reg] = value;
+    }
+
     spi_buffer[0] = W_REGISTER | reg;
     spi_buffer[1] = value;
 
@@ -143,6 +286,62 @@ void rf_disable_clock(void)
 }
 
 
+// ****************************************************************************
+// Read the configuration registers of the nRF24 into the RAM shadow.
+//
+// All other functions of this library that configure the nRF24 work on the
+// shadow, so this must be called once before them. It does not assume the
+// reset values because the MCU may have been reset while the nRF24 kept
+// its configuration.
+// ****************************************************************************
+void rf_sync_registers(void)
+{
+    uint8_t reg;
+
+    for (reg = 0; reg < sizeof(shadow); reg++) {
+        if (is_shadowed(reg)) {
+            shadow[reg] = rf_read_register(reg);
+        }
+    }
+
+    shadow_rx_address_width = 0;
+}
+
+
+// ****************************************************************************
+// Read back one of the configuration registers and compare it with the
+// shadow; call it regularly to find out whether the nRF24 lost its
+// configuration, e.g. in a brown-out. Returns false on a mismatch.
+//
+// Each call costs one SPI transaction of 2 bytes, 6 for the address.
+// ****************************************************************************
+bool rf_check_registers(void)
+{
+    uint8_t reg;
+    uint8_t address[sizeof(shadow_rx_address)];
+    uint8_t i;
+
+    ++check_index;
+    if (check_index >= 2 * sizeof(checked_registers)) {
+        check_index = 0;
+    }
+
+    reg = (check_index & 1) ? checked_registers[check_index / 2] : CONFIG;
+
+    if (reg != RX_ADDR_P0) {
+        return rf_read_register(reg) == shadow[reg];
+    }
+
+    rf_read_command_buffer(R_REGISTER | RX_ADDR_P0, shadow_rx_address_width, address);
+    for (i = 0; i < shadow_rx_address_width; i++) {
+        if (address[i] != shadow_rx_address[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
 // ****************************************************************************
 // Return the contents of the STATUS register by issuing a NOP command
 // ****************************************************************************
@@ -153,23 +352,61 @@ uint8_t rf_get_status(void)
 
 
 // ****************************************************************************
-void rf_set_ce(void)
+static void raise_ce(void)
 {
     LPC_GPIO_PORT->SET0 = gpio_mask_nrf_ce;
 
     // Data sheet page 24: Delay from CE positive edge to CSN low: 4us
-    // To ensure that we always delay for 4us.
-    delay_us(4);
+    // The SPI does not start a transaction during that time, so we do not
+    // have to wait here.
+    spi_hold(CE_TO_CSN_DELAY_IN_US);
 }
 
 
+// ****************************************************************************
+// Set CE. If the nRF24 is still starting up after rf_enable_receiver() or
+// rf_enable_transmitter() the rising edge is deferred until it is ready.
+// ****************************************************************************
+void rf_set_ce(void)
+{
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+    if (LPC_MRT->Channel[CE_TIMER].STAT & MRT_STAT_RUN) {
+        ce_pending = true;
+    }
+    else {
+        raise_ce();
+    }
+    __set_PRIMASK(primask);
+}
+
+
+// ****************************************************************************
+// Clear CE. This also cancels setting CE after a channel change that
+// rf_hop_async() has queued.
 // ****************************************************************************
 void rf_clear_ce(void)
 {
+    ce_after_hop = false;
+    hop_next = NULL;
+    ce_pending = false;
     LPC_GPIO_PORT->CLR0 = gpio_mask_nrf_ce;
 }
 
 
+// ****************************************************************************
+// Called when the start-up timer expires
+// ****************************************************************************
+void rf_ce_timer_handler(void)
+{
+    if (ce_pending) {
+        ce_pending = false;
+        raise_ce();
+    }
+}
+
+
 // ****************************************************************************
 // Sets the receive address for the given pipe.
 //
@@ -187,6 +424,30 @@ void rf_set_rx_address(uint8_t pipe, uint8_t address_width, const uint8_t addres
         address_width = 1;
     }
 
+    if (pipe_no == 0) {
+        uint8_t i;
+
+        if (address_width > sizeof(shadow_rx_address)) {
+            address_width = sizeof(shadow_rx_address);
+        }
+
+        if (address_width == shadow_rx_address_width) {
+            for (i = 0; i < address_width; i++) {
+                if (address[i] != shadow_rx_address[i]) {
+                    break;
+                }
+            }
+            if (i == address_width) {
+                return;
+            }
+        }
+
+        shadow_rx_address_width = address_width;
+        for (i = 0; i < address_width; i++) {
+            shadow_rx_address[i] = address[i];
+        }
+    }
+
     rf_write_multi_byte_register(RX_ADDR_P0 + pipe_no, address_width, address);
 }
 
@@ -204,6 +465,16 @@ void rf_set_channel(uint8_t channel)
 }
 
 
+// ****************************************************************************
+// Returns the channel the nRF24 is tuned to, or is being tuned to by
+// rf_hop_async()
+// ****************************************************************************
+uint8_t rf_get_channel(void)
+{
+    return shadow[RF_CH];
+}
+
+
 // ****************************************************************************
 // Return true if the receiver FIFO is empty
 // ****************************************************************************
@@ -223,11 +494,29 @@ bool rf_is_tx_fifo_full(void)
 
 
 // ****************************************************************************
-// Read one packet from the receive FIFO
+// Send buffer[0] as command to the nRF24, followed by the remaining *count* - 1
+// bytes. The bytes received replace the ones sent: buffer[0] becomes the
+// STATUS register value, which is also returned.
 // ****************************************************************************
-void rf_read_fifo(uint8_t *buffer, size_t byte_count)
+uint8_t rf_transfer(uint8_t *buffer, uint8_t count)
 {
-    rf_read_command_buffer(R_RX_PAYLOAD, byte_count, buffer);
+    return spi_transaction(count, buffer);
+}
+
+
+// ****************************************************************************
+// Read one packet from the receive FIFO into buffer[1] onwards. *buffer* must
+// hold byte_count + 1 bytes (see RF_PACKET_BUFFER_SIZE).
+// Returns the STATUS register value
+// ****************************************************************************
+uint8_t rf_read_fifo(uint8_t *buffer, uint8_t byte_count)
+{
+    if (byte_count > RF_MAX_BUFFER_LENGTH) {
+        byte_count = RF_MAX_BUFFER_LENGTH;
+    }
+
+    buffer[0] = R_RX_PAYLOAD;
+    return rf_transfer(buffer, byte_count + 1);
 }
 
 
@@ -269,17 +558,7 @@ void rf_flush_tx_fifo(void)
 // ****************************************************************************
 void rf_set_irq_source(uint8_t irq_source)
 {
-    uint8_t config;
-
-    // Datasheet page 56: The IRQ mask in the CONFIG register is used to select
-    // the IRQ sources that are allowed to assert the IRQ pin. By setting one of
-    // the MASK bits high, the corresponding IRQ source is disabled. By default
-    // all IRQ sources are enabled.
-
-    config = rf_read_register(CONFIG);
-    config |= 0x70;
-    config &= ~irq_source;      // Toggle bits as 1 = irq source disabled
-    rf_write_register(CONFIG, config);
+    rf_write_register(CONFIG, config_irq_source(shadow[CONFIG], irq_source));
 }
 
 
@@ -309,17 +588,7 @@ void rf_clear_irq(uint8_t irq_source)
 // ****************************************************************************
 void rf_set_crc(uint8_t crc_size)
 {
-    uint8_t config;
-
-    config = rf_read_register(CONFIG);
-    config &= ~(EN_CRC | CRC0);
-    if (crc_size == 1) {
-        config |= EN_CRC;
-    }
-    else if (crc_size == 2) {
-        config |= EN_CRC | CRC0;
-    }
-    rf_write_register(CONFIG, config);
+    rf_write_register(CONFIG, config_crc(shadow[CONFIG], crc_size));
 }
 
 
@@ -365,7 +634,7 @@ void rf_set_address_width(uint8_t aw)
 // ****************************************************************************
 uint8_t rf_get_address_width(void)
 {
-    return rf_read_register(SETUP_AW) + 2;
+    return shadow[SETUP_AW] + 2;
 }
 
 
@@ -381,23 +650,7 @@ uint8_t rf_get_address_width(void)
 // ****************************************************************************
 void rf_set_data_rate(uint8_t data_rate)
 {
-    uint8_t rf_setup;
-
-    rf_setup = rf_read_register(RF_SETUP);
-
-    // Clear everything except transmit power
-    rf_setup &= 0x06;
-    if (data_rate == DATA_RATE_250K) {
-        rf_setup |= RF_DR_LOW;
-    }
-    else if (data_rate == DATA_RATE_1M) {
-        // Nothing to do, both bits are already cleared
-    }
-    else { // 2Mbps (default)
-        rf_setup |= RF_DR_HIGH;
-    }
-
-    rf_write_register(RF_SETUP, rf_setup);
+    rf_write_register(RF_SETUP, rf_setup_data_rate(shadow[RF_SETUP], data_rate));
 }
 
 
@@ -430,12 +683,20 @@ void rf_power_down(void)
 {
     uint8_t config;
 
-    config = rf_read_register(CONFIG);
+    config = shadow[CONFIG];
     config &= ~PWR_UP;                      // Clear PWR_UP
     rf_write_register(CONFIG, config);
 }
 
 
+// ****************************************************************************
+static void start_power_up_timer(void)
+{
+    LPC_MRT->Channel[CE_TIMER].INTVAL =
+        ((__SYSTEM_CLOCK / 1000000) * POWER_UP_DELAY_IN_US) & 0x7fffffff;
+}
+
+
 // ****************************************************************************
 // Power up the nRF24 and configure it in transmit mode
 // ****************************************************************************
@@ -444,7 +705,7 @@ void rf_enable_transmitter(void)
     uint8_t config;
     bool powered;
 
-    config = rf_read_register(CONFIG);
+    config = shadow[CONFIG];
     powered = (config & PWR_UP);
 
     config |= PWR_UP;                       // Set PWR_UP
@@ -456,8 +717,9 @@ void rf_enable_transmitter(void)
     // Tpd2stby (see Table 16.) after the nRF24L01+ leaves power down mode
     // before the CE is set high.
     // Worst case Tpd2stb is 4.5ms, it depends on the crystal inductance.
+    // rf_set_ce() defers CE until the timer expires.
     if (!powered) {
-        delay_us(4500);
+        start_power_up_timer();
     }
 }
 
@@ -470,7 +732,7 @@ void rf_enable_receiver(void)
     uint8_t config;
     bool powered;
 
-    config = rf_read_register(CONFIG);
+    config = shadow[CONFIG];
     powered = (config & PWR_UP);
 
     config |= PWR_UP;                       // Set PWR_UP
@@ -482,8 +744,9 @@ void rf_enable_receiver(void)
     // Tpd2stby (see Table 16.) after the nRF24L01+ leaves power down mode
     // before the CE is set high.
     // Worst case Tpd2stb is 4.5ms, it depends on the crystal inductance.
+    // rf_set_ce() defers CE until the timer expires.
     if (!powered) {
-        delay_us(4500);
+        start_power_up_timer();
     }
 }
 
@@ -511,3 +774,268 @@ void rf_set_feature(uint8_t feature_list)
 {
     rf_write_register(FEATURE, feature_list);
 }
+
+
+// ****************************************************************************
+// Configure the nRF24 for a radio mode.
+//
+// Only the registers whose value differs from the shadow are written, so
+// switching between two similar profiles costs little SPI traffic.
+// PWR_UP and PRIM_RX, as well as the transmit power, are left as they are.
+//
+// Like the individual functions, this must be called with CE low.
+// ****************************************************************************
+void rf_apply_profile(const rf_profile_t *profile)
+{
+    uint8_t config;
+
+    config = config_crc(shadow[CONFIG], profile->crc);
+    config = config_irq_source(config, profile->irq_source);
+    rf_write_register(CONFIG, config);
+
+    rf_set_address_width(profile->address_width);
+    rf_set_data_rate(profile->data_rate);
+    rf_set_data_pipes(profile->pipes, profile->auto_acknowledge_pipes);
+    rf_set_payload_size(profile->pipes, profile->payload_size);
+
+    // DYNPD only takes effect while EN_DPL is set in FEATURE: enable the
+    // feature before the pipes, and disable it after them.
+    if (profile->feature & EN_DPL) {
+        rf_set_feature(profile->feature);
+        rf_set_dynpd(profile->dynpd);
+    }
+    else {
+        rf_set_dynpd(profile->dynpd);
+        rf_set_feature(profile->feature);
+    }
+}
+
+
+// ****************************************************************************
+// The steps of draining the receive FIFO in the background. Runs in the SPI
+// interrupt when the previous transaction is done.
+//
+// The nRF24 only gives out the oldest packet of the FIFO, so every packet
+// has to be read to get to the newest one. The STATUS byte that the nRF24
+// shifts out with every command tells whether more are waiting, so no extra
+// transactions are needed to find out. Each packet is read over the
+// previous one in the caller's buffer; only the last one is handed to the
+// callback.
+// ****************************************************************************
+static void rx_continue(spi_request_t *request);
+
+static void rx_queue(rx_step_t step, uint8_t *buffer, uint8_t count)
+{
+    rx_step = step;
+    rx_request.buffer = buffer;
+    rx_request.count = count;
+    rx_request.callback = rx_continue;
+    spi_queue(&rx_request);
+}
+
+
+// ****************************************************************************
+static void rx_read_payload(void)
+{
+    // With dynamic payload length on pipe 0 we have to ask the nRF24 how
+    // long the packet is; otherwise it is the configured payload size
+    if ((shadow[FEATURE] & EN_DPL)  &&  (shadow[DYNPD] & DATA_PIPE_0)) {
+        rx_command[0] = R_RX_PL_WID;
+        rx_command[1] = 0;
+        rx_queue(RX_WIDTH, rx_command, 2);
+        return;
+    }
+
+    rx_width = shadow[RX_PW_P0];
+    rx_buffer[0] = R_RX_PAYLOAD;
+    rx_queue(RX_PAYLOAD, rx_buffer, rx_width + 1);
+}
+
+
+// ****************************************************************************
+static void rx_clear(void)
+{
+    rx_command[0] = W_REGISTER | STATUS;
+    rx_command[1] = RX_RD;
+    rx_queue(RX_CLEAR, rx_command, 2);
+}
+
+
+// ****************************************************************************
+static void rx_continue(spi_request_t *request)
+{
+    (void)request;
+
+    switch (rx_step) {
+        case RX_WIDTH:
+            rx_width = rx_command[1];
+            if (rx_width > RF_MAX_BUFFER_LENGTH) {
+                // Data sheet page 63: a width above 32 means the packet is
+                // corrupt; it must be flushed, and with it the rest
+                rx_valid = false;
+                rx_command[0] = FLUSH_RX;
+                rx_queue(RX_CLEAR, rx_command, 1);
+                break;
+            }
+            rx_buffer[0] = R_RX_PAYLOAD;
+            rx_queue(RX_PAYLOAD, rx_buffer, rx_width + 1);
+            break;
+
+        case RX_PAYLOAD:
+            // The STATUS byte shifted out with the command tells whether
+            // there was a packet at all
+            if ((rx_buffer[0] & STATUS_RX_P_NO_MASK) != STATUS_RX_FIFO_EMPTY) {
+                rx_valid = true;
+            }
+            rx_clear();
+            break;
+
+        case RX_CLEAR:
+            // More packets in the FIFO: the one we have is not the newest.
+            // Reading a packet only after the FIFO was found not empty
+            // makes sure that rx_buffer is never overwritten by nothing.
+            if ((rx_command[0] & STATUS_RX_P_NO_MASK) != STATUS_RX_FIFO_EMPTY) {
+                rx_read_payload();
+                break;
+            }
+
+            // Another drain was requested while we were busy: look again
+            if (rx_again) {
+                rx_again = false;
+                rx_clear();
+                break;
+            }
+
+            rx_step = RX_IDLE;
+            if (rx_valid) {
+                rx_valid = false;
+                rx_callback(&rx_buffer[1], rx_width);
+            }
+            break;
+
+        case RX_IDLE:
+        default:
+            rx_step = RX_IDLE;
+            break;
+    }
+}
+
+
+// ****************************************************************************
+// Read the receive FIFO until it is empty and clear the RX_DR interrupt,
+// without waiting for it. The packets are read straight into *buffer*, which
+// must hold RF_PACKET_BUFFER_SIZE bytes and belongs to the SPI interrupt
+// until *callback* has been called. The callback gets the newest packet
+// (&buffer[1]); older packets that were still in the FIFO are dropped. It is
+// not called if there was no packet.
+//
+// If a drain is still running it continues with its buffer and callback.
+//
+// The payload size is the one configured for pipe 0, or read from the nRF24
+// if dynamic payload length is enabled on pipe 0.
+// ****************************************************************************
+void rf_drain_rx_fifo_async(uint8_t *buffer, rf_payload_callback_t callback)
+{
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+    if (rx_step != RX_IDLE) {
+        rx_again = true;
+        __set_PRIMASK(primask);
+        return;
+    }
+    rx_buffer = buffer;
+    rx_callback = callback;
+    rx_again = false;
+    rx_valid = false;
+    rx_read_payload();
+    __set_PRIMASK(primask);
+}
+
+
+// ****************************************************************************
+// Build the command for changing to *channel* with rf_hop_async() in
+// *command*, which must hold RF_HOP_COMMAND_SIZE bytes.
+// ****************************************************************************
+void rf_prepare_hop(uint8_t *command, uint8_t channel)
+{
+    command[0] = W_REGISTER | RF_CH;
+    command[1] = channel & 0x7f;
+}
+
+
+// ****************************************************************************
+static void hop_done(spi_request_t *request);
+
+static void queue_hop(uint8_t *command)
+{
+    shadow[RF_CH] = command[1];
+    ce_after_hop = true;
+
+    // The command is sent as is and stays intact for the next time
+    hop_request.buffer = command;
+    hop_request.count = RF_HOP_COMMAND_SIZE;
+    hop_request.callback = hop_done;
+    hop_request.write_only = true;
+    spi_queue(&hop_request);
+}
+
+
+// ****************************************************************************
+static void hop_done(spi_request_t *request)
+{
+    (void)request;
+
+    if (hop_next != NULL) {
+        uint8_t *command = hop_next;
+
+        hop_next = NULL;
+        queue_hop(command);
+        return;
+    }
+
+    if (ce_after_hop) {
+        ce_after_hop = false;
+        rf_set_ce();
+        if (hop_callback != NULL) {
+            hop_callback();
+        }
+    }
+}
+
+
+// ****************************************************************************
+// Change the channel with a command built by rf_prepare_hop(): CE goes low,
+// and high again once the new channel has been written. Does not wait for
+// the SPI, so it can be called from an interrupt handler; the SPI queue
+// lets it in between transactions of the main loop.
+//
+// *callback* (may be NULL) is called when CE has gone high again, from the
+// SPI interrupt or from within rf_hop_async(). It is not called if the hop
+// is cancelled by rf_clear_ce().
+// ****************************************************************************
+void rf_hop_async(uint8_t *command, rf_hop_callback_t callback)
+{
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+    rf_clear_ce();
+    hop_callback = callback;
+
+    // The previous hop is normally long done. If the SPI is that congested
+    // this one follows when it is.
+    if (hop_request.busy) {
+        hop_next = command;
+        ce_after_hop = true;
+    }
+    else if (shadow[RF_CH] == command[1]) {
+        rf_set_ce();
+        if (callback != NULL) {
+            callback();
+        }
+    }
+    else {
+        queue_hop(command);
+    }
+    __set_PRIMASK(primask);
+}
@@ -6,6 +6,13 @@
 
 #define RF_MAX_BUFFER_LENGTH 32
 
+// A buffer for a whole packet transfer: the command byte (STATUS afterwards)
+// followed by the payload
+#define RF_PACKET_BUFFER_SIZE (RF_MAX_BUFFER_LENGTH + 1)
+
+// A channel change for rf_hop_async(), see rf_prepare_hop()
+#define RF_HOP_COMMAND_SIZE 2
+
 
 //******************************************************************************
 // nRF24L01+ SPI commands
@@ -87,17 +94,42 @@
 #define EN_ACK_PAY      (1 << 1)
 #define EN_DPL          (1 << 2)
 
+//******************************************************************************
+// A radio mode for rf_apply_profile(). The fields take the same values as the
+// parameters of the corresponding rf_set_...() functions.
+typedef struct {
+    uint8_t crc;
+    uint8_t irq_source;
+    uint8_t address_width;
+    uint8_t data_rate;
+    uint8_t pipes;
+    uint8_t auto_acknowledge_pipes;
+    uint8_t payload_size;           // For all pipes in *pipes*
+    uint8_t dynpd;
+    uint8_t feature;
+} rf_profile_t;
+
+typedef void (* rf_payload_callback_t)(const uint8_t *payload, uint8_t width);
+typedef void (* rf_hop_callback_t)(void);
+
+
 //******************************************************************************
 void rf_enable_clock(void);
 void rf_disable_clock(void);
 void rf_set_ce(void);
 void rf_clear_ce(void);
+void rf_ce_timer_handler(void);
+
+void rf_sync_registers(void);
+bool rf_check_registers(void);
+void rf_apply_profile(const rf_profile_t *profile);
 
 uint8_t rf_get_status(void);
 
 bool rf_is_rx_fifo_emtpy(void);
 bool rf_is_tx_fifo_full(void);
-void rf_read_fifo(uint8_t *buffer, size_t byte_count);
+uint8_t rf_transfer(uint8_t *buffer, uint8_t count);
+uint8_t rf_read_fifo(uint8_t *buffer, uint8_t byte_count);
 uint8_t rf_read_payload_width(void);
 void rf_flush_rx_fifo(void);
 void rf_flush_tx_fifo(void);
@@ -110,6 +142,7 @@ void rf_enable_receiver(void);
 void rf_power_down(void);
 
 void rf_set_channel(uint8_t channel);
+uint8_t rf_get_channel(void);
 void rf_set_crc(uint8_t crc_size);
 void rf_set_data_rate(uint8_t data_rate);
 void rf_set_address_width(uint8_t aw);
@@ -119,3 +152,7 @@ void rf_set_payload_size(uint8_t pipes, uint8_t payload_size);
 void rf_set_rx_address(uint8_t pipe, uint8_t address_width, const uint8_t address[]);
 void rf_set_dynpd(uint8_t pipes);
 void rf_set_feature(uint8_t feature_list);
+
+void rf_drain_rx_fifo_async(uint8_t *buffer, rf_payload_callback_t callback);
+void rf_prepare_hop(uint8_t *command, uint8_t channel);
+void rf_hop_async(uint8_t *command, rf_hop_callback_t callback);
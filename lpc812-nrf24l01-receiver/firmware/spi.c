@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdbool.h>
 
 #include <platform.h>
 #include <spi.h>
@@ -16,6 +17,8 @@
 #define SPI_STAT_ENDTRANSFER (1 << 7)
 #define SPI_STAT_MSTIDLE (1 << 8)
 
+#define SPI_INTEN_RXRDY (1 << 0)
+
 #define SPI_TXDATCTL_SSEL_N(s) ((s) << 16)
 #define SPI_TXDATCTL_EOT (1 << 20)
 #define SPI_TXDATCTL_EOF (1 << 21)
@@ -23,12 +26,90 @@
 #define SPI_TXDATCTL_LEN(l) ((l - 1) << 24)
 
 
+// SPI clock. nRF24L01+ datasheet page 50: maximum data rate of 10Mbps.
+// The LPC81x SPI master runs at up to half the system clock, i.e. 6 MHz at
+// 12 MHz. The divider is rounded up, so the clock never exceeds SPI_CLOCK.
+#ifndef SPI_CLOCK
+#define SPI_CLOCK 6000000
+#endif
+
+#if SPI_CLOCK > (__SYSTEM_CLOCK / 2)
+#error SPI_CLOCK must not exceed half the system clock
+#endif
+
+#define SPI_DIV (((__SYSTEM_CLOCK + SPI_CLOCK - 1) / SPI_CLOCK) - 1)
+
+// Bytes in flight: one in the shift register, one in the TX holding register
+#define SPI_MAX_IN_FLIGHT 2
+
+// MRT channel that times spi_hold()
+#define SPI_HOLD_TIMER 1
+
+
+// Queued transactions; current is the one on the bus
+static spi_request_t *queue_head;
+static spi_request_t *queue_tail;
+static spi_request_t *current;
+static unsigned int bytes_sent;
+static unsigned int bytes_received;
+
+// No transaction may start while held (spi_hold()) or while
+// spi_transaction() polls the SPI
+static volatile bool held;
+static volatile bool polling;
+
+
+// ****************************************************************************
+// Feed the TX holding register of the current request while there is room.
+// The last byte carries EOT, which releases SSEL when it is done.
+// ****************************************************************************
+static void send_bytes(void)
+{
+    while (bytes_sent < current->count  &&  (bytes_sent - bytes_received) < SPI_MAX_IN_FLIGHT  &&
+            (LPC_SPI->STAT & SPI_STAT_TXRDY)) {
+        uint32_t ctl = SPI_TXDATCTL_EOF | SPI_TXDATCTL_LEN(8);
+
+        if (bytes_sent == current->count - 1u) {
+            ctl |= SPI_TXDATCTL_EOT;
+        }
+        LPC_SPI->TXDATCTL = ctl | current->buffer[bytes_sent];
+        ++bytes_sent;
+    }
+}
+
+
+// ****************************************************************************
+// Start the next queued request if the SPI is free. Must be called with
+// interrupts disabled, or from an interrupt handler.
+// ****************************************************************************
+static void start_next(void)
+{
+    if (current != NULL  ||  held  ||  polling) {
+        return;
+    }
+
+    if (queue_head == NULL) {
+        LPC_SPI->INTENCLR = SPI_INTEN_RXRDY;
+        return;
+    }
+
+    current = queue_head;
+    queue_head = current->next;
+    if (queue_head == NULL) {
+        queue_tail = NULL;
+    }
+
+    bytes_sent = 0;
+    bytes_received = 0;
+    send_bytes();
+    LPC_SPI->INTENSET = SPI_INTEN_RXRDY;
+}
+
+
 // ****************************************************************************
 void init_spi(void)
 {
-    // nRF24L01+ datasheet page 50: maximum data rate of 10Mbps
-    // To have some margin, we use 2 MHz SPI clock.
-    LPC_SPI->DIV = (__SYSTEM_CLOCK / 2000000) - 1;
+    LPC_SPI->DIV = SPI_DIV;
 
     LPC_SPI->CFG = SPI_CFG_ENABLE | SPI_CFG_MASTER;
 
@@ -36,33 +117,150 @@ void init_spi(void)
 }
 
 
+// ****************************************************************************
+// Exchange *count* bytes with the nRF24. The received bytes overwrite the
+// sent ones in *buffer*. Returns the first received byte, which is the
+// STATUS register for all nRF24 commands.
+//
+// The TX holding register is refilled while the previous byte is still
+// shifting, so the bytes go out back-to-back. RXDAT holds only one byte; if
+// we are late reading it the SPI master stalls rather than losing data.
+// The last byte is sent with EOT, which releases SSEL when it is done.
 // ****************************************************************************
 uint8_t spi_transaction(unsigned int count, uint8_t *buffer)
 {
-    uint8_t *ptr = buffer;
+    unsigned int sent = 0;
+    unsigned int received = 0;
 
-    // Wait for MSTIDLE
-    while (~LPC_SPI->STAT & SPI_STAT_MSTIDLE);
+    if (count == 0) {
+        return 0;
+    }
 
-    while (count--) {
-        // Wait for TXRDY
-        while (~LPC_SPI->STAT & SPI_STAT_TXRDY);
+    // Wait until the queued transactions are done and no hold is active,
+    // then keep the queue from starting while we use the SPI.
+    for (;;) {
+        // Wait for MSTIDLE
+        while (~LPC_SPI->STAT & SPI_STAT_MSTIDLE);
 
-        LPC_SPI->TXDAT = *ptr;
+        __disable_irq();
+        if (current == NULL  &&  queue_head == NULL  &&  !held) {
+            polling = true;
+            __enable_irq();
+            break;
+        }
+        __enable_irq();
+    }
 
-        // Wait for RXRDY
-        while (~LPC_SPI->STAT & SPI_STAT_RXRDY);
+    while (received < count) {
+        uint32_t stat = LPC_SPI->STAT;
 
-        *ptr = LPC_SPI->RXDAT;
-        ++ptr;
+        if (stat & SPI_STAT_RXRDY) {
+            buffer[received] = LPC_SPI->RXDAT;
+            ++received;
+        }
+
+        if ((stat & SPI_STAT_TXRDY)  &&  sent < count  &&
+                (sent - received) < SPI_MAX_IN_FLIGHT) {
+            uint32_t ctl = SPI_TXDATCTL_EOF | SPI_TXDATCTL_LEN(8);
+
+            if (sent == count - 1) {
+                ctl |= SPI_TXDATCTL_EOT;
+            }
+            LPC_SPI->TXDATCTL = ctl | buffer[sent];
+            ++sent;
+        }
+    }
+
+    __disable_irq();
+    polling = false;
+    start_next();
+    __enable_irq();
+
+    return buffer[0];
+}
+
+
+// ****************************************************************************
+// Queue a transaction. It runs in the background, driven by the SPI
+// interrupt; *request* and its buffer must stay valid until the callback
+// (called from the interrupt handler) has run.
+//
+// May be called from the main loop and from interrupt handlers, including
+// the callbacks, and with interrupts disabled: it restores PRIMASK.
+// ****************************************************************************
+void spi_queue(spi_request_t *request)
+{
+    uint32_t primask = __get_PRIMASK();
+
+    request->next = NULL;
+    request->busy = true;
+
+    __disable_irq();
+    if (queue_tail != NULL) {
+        queue_tail->next = request;
+    }
+    else {
+        queue_head = request;
     }
+    queue_tail = request;
+    start_next();
+    __set_PRIMASK(primask);
+}
+
 
-    // Force END OF TRANSFER
-    LPC_SPI->STAT = SPI_STAT_ENDTRANSFER;
+// ****************************************************************************
+// Do not start a transaction for the given time. Used for the time the
+// nRF24 needs between a CE rising edge and CSN going low; a transaction
+// already on the bus is not affected.
+// ****************************************************************************
+void spi_hold(uint32_t microseconds)
+{
+    held = true;
+    LPC_MRT->Channel[SPI_HOLD_TIMER].INTVAL =
+        ((__SYSTEM_CLOCK / 1000000) * microseconds) & 0x7fffffff;
+}
 
-    // Wait for MSTIDLE
-    while (~LPC_SPI->STAT & SPI_STAT_MSTIDLE);
 
-    return *buffer;
+// ****************************************************************************
+void spi_hold_timer_handler(void)
+{
+    held = false;
+    start_next();
 }
 
+
+// ****************************************************************************
+void SPI0_irq_handler(void)
+{
+    spi_request_t *request = current;
+
+    if (request == NULL) {
+        LPC_SPI->INTENCLR = SPI_INTEN_RXRDY;
+        return;
+    }
+
+    // Once the first byte is back the rest of the transaction takes less
+    // time than an interrupt per byte, so we poll it to the end like
+    // spi_transaction() does. RXDAT must be read in any case, otherwise the
+    // SPI master stalls.
+    while (bytes_received < request->count) {
+        if (!(LPC_SPI->STAT & SPI_STAT_RXRDY)) {
+            continue;
+        }
+        if (request->write_only) {
+            (void)LPC_SPI->RXDAT;
+        }
+        else {
+            request->buffer[bytes_received] = LPC_SPI->RXDAT;
+        }
+        ++bytes_received;
+        send_bytes();
+    }
+
+    current = NULL;
+    request->busy = false;
+    if (request->callback != NULL) {
+        request->callback(request);
+    }
+    start_next();
+}
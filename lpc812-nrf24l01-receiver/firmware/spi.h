@@ -1,7 +1,22 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdbool.h>
+
+// A transaction for spi_queue(). The received bytes overwrite the sent ones
+// in *buffer*, unless write_only is set.
+typedef struct spi_request {
+    uint8_t *buffer;
+    uint8_t count;
+    void (* callback)(struct spi_request *request);
+    bool write_only;                // Do not store the received bytes
+    volatile bool busy;             // Set while queued or on the bus
+    struct spi_request *next;
+} spi_request_t;
 
 void init_spi(void);
 uint8_t spi_transaction(unsigned int count, uint8_t *buffer);
-
+void spi_queue(spi_request_t *request);
+void spi_hold(uint32_t microseconds);
+void spi_hold_timer_handler(void);
+void SPI0_irq_handler(void);
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+
+#define CHANNEL_100_PERCENT 10000
+#define CHANNEL_CENTER 0
+#define CHANNEL_N100_PERCENT -10000
+
+
+// ****************************************************************************
+// Exactly the same function as we use in the rc-headless-transmitter.
+//
+// Shared between the RF data simulation in rc_receiver.c and the transmitter
+// model of the host build, hence inline in this header.
+// ****************************************************************************
+static inline uint16_t channel_to_stickdata(int32_t ch)
+{
+    int32_t pulse_ns;
+/*
+    Desired us range:
+        476         1000       1500    2000     2523
+
+    ns with reference to 476 us minimum:
+        0           524000       1024000    1524000    2048000
+
+    Translated 12 bit values:
+        0           1048       2048    2048     4095
+
+    => 12 bit value = ns / 500
+*/
+
+    pulse_ns = ch * 500 * 1000 / CHANNEL_100_PERCENT;
+    pulse_ns += 1500 * 1000;
+    pulse_ns -= 476 * 1000;
+
+    if (pulse_ns < 0) {
+        pulse_ns = 0;
+    }
+
+    pulse_ns /= 500;
+    return (uint16_t)pulse_ns;
+}
@@ -0,0 +1,452 @@
+/******************************************************************************
+
+    Runs the nRF24LE1 receiver image on an MCS-51 instruction set simulator
+    (mcs51.c) with models of the nRF24LE1 peripherals (peripherals.c). The
+    nRF24L01+ and the transmitter are the models of the LPC812 simulator.
+
+    The servo pulses of the firmware are timed in software, so every cycle
+    that the Timer1 interrupt is late shows up on the servo outputs. The
+    report shows a histogram of the pulse widths on every servo output, and
+    of the Timer1 interrupt latency by what the CPU was doing when the timer
+    overflowed: main loop, Timer0, Timer2 or RF interrupt handler.
+
+    Usage: receiver-iss [options]
+
+        -x image    Firmware image, raw binary or Intel HEX (default:
+                    receiver.bin)
+        -H hardware Pinout of the image: module, xr3100 or hkr3000 (default:
+                    module)
+        -t ms       Virtual run time in milliseconds (default 10000)
+        -u file     Write the UART output of the firmware to file ('-': stdout)
+        -v          Print pin changes as they happen
+        -E file     Write the servo output edges to file: time in cycles,
+                    pin and level, one edge per line
+
+    Transmitter options:
+
+        -P protocol Transmitter protocol: 3, 4 or 'none' (default: 3)
+        -s seed     Seed for the bind data (default 1)
+        -a ms       Switch the transmitter on after the given time
+        -d ppm      Crystal error of the transmitter
+        -B ms       Press the bind button at the given time for 200 ms
+        -n          Do not preload the bind data of the transmitter (the
+                    receiver has to be bound with -B)
+
+******************************************************************************/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mcs51.h"
+#include "nrf24.h"
+#include "peripherals.h"
+#include "transmitter.h"
+
+
+#define DEFAULT_RUN_TIME_MS 10000
+#define DEFAULT_IMAGE "receiver.bin"
+
+#define NUMBER_OF_SERVO_OUTPUTS 4
+
+// Bind data in the NV memory: address, hop channels, protocol
+#define PERSISTENT_DATA_SIZE 26
+
+#define BIND_BUTTON_PRESS_TIME HOST_MS(200)
+
+// Pulse widths are counted from WIDTH_BINS / 2 cycles below to
+// WIDTH_BINS / 2 cycles above the first pulse of an output
+#define WIDTH_BINS 1024
+
+
+typedef struct {
+    const char *name;
+    unsigned int bind;
+    unsigned int servo[NUMBER_OF_SERVO_OUTPUTS];
+} hardware_t;
+
+typedef struct {
+    unsigned int pin;
+    uint64_t rising;
+    uint64_t pulses;
+    uint64_t width_min;
+    uint64_t width_max;
+    uint64_t width_sum;
+    uint64_t period_min;
+    uint64_t period_max;
+    uint64_t width_base;
+    uint64_t width_outside;
+    uint64_t width_histogram[WIDTH_BINS];
+} servo_output_t;
+
+
+// See platform.h
+static const hardware_t hardware_variants[] = {
+    {"module", LE1_PIN(0, 6), {LE1_PIN(0, 5), LE1_PIN(0, 7), LE1_PIN(1, 0), LE1_PIN(0, 3)}},
+    {"xr3100", LE1_PIN(0, 3), {LE1_PIN(0, 5), LE1_PIN(0, 7), LE1_PIN(1, 0), LE1_PIN(1, 1)}},
+    {"hkr3000", LE1_PIN(0, 6), {LE1_PIN(0, 5), LE1_PIN(0, 7), LE1_PIN(1, 0), LE1_PIN(1, 1)}},
+};
+
+static const hardware_t *hardware = &hardware_variants[0];
+static bool verbose;
+static servo_output_t servo_outputs[NUMBER_OF_SERVO_OUTPUTS];
+static FILE *edge_file;
+
+static transmitter_t transmitter;
+static host_timer_t bind_button_timer;
+
+
+// ****************************************************************************
+static void usage(const char *name)
+{
+    fprintf(stderr,
+        "Usage: %s [-x image] [-H hardware] [-t ms] [-u file] [-v] [-E file]\n"
+        "       [-P protocol] [-s seed] [-a ms] [-d ppm] [-B ms] [-n]\n", name);
+    exit(1);
+}
+
+
+// ****************************************************************************
+static void bind_button_changed(void *context)
+{
+    (void)context;
+
+    // The button is active low: press it, and release it again later
+    if (host_get_pin(hardware->bind)) {
+        host_set_input(hardware->bind, false);
+        host_timer_start(&bind_button_timer, host_cycles + BIND_BUTTON_PRESS_TIME);
+    }
+    else {
+        host_set_input(hardware->bind, true);
+    }
+}
+
+
+// ****************************************************************************
+static void servo_edge(servo_output_t *output, bool level)
+{
+    uint64_t width;
+    uint64_t period;
+    uint64_t bin;
+
+    if (edge_file) {
+        fprintf(edge_file, "%llu %u %u\n", (unsigned long long)host_cycles,
+            output->pin, level);
+    }
+
+    if (level) {
+        if (output->rising) {
+            period = host_cycles - output->rising;
+            if (!output->period_min || period < output->period_min) {
+                output->period_min = period;
+            }
+            if (period > output->period_max) {
+                output->period_max = period;
+            }
+        }
+        output->rising = host_cycles;
+        return;
+    }
+
+    if (!output->rising) {
+        return;
+    }
+
+    width = host_cycles - output->rising;
+    if (!output->pulses) {
+        output->width_min = width;
+        output->width_base = width - WIDTH_BINS / 2;
+    }
+    if (width < output->width_min) {
+        output->width_min = width;
+    }
+    if (width > output->width_max) {
+        output->width_max = width;
+    }
+    output->width_sum += width;
+    ++output->pulses;
+
+    bin = width - output->width_base;
+    if (bin < WIDTH_BINS) {
+        ++output->width_histogram[bin];
+    }
+    else {
+        ++output->width_outside;
+    }
+}
+
+
+// ****************************************************************************
+static void pin_changed(unsigned int pin, bool level)
+{
+    unsigned int i;
+
+    for (i = 0; i < NUMBER_OF_SERVO_OUTPUTS; i++) {
+        if (servo_outputs[i].pin == pin) {
+            servo_edge(&servo_outputs[i], level);
+        }
+    }
+
+    if (verbose) {
+        printf("%12.6f pin %2u %s\n", (double)host_cycles / __SYSTEM_CLOCK,
+            pin, level ? "high" : "low");
+    }
+}
+
+
+// ****************************************************************************
+static void report_servo_outputs(FILE *f, bool transmitter_enabled)
+{
+    unsigned int i;
+    unsigned int bin;
+    unsigned int first = WIDTH_BINS;
+    unsigned int last = 0;
+
+    fprintf(f, "Servo pulses (us):   pulses  expected     min   average       max  jitter  period min / max\n");
+
+    for (i = 0; i < NUMBER_OF_SERVO_OUTPUTS; i++) {
+        const servo_output_t *output = &servo_outputs[i];
+        uint32_t expected = 0;
+
+        if (transmitter_enabled) {
+            expected = transmitter_expected_pulse_us(&transmitter,
+                transmitter_get_channel(&transmitter, i, host_cycles));
+        }
+
+        if (!output->pulses) {
+            fprintf(f, "  CH%u (P%u.%u)        none\n", i + 1, output->pin / 8, output->pin % 8);
+            continue;
+        }
+        fprintf(f, "  CH%u (P%u.%u)  %10llu  %8u  %6.2f  %8.3f  %8.2f  %6.2f  %.2f / %.2f ms\n",
+            i + 1, output->pin / 8, output->pin % 8, (unsigned long long)output->pulses,
+            expected,
+            (double)output->width_min / HOST_CYCLES_PER_US,
+            (double)output->width_sum / output->pulses / HOST_CYCLES_PER_US,
+            (double)output->width_max / HOST_CYCLES_PER_US,
+            (double)(output->width_max - output->width_min) / HOST_CYCLES_PER_US,
+            (double)output->period_min / HOST_MS(1),
+            (double)output->period_max / HOST_MS(1));
+
+        for (bin = 0; bin < WIDTH_BINS; bin++) {
+            if (output->width_histogram[bin]) {
+                if (bin + output->width_base - output->width_min < first) {
+                    first = bin + output->width_base - output->width_min;
+                }
+                if (bin + output->width_base - output->width_min > last) {
+                    last = bin + output->width_base - output->width_min;
+                }
+            }
+        }
+    }
+
+    if (first > last) {
+        return;
+    }
+
+    fprintf(f, "Servo pulse width above the shortest pulse (cycles of %.1f ns):\n",
+        1e9 / __SYSTEM_CLOCK);
+    fprintf(f, "  cycles");
+    for (i = 0; i < NUMBER_OF_SERVO_OUTPUTS; i++) {
+        fprintf(f, "         CH%u", i + 1);
+    }
+    fprintf(f, "\n");
+
+    for (bin = first; bin <= last; bin++) {
+        bool used = false;
+
+        for (i = 0; i < NUMBER_OF_SERVO_OUTPUTS; i++) {
+            const servo_output_t *output = &servo_outputs[i];
+            uint64_t index = output->width_min + bin - output->width_base;
+
+            if (output->pulses && index < WIDTH_BINS && output->width_histogram[index]) {
+                used = true;
+            }
+        }
+        if (!used) {
+            continue;
+        }
+
+        fprintf(f, "  %6u", bin);
+        for (i = 0; i < NUMBER_OF_SERVO_OUTPUTS; i++) {
+            const servo_output_t *output = &servo_outputs[i];
+            uint64_t index = output->width_min + bin - output->width_base;
+            uint64_t count = 0;
+
+            if (output->pulses && index < WIDTH_BINS) {
+                count = output->width_histogram[index];
+            }
+            fprintf(f, "  %10llu", (unsigned long long)count);
+        }
+        fprintf(f, "\n");
+    }
+
+    for (i = 0; i < NUMBER_OF_SERVO_OUTPUTS; i++) {
+        if (servo_outputs[i].width_outside) {
+            fprintf(f, "  CH%u: %llu pulses outside of the histogram\n", i + 1,
+                (unsigned long long)servo_outputs[i].width_outside);
+        }
+    }
+}
+
+
+// ****************************************************************************
+int main(int argc, char *argv[])
+{
+    const char *image = DEFAULT_IMAGE;
+    const char *edge_filename = NULL;
+    const char *protocol = "3";
+    uint64_t run_time_ms = DEFAULT_RUN_TIME_MS;
+    uint64_t seed = 1;
+    uint64_t tx_start_ms = 0;
+    int32_t drift_ppm = 0;
+    int64_t bind_button_ms = -1;
+    bool preload_tx_bind_data = true;
+    bool transmitter_enabled = true;
+    transmitter_config_t tx_config;
+    unsigned int i;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "x:H:t:u:vE:P:s:a:d:B:n")) != -1) {
+        switch (opt) {
+            case 'x':
+                image = optarg;
+                break;
+
+            case 'H':
+                hardware = NULL;
+                for (i = 0; i < sizeof(hardware_variants) / sizeof(hardware_variants[0]); i++) {
+                    if (strcmp(optarg, hardware_variants[i].name) == 0) {
+                        hardware = &hardware_variants[i];
+                    }
+                }
+                if (!hardware) {
+                    usage(argv[0]);
+                }
+                break;
+
+            case 't':
+                run_time_ms = strtoull(optarg, NULL, 0);
+                break;
+
+            case 'u':
+                if (strcmp(optarg, "-") == 0) {
+                    le1_uart_output = stdout;
+                }
+                else {
+                    le1_uart_output = fopen(optarg, "wb");
+                    if (!le1_uart_output) {
+                        perror(optarg);
+                        return 1;
+                    }
+                }
+                break;
+
+            case 'v':
+                verbose = true;
+                break;
+
+            case 'E':
+                edge_filename = optarg;
+                break;
+
+            case 'P':
+                protocol = optarg;
+                break;
+
+            case 's':
+                seed = strtoull(optarg, NULL, 0);
+                break;
+
+            case 'a':
+                tx_start_ms = strtoull(optarg, NULL, 0);
+                break;
+
+            case 'd':
+                drift_ppm = strtol(optarg, NULL, 0);
+                break;
+
+            case 'B':
+                bind_button_ms = strtoll(optarg, NULL, 0);
+                break;
+
+            case 'n':
+                preload_tx_bind_data = false;
+                break;
+
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if (strcmp(protocol, "none") == 0) {
+        transmitter_enabled = false;
+    }
+    else if (strcmp(protocol, "3") == 0) {
+        transmitter_default_config(&tx_config, PROTOCOL_3CH, seed);
+    }
+    else if (strcmp(protocol, "4") == 0) {
+        transmitter_default_config(&tx_config, PROTOCOL_4CH, seed);
+    }
+    else {
+        usage(argv[0]);
+    }
+
+    if (edge_filename) {
+        edge_file = fopen(edge_filename, "w");
+        if (!edge_file) {
+            perror(edge_filename);
+            return 1;
+        }
+    }
+
+    if (!mcs51_load(image)) {
+        return 1;
+    }
+    le1_init();
+
+    for (i = 0; i < NUMBER_OF_SERVO_OUTPUTS; i++) {
+        servo_outputs[i].pin = hardware->servo[i];
+    }
+    host_add_pin_hook(pin_changed);
+    nrf24_init(LE1_PIN_RF_CE, LE1_PIN_RF_IRQ);
+
+    if (transmitter_enabled) {
+        tx_config.start = HOST_MS(tx_start_ms);
+        tx_config.drift_ppm = drift_ppm;
+        transmitter_init(&transmitter, &tx_config);
+
+        if (preload_tx_bind_data) {
+            uint8_t data[PERSISTENT_DATA_SIZE];
+
+            transmitter_get_bind_data(&transmitter, data);
+            le1_write_persistent_data(data, sizeof(data));
+        }
+    }
+
+    if (bind_button_ms >= 0) {
+        bind_button_timer.callback = bind_button_changed;
+        host_timer_start(&bind_button_timer, HOST_MS(bind_button_ms));
+    }
+
+    le1_run(HOST_MS(run_time_ms));
+
+    printf("Image:                  %s (%s hardware)\n", image, hardware->name);
+    le1_report(stdout);
+    nrf24_report(stdout);
+    if (transmitter_enabled) {
+        transmitter_report(&transmitter, stdout);
+    }
+    report_servo_outputs(stdout, transmitter_enabled);
+    le1_report_latency(stdout, LE1_IRQ_TIMER1);
+
+    if (edge_file) {
+        fclose(edge_file);
+    }
+    if (le1_uart_output && le1_uart_output != stdout) {
+        fclose(le1_uart_output);
+    }
+
+    return 0;
+}
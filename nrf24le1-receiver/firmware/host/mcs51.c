@@ -0,0 +1,979 @@
+/******************************************************************************
+
+    MCS-51 instruction set simulator, running the nRF24LE1 receiver image.
+
+    Memory
+    ------
+    Code memory is the 16 KB flash. IRAM has 256 bytes; direct addresses
+    from 0x80 are SFRs. The core SFRs (ACC, B, PSW, SP, both DPTRs) are
+    handled here, all others are passed to the peripheral models, which
+    also provide XDATA. The nRF24LE1 has two data pointers selected by
+    DPS bit 0. MOVX @Ri takes the upper address byte from P2, like on the
+    classic 8051.
+
+    Timing
+    ------
+    The nRF24LE1 core is not the 12-clock machine-cycle 8051: most
+    instructions take one clock per code byte. Accesses through a pointer
+    (@Ri, MOVX) add one clock, MOVC two, and jumps, calls and returns need
+    extra clocks to load the new program counter. MUL takes 2 and DIV 6
+    clocks. The numbers are in the individual instructions below.
+
+******************************************************************************/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mcs51.h"
+
+
+#define CY 0x80
+#define AC 0x40
+#define OV 0x04
+
+#define A (sfr[MCS51_SFR_ACC - 0x80])
+#define B (sfr[MCS51_SFR_B - 0x80])
+#define PSW (sfr[MCS51_SFR_PSW - 0x80])
+#define SP (sfr[MCS51_SFR_SP - 0x80])
+
+
+mcs51_stats_t mcs51_stats;
+
+static uint8_t code[MCS51_CODE_SIZE];
+static uint8_t iram[256];
+static uint8_t sfr[128];
+static uint16_t pc;
+static bool interrupt_blocked;
+
+
+// ****************************************************************************
+static bool is_core_sfr(uint8_t address)
+{
+    switch (address) {
+        case MCS51_SFR_SP:
+        case MCS51_SFR_DPL:
+        case MCS51_SFR_DPH:
+        case MCS51_SFR_DPL1:
+        case MCS51_SFR_DPH1:
+        case MCS51_SFR_DPS:
+        case MCS51_SFR_PSW:
+        case MCS51_SFR_ACC:
+        case MCS51_SFR_B:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+
+// ****************************************************************************
+// PSW bit 0 is the parity of the accumulator, maintained by hardware
+// ****************************************************************************
+static uint8_t get_psw(void)
+{
+    uint8_t parity = A;
+
+    parity ^= parity >> 4;
+    parity ^= parity >> 2;
+    parity ^= parity >> 1;
+
+    return (PSW & 0xfe) | (parity & 1);
+}
+
+
+// ****************************************************************************
+static uint8_t read_direct(uint8_t address, bool read_modify_write)
+{
+    if (address < 0x80) {
+        return iram[address];
+    }
+    if (address == MCS51_SFR_PSW) {
+        return get_psw();
+    }
+    if (is_core_sfr(address)) {
+        return sfr[address - 0x80];
+    }
+    return peripheral_sfr_read(address, read_modify_write);
+}
+
+
+// ****************************************************************************
+static void write_direct(uint8_t address, uint8_t value)
+{
+    if (address < 0x80) {
+        iram[address] = value;
+        return;
+    }
+
+    sfr[address - 0x80] = value;
+    if (is_core_sfr(address)) {
+        return;
+    }
+
+    // IEN0, IEN1, IP0, IP1
+    if (address == 0xa8 || address == 0xa9 || address == 0xb8 || address == 0xb9) {
+        interrupt_blocked = true;
+    }
+    peripheral_sfr_written(address, value);
+}
+
+
+// ****************************************************************************
+static uint8_t bit_address(uint8_t bit)
+{
+    return bit < 0x80 ? 0x20 + (bit >> 3) : (bit & 0xf8);
+}
+
+
+// ****************************************************************************
+static bool read_bit(uint8_t bit, bool read_modify_write)
+{
+    return (read_direct(bit_address(bit), read_modify_write) >> (bit & 7)) & 1;
+}
+
+
+// ****************************************************************************
+static void write_bit(uint8_t bit, bool value)
+{
+    uint8_t address = bit_address(bit);
+    uint8_t byte = read_direct(address, true);
+
+    if (value) {
+        byte |= 1 << (bit & 7);
+    }
+    else {
+        byte &= ~(1 << (bit & 7));
+    }
+    write_direct(address, byte);
+}
+
+
+// ****************************************************************************
+static uint8_t *reg(uint8_t n)
+{
+    return &iram[(PSW & 0x18) + n];
+}
+
+
+// ****************************************************************************
+static uint8_t *indirect(uint8_t opcode)
+{
+    return &iram[*reg(opcode & 1)];
+}
+
+
+// ****************************************************************************
+static uint16_t get_dptr(void)
+{
+    if (sfr[MCS51_SFR_DPS - 0x80] & 1) {
+        return (sfr[MCS51_SFR_DPH1 - 0x80] << 8) | sfr[MCS51_SFR_DPL1 - 0x80];
+    }
+    return (sfr[MCS51_SFR_DPH - 0x80] << 8) | sfr[MCS51_SFR_DPL - 0x80];
+}
+
+
+// ****************************************************************************
+static void set_dptr(uint16_t dptr)
+{
+    if (sfr[MCS51_SFR_DPS - 0x80] & 1) {
+        sfr[MCS51_SFR_DPH1 - 0x80] = dptr >> 8;
+        sfr[MCS51_SFR_DPL1 - 0x80] = dptr & 0xff;
+    }
+    else {
+        sfr[MCS51_SFR_DPH - 0x80] = dptr >> 8;
+        sfr[MCS51_SFR_DPL - 0x80] = dptr & 0xff;
+    }
+}
+
+
+// ****************************************************************************
+static uint8_t read_code(uint16_t address)
+{
+    return address < MCS51_CODE_SIZE ? code[address] : 0xff;
+}
+
+
+// ****************************************************************************
+static uint8_t fetch(void)
+{
+    return read_code(pc++);
+}
+
+
+// ****************************************************************************
+static void push(uint8_t value)
+{
+    iram[++SP] = value;
+}
+
+
+// ****************************************************************************
+static uint8_t pop(void)
+{
+    return iram[SP--];
+}
+
+
+// ****************************************************************************
+static void set_flag(uint8_t flag, bool value)
+{
+    if (value) {
+        PSW |= flag;
+    }
+    else {
+        PSW &= ~flag;
+    }
+}
+
+
+// ****************************************************************************
+static void add(uint8_t value, bool with_carry)
+{
+    unsigned int carry = (with_carry && (PSW & CY)) ? 1 : 0;
+    unsigned int result = A + value + carry;
+
+    set_flag(CY, result > 0xff);
+    set_flag(AC, (A & 0x0f) + (value & 0x0f) + carry > 0x0f);
+    set_flag(OV, ((A ^ result) & (value ^ result) & 0x80) != 0);
+    A = (uint8_t)result;
+}
+
+
+// ****************************************************************************
+static void subb(uint8_t value)
+{
+    unsigned int borrow = (PSW & CY) ? 1 : 0;
+    unsigned int result = (A - value - borrow) & 0xff;
+
+    set_flag(CY, A < value + borrow);
+    set_flag(AC, (A & 0x0f) < (value & 0x0f) + borrow);
+    set_flag(OV, ((A ^ value) & (A ^ result) & 0x80) != 0);
+    A = (uint8_t)result;
+}
+
+
+// ****************************************************************************
+static void decimal_adjust(void)
+{
+    unsigned int a = A;
+
+    if ((a & 0x0f) > 9 || (PSW & AC)) {
+        a += 0x06;
+    }
+    if (a > 0xff) {
+        PSW |= CY;
+    }
+    if ((a & 0x1f0) > 0x90 || (PSW & CY)) {
+        a += 0x60;
+    }
+    if (a > 0xff) {
+        PSW |= CY;
+    }
+    A = (uint8_t)a;
+}
+
+
+// ****************************************************************************
+static void relative_jump(uint8_t offset, bool condition)
+{
+    if (condition) {
+        pc += (int8_t)offset;
+    }
+}
+
+
+// ****************************************************************************
+static void compare_and_jump(uint8_t a, uint8_t b, uint8_t offset)
+{
+    set_flag(CY, a < b);
+    relative_jump(offset, a != b);
+}
+
+
+// ****************************************************************************
+// ANL, ORL and XRL share their addressing modes
+// ****************************************************************************
+static uint8_t logic(uint8_t operation, uint8_t a, uint8_t b)
+{
+    switch (operation) {
+        case 0x40:
+            return a | b;
+        case 0x50:
+            return a & b;
+        default:
+            return a ^ b;
+    }
+}
+
+
+// ****************************************************************************
+static unsigned int execute_logic(uint8_t opcode)
+{
+    uint8_t operation = opcode & 0xf0;
+    uint8_t address;
+    uint8_t value;
+
+    switch (opcode & 0x0f) {
+        case 0x02:
+            address = fetch();
+            write_direct(address, logic(operation, read_direct(address, true), A));
+            return 2;
+
+        case 0x03:
+            address = fetch();
+            value = fetch();
+            write_direct(address, logic(operation, read_direct(address, true), value));
+            return 3;
+
+        case 0x04:
+            A = logic(operation, A, fetch());
+            return 2;
+
+        case 0x05:
+            A = logic(operation, A, read_direct(fetch(), false));
+            return 2;
+
+        case 0x06:
+        case 0x07:
+            A = logic(operation, A, *indirect(opcode));
+            return 2;
+
+        default:
+            A = logic(operation, A, *reg(opcode & 7));
+            return 1;
+    }
+}
+
+
+// ****************************************************************************
+// The instructions with Rn / @Ri / direct / #data operands in the columns
+// 4..F of the opcode map: the operand value for the rows that read one.
+// Returns the number of extra clocks.
+// ****************************************************************************
+static unsigned int source_operand(uint8_t opcode, uint8_t *value)
+{
+    switch (opcode & 0x0f) {
+        case 0x04:
+            *value = fetch();
+            return 1;
+
+        case 0x05:
+            *value = read_direct(fetch(), false);
+            return 1;
+
+        case 0x06:
+        case 0x07:
+            *value = *indirect(opcode);
+            return 1;
+
+        default:
+            *value = *reg(opcode & 7);
+            return 0;
+    }
+}
+
+
+// ****************************************************************************
+static unsigned int execute(uint8_t opcode)
+{
+    uint8_t value;
+    uint8_t address;
+    uint8_t offset;
+    uint16_t target;
+    unsigned int result;
+
+    // AJMP and ACALL: the upper three opcode bits are part of the address
+    if ((opcode & 0x1f) == 0x01) {
+        address = fetch();
+        target = (pc & 0xf800) | ((opcode & 0xe0) << 3) | address;
+        pc = target;
+        return 3;
+    }
+    if ((opcode & 0x1f) == 0x11) {
+        address = fetch();
+        target = (pc & 0xf800) | ((opcode & 0xe0) << 3) | address;
+        push(pc & 0xff);
+        push(pc >> 8);
+        pc = target;
+        return 3;
+    }
+
+    switch (opcode) {
+        case 0x00:                      // NOP
+            return 1;
+
+        case 0x02:                      // LJMP addr16
+            target = fetch() << 8;
+            target |= fetch();
+            pc = target;
+            return 4;
+
+        case 0x12:                      // LCALL addr16
+            target = fetch() << 8;
+            target |= fetch();
+            push(pc & 0xff);
+            push(pc >> 8);
+            pc = target;
+            return 4;
+
+        case 0x22:                      // RET
+        case 0x32:                      // RETI
+            pc = pop() << 8;
+            pc |= pop();
+            if (opcode == 0x32) {
+                interrupt_blocked = true;
+                peripheral_reti();
+            }
+            return 4;
+
+        case 0x03:                      // RR A
+            A = (A >> 1) | (A << 7);
+            return 1;
+
+        case 0x13:                      // RRC A
+            value = A & 1;
+            A = (A >> 1) | ((PSW & CY) ? 0x80 : 0);
+            set_flag(CY, value);
+            return 1;
+
+        case 0x23:                      // RL A
+            A = (A << 1) | (A >> 7);
+            return 1;
+
+        case 0x33:                      // RLC A
+            value = A & 0x80;
+            A = (A << 1) | ((PSW & CY) ? 1 : 0);
+            set_flag(CY, value);
+            return 1;
+
+        case 0x04:                      // INC A
+            ++A;
+            return 1;
+
+        case 0x05:                      // INC direct
+            address = fetch();
+            write_direct(address, read_direct(address, true) + 1);
+            return 2;
+
+        case 0x06:                      // INC @Ri
+        case 0x07:
+            ++*indirect(opcode);
+            return 2;
+
+        case 0x14:                      // DEC A
+            --A;
+            return 1;
+
+        case 0x15:                      // DEC direct
+            address = fetch();
+            write_direct(address, read_direct(address, true) - 1);
+            return 2;
+
+        case 0x16:                      // DEC @Ri
+        case 0x17:
+            --*indirect(opcode);
+            return 2;
+
+        case 0x10:                      // JBC bit, rel
+            address = fetch();
+            offset = fetch();
+            if (read_bit(address, true)) {
+                write_bit(address, false);
+                relative_jump(offset, true);
+            }
+            return 4;
+
+        case 0x20:                      // JB bit, rel
+        case 0x30:                      // JNB bit, rel
+            address = fetch();
+            offset = fetch();
+            relative_jump(offset, read_bit(address, false) == (opcode == 0x20));
+            return 4;
+
+        case 0x40:                      // JC rel
+            relative_jump(fetch(), PSW & CY);
+            return 3;
+
+        case 0x50:                      // JNC rel
+            relative_jump(fetch(), !(PSW & CY));
+            return 3;
+
+        case 0x60:                      // JZ rel
+            relative_jump(fetch(), A == 0);
+            return 3;
+
+        case 0x70:                      // JNZ rel
+            relative_jump(fetch(), A != 0);
+            return 3;
+
+        case 0x80:                      // SJMP rel
+            relative_jump(fetch(), true);
+            return 3;
+
+        case 0x73:                      // JMP @A+DPTR
+            pc = get_dptr() + A;
+            return 3;
+
+        case 0x90:                      // MOV DPTR, #data16
+            target = fetch() << 8;
+            target |= fetch();
+            set_dptr(target);
+            return 3;
+
+        case 0xa3:                      // INC DPTR
+            set_dptr(get_dptr() + 1);
+            return 1;
+
+        case 0x72:                      // ORL C, bit
+            if (read_bit(fetch(), false)) {
+                PSW |= CY;
+            }
+            return 2;
+
+        case 0xa0:                      // ORL C, /bit
+            if (!read_bit(fetch(), false)) {
+                PSW |= CY;
+            }
+            return 2;
+
+        case 0x82:                      // ANL C, bit
+            if (!read_bit(fetch(), false)) {
+                PSW &= ~CY;
+            }
+            return 2;
+
+        case 0xb0:                      // ANL C, /bit
+            if (read_bit(fetch(), false)) {
+                PSW &= ~CY;
+            }
+            return 2;
+
+        case 0x92:                      // MOV bit, C
+            write_bit(fetch(), PSW & CY);
+            return 2;
+
+        case 0xa2:                      // MOV C, bit
+            set_flag(CY, read_bit(fetch(), false));
+            return 2;
+
+        case 0xb2:                      // CPL bit
+            address = fetch();
+            write_bit(address, !read_bit(address, true));
+            return 2;
+
+        case 0xb3:                      // CPL C
+            PSW ^= CY;
+            return 1;
+
+        case 0xc2:                      // CLR bit
+            write_bit(fetch(), false);
+            return 2;
+
+        case 0xc3:                      // CLR C
+            PSW &= ~CY;
+            return 1;
+
+        case 0xd2:                      // SETB bit
+            write_bit(fetch(), true);
+            return 2;
+
+        case 0xd3:                      // SETB C
+            PSW |= CY;
+            return 1;
+
+        case 0xc0:                      // PUSH direct
+            push(read_direct(fetch(), false));
+            return 2;
+
+        case 0xd0:                      // POP direct
+            address = fetch();
+            value = pop();
+            write_direct(address, value);
+            return 2;
+
+        case 0xe0:                      // MOVX A, @DPTR
+            A = peripheral_xdata_read(get_dptr());
+            return 2;
+
+        case 0xf0:                      // MOVX @DPTR, A
+            peripheral_xdata_write(get_dptr(), A);
+            return 2;
+
+        case 0xe2:                      // MOVX A, @Ri
+        case 0xe3:
+            A = peripheral_xdata_read((sfr[MCS51_SFR_P2 - 0x80] << 8) | *reg(opcode & 1));
+            return 2;
+
+        case 0xf2:                      // MOVX @Ri, A
+        case 0xf3:
+            peripheral_xdata_write((sfr[MCS51_SFR_P2 - 0x80] << 8) | *reg(opcode & 1), A);
+            return 2;
+
+        case 0x83:                      // MOVC A, @A+PC
+            A = read_code(pc + A);
+            return 3;
+
+        case 0x93:                      // MOVC A, @A+DPTR
+            A = read_code(get_dptr() + A);
+            return 3;
+
+        case 0x84:                      // DIV AB
+            PSW &= ~CY;
+            if (B == 0) {
+                PSW |= OV;
+            }
+            else {
+                value = A % B;
+                A = A / B;
+                B = value;
+                PSW &= ~OV;
+            }
+            return 6;
+
+        case 0xa4:                      // MUL AB
+            result = A * B;
+            A = result & 0xff;
+            B = result >> 8;
+            PSW &= ~CY;
+            set_flag(OV, result > 0xff);
+            return 2;
+
+        case 0x74:                      // MOV A, #data
+            A = fetch();
+            return 2;
+
+        case 0x75:                      // MOV direct, #data
+            address = fetch();
+            write_direct(address, fetch());
+            return 3;
+
+        case 0x76:                      // MOV @Ri, #data
+        case 0x77:
+            *indirect(opcode) = fetch();
+            return 3;
+
+        case 0x85:                      // MOV direct, direct (source first)
+            value = read_direct(fetch(), false);
+            write_direct(fetch(), value);
+            return 3;
+
+        case 0x86:                      // MOV direct, @Ri
+        case 0x87:
+            write_direct(fetch(), *indirect(opcode));
+            return 3;
+
+        case 0xa6:                      // MOV @Ri, direct
+        case 0xa7:
+            *indirect(opcode) = read_direct(fetch(), false);
+            return 3;
+
+        case 0xe4:                      // CLR A
+            A = 0;
+            return 1;
+
+        case 0xf4:                      // CPL A
+            A = ~A;
+            return 1;
+
+        case 0xc4:                      // SWAP A
+            A = (A << 4) | (A >> 4);
+            return 1;
+
+        case 0xd4:                      // DA A
+            decimal_adjust();
+            return 1;
+
+        case 0xe5:                      // MOV A, direct
+            A = read_direct(fetch(), false);
+            return 2;
+
+        case 0xe6:                      // MOV A, @Ri
+        case 0xe7:
+            A = *indirect(opcode);
+            return 2;
+
+        case 0xf5:                      // MOV direct, A
+            write_direct(fetch(), A);
+            return 2;
+
+        case 0xf6:                      // MOV @Ri, A
+        case 0xf7:
+            *indirect(opcode) = A;
+            return 2;
+
+        case 0xb4:                      // CJNE A, #data, rel
+            value = fetch();
+            compare_and_jump(A, value, fetch());
+            return 4;
+
+        case 0xb5:                      // CJNE A, direct, rel
+            value = read_direct(fetch(), false);
+            compare_and_jump(A, value, fetch());
+            return 4;
+
+        case 0xb6:                      // CJNE @Ri, #data, rel
+        case 0xb7:
+            value = fetch();
+            compare_and_jump(*indirect(opcode), value, fetch());
+            return 4;
+
+        case 0xc5:                      // XCH A, direct
+            address = fetch();
+            value = read_direct(address, true);
+            write_direct(address, A);
+            A = value;
+            return 2;
+
+        case 0xc6:                      // XCH A, @Ri
+        case 0xc7:
+            value = *indirect(opcode);
+            *indirect(opcode) = A;
+            A = value;
+            return 2;
+
+        case 0xd6:                      // XCHD A, @Ri
+        case 0xd7:
+            value = *indirect(opcode);
+            *indirect(opcode) = (value & 0xf0) | (A & 0x0f);
+            A = (A & 0xf0) | (value & 0x0f);
+            return 2;
+
+        case 0xd5:                      // DJNZ direct, rel
+            address = fetch();
+            value = read_direct(address, true) - 1;
+            write_direct(address, value);
+            relative_jump(fetch(), value != 0);
+            return 4;
+
+        case 0xa5:                      // Undefined
+            ++mcs51_stats.undefined_opcodes;
+            return 1;
+
+        default:
+            break;
+    }
+
+    // Columns 8..F: Rn operand
+    if (opcode & 0x08) {
+        uint8_t *r = reg(opcode & 7);
+
+        switch (opcode & 0xf0) {
+            case 0x00:                  // INC Rn
+                ++*r;
+                return 1;
+
+            case 0x10:                  // DEC Rn
+                --*r;
+                return 1;
+
+            case 0x70:                  // MOV Rn, #data
+                *r = fetch();
+                return 2;
+
+            case 0x80:                  // MOV direct, Rn
+                write_direct(fetch(), *r);
+                return 2;
+
+            case 0xa0:                  // MOV Rn, direct
+                *r = read_direct(fetch(), false);
+                return 2;
+
+            case 0xb0:                  // CJNE Rn, #data, rel
+                value = fetch();
+                compare_and_jump(*r, value, fetch());
+                return 3;
+
+            case 0xc0:                  // XCH A, Rn
+                value = *r;
+                *r = A;
+                A = value;
+                return 1;
+
+            case 0xd0:                  // DJNZ Rn, rel
+                relative_jump(fetch(), --*r != 0);
+                return 3;
+
+            case 0xe0:                  // MOV A, Rn
+                A = *r;
+                return 1;
+
+            case 0xf0:                  // MOV Rn, A
+                *r = A;
+                return 1;
+
+            default:
+                break;
+        }
+    }
+
+    // Arithmetic and logic with #data, direct, @Ri or Rn source operand
+    switch (opcode & 0xf0) {
+        case 0x20:                      // ADD
+            result = source_operand(opcode, &value);
+            add(value, false);
+            return 1 + result;
+
+        case 0x30:                      // ADDC
+            result = source_operand(opcode, &value);
+            add(value, true);
+            return 1 + result;
+
+        case 0x90:                      // SUBB
+            result = source_operand(opcode, &value);
+            subb(value);
+            return 1 + result;
+
+        case 0x40:                      // ORL
+        case 0x50:                      // ANL
+        case 0x60:                      // XRL
+            return execute_logic(opcode);
+
+        default:
+            break;
+    }
+
+    ++mcs51_stats.undefined_opcodes;
+    return 1;
+}
+
+
+// ****************************************************************************
+unsigned int mcs51_step(void)
+{
+    interrupt_blocked = false;
+    ++mcs51_stats.instructions;
+
+    return execute(fetch());
+}
+
+
+// ****************************************************************************
+bool mcs51_interrupt_blocked(void)
+{
+    return interrupt_blocked;
+}
+
+
+// ****************************************************************************
+void mcs51_call(uint16_t vector)
+{
+    push(pc & 0xff);
+    push(pc >> 8);
+    pc = vector;
+}
+
+
+// ****************************************************************************
+uint16_t mcs51_pc(void)
+{
+    return pc;
+}
+
+
+// ****************************************************************************
+uint8_t mcs51_get_sfr(uint8_t address)
+{
+    return sfr[(address - 0x80) & 0x7f];
+}
+
+
+// ****************************************************************************
+void mcs51_set_sfr(uint8_t address, uint8_t value)
+{
+    sfr[(address - 0x80) & 0x7f] = value;
+}
+
+
+// ****************************************************************************
+void mcs51_reset(void)
+{
+    memset(iram, 0, sizeof(iram));
+    memset(sfr, 0, sizeof(sfr));
+    SP = 0x07;
+    pc = 0;
+    interrupt_blocked = false;
+}
+
+
+// ****************************************************************************
+static bool load_hex(FILE *f, const char *filename)
+{
+    char line[600];
+    unsigned int line_number = 0;
+
+    while (fgets(line, sizeof(line), f)) {
+        uint8_t record[256];
+        unsigned int count = 0;
+        unsigned int checksum = 0;
+        unsigned int address;
+        unsigned int i;
+        const char *p = line + 1;
+
+        ++line_number;
+        if (line[0] != ':') {
+            continue;
+        }
+
+        while (count < sizeof(record) && sscanf(p, "%2x", &i) == 1) {
+            record[count++] = (uint8_t)i;
+            checksum += i;
+            p += 2;
+        }
+
+        if (count < 5 || count != record[0] + 5u || (checksum & 0xff) != 0) {
+            fprintf(stderr, "%s:%u: invalid record\n", filename, line_number);
+            return false;
+        }
+
+        // Only data records matter for a 16 KB image
+        if (record[3] == 0x01) {
+            break;
+        }
+        if (record[3] != 0x00) {
+            continue;
+        }
+
+        address = (record[1] << 8) | record[2];
+        if (address + record[0] > MCS51_CODE_SIZE) {
+            fprintf(stderr, "%s:%u: address 0x%04x outside of the flash\n",
+                filename, line_number, address);
+            return false;
+        }
+        memcpy(&code[address], &record[4], record[0]);
+    }
+    return true;
+}
+
+
+// ****************************************************************************
+bool mcs51_load(const char *filename)
+{
+    FILE *f = fopen(filename, "rb");
+    bool success = true;
+    int c;
+
+    if (!f) {
+        perror(filename);
+        return false;
+    }
+
+    memset(code, 0xff, sizeof(code));
+
+    c = fgetc(f);
+    if (c == ':') {
+        rewind(f);
+        success = load_hex(f, filename);
+    }
+    else if (c != EOF) {
+        rewind(f);
+        if (fread(code, 1, sizeof(code), f) == sizeof(code) && fgetc(f) != EOF) {
+            fprintf(stderr, "%s: image larger than %u bytes, ignoring the rest\n",
+                filename, MCS51_CODE_SIZE);
+        }
+    }
+
+    fclose(f);
+    return success;
+}
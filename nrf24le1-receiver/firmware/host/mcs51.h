@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#define MCS51_CODE_SIZE 0x4000      // 16 KB flash of the nRF24LE1
+
+// SFRs of the core itself
+#define MCS51_SFR_SP 0x81
+#define MCS51_SFR_DPL 0x82
+#define MCS51_SFR_DPH 0x83
+#define MCS51_SFR_DPL1 0x84
+#define MCS51_SFR_DPH1 0x85
+#define MCS51_SFR_DPS 0x92
+#define MCS51_SFR_P2 0xa0
+#define MCS51_SFR_PSW 0xd0
+#define MCS51_SFR_ACC 0xe0
+#define MCS51_SFR_B 0xf0
+
+
+typedef struct {
+    uint64_t instructions;
+    uint64_t undefined_opcodes;
+} mcs51_stats_t;
+
+
+extern mcs51_stats_t mcs51_stats;
+
+
+void mcs51_reset(void);
+
+// Loads a raw binary or an Intel HEX file (detected by the leading ':')
+bool mcs51_load(const char *filename);
+
+// Executes one instruction and returns the number of clock cycles it took
+unsigned int mcs51_step(void);
+
+// True if the last instruction was RETI or wrote to an interrupt enable or
+// priority register: the next instruction runs before any interrupt
+bool mcs51_interrupt_blocked(void);
+
+// Hardware call of an interrupt vector
+void mcs51_call(uint16_t vector);
+
+uint16_t mcs51_pc(void);
+
+// SFR storage without side effects, for the peripheral models
+uint8_t mcs51_get_sfr(uint8_t address);
+void mcs51_set_sfr(uint8_t address, uint8_t value);
+
+
+// ****************************************************************************
+// Implemented by the peripheral models (peripherals.c)
+// ****************************************************************************
+
+// Reads a peripheral SFR. read_modify_write is set for instructions that
+// write the value back (ANL, ORL, SETB, ...); ports return their latch then.
+uint8_t peripheral_sfr_read(uint8_t address, bool read_modify_write);
+
+// Called after the core stored a new value in a peripheral SFR
+void peripheral_sfr_written(uint8_t address, uint8_t value);
+
+uint8_t peripheral_xdata_read(uint16_t address);
+void peripheral_xdata_write(uint16_t address, uint8_t value);
+
+// Called when an interrupt handler returns
+void peripheral_reti(void);
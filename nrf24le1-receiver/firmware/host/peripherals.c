@@ -0,0 +1,982 @@
+/******************************************************************************
+
+    nRF24LE1 peripheral models for the MCS-51 simulator.
+
+    Modelled are what the receiver firmware uses: P0/P1 with direction
+    registers, Timer0/1 (modes 0-2), Timer2 (reload mode 0), the interrupt
+    controller with its four priority levels, the RF SPI master
+    (SPIRDAT/SPIRSTAT) and RFCON driving the nRF24L01+ model of the LPC812
+    simulator, UART0 transmit, and the NV data memory with the self-timed
+    erase and write that halt the CPU.
+
+    Time
+    ----
+    host_cycles counts CPU clocks at 16 MHz. Timers 0 and 1 count every 12
+    clocks, Timer2 every 12 or 24. The prescaler runs freely, so a timer
+    that is started waits up to 11 clocks for its first count, like the
+    hardware does.
+
+    Interrupts
+    ----------
+    Requests are accepted between instructions, but not directly after RETI
+    or a write to IEN0/IEN1/IP0/IP1. An interrupt can only preempt a handler
+    of a lower priority level. For every request we note the time and what
+    the CPU was doing; the latency until the first handler instruction is
+    what delays the servo edges of the firmware.
+
+    TF0, TF1 and the RF interrupt flag are cleared when the handler is
+    entered, TF2 and the UART flags by the firmware.
+
+******************************************************************************/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mcs51.h"
+#include "peripherals.h"
+
+
+#define SFR_P0 0x80
+#define SFR_PCON 0x87
+#define SFR_TCON 0x88
+    #define TCON_TR0 (1 << 4)
+    #define TCON_TF0 (1 << 5)
+    #define TCON_TR1 (1 << 6)
+    #define TCON_TF1 (1 << 7)
+#define SFR_TMOD 0x89
+#define SFR_TL0 0x8a
+#define SFR_TL1 0x8b
+#define SFR_TH0 0x8c
+#define SFR_TH1 0x8d
+#define SFR_P1 0x90
+#define SFR_P0DIR 0x93
+#define SFR_P1DIR 0x94
+#define SFR_S0CON 0x98
+    #define S0CON_RI0 (1 << 0)
+    #define S0CON_TI0 (1 << 1)
+#define SFR_S0BUF 0x99
+#define SFR_IEN0 0xa8
+    #define IEN0_ALL (1 << 7)
+#define SFR_IP0 0xa9
+#define SFR_S0RELL 0xaa
+#define SFR_IEN1 0xb8
+#define SFR_IP1 0xb9
+#define SFR_S0RELH 0xba
+#define SFR_IRCON 0xc0
+    #define IRCON_RFIRQ (1 << 1)
+    #define IRCON_TF2 (1 << 6)
+    #define IRCON_EXF2 (1 << 7)
+#define SFR_T2CON 0xc8
+    #define T2CON_T2PS (1 << 7)
+#define SFR_CRCL 0xca
+#define SFR_CRCH 0xcb
+#define SFR_TL2 0xcc
+#define SFR_TH2 0xcd
+#define SFR_ADCON 0xd8
+    #define ADCON_BD (1 << 7)
+#define SFR_SPIRSTAT 0xe6
+    #define SPIRSTAT_TX_READY (1 << 0)
+    #define SPIRSTAT_RX_READY (1 << 1)
+    #define SPIRSTAT_TX_EMPTY (1 << 2)
+    #define SPIRSTAT_RX_FULL (1 << 3)
+#define SFR_SPIRDAT 0xe7
+#define SFR_RFCON 0xe8
+    #define RFCON_RFCE (1 << 0)
+    #define RFCON_RFCSN (1 << 1)
+#define SFR_FSR 0xf8
+    #define FSR_WEN (1 << 5)
+#define SFR_FCR 0xfa
+
+#define XRAM_SIZE 0x400
+#define NV_DATA_START 0xfa00
+#define NV_DATA_SIZE 0x600
+#define NV_FIRST_PAGE 32
+
+// Self-timed NV memory programming, see persistent_storage.c
+#define FLASH_ERASE_CYCLES HOST_US(22500)
+#define FLASH_WRITE_CYCLES HOST_US(46)
+
+// The RF SPI runs at half the CPU clock
+#define SPI_BYTE_CYCLES 16
+#define SPI_FIFO_DEPTH 2
+
+#define INTERRUPT_ENTRY_CYCLES 4
+#define MAX_NESTING 4
+#define NUMBER_OF_PIN_HOOKS 4
+
+
+typedef struct {
+    const char *name;
+    uint16_t vector;
+    uint8_t group;                  // Priority group, see IP0/IP1
+    uint8_t flag_sfr;
+    uint8_t flag_mask;
+    uint8_t enable_sfr;
+    uint8_t enable_mask;
+    bool cleared_on_entry;
+} irq_source_t;
+
+typedef struct {
+    uint8_t data[SPI_FIFO_DEPTH];
+    unsigned int count;
+} fifo_t;
+
+
+le1_stats_t le1_stats;
+FILE *le1_uart_output;
+uint64_t host_cycles;
+
+static const irq_source_t irq_sources[LE1_NUMBER_OF_IRQS] = {
+    [LE1_IRQ_TIMER0] = {"Timer0", 0x0b, 1, SFR_TCON, TCON_TF0, SFR_IEN0, 1 << 1, true},
+    [LE1_IRQ_RF] = {"RF", 0x4b, 1, SFR_IRCON, IRCON_RFIRQ, SFR_IEN1, 1 << 1, true},
+    [LE1_IRQ_TIMER1] = {"Timer1", 0x1b, 3, SFR_TCON, TCON_TF1, SFR_IEN0, 1 << 3, true},
+    [LE1_IRQ_UART0] = {"UART0", 0x23, 4, SFR_S0CON, S0CON_RI0 | S0CON_TI0, SFR_IEN0, 1 << 4, false},
+    [LE1_IRQ_TIMER2] = {"Timer2", 0x2b, 5, SFR_IRCON, IRCON_TF2 | IRCON_EXF2, SFR_IEN0, 1 << 5, false},
+};
+
+static host_timer_t *timers;
+static uint64_t timers_counted_until;
+
+static bool requested[LE1_NUMBER_OF_IRQS];
+static uint64_t requested_at[LE1_NUMBER_OF_IRQS];
+static le1_context_t requested_in[LE1_NUMBER_OF_IRQS];
+
+// Interrupt handlers in progress, innermost last
+static le1_irq_t active[MAX_NESTING];
+static int active_level[MAX_NESTING];
+static unsigned int nesting;
+
+static uint32_t pin_levels;
+static uint32_t input_levels;
+static host_pin_hook_t pin_hooks[NUMBER_OF_PIN_HOOKS];
+static unsigned int number_of_pin_hooks;
+
+static const host_spi_device_t *spi_device;
+static bool spi_selected;
+static bool spi_busy;
+static fifo_t spi_tx;
+static fifo_t spi_rx;
+static host_timer_t spi_timer;
+
+static bool uart_busy;
+static host_timer_t uart_timer;
+
+static uint8_t xram[XRAM_SIZE];
+static uint8_t nv_data[NV_DATA_SIZE];
+static uint64_t stall_cycles;
+static bool flash_busy;
+
+
+// ****************************************************************************
+static uint8_t sfr(uint8_t address)
+{
+    return mcs51_get_sfr(address);
+}
+
+
+// ****************************************************************************
+static void set_sfr_bits(uint8_t address, uint8_t mask)
+{
+    mcs51_set_sfr(address, sfr(address) | mask);
+}
+
+
+// ****************************************************************************
+static void clear_sfr_bits(uint8_t address, uint8_t mask)
+{
+    mcs51_set_sfr(address, sfr(address) & ~mask);
+}
+
+
+// ****************************************************************************
+// Interrupt controller
+// ****************************************************************************
+static le1_context_t current_context(void)
+{
+    if (flash_busy) {
+        return LE1_CONTEXT_FLASH;
+    }
+    if (nesting) {
+        return LE1_CONTEXT_HANDLER + active[nesting - 1];
+    }
+    if (!(sfr(SFR_IEN0) & IEN0_ALL)) {
+        return LE1_CONTEXT_MAIN_EA_OFF;
+    }
+    return LE1_CONTEXT_MAIN;
+}
+
+
+// ****************************************************************************
+static void request(le1_irq_t irq, uint64_t at)
+{
+    if (requested[irq]) {
+        return;
+    }
+    requested[irq] = true;
+    requested_at[irq] = at;
+    requested_in[irq] = current_context();
+}
+
+
+// ****************************************************************************
+static int priority_level(le1_irq_t irq)
+{
+    uint8_t group = irq_sources[irq].group;
+
+    return (((sfr(SFR_IP1) >> group) & 1) << 1) | ((sfr(SFR_IP0) >> group) & 1);
+}
+
+
+// ****************************************************************************
+// Returns the interrupt to enter now, or -1
+// ****************************************************************************
+static int pending_interrupt(void)
+{
+    int current_level = nesting ? active_level[nesting - 1] : -1;
+    int best = -1;
+    int best_level = current_level;
+    int i;
+
+    for (i = 0; i < LE1_NUMBER_OF_IRQS; i++) {
+        const irq_source_t *s = &irq_sources[i];
+        int level;
+
+        // Flags the firmware sets or clears itself
+        if (!(sfr(s->flag_sfr) & s->flag_mask)) {
+            requested[i] = false;
+            continue;
+        }
+        request(i, host_cycles);
+
+        if (!(sfr(SFR_IEN0) & IEN0_ALL) || !(sfr(s->enable_sfr) & s->enable_mask)) {
+            continue;
+        }
+
+        level = priority_level(i);
+        if (level > best_level) {
+            best = i;
+            best_level = level;
+        }
+    }
+
+    return best;
+}
+
+
+// ****************************************************************************
+static void enter_interrupt(le1_irq_t irq)
+{
+    const irq_source_t *s = &irq_sources[irq];
+    le1_irq_stats_t *stats = &le1_stats.irq[irq];
+    uint64_t latency = host_cycles + INTERRUPT_ENTRY_CYCLES - requested_at[irq];
+
+    if (!stats->count || latency < stats->latency_min) {
+        stats->latency_min = latency;
+    }
+    if (latency > stats->latency_max) {
+        stats->latency_max = latency;
+    }
+    stats->latency_sum += latency;
+    ++stats->latency_histogram[requested_in[irq]]
+        [latency < LE1_LATENCY_BINS ? latency : LE1_LATENCY_BINS - 1];
+    ++stats->count;
+
+    if (s->cleared_on_entry) {
+        clear_sfr_bits(s->flag_sfr, s->flag_mask);
+    }
+    requested[irq] = false;
+
+    if (nesting < MAX_NESTING) {
+        active[nesting] = irq;
+        active_level[nesting] = priority_level(irq);
+        ++nesting;
+    }
+    mcs51_call(s->vector);
+}
+
+
+// ****************************************************************************
+void peripheral_reti(void)
+{
+    if (nesting) {
+        --nesting;
+    }
+}
+
+
+// ****************************************************************************
+// Timers
+// ****************************************************************************
+
+// ****************************************************************************
+// Counts Timer0 or Timer1 by the given number of ticks, the first of them at
+// first_tick (in units of 12 clocks)
+// ****************************************************************************
+static void count_timer(unsigned int n, uint64_t ticks, uint64_t first_tick)
+{
+    uint8_t mode = (sfr(SFR_TMOD) >> (4 * n)) & 0x0f;
+    uint8_t tl = sfr(SFR_TL0 + n);
+    uint8_t th = sfr(SFR_TH0 + n);
+    uint8_t run = n ? TCON_TR1 : TCON_TR0;
+    uint32_t value;
+    uint32_t range;
+    uint32_t period;
+    uint64_t until_overflow;
+
+    // Counter mode (C/T) counts pin edges, which we do not model
+    if (!ticks || !(sfr(SFR_TCON) & run) || (mode & 0x04)) {
+        return;
+    }
+
+    switch (mode & 0x03) {
+        case 0:
+            value = (th << 5) | (tl & 0x1f);
+            range = period = 0x2000;
+            break;
+
+        case 1:
+            value = (th << 8) | tl;
+            range = period = 0x10000;
+            break;
+
+        case 2:
+            value = tl;
+            range = 0x100;
+            period = 0x100 - th;
+            break;
+
+        default:
+            return;
+    }
+
+    until_overflow = range - value;
+    if (ticks < until_overflow) {
+        value += ticks;
+    }
+    else {
+        value = ((mode & 0x03) == 2 ? th : 0) + (ticks - until_overflow) % period;
+        set_sfr_bits(SFR_TCON, n ? TCON_TF1 : TCON_TF0);
+        request(n ? LE1_IRQ_TIMER1 : LE1_IRQ_TIMER0, (first_tick + until_overflow - 1) * 12);
+    }
+
+    switch (mode & 0x03) {
+        case 0:
+            mcs51_set_sfr(SFR_TL0 + n, (tl & 0xe0) | (value & 0x1f));
+            mcs51_set_sfr(SFR_TH0 + n, value >> 5);
+            break;
+
+        case 1:
+            mcs51_set_sfr(SFR_TL0 + n, value & 0xff);
+            mcs51_set_sfr(SFR_TH0 + n, value >> 8);
+            break;
+
+        default:
+            mcs51_set_sfr(SFR_TL0 + n, value);
+            break;
+    }
+}
+
+
+// ****************************************************************************
+// Timer2 in reload mode 0 reloads from CRC on overflow, otherwise it wraps
+// ****************************************************************************
+static void count_timer2(uint64_t from, uint64_t to)
+{
+    uint8_t t2con = sfr(SFR_T2CON);
+    unsigned int prescaler = (t2con & T2CON_T2PS) ? 24 : 12;
+    uint64_t ticks = to / prescaler - from / prescaler;
+    uint32_t value = (sfr(SFR_TH2) << 8) | sfr(SFR_TL2);
+    uint32_t reload = 0;
+    uint64_t until_overflow;
+
+    if ((t2con & 0x03) != 0x01 || !ticks) {
+        return;
+    }
+    if (((t2con >> 3) & 0x03) == 0x02) {
+        reload = (sfr(SFR_CRCH) << 8) | sfr(SFR_CRCL);
+    }
+
+    until_overflow = 0x10000 - value;
+    if (ticks < until_overflow) {
+        value += ticks;
+    }
+    else {
+        value = reload + (ticks - until_overflow) % (0x10000 - reload);
+        set_sfr_bits(SFR_IRCON, IRCON_TF2);
+        request(LE1_IRQ_TIMER2, (from / prescaler + until_overflow) * prescaler);
+    }
+
+    mcs51_set_sfr(SFR_TL2, value & 0xff);
+    mcs51_set_sfr(SFR_TH2, value >> 8);
+}
+
+
+// ****************************************************************************
+static void count_timers(uint64_t until)
+{
+    uint64_t from = timers_counted_until;
+
+    if (until <= from) {
+        return;
+    }
+
+    count_timer(0, until / 12 - from / 12, from / 12 + 1);
+    count_timer(1, until / 12 - from / 12, from / 12 + 1);
+    count_timer2(from, until);
+    timers_counted_until = until;
+}
+
+
+// ****************************************************************************
+// Time
+// ****************************************************************************
+static void advance(uint64_t cycles)
+{
+    uint64_t end = host_cycles + cycles;
+
+    le1_stats.context_cycles[current_context()] += cycles;
+
+    while (timers && timers->at <= end) {
+        host_timer_t *timer = timers;
+
+        if (timer->at > host_cycles) {
+            count_timers(timer->at);
+            host_cycles = timer->at;
+        }
+        timers = timer->next;
+        timer->armed = false;
+        timer->callback(timer->context);
+    }
+
+    count_timers(end);
+    host_cycles = end;
+}
+
+
+// ****************************************************************************
+void host_timer_start(host_timer_t *timer, uint64_t at)
+{
+    host_timer_t **p;
+
+    host_timer_stop(timer);
+
+    timer->at = at;
+    timer->armed = true;
+
+    for (p = &timers; *p && (*p)->at <= at; p = &(*p)->next) {
+        ;
+    }
+    timer->next = *p;
+    *p = timer;
+}
+
+
+// ****************************************************************************
+void host_timer_stop(host_timer_t *timer)
+{
+    host_timer_t **p;
+
+    if (!timer->armed) {
+        return;
+    }
+
+    for (p = &timers; *p; p = &(*p)->next) {
+        if (*p == timer) {
+            *p = timer->next;
+            break;
+        }
+    }
+    timer->armed = false;
+}
+
+
+// ****************************************************************************
+// Pins
+// ****************************************************************************
+static void update_pins(void)
+{
+    uint32_t levels = input_levels;
+    uint32_t outputs = (uint32_t)(uint8_t)~sfr(SFR_P0DIR) |
+        ((uint32_t)(uint8_t)~sfr(SFR_P1DIR) << 8) | (1 << LE1_PIN_RF_CE);
+    uint32_t latches = sfr(SFR_P0) | (sfr(SFR_P1) << 8) |
+        ((sfr(SFR_RFCON) & RFCON_RFCE) ? (1 << LE1_PIN_RF_CE) : 0);
+    uint32_t changed;
+    unsigned int pin;
+    unsigned int i;
+
+    levels = (levels & ~outputs) | (latches & outputs);
+    changed = levels ^ pin_levels;
+    pin_levels = levels;
+
+    // The RF interrupt flag is set when the nRF24 asserts its IRQ line
+    if ((changed & (1 << LE1_PIN_RF_IRQ)) && !(levels & (1 << LE1_PIN_RF_IRQ))) {
+        set_sfr_bits(SFR_IRCON, IRCON_RFIRQ);
+        request(LE1_IRQ_RF, host_cycles);
+    }
+
+    for (pin = 0; changed; pin++, changed >>= 1) {
+        if (changed & 1) {
+            for (i = 0; i < number_of_pin_hooks; i++) {
+                pin_hooks[i](pin, (levels >> pin) & 1);
+            }
+        }
+    }
+}
+
+
+// ****************************************************************************
+void host_add_pin_hook(host_pin_hook_t hook)
+{
+    if (number_of_pin_hooks < NUMBER_OF_PIN_HOOKS) {
+        pin_hooks[number_of_pin_hooks++] = hook;
+    }
+}
+
+
+// ****************************************************************************
+void host_set_input(unsigned int pin, bool level)
+{
+    if (level) {
+        input_levels |= (1 << pin);
+    }
+    else {
+        input_levels &= ~(1 << pin);
+    }
+    update_pins();
+}
+
+
+// ****************************************************************************
+bool host_get_pin(unsigned int pin)
+{
+    return (pin_levels >> pin) & 1;
+}
+
+
+// ****************************************************************************
+// RF SPI
+// ****************************************************************************
+static void fifo_push(fifo_t *fifo, uint8_t value)
+{
+    if (fifo->count < SPI_FIFO_DEPTH) {
+        fifo->data[fifo->count++] = value;
+    }
+}
+
+
+// ****************************************************************************
+static uint8_t fifo_pop(fifo_t *fifo)
+{
+    uint8_t value = fifo->data[0];
+
+    if (fifo->count) {
+        --fifo->count;
+        memmove(&fifo->data[0], &fifo->data[1], fifo->count);
+    }
+    return value;
+}
+
+
+// ****************************************************************************
+static void spi_byte_done(void *context)
+{
+    uint8_t mosi = fifo_pop(&spi_tx);
+    uint8_t miso = 0xff;
+
+    (void)context;
+
+    if (spi_device && spi_selected) {
+        miso = spi_device->exchange(mosi);
+    }
+    fifo_push(&spi_rx, miso);
+    ++le1_stats.spi_bytes;
+
+    spi_busy = spi_tx.count != 0;
+    if (spi_busy) {
+        host_timer_start(&spi_timer, host_cycles + SPI_BYTE_CYCLES);
+    }
+}
+
+
+// ****************************************************************************
+static void spi_write(uint8_t value)
+{
+    fifo_push(&spi_tx, value);
+    if (!spi_busy) {
+        spi_busy = true;
+        host_timer_start(&spi_timer, host_cycles + SPI_BYTE_CYCLES);
+    }
+}
+
+
+// ****************************************************************************
+static uint8_t spi_status(void)
+{
+    uint8_t status = 0;
+
+    if (spi_tx.count < SPI_FIFO_DEPTH) {
+        status |= SPIRSTAT_TX_READY;
+    }
+    if (spi_rx.count) {
+        status |= SPIRSTAT_RX_READY;
+    }
+    if (!spi_tx.count) {
+        status |= SPIRSTAT_TX_EMPTY;
+    }
+    if (spi_rx.count == SPI_FIFO_DEPTH) {
+        status |= SPIRSTAT_RX_FULL;
+    }
+    return status;
+}
+
+
+// ****************************************************************************
+static void rfcon_written(uint8_t value)
+{
+    bool selected = !(value & RFCON_RFCSN);
+
+    if (selected != spi_selected) {
+        spi_selected = selected;
+        if (spi_device) {
+            spi_device->select(selected);
+        }
+    }
+    update_pins();
+}
+
+
+// ****************************************************************************
+void host_set_spi_device(const host_spi_device_t *device)
+{
+    spi_device = device;
+}
+
+
+// ****************************************************************************
+// UART0, transmit only
+// ****************************************************************************
+static void uart_byte_done(void *context)
+{
+    (void)context;
+
+    uart_busy = false;
+    set_sfr_bits(SFR_S0CON, S0CON_TI0);
+}
+
+
+// ****************************************************************************
+// Baud rate generator: baud = 2^SMOD * clock / 64 / (1024 - S0REL)
+// ****************************************************************************
+static uint64_t uart_bit_cycles(void)
+{
+    unsigned int reload = ((sfr(SFR_S0RELH) & 0x03) << 8) | sfr(SFR_S0RELL);
+    uint64_t cycles = 64 * (uint64_t)(1024 - reload);
+
+    if (sfr(SFR_PCON) & 0x80) {
+        cycles /= 2;
+    }
+    return cycles;
+}
+
+
+// ****************************************************************************
+static void uart_write(uint8_t value)
+{
+    if (uart_busy || !(sfr(SFR_ADCON) & ADCON_BD)) {
+        return;
+    }
+
+    if (le1_uart_output) {
+        fputc(value, le1_uart_output);
+    }
+    ++le1_stats.uart_bytes;
+
+    // Start bit, 8 data bits, stop bit
+    uart_busy = true;
+    host_timer_start(&uart_timer, host_cycles + 10 * uart_bit_cycles());
+}
+
+
+// ****************************************************************************
+// NV data memory: the CPU halts while the flash is erased or written
+// ****************************************************************************
+static void flash_erase(uint8_t page)
+{
+    unsigned int start;
+    unsigned int size;
+
+    if (!(sfr(SFR_FSR) & FSR_WEN)) {
+        return;
+    }
+    ++le1_stats.flash_erases;
+    stall_cycles += FLASH_ERASE_CYCLES;
+
+    // Two 256 byte extended endurance pages, followed by two 512 byte pages.
+    // Erasing program memory pages is not modelled.
+    if (page < NV_FIRST_PAGE || page > NV_FIRST_PAGE + 3) {
+        return;
+    }
+    page -= NV_FIRST_PAGE;
+    start = page < 2 ? page * 0x100 : 0x200 + (page - 2) * 0x200;
+    size = page < 2 ? 0x100 : 0x200;
+    memset(&nv_data[start], 0xff, size);
+}
+
+
+// ****************************************************************************
+uint8_t peripheral_xdata_read(uint16_t address)
+{
+    if (address < XRAM_SIZE) {
+        return xram[address];
+    }
+    if (address >= NV_DATA_START) {
+        return nv_data[address - NV_DATA_START];
+    }
+    return 0xff;
+}
+
+
+// ****************************************************************************
+void peripheral_xdata_write(uint16_t address, uint8_t value)
+{
+    if (address < XRAM_SIZE) {
+        xram[address] = value;
+        return;
+    }
+
+    // PCON bit 4 (PMW) would select the program memory instead
+    if (address >= NV_DATA_START && (sfr(SFR_FSR) & FSR_WEN) && !(sfr(SFR_PCON) & 0x10)) {
+        // Programming can only clear bits
+        nv_data[address - NV_DATA_START] &= value;
+        ++le1_stats.flash_writes;
+        stall_cycles += FLASH_WRITE_CYCLES;
+    }
+}
+
+
+// ****************************************************************************
+void le1_write_persistent_data(const uint8_t *data, unsigned int count)
+{
+    if (count > NV_DATA_SIZE) {
+        count = NV_DATA_SIZE;
+    }
+    memcpy(nv_data, data, count);
+}
+
+
+// ****************************************************************************
+// SFR access from the core
+// ****************************************************************************
+uint8_t peripheral_sfr_read(uint8_t address, bool read_modify_write)
+{
+    switch (address) {
+        case SFR_P0:
+            return read_modify_write ? sfr(SFR_P0) : (uint8_t)pin_levels;
+
+        case SFR_P1:
+            return read_modify_write ? sfr(SFR_P1) : (uint8_t)(pin_levels >> 8);
+
+        case SFR_SPIRSTAT:
+            return spi_status();
+
+        case SFR_SPIRDAT:
+            return fifo_pop(&spi_rx);
+
+        default:
+            return sfr(address);
+    }
+}
+
+
+// ****************************************************************************
+void peripheral_sfr_written(uint8_t address, uint8_t value)
+{
+    switch (address) {
+        case SFR_P0:
+        case SFR_P1:
+        case SFR_P0DIR:
+        case SFR_P1DIR:
+            update_pins();
+            break;
+
+        case SFR_SPIRDAT:
+            spi_write(value);
+            break;
+
+        case SFR_RFCON:
+            rfcon_written(value);
+            break;
+
+        case SFR_S0BUF:
+            uart_write(value);
+            break;
+
+        case SFR_FCR:
+            flash_erase(value);
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+// ****************************************************************************
+void le1_run(uint64_t duration)
+{
+    uint64_t end = host_cycles + duration;
+
+    while (host_cycles < end) {
+        int irq = mcs51_interrupt_blocked() ? -1 : pending_interrupt();
+
+        if (irq >= 0) {
+            enter_interrupt(irq);
+            advance(INTERRUPT_ENTRY_CYCLES);
+        }
+        else {
+            advance(mcs51_step());
+        }
+
+        if (stall_cycles) {
+            uint64_t cycles = stall_cycles;
+
+            stall_cycles = 0;
+            flash_busy = true;
+            advance(cycles);
+            flash_busy = false;
+        }
+    }
+}
+
+
+// ****************************************************************************
+void le1_init(void)
+{
+    mcs51_reset();
+
+    mcs51_set_sfr(SFR_P0DIR, 0xff);
+    mcs51_set_sfr(SFR_P1DIR, 0xff);
+    mcs51_set_sfr(SFR_RFCON, RFCON_RFCSN);
+
+    memset(nv_data, 0xff, sizeof(nv_data));
+    spi_timer.callback = spi_byte_done;
+    uart_timer.callback = uart_byte_done;
+
+    // Pull-ups on all inputs, RF IRQ not asserted
+    input_levels = ~(uint32_t)0;
+    pin_levels = input_levels;
+    update_pins();
+}
+
+
+// ****************************************************************************
+const char *le1_irq_name(le1_irq_t irq)
+{
+    return irq < LE1_NUMBER_OF_IRQS ? irq_sources[irq].name : "?";
+}
+
+
+// ****************************************************************************
+const char *le1_context_name(le1_context_t context)
+{
+    switch (context) {
+        case LE1_CONTEXT_MAIN:
+            return "main";
+
+        case LE1_CONTEXT_MAIN_EA_OFF:
+            return "main, EA=0";
+
+        case LE1_CONTEXT_FLASH:
+            return "flash";
+
+        case LE1_NUMBER_OF_CONTEXTS:
+            return "?";
+
+        case LE1_CONTEXT_HANDLER:
+        default:
+            return le1_irq_name(context - LE1_CONTEXT_HANDLER);
+    }
+}
+
+
+// ****************************************************************************
+void le1_report(FILE *f)
+{
+    uint64_t total = host_cycles ? host_cycles : 1;
+    int i;
+
+    fprintf(f, "Processor: MCS-51 (nRF24LE1), %llu instructions in %.3f s",
+        (unsigned long long)mcs51_stats.instructions, (double)host_cycles / __SYSTEM_CLOCK);
+    if (mcs51_stats.undefined_opcodes) {
+        fprintf(f, ", %llu undefined opcodes", (unsigned long long)mcs51_stats.undefined_opcodes);
+    }
+    fprintf(f, "\n");
+
+    fprintf(f, "Interrupts:        count  latency min / avg / max (cycles)  CPU time\n");
+    for (i = 0; i < LE1_NUMBER_OF_IRQS; i++) {
+        const le1_irq_stats_t *s = &le1_stats.irq[i];
+
+        if (!s->count) {
+            continue;
+        }
+        fprintf(f, "  %-8s  %10llu  %8llu / %6.2f / %llu  %17.2f %%\n",
+            le1_irq_name(i), (unsigned long long)s->count,
+            (unsigned long long)s->latency_min, (double)s->latency_sum / s->count,
+            (unsigned long long)s->latency_max,
+            100.0 * (double)le1_stats.context_cycles[LE1_CONTEXT_HANDLER + i] / total);
+    }
+    fprintf(f, "  main() %.2f %%, with interrupts disabled %.2f %%, halted for flash %.2f %%\n",
+        100.0 * (double)le1_stats.context_cycles[LE1_CONTEXT_MAIN] / total,
+        100.0 * (double)le1_stats.context_cycles[LE1_CONTEXT_MAIN_EA_OFF] / total,
+        100.0 * (double)le1_stats.context_cycles[LE1_CONTEXT_FLASH] / total);
+
+    fprintf(f, "RF SPI bytes: %llu, UART bytes: %llu, NV memory: %llu erases, %llu byte writes\n",
+        (unsigned long long)le1_stats.spi_bytes, (unsigned long long)le1_stats.uart_bytes,
+        (unsigned long long)le1_stats.flash_erases, (unsigned long long)le1_stats.flash_writes);
+}
+
+
+// ****************************************************************************
+void le1_report_latency(FILE *f, le1_irq_t irq)
+{
+    const le1_irq_stats_t *s = &le1_stats.irq[irq];
+    uint64_t column_totals[LE1_NUMBER_OF_CONTEXTS] = {0};
+    int bin;
+    int c;
+
+    for (c = 0; c < LE1_NUMBER_OF_CONTEXTS; c++) {
+        for (bin = 0; bin < LE1_LATENCY_BINS; bin++) {
+            column_totals[c] += s->latency_histogram[c][bin];
+        }
+    }
+
+    fprintf(f, "%s interrupt latency by what the CPU was doing (cycles of %.1f ns):\n",
+        le1_irq_name(irq), 1e9 / __SYSTEM_CLOCK);
+    fprintf(f, "  cycles");
+    for (c = 0; c < LE1_NUMBER_OF_CONTEXTS; c++) {
+        if (column_totals[c]) {
+            fprintf(f, "  %10s", le1_context_name(c));
+        }
+    }
+    fprintf(f, "\n");
+
+    for (bin = 0; bin < LE1_LATENCY_BINS; bin++) {
+        bool used = false;
+
+        for (c = 0; c < LE1_NUMBER_OF_CONTEXTS; c++) {
+            used |= s->latency_histogram[c][bin] != 0;
+        }
+        if (!used) {
+            continue;
+        }
+
+        fprintf(f, "  %5d%s", bin, bin == LE1_LATENCY_BINS - 1 ? "+" : " ");
+        for (c = 0; c < LE1_NUMBER_OF_CONTEXTS; c++) {
+            if (column_totals[c]) {
+                fprintf(f, "  %10llu", (unsigned long long)s->latency_histogram[c][bin]);
+            }
+        }
+        fprintf(f, "\n");
+    }
+}
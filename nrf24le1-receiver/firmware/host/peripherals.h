@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+// The host interface of the LPC812 simulator. The nRF24 and transmitter
+// models are shared with it and use its timer, SPI device and pin
+// functions, which peripherals.c implements for the nRF24LE1.
+#include "hal.h"
+
+// Pins: P0.0..P0.7 are 0..7, P1.0..P1.7 are 8..15. The internal
+// nRF24L01+ is connected through two more.
+#define LE1_PIN(port, bit) ((port) * 8 + (bit))
+#define LE1_PIN_RF_CE 16            // RFCON.rfce
+#define LE1_PIN_RF_IRQ 17           // Active low
+#define LE1_NUMBER_OF_PINS 18
+
+// Interrupt latencies from 0 to LE1_LATENCY_BINS - 2 cycles are counted
+// individually, longer ones in the last bin
+#define LE1_LATENCY_BINS 64
+
+
+// In the polling order of the interrupt controller
+typedef enum {
+    LE1_IRQ_TIMER0,
+    LE1_IRQ_RF,
+    LE1_IRQ_TIMER1,
+    LE1_IRQ_UART0,
+    LE1_IRQ_TIMER2,
+    LE1_NUMBER_OF_IRQS
+} le1_irq_t;
+
+// What the CPU was doing when an interrupt request came up
+typedef enum {
+    LE1_CONTEXT_MAIN,
+    LE1_CONTEXT_MAIN_EA_OFF,        // main() with interrupts disabled
+    LE1_CONTEXT_FLASH,              // CPU halted while the flash is programmed
+    LE1_CONTEXT_HANDLER,            // + le1_irq_t: in that interrupt handler
+    LE1_NUMBER_OF_CONTEXTS = LE1_CONTEXT_HANDLER + LE1_NUMBER_OF_IRQS
+} le1_context_t;
+
+typedef struct {
+    uint64_t count;
+    uint64_t latency_min;
+    uint64_t latency_max;
+    uint64_t latency_sum;
+    uint64_t latency_histogram[LE1_NUMBER_OF_CONTEXTS][LE1_LATENCY_BINS];
+} le1_irq_stats_t;
+
+typedef struct {
+    le1_irq_stats_t irq[LE1_NUMBER_OF_IRQS];
+    uint64_t context_cycles[LE1_NUMBER_OF_CONTEXTS];
+    uint64_t spi_bytes;
+    uint64_t uart_bytes;
+    uint64_t flash_erases;
+    uint64_t flash_writes;
+} le1_stats_t;
+
+
+extern le1_stats_t le1_stats;
+extern FILE *le1_uart_output;
+
+
+// Resets the core and the peripherals; the image must be loaded already
+void le1_init(void);
+
+void le1_run(uint64_t duration);
+
+// Writes the bind data into the NV memory (XDATA 0xfa00)
+void le1_write_persistent_data(const uint8_t *data, unsigned int count);
+
+const char *le1_irq_name(le1_irq_t irq);
+const char *le1_context_name(le1_context_t context);
+
+void le1_report(FILE *f);
+
+// Latency of one interrupt, by what the CPU was doing when it was requested
+void le1_report_latency(FILE *f, le1_irq_t irq);